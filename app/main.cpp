@@ -1,6 +1,30 @@
 #include "particle.hpp"
 #include "solarSystem.hpp"
 #include "randomParticleSystem.hpp"
+#include "closeEncounters.hpp"
+#include "multipleTimestep.hpp"
+#include "adaptiveTimestep.hpp"
+#include "sharedFrameRing.hpp"
+#include "frameServer.hpp"
+#include "trajectoryCodec.hpp"
+#include "ephemeris.hpp"
+#include "numa.hpp"
+#include "workStealing.hpp"
+#include "isaDispatch.hpp"
+#include "autotune.hpp"
+#include "batchRunner.hpp"
+#include "simulation.hpp"
+#include "compactSystem.hpp"
+#include "diagnostics.hpp"
+#include "outOfCore.hpp"
+#include "memoryReport.hpp"
+#include <algorithm>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#ifdef NBODY_WITH_MPI
+#include "distributed.hpp"
+#endif
 
 
 void help() {
@@ -13,6 +37,31 @@ void help() {
             << "  -e,   --epsilon            Set the softening factor for the random system. Type is double. Default is 0.0.\n"
             << "  -t,   --timestep           Set the timestep of the simulation. Type is double.\n"
             << "  -s,   --simulation_time    Set the total simulation time. Type is double.\n"
+            << "  -c,   --collision_radius   Merge bodies that come closer than this distance (conserving momentum). Type is double. Default is 0.0 (off).\n"
+            << "  -m,   --multistep          Split forces: star-body force every inner step, body-body force once per timestep. Type is integer (inner steps per timestep). Default is 0 (off).\n"
+            << "  -a,   --adaptive           Adapt the timestep every step, keeping the relative energy change of each step below this tolerance. Type is double. Default is 0.0 (off).\n"
+            << "  -p,   --precision          Arithmetic of the force calculation: 'double' or 'mixed' (float interactions, double sums). Default is double.\n"
+            << "  -fl,  --force_law          Force law: 'plummer' (softened by epsilon), 'spline' (cubic spline softening within 2.8 epsilon), 'newtonian' (no softening)\n"
+            << "                             or 'post-newtonian' (Newtonian with the 1PN correction). Default is plummer. Laws other than plummer need the default integrator.\n"
+            << "  -sm,  --shared_memory      Publish live frames to a POSIX shared memory ring buffer with this name (e.g. /nbody_frames). Default integrator only.\n"
+            << "  -sv,  --serve              Serve live frames on a Unix domain socket at this path. Clients can join at any time. Default integrator only.\n"
+            << "  -tr,  --trajectory         Write frames to this compressed trajectory file. Default integrator only.\n"
+            << "  -ep,  --ephemeris          Record an ephemeris (cubic Hermite segments between frames) and save it to this file. Default integrator only.\n"
+            << "  -dg,  --diagnostics        Compute energies, momentum, angular momentum and centre of mass every frame on a worker thread\n"
+            << "                             while the run continues, and log them (CSV) to this file. Default integrator only.\n"
+            << "  -f,   --frame_interval     Number of timesteps between published frames. Type is integer. Default is 1.\n"
+            << "  -af,  --affinity           Pin the OpenMP threads: 'none', 'compact' (fill one NUMA node first) or 'spread' (across NUMA nodes). Default is none.\n"
+            << "  -isa, --isa                Instruction set of the force, update and energy kernels: 'baseline', 'sse4.2', 'avx2' or 'avx512'. Default is the best this CPU supports.\n"
+            << "  -at,  --autotune           Time short trials on the initial conditions and run with the fastest solver, kernels, thread count and task size.\n"
+            << "                             The choice is cached per machine and system size in ~/.nbody_autotune (or $NBODY_AUTOTUNE_CACHE). Default integrator only.\n"
+            << "  -b,   --batch              Run every scenario in this file (one run per line of key=value fields, see the README) several at a time,\n"
+            << "                             sharing the OMP_NUM_THREADS cores between them. Replaces -ss/-rs.\n"
+            << "  -o,   --results            Write the batch results table (CSV) to this file. Default is batch_results.csv.\n"
+            << "  -ic,  --ic_cache           Keep generated random systems in this directory and map them on later runs with the same number of bodies.\n"
+            << "  -cm,  --compact            Store the random system compactly (float position offsets, no stored accelerations) to fit more bodies in memory.\n"
+            << "                             Velocities in 'double' or 'float'. Default integrator only.\n"
+            << "  -oc,  --out_of_core        Write the random system to this state file and evolve it there, streaming it through memory in tiles,\n"
+            << "                             for systems bigger than memory. The file holds the final state afterwards. Default integrator only.\n"
             << "  -h,   --help               Show this help message.\n"
             << " \n"
             << "Note 1 : The units for the time arguments are in radians where 2π represents one full earth cycle (i.e. one year).\n"
@@ -24,15 +73,437 @@ void help() {
 
 
 
+// Settings parsed from the command line that control how the system is evolved
+struct RunOptions {
+  double soft_fac = 0.0; // The softening factor i.e epsilon
+  double dt = 0.0;
+  double sim_time = 0.0;
+  double collision_radius = 0.0; // Bodies closer than this merge, 0 disables collisions
+  int substeps = 0; // Inner steps per timestep for multiple time-stepping, 0 disables it
+  double energy_tolerance = 0.0; // Per-step relative energy tolerance for the adaptive timestep, 0 disables it
+  ForcePrecision precision = ForcePrecision::Double;
+  ForceLaw force_law = ForceLaw::Plummer;
+  std::string shared_memory_name; // Shared memory ring buffer for live frames, empty disables it
+  std::string socket_path; // Unix domain socket to serve live frames on, empty disables it
+  std::string trajectory_path; // Compressed trajectory file, empty disables it
+  std::string ephemeris_path; // Ephemeris file, empty disables it
+  std::string diagnostics_path; // Diagnostics log, empty disables it
+  int frame_interval = 1; // Timesteps between published frames
+  ThreadAffinity affinity = ThreadAffinity::None;
+  IsaLevel isa = detectIsaLevel(); // Kernels to run, at most the best the CPU supports
+  bool autotune = false; // Pick the solver, kernels, threads and task size by timing trials
+  std::string batch_path; // Scenario file of a batch run, empty for a single run
+  std::string results_path = "batch_results.csv"; // Results table of a batch run
+  std::string ic_cache_directory; // Cache of generated random systems, empty disables it
+  bool compact = false; // Random system in compact storage instead of a list of particles
+  bool compact_float_velocities = false;
+  std::string out_of_core_path; // State file of an out-of-core run, empty for a run in memory
+};
+
+
+
+// Whether the run writes frames, files or diagnostics, which needs the step observer of evolutionOfSystem
+bool observesSteps(const RunOptions& options) {
+  return !options.shared_memory_name.empty() || !options.socket_path.empty() || !options.trajectory_path.empty() || !options.ephemeris_path.empty()
+         || !options.diagnostics_path.empty();
+}
+
+
+// Throw if the options ask for integrators or outputs that cannot be combined
+void checkRunOptions(const RunOptions& options) {
+  int num_modes = (options.collision_radius > 0.0) + (options.substeps > 0) + (options.energy_tolerance > 0.0);
+  if (num_modes > 1) {
+    throw std::invalid_argument("Only one of collisions, multiple time-stepping and adaptive timestep can be used at a time.");
+  }
+  if (num_modes > 0 && options.precision != ForcePrecision::Double) {
+    throw std::invalid_argument("Mixed precision is only available with the default integrator.");
+  }
+  if ((num_modes > 0 || options.precision != ForcePrecision::Double) && options.autotune) {
+    throw std::invalid_argument("Autotune is only available with the default integrator in double precision.");
+  }
+  if (options.force_law != ForceLaw::Plummer && (num_modes > 0 || options.precision != ForcePrecision::Double || options.autotune)) {
+    throw std::invalid_argument("The " + forceLawName(options.force_law) + " force law is only available with the default integrator in double precision, without autotune.");
+  }
+  if (num_modes > 0 && observesSteps(options)) {
+    throw std::invalid_argument("Live frames and diagnostics are only available with the default integrator.");
+  }
+}
+
+
+// Tune the settings of the run (see autotune.hpp) if asked to, before it is timed
+// Describes the choice in the summary and sets tuning_ms to the time the trials took
+std::optional<TuningResult> tuneRun(const std::vector<std::shared_ptr<Particle>>& body_list, const RunOptions& options, std::ostringstream& summary,
+                                    double& tuning_ms) {
+  tuning_ms = 0.0;
+  if (!options.autotune) {
+    return std::nullopt;
+  }
+
+  auto start_time = std::chrono::high_resolution_clock::now();
+  // The step observer needs the particle list, so the arrays solver is only tried without one
+  TuningResult tuning = autotune(body_list, options.dt, options.soft_fac, defaultAutotuneCachePath(), !observesSteps(options));
+  auto end_time = std::chrono::high_resolution_clock::now();
+  tuning_ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+
+  summary << "Autotune: " << describeTuning(tuning.best);
+  if (tuning.from_cache) {
+    summary << " (cached for up to " << sizeBucket(body_list.size()) << " bodies)";
+  }
+  else {
+    summary << " (" << tuning.trials.size() << " trials)";
+  }
+  summary << "\n" << std::endl;
+  return tuning;
+}
+
+
+
+
+// Run the scenarios of a batch file side by side and write the results table
+int runBatchFile(const RunOptions& options) {
+  std::vector<Scenario> scenarios = readScenarios(options.batch_path);
+  const int num_cores = omp_get_max_threads();
+  std::cout << "Running " << scenarios.size() << " scenarios on " << num_cores << " cores\n" << std::endl;
+
+  auto start_time = std::chrono::high_resolution_clock::now();
+  std::vector<ScenarioResult> results = runBatch(scenarios, num_cores, [](const ScenarioResult& result) {
+    std::cout << (result.error.empty() ? "Finished " : "FAILED ") << result.scenario.name << " on " << result.num_threads
+              << (result.num_threads == 1 ? " thread in " : " threads in ") << result.runtime_ms << " ms"
+              << (result.error.empty() ? "" : ": " + result.error) << std::endl;
+  });
+  auto end_time = std::chrono::high_resolution_clock::now();
+
+  std::ofstream table(options.results_path);
+  if (!table) {
+    throw std::runtime_error("Could not write the results table " + options.results_path + ".");
+  }
+  writeResultsTable(table, results);
+
+  int num_failed = std::count_if(results.begin(), results.end(), [](const ScenarioResult& result) { return !result.error.empty(); });
+  std::cout << "\nWrote the results of " << results.size() << " scenarios (" << num_failed << " failed) to " << options.results_path << "\n"
+            << "The total batch time is: " << std::chrono::duration<double, std::milli>(end_time - start_time).count() << " ms\n" << std::endl;
+  return num_failed == 0 ? 0 : 1;
+}
+
+
+
+// Evolve the bodies with the integrator selected on the command line (checked by checkRunOptions), with the settings chosen by tuneRun if any
+// Returns any extra lines for the run summary and sets the number of timesteps taken
+std::string runEvolution(std::vector<std::shared_ptr<Particle>>& body_list, const RunOptions& options, const std::optional<TuningResult>& tuning,
+                         int& num_timesteps) {
+  std::ostringstream summary;
+  num_timesteps = std::ceil( options.sim_time / options.dt ); // Number of timesteps needed in simulation (round up to nearest int)
+
+  if (options.collision_radius > 0.0) {
+    int num_merged = evolutionOfSystemWithCollisions(body_list, options.dt, options.sim_time, options.collision_radius, options.soft_fac);
+    summary << "The number of bodies merged by collisions is: " << num_merged << "\n" << std::endl;
+  }
+  else if (options.substeps > 0) {
+    evolutionOfSystemMultiStep(body_list, options.dt, options.sim_time, options.substeps, options.soft_fac);
+    summary << "Multiple time-stepping used " << options.substeps << " star-body steps per body-body step.\n" << std::endl;
+  }
+  else if (options.energy_tolerance > 0.0) {
+    AdaptiveTolerances tolerances;
+    tolerances.energy_tolerance = options.energy_tolerance;
+    tolerances.max_dt = options.sim_time;
+
+    AdaptiveStepStats stats = evolutionOfSystemAdaptive(body_list, options.dt, options.sim_time, tolerances, options.soft_fac);
+    num_timesteps = stats.accepted_steps + stats.rejected_steps;
+    summary << "Adaptive timestep: " << stats.accepted_steps << " accepted steps, " << stats.rejected_steps << " rejected steps\n"
+            << "Smallest timestep: " << stats.smallest_dt << ", largest timestep: " << stats.largest_dt << "\n"
+            << "Relative energy error: " << stats.relative_energy_error << "\n" << std::endl;
+  }
+  else if (observesSteps(options)) {
+    std::unique_ptr<FramePublisher> publisher;
+    std::unique_ptr<FrameServer> server;
+    std::unique_ptr<TrajectoryWriter> trajectory;
+    std::unique_ptr<EphemerisRecorder> ephemeris;
+    std::unique_ptr<DiagnosticsPipeline> diagnostics;
+    if (!options.shared_memory_name.empty()) {
+      publisher = std::make_unique<FramePublisher>(options.shared_memory_name, body_list.size());
+    }
+    if (!options.trajectory_path.empty()) {
+      trajectory = std::make_unique<TrajectoryWriter>(options.trajectory_path, body_list.size());
+    }
+    if (!options.ephemeris_path.empty()) {
+      ephemeris = std::make_unique<EphemerisRecorder>(body_list.size());
+      ephemeris->record(0.0, body_list);
+    }
+    if (!options.diagnostics_path.empty()) {
+      diagnostics = std::make_unique<DiagnosticsPipeline>(options.diagnostics_path, body_list.size());
+      diagnostics->sample(0, 0.0, body_list);
+    }
+    if (!options.socket_path.empty()) {
+      server = std::make_unique<FrameServer>(options.socket_path, body_list.size()); // Clients can join at any frame, the run does not wait for them
+    }
+
+    StepObserver observer = [&](long step, double sim_time, const std::vector<std::shared_ptr<Particle>>& particle_list) {
+      if (step % options.frame_interval != 0) {
+        return;
+      }
+      if (publisher) {
+        publisher->publish(step, sim_time, particle_list);
+      }
+      if (server) {
+        server->publish(step, sim_time, particle_list);
+      }
+      if (trajectory) {
+        trajectory->writeFrame(step, sim_time, particle_list);
+      }
+      if (ephemeris) {
+        ephemeris->record(sim_time, particle_list);
+      }
+      if (diagnostics) {
+        diagnostics->sample(step, sim_time, particle_list);
+      }
+    };
+    evolutionOfSystem(body_list, options.dt, options.sim_time, options.soft_fac, options.precision, observer, options.force_law);
+
+    if (publisher) {
+      summary << "Published " << publisher->getFramesPublished() << " frames to shared memory " << options.shared_memory_name << "\n" << std::endl;
+    }
+    if (server) {
+      summary << "Served " << server->getFramesPublished() << " frames on " << options.socket_path << " (" << server->getFramesDropped() << " dropped)\n" << std::endl;
+    }
+    if (trajectory) {
+      trajectory->finish();
+      summary << "Wrote " << trajectory->getNumFrames() << " frames (" << trajectory->getBytesWritten() << " bytes) to " << options.trajectory_path << "\n" << std::endl;
+    }
+    if (ephemeris) {
+      ephemeris->build().save(options.ephemeris_path);
+      summary << "Saved an ephemeris of " << ephemeris->getNumSegments() << " segments to " << options.ephemeris_path << "\n" << std::endl;
+    }
+    if (diagnostics) {
+      diagnostics->finish();
+      summary << "Logged diagnostics of " << diagnostics->getNumSamples() << " frames to " << options.diagnostics_path << " (the run waited "
+              << diagnostics->getStallSeconds() * 1000.0 << " ms for the diagnostics workers)\n" << std::endl;
+    }
+  }
+  else if (tuning) {
+    if (tuning->best.solver == Solver::Arrays) {
+      Simulation simulation(body_list, options.dt, options.soft_fac);
+      simulation.advanceTo(options.sim_time);
+      simulation.writeBack(body_list);
+    }
+    else {
+      evolutionOfSystem(body_list, options.dt, options.sim_time, options.soft_fac);
+    }
+  }
+  else {
+    evolutionOfSystem(body_list, options.dt, options.sim_time, options.soft_fac, options.precision, {}, options.force_law); // Run simulation evolution 
+  }
+
+  if (options.force_law != ForceLaw::Plummer) {
+    summary << "Force law: " << forceLawName(options.force_law) << "\n" << std::endl;
+  }
+  return summary.str();
+}
+
+
+
+// Evolve a random system in compact storage (see compactSystem.hpp), generated straight into it without a list of particles
+int runCompact(const RunOptions& options, int num_bodies) {
+  bool default_integrator = options.collision_radius == 0.0 && options.substeps == 0 && options.energy_tolerance == 0.0
+                            && options.precision == ForcePrecision::Double && options.force_law == ForceLaw::Plummer && !options.autotune
+                            && options.shared_memory_name.empty() && options.socket_path.empty() && options.trajectory_path.empty()
+                            && options.ephemeris_path.empty() && options.diagnostics_path.empty() && options.ic_cache_directory.empty();
+  if (!default_integrator) {
+    throw std::invalid_argument("Compact storage is only available with the default integrator and force law, without frames, diagnostics, autotune or the initial condition cache.");
+  }
+
+  RandomSystem random_system(num_bodies);
+  CompactSystem system(num_bodies, [&](const CompactSystem::BodyVisitor& visit) { random_system.forEachBody(visit); },
+                       options.dt, options.soft_fac, options.compact_float_velocities);
+  std::cout << "The initial total kinetic energy of the system is " << system.totalKineticEnergy() << "\n"
+            << "The initial total potential energy of the system is " << system.totalPotentialEnergy() << "\n"
+            << "The initial total energy of the system is " << system.totalEnergy() << "\n"
+  << std::endl;
+
+  auto start_time = std::chrono::high_resolution_clock::now();
+  system.advanceTo(options.sim_time);
+  auto end_time = std::chrono::high_resolution_clock::now();
+
+  std::vector<MemoryUsage> usage = system.getMemoryUsage();
+  usage.push_back({"Scratch pool", scratchPool().getBytesReserved()});
+  double runtime = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+  std::cout << "The final total kinetic energy of the system is " << system.totalKineticEnergy() << "\n"
+            << "The final total potential energy of the system is " << system.totalPotentialEnergy() << "\n"
+            << "The final total energy of the system is " << system.totalEnergy() << "\n"
+  << std::endl;
+  std::cout << "Compact storage: " << system.getNumCells() << " cells, sorted again " << system.getNumRebins() << " times\n"
+            << formatMemoryReport(usage, num_bodies)
+            << "Kernels: " << isaReport() << "\n"
+  << std::endl;
+  const long num_steps = system.getStepCount(); // 0 if the simulation time is not positive
+  std::cout << "The total simulation time is: " << runtime << " ms\n";
+  if (num_steps > 0) {
+    std::cout << "The average time per timestep is: " << runtime/num_steps << " ms\n";
+  }
+  std::cout << std::endl;
+  return 0;
+}
+
+
+
+// Evolve a random system out of core (see outOfCore.hpp): it is generated straight into the state file, then streamed through memory every pass
+int runOutOfCore(const RunOptions& options, int num_bodies) {
+  bool default_integrator = options.collision_radius == 0.0 && options.substeps == 0 && options.energy_tolerance == 0.0
+                            && options.precision == ForcePrecision::Double && options.force_law == ForceLaw::Plummer && !options.autotune
+                            && options.shared_memory_name.empty() && options.socket_path.empty() && options.trajectory_path.empty()
+                            && options.ephemeris_path.empty() && options.diagnostics_path.empty() && options.ic_cache_directory.empty() && !options.compact;
+  if (!default_integrator) {
+    throw std::invalid_argument("Out-of-core runs are only available with the default integrator and force law, without frames, diagnostics, autotune, "
+                                "the initial condition cache or compact storage.");
+  }
+
+  RandomSystem random_system(num_bodies);
+  auto generation_start = std::chrono::high_resolution_clock::now();
+  saveInitialConditions(options.out_of_core_path, random_system.getCacheParameters(), num_bodies,
+                        [&](const std::function<void(int, const Particle&)>& visit) { random_system.forEachBody(visit); });
+  auto generation_end = std::chrono::high_resolution_clock::now();
+
+  OutOfCoreSystem system(options.out_of_core_path, options.dt, options.soft_fac);
+  std::cout << "Generated the initial conditions into " << options.out_of_core_path << " (" << formatBytes(system.getFileBytes()) << ") in "
+            << std::chrono::duration<double, std::milli>(generation_end - generation_start).count() << " ms\n"
+            << "The initial total kinetic energy of the system is " << system.totalKineticEnergy() << "\n"
+            << "The initial total potential energy of the system is " << system.totalPotentialEnergy() << "\n"
+            << "The initial total energy of the system is " << system.totalEnergy() << "\n"
+  << std::endl;
+
+  auto start_time = std::chrono::high_resolution_clock::now();
+  const std::uint64_t streamed_before = system.getBytesStreamed();
+  system.advanceTo(options.sim_time);
+  const std::uint64_t streamed = system.getBytesStreamed() - streamed_before;
+  system.sync();
+  auto end_time = std::chrono::high_resolution_clock::now();
+
+  double runtime = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+  std::cout << "The final total kinetic energy of the system is " << system.totalKineticEnergy() << "\n"
+            << "The final total potential energy of the system is " << system.totalPotentialEnergy() << "\n"
+            << "The final total energy of the system is " << system.totalEnergy() << "\n"
+  << std::endl;
+  const long num_steps = system.getStepCount(); // 0 if the simulation time is not positive
+  std::cout << "Out of core: streamed " << formatBytes(streamed) << " of source tiles";
+  if (num_steps > 0) {
+    std::cout << " (" << formatBytes(streamed / num_steps) << " per step)";
+  }
+  std::cout << " from " << options.out_of_core_path << "\n"
+            << formatMemoryReport(system.getMemoryUsage(), num_bodies)
+            << "Kernels: " << isaReport() << "\n"
+  << std::endl;
+  std::cout << "The total simulation time is: " << runtime << " ms\n";
+  if (num_steps > 0) {
+    std::cout << "The average time per timestep is: " << runtime/num_steps << " ms\n";
+  }
+  std::cout << std::endl;
+  return 0;
+}
+
+
+
+#ifdef NBODY_WITH_MPI
+// Initialises MPI for the whole run and finalises it on the way out of main
+struct MpiSession {
+  MpiSession(int& argc, char**& argv) { MPI_Init(&argc, &argv); }
+  ~MpiSession() { MPI_Finalize(); }
+};
+
+
+
+// Evolve the system spread over every MPI rank, rank 0 generating the bodies and printing the results
+int runDistributed(const RunOptions& options, bool solarsystem, int num_bodies) {
+  int rank = 0;
+  int num_ranks = 1;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+
+  bool default_integrator = options.collision_radius == 0.0 && options.substeps == 0 && options.energy_tolerance == 0.0
+                            && options.precision == ForcePrecision::Double && options.force_law == ForceLaw::Plummer && options.shared_memory_name.empty() && options.socket_path.empty()
+                            && options.trajectory_path.empty() && options.ephemeris_path.empty() && options.diagnostics_path.empty()
+                            && options.out_of_core_path.empty() && !options.compact && !options.autotune && options.ic_cache_directory.empty();
+  if (!default_integrator) {
+    if (rank == 0) {
+      std::cerr << "ERROR: Only the default integrator is available on more than one MPI rank." << std::endl;
+    }
+    return 1;
+  }
+
+  // Rank 0 alone generates the bodies, so every rank has to hear whether that failed before going on
+  std::unique_ptr<InitialConditionGenerator> generator;
+  std::vector<std::shared_ptr<Particle>> body_list;
+  int generated = 1;
+  if (rank == 0) {
+    try {
+      if (solarsystem) {
+        generator = std::make_unique<SolarSystem>();
+      }
+      else {
+        generator = std::make_unique<RandomSystem>(num_bodies);
+      }
+      body_list = generator->generateInitialConditions();
+    }
+    catch (const std::exception &e) {
+      help();
+      std::cerr << "ERROR: " << e.what() << std::endl;
+      generated = 0;
+    }
+  }
+  MPI_Bcast(&generated, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if (!generated) {
+    return 1;
+  }
+
+  // The distributed system checks its arguments on every rank alike, so every rank throws together
+  try {
+    DistributedSystem system(MPI_COMM_WORLD, body_list, options.soft_fac);
+    double initial_energy = system.totalEnergy();
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    auto start_time = std::chrono::high_resolution_clock::now();
+    system.evolve(options.dt, options.sim_time);
+    MPI_Barrier(MPI_COMM_WORLD);
+    auto end_time = std::chrono::high_resolution_clock::now();
+
+    double final_kinetic = system.totalKineticEnergy();
+    double final_potential = system.totalPotentialEnergy();
+
+    if (rank == 0) {
+      int num_timesteps = std::ceil( options.sim_time / options.dt );
+      double runtime = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+      std::cout << "Distributed over " << num_ranks << " MPI ranks, " << system.getNumGlobal() << " bodies\n"
+                << "The initial total energy of the system is " << initial_energy << "\n"
+                << "The final total kinetic energy of the system is " << final_kinetic << "\n"
+                << "The final total potential energy of the system is " << final_potential << "\n"
+                << "The final total energy of the system is " << final_kinetic + final_potential << "\n"
+                << "The total simulation time is: " << runtime << " ms\n"
+                << "The average time per timestep is: " << runtime/num_timesteps << " ms\n"
+      << std::endl;
+    }
+  }
+  catch (const std::exception &e) {
+    if (rank == 0) {
+      help();
+      std::cerr << "ERROR: " << e.what() << std::endl;
+    }
+    return 1;
+  }
+  return 0;
+}
+#endif
+
+
+
 int main(int argc, char *argv[]) 
 {
+#ifdef NBODY_WITH_MPI
+  MpiSession mpi_session(argc, argv);
+#endif
+
   // Parse command line arguments
   bool solarsystem = false;
   bool randomsystem = false;
   int num_bodies = 0;
-  double soft_fac = 0.0; // The softening factor i.e epsilon
-  double dt = 0.0;
-  double sim_time = 0.0;
+  RunOptions options;
 
   if (argc == 1) // When there are no arguments given
   {
@@ -88,7 +559,7 @@ int main(int argc, char *argv[])
       {
         const char* input = argv[i + 1];
         char* endptr;
-        soft_fac = strtod(input, &endptr); // Convert char to double using strtod()
+        options.soft_fac = strtod(input, &endptr); // Convert char to double using strtod()
 
         if (*endptr != '\0') { // If non-numerical character in argument
           help();
@@ -110,7 +581,7 @@ int main(int argc, char *argv[])
       {
         const char* input = argv[i + 1];
         char* endptr;
-        dt = strtod(input, &endptr); // Convert timestep to double
+        options.dt = strtod(input, &endptr); // Convert timestep to double
 
         if (*endptr != '\0') { // If non-numerical character in argument
           help();
@@ -137,7 +608,7 @@ int main(int argc, char *argv[])
         if (pi_pos == std::string::npos) { 
           const char* input = argv[i + 1];
           char* endptr;
-          sim_time = strtod(input, &endptr); // Simulation time as input if input is a double
+          options.sim_time = strtod(input, &endptr); // Simulation time as input if input is a double
 
           if (*endptr != '\0') { // If non-numerical character in argument
             help();
@@ -153,11 +624,11 @@ int main(int argc, char *argv[])
             throw std::invalid_argument("The only non-numerical characters allowed are 'pi' and it must be at the end.");
           }
           else if (x_str == "") { // If no coefficient
-            sim_time = M_PI;
+            options.sim_time = M_PI;
           }
           else {
             double x = std::stod(x_str);
-            sim_time = x * M_PI;
+            options.sim_time = x * M_PI;
           }
         }
         i++;
@@ -175,6 +646,385 @@ int main(int argc, char *argv[])
 
 
 
+    else if (arg == "-c" || arg == "--collision_radius")
+    {
+      if (i + 1 < argc)
+      {
+        const char* input = argv[i + 1];
+        char* endptr;
+        options.collision_radius = strtod(input, &endptr); // Convert collision radius to double
+
+        if (*endptr != '\0' || options.collision_radius < 0.0) { // If non-numerical character in argument or negative radius
+          help();
+          throw std::invalid_argument("Invalid collision radius argument.");
+        }
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("No value given for collision radius argument.");
+        return 1;
+      }
+    }
+
+
+
+
+    else if (arg == "-m" || arg == "--multistep")
+    {
+      if (i + 1 < argc)
+      {
+        std::string substep_arg = argv[i + 1];
+        for (auto c : substep_arg) { // Loop through each char in the string
+          if (!std::isdigit(c)) { // Must be a positive integer
+            help();
+            throw std::invalid_argument("Multistep argument must be a positive integer.");
+          }
+        }
+
+        options.substeps = std::stoi(substep_arg);
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("No value given for multistep argument.");
+        return 1;
+      }
+    }
+
+
+
+
+    else if (arg == "-a" || arg == "--adaptive")
+    {
+      if (i + 1 < argc)
+      {
+        const char* input = argv[i + 1];
+        char* endptr;
+        options.energy_tolerance = strtod(input, &endptr); // Convert tolerance to double
+
+        if (*endptr != '\0' || options.energy_tolerance <= 0.0) { // If non-numerical character in argument or not positive
+          help();
+          throw std::invalid_argument("Invalid adaptive energy tolerance argument.");
+        }
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("No value given for adaptive argument.");
+        return 1;
+      }
+    }
+
+
+
+
+    else if (arg == "-fl" || arg == "--force_law")
+    {
+      if (i + 1 < argc)
+      {
+        try {
+          options.force_law = parseForceLaw(argv[i + 1]);
+        }
+        catch (const std::invalid_argument&) {
+          help();
+          throw;
+        }
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("No value given for force law argument.");
+        return 1;
+      }
+    }
+
+
+
+
+    else if (arg == "-p" || arg == "--precision")
+    {
+      if (i + 1 < argc)
+      {
+        try {
+          options.precision = parseForcePrecision(argv[i + 1]);
+        }
+        catch (const std::invalid_argument&) {
+          help();
+          throw;
+        }
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("No value given for precision argument.");
+        return 1;
+      }
+    }
+
+
+
+
+    else if (arg == "-sm" || arg == "--shared_memory")
+    {
+      if (i + 1 < argc)
+      {
+        options.shared_memory_name = argv[i + 1];
+        if (options.shared_memory_name.empty()) {
+          help();
+          throw std::invalid_argument("The shared memory name must not be empty.");
+        }
+        if (options.shared_memory_name.front() != '/') { // POSIX shared memory names start with a slash
+          options.shared_memory_name.insert(0, "/");
+        }
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("No value given for shared memory argument.");
+        return 1;
+      }
+    }
+
+
+
+
+    else if (arg == "-sv" || arg == "--serve")
+    {
+      if (i + 1 < argc)
+      {
+        options.socket_path = argv[i + 1];
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("No value given for serve argument.");
+        return 1;
+      }
+    }
+
+
+
+
+    else if (arg == "-tr" || arg == "--trajectory")
+    {
+      if (i + 1 < argc)
+      {
+        options.trajectory_path = argv[i + 1];
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("No value given for trajectory argument.");
+        return 1;
+      }
+    }
+
+
+
+
+    else if (arg == "-ep" || arg == "--ephemeris")
+    {
+      if (i + 1 < argc)
+      {
+        options.ephemeris_path = argv[i + 1];
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("No value given for ephemeris argument.");
+        return 1;
+      }
+    }
+
+
+
+
+    else if (arg == "-dg" || arg == "--diagnostics")
+    {
+      if (i + 1 < argc)
+      {
+        options.diagnostics_path = argv[i + 1];
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("No value given for diagnostics argument.");
+        return 1;
+      }
+    }
+
+
+
+
+    else if (arg == "-f" || arg == "--frame_interval")
+    {
+      if (i + 1 < argc)
+      {
+        std::string interval_arg = argv[i + 1];
+        for (auto c : interval_arg) { // Loop through each char in the string
+          if (!std::isdigit(c)) { // Must be a positive integer
+            help();
+            throw std::invalid_argument("Frame interval argument must be a positive integer.");
+          }
+        }
+
+        options.frame_interval = std::stoi(interval_arg);
+        if (options.frame_interval < 1) {
+          help();
+          throw std::invalid_argument("Frame interval argument must be a positive integer.");
+        }
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("No value given for frame interval argument.");
+        return 1;
+      }
+    }
+
+
+
+
+    else if (arg == "-af" || arg == "--affinity")
+    {
+      if (i + 1 < argc)
+      {
+        try {
+          options.affinity = parseThreadAffinity(argv[i + 1]);
+        }
+        catch (const std::invalid_argument&) {
+          help();
+          throw;
+        }
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("No value given for affinity argument.");
+        return 1;
+      }
+    }
+
+    else if (arg == "-b" || arg == "--batch")
+    {
+      if (i + 1 < argc)
+      {
+        options.batch_path = argv[i + 1];
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("No value given for batch argument.");
+        return 1;
+      }
+    }
+
+    else if (arg == "-o" || arg == "--results")
+    {
+      if (i + 1 < argc)
+      {
+        options.results_path = argv[i + 1];
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("No value given for results argument.");
+        return 1;
+      }
+    }
+
+    else if (arg == "-cm" || arg == "--compact")
+    {
+      if (i + 1 < argc && (std::string(argv[i + 1]) == "double" || std::string(argv[i + 1]) == "float"))
+      {
+        options.compact = true;
+        options.compact_float_velocities = std::string(argv[i + 1]) == "float";
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("Compact storage needs 'double' or 'float' velocities.");
+        return 1;
+      }
+    }
+
+    else if (arg == "-oc" || arg == "--out_of_core")
+    {
+      if (i + 1 < argc)
+      {
+        options.out_of_core_path = argv[i + 1];
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("No value given for out-of-core argument.");
+        return 1;
+      }
+    }
+
+
+
+
+    else if (arg == "-ic" || arg == "--ic_cache")
+    {
+      if (i + 1 < argc)
+      {
+        options.ic_cache_directory = argv[i + 1];
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("No value given for initial condition cache argument.");
+        return 1;
+      }
+    }
+
+    else if (arg == "-at" || arg == "--autotune")
+    {
+      options.autotune = true;
+    }
+    else if (arg == "-isa" || arg == "--isa")
+    {
+      if (i + 1 < argc)
+      {
+        try {
+          options.isa = parseIsaLevel(argv[i + 1]);
+        }
+        catch (const std::invalid_argument&) {
+          help();
+          throw;
+        }
+        i++;
+      }
+      else 
+      {
+        help();
+        throw std::invalid_argument("No value given for isa argument.");
+        return 1;
+      }
+    }
+
+
+
+
     else if (arg == "-h" || arg == "--help")
     {
       help();
@@ -184,6 +1034,24 @@ int main(int argc, char *argv[])
   }
 
 
+  // A batch of scenarios replaces the single run
+  if (!options.batch_path.empty()) {
+#ifdef NBODY_WITH_MPI
+    int batch_rank = 0;
+    int batch_ranks = 1;
+    MPI_Comm_rank(MPI_COMM_WORLD, &batch_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &batch_ranks);
+    if (batch_ranks > 1) {
+      // Every rank would run the whole batch and write the same outputs
+      if (batch_rank == 0) {
+        std::cerr << "ERROR: Batch runs are only available on one MPI rank." << std::endl;
+      }
+      return 1;
+    }
+#endif
+    return runBatchFile(options);
+  }
+
   // If neither system is selected
   if (solarsystem == false && randomsystem == false) {
     help();
@@ -209,15 +1077,30 @@ int main(int argc, char *argv[])
 
 
 
+#ifdef NBODY_WITH_MPI
+  int num_ranks = 1;
+  MPI_Comm_size(MPI_COMM_WORLD, &num_ranks);
+  if (num_ranks > 1) {
+    return runDistributed(options, solarsystem, num_bodies);
+  }
+#endif
+
+
+  setIsaLevel(options.isa);
+
+  // Pin the threads before any particle data is created, so the parallel first touch places it on the right NUMA nodes
+  pinThreads(options.affinity);
+
+
   // Use pointer to base class generateInitialConditions method instead of calling from subclasses
   // This will reduce code duplication and reduce memory usage
-  InitialConditionGenerator* systems[2]; // Pointer to initial condition generator base class
+  std::unique_ptr<InitialConditionGenerator> systems[2]; // Pointer to initial condition generator base class (freed at the end of main)
 
 
   if (solarsystem == true) {
 
-    systems[0] = new SolarSystem(); // Create object of SolarSystem class
-    SolarSystem* solar_system = dynamic_cast<SolarSystem*>(systems[0]); // Cast the already defined InitialConditionGenerator Pointer to a SolarSystem pointer. 
+    systems[0] = std::make_unique<SolarSystem>(); // Create object of SolarSystem class
+    SolarSystem* solar_system = dynamic_cast<SolarSystem*>(systems[0].get()); // Cast the already defined InitialConditionGenerator Pointer to a SolarSystem pointer. 
     // i.e. you can use solar_system as a pointer to SolarSystem and use the other methods exclusive to the SolarSystem class
 
     try {
@@ -226,21 +1109,37 @@ int main(int argc, char *argv[])
       printEnergyMessages(solar_system->getCelestialBodyList());
 
 
+      std::vector<std::shared_ptr<Particle>> body_list = systems[0]->generateInitialConditions(); // Run this again to measure total simulation time
+      checkRunOptions(options);
+      std::ostringstream tuning_summary;
+      double tuning_ms = 0.0;
+      std::optional<TuningResult> tuning = tuneRun(body_list, options, tuning_summary, tuning_ms); // Not part of the simulation time
+
       auto start_time = std::chrono::high_resolution_clock::now();
-      systems[0]->generateInitialConditions(); // Run this again to measure total simulation time
-      evolutionOfSystem(solar_system->getCelestialBodyList(), dt, sim_time, soft_fac); // Run simulation evolution 
+      int num_timesteps = 0;
+      std::string run_summary = runEvolution(body_list, options, tuning, num_timesteps); // Run simulation evolution 
       auto end_time = std::chrono::high_resolution_clock::now();
 
 
       solar_system->printMessages();
-      printEnergyMessages(solar_system->getCelestialBodyList());
+      printEnergyMessages(body_list);
+      std::cout << tuning_summary.str() << run_summary;
+      std::cout << "Particle arena: " << solar_system->getArenaBytes() << " bytes\n"
+                << "Scratch pool: " << scratchPool().getBytesReserved() << " bytes in " << scratchPool().getNumBuffers() << " buffers\n"
+                << "Threads: " << affinityReport() << "\n"
+                << "Kernels: " << isaReport() << "\n"
+                << "Work stealing: " << forceExecutor().getTotalStats().tasks_run << " force tasks, " << forceExecutor().getTotalStats().tasks_stolen << " stolen, "
+                << forceExecutor().getTotalStats().idle_seconds * 1000 << " ms idle over all threads\n"
+      << std::endl;
 
 
-      int num_timesteps = std::ceil( sim_time / dt ); // Number of timesteps needed in simulation (round up to nearest int)
       double runtime = std::chrono::duration<double, std::milli>(end_time - start_time).count();
       std::cout << "The total simulation time is: " << runtime << " ms\n"
-                << "The average time per timestep is: " << runtime/num_timesteps << " ms\n"         
-      << std::endl;
+                << "The average time per timestep is: " << runtime/num_timesteps << " ms\n";
+      if (tuning) {
+        std::cout << "The autotune time (not in the simulation time) is: " << tuning_ms << " ms\n";
+      }
+      std::cout << std::endl;
     }
 
     catch(const std::exception &e) {
@@ -265,27 +1164,61 @@ int main(int argc, char *argv[])
   else if (randomsystem == true) {
     try 
     {
-      systems[1] = new RandomSystem(num_bodies); // Create object of RandomSystem class
-      RandomSystem* random_system = dynamic_cast<RandomSystem*>(systems[1]); // Cast the already defined InitialConditionGenerator Pointer to a RandomSystem pointer
+      if (!options.out_of_core_path.empty()) {
+        return runOutOfCore(options, num_bodies);
+      }
+      if (options.compact) {
+        return runCompact(options, num_bodies);
+      }
+
+      systems[1] = std::make_unique<RandomSystem>(num_bodies); // Create object of RandomSystem class
+      RandomSystem* random_system = dynamic_cast<RandomSystem*>(systems[1].get()); // Cast the already defined InitialConditionGenerator Pointer to a RandomSystem pointer
+      if (!options.ic_cache_directory.empty()) {
+        random_system->setCacheDirectory(options.ic_cache_directory);
+      }
 
       // Simulate random system and it's evolution:
+      auto generation_start = std::chrono::high_resolution_clock::now();
       systems[1]->generateInitialConditions();
+      auto generation_end = std::chrono::high_resolution_clock::now();
+      if (!options.ic_cache_directory.empty()) {
+        std::cout << (random_system->wasLoadedFromCache() ? "Loaded the initial conditions from " : "Generated the initial conditions and cached them in ")
+                  << options.ic_cache_directory << " in " << std::chrono::duration<double, std::milli>(generation_end - generation_start).count() << " ms\n";
+      }
       printEnergyMessages(random_system->getCelestialBodyList()); 
 
 
+      std::vector<std::shared_ptr<Particle>> body_list = systems[1]->generateInitialConditions();
+      checkRunOptions(options);
+      std::ostringstream tuning_summary;
+      double tuning_ms = 0.0;
+      std::optional<TuningResult> tuning = tuneRun(body_list, options, tuning_summary, tuning_ms); // Not part of the simulation time
+
       auto start_time = std::chrono::high_resolution_clock::now();
-      systems[1]->generateInitialConditions();
-      evolutionOfSystem(random_system->getCelestialBodyList(), dt, sim_time, soft_fac); // Run simulation evolution    
+      int num_timesteps = 0;
+      std::string run_summary = runEvolution(body_list, options, tuning, num_timesteps); // Run simulation evolution    
       auto end_time = std::chrono::high_resolution_clock::now();
       
       
-      printEnergyMessages(random_system->getCelestialBodyList());  
-      int num_timesteps = std::ceil( sim_time / dt ); 
+      printEnergyMessages(body_list);  
+      std::cout << tuning_summary.str() << run_summary;
+      std::vector<MemoryUsage> usage {{"Particle arena", random_system->getArenaBytes()},
+                                      {"Particle handles", (body_list.capacity() + random_system->getCelestialBodyList().capacity()) * sizeof(std::shared_ptr<Particle>)},
+                                      {"Scratch pool", scratchPool().getBytesReserved()}};
+      std::cout << formatMemoryReport(usage, body_list.size())
+                << "Threads: " << affinityReport() << "\n"
+                << "Kernels: " << isaReport() << "\n"
+                << "Work stealing: " << forceExecutor().getTotalStats().tasks_run << " force tasks, " << forceExecutor().getTotalStats().tasks_stolen << " stolen, "
+                << forceExecutor().getTotalStats().idle_seconds * 1000 << " ms idle over all threads\n"
+      << std::endl;
 
       double runtime = std::chrono::duration<double, std::milli>(end_time - start_time).count();
       std::cout << "The total simulation time is: " << runtime << " ms\n"
-                << "The average time per timestep is: " << runtime/num_timesteps << " ms\n"         
-      << std::endl;
+                << "The average time per timestep is: " << runtime/num_timesteps << " ms\n";
+      if (tuning) {
+        std::cout << "The autotune time (not in the simulation time) is: " << tuning_ms << " ms\n";
+      }
+      std::cout << std::endl;
 
       // Print number of max threads
       int thread_num_max = omp_get_max_threads();
@@ -0,0 +1,369 @@
+// Timings of the library's hot functions, as medians over repeated runs, and the performance gate run by ctest -L perf
+#include "particle.hpp"
+#include "solarSystem.hpp"
+#include "randomParticleSystem.hpp"
+#include "isaDispatch.hpp"
+#include "deterministicSum.hpp"
+#include "outOfCore.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <omp.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+
+// Median and median absolute deviation of the wall clock times (ms) of repeated calls, after one warm up call
+struct Timing {
+    double median;
+    double deviation;
+};
+
+template <typename Work>
+Timing measure(int repeats, Work&& work) {
+    work();
+
+    std::vector<double> times;
+    for (int r = 0; r < repeats; r++) {
+        auto start = std::chrono::steady_clock::now();
+        work();
+        auto end = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    const double median = times[times.size() / 2];
+
+    for (double& time : times) {
+        time = std::abs(time - median);
+    }
+    std::sort(times.begin(), times.end());
+    return {median, times[times.size() / 2]};
+}
+
+
+
+// The OpenMP reduction(+) sums the energy functions used before, to measure what the deterministic sums cost
+static double reductionKineticEnergy(const std::vector<std::shared_ptr<Particle>>& particle_list) {
+    double tot_KE_sum = 0.0;
+
+    #pragma omp parallel for reduction(+: tot_KE_sum)
+    for (int i = 0; i < particle_list.size(); i++) {
+        tot_KE_sum += particle_list[i]->getMass() * (particle_list[i]->getVelocity()).squaredNorm();
+    }
+    return tot_KE_sum * 0.5;
+}
+
+
+static double reductionPotentialEnergy(const std::vector<std::shared_ptr<Particle>>& particle_list) {
+    const int num_particles = particle_list.size();
+    std::vector<double> mass(num_particles), x(num_particles), y(num_particles), z(num_particles);
+
+    #pragma omp parallel for
+    for (int i = 0; i < num_particles; i++) {
+        mass[i] = particle_list[i]->getMass();
+        x[i] = particle_list[i]->getPosition()[0];
+        y[i] = particle_list[i]->getPosition()[1];
+        z[i] = particle_list[i]->getPosition()[2];
+    }
+
+    const IsaKernels& kernels = isaKernels();
+    double tot_PE_sum = 0.0;
+
+    #pragma omp parallel for reduction(+: tot_PE_sum)
+    for (int begin = 0; begin < num_particles; begin += kernel_block_rows) {
+        tot_PE_sum += kernels.potentialRows(begin, std::min(begin + kernel_block_rows, num_particles), num_particles, x.data(), y.data(), z.data(), mass.data());
+    }
+    return tot_PE_sum * -0.5;
+}
+
+
+
+// Whether energy gives the same bits on every thread count from 1 to max_threads
+template <typename Energy>
+bool sameOnAnyThreadCount(Energy&& energy, const std::vector<std::shared_ptr<Particle>>& particle_list, int max_threads) {
+    const int default_threads = omp_get_max_threads();
+
+    omp_set_num_threads(1);
+    const double serial = energy(particle_list);
+    bool same = true;
+    for (int threads = 2; threads <= max_threads; threads++) {
+        omp_set_num_threads(threads);
+        same = same && energy(particle_list) == serial;
+    }
+    omp_set_num_threads(default_threads);
+    return same;
+}
+
+
+
+static void printRow(const std::string& name, int num_bodies, double milliseconds, const std::string& note = "") {
+    std::cout << std::left << std::setw(40) << name << std::right << std::setw(8) << num_bodies
+              << std::setw(14) << std::fixed << std::setprecision(4) << milliseconds << "  " << note << std::endl;
+}
+
+
+static std::string overhead(double milliseconds, double reference) {
+    std::ostringstream note;
+    note << std::showpos << std::fixed << std::setprecision(1) << 100.0 * (milliseconds / reference - 1.0) << "% vs omp reduction";
+    return note.str();
+}
+
+
+
+// The deterministic energy sums against the OpenMP reductions they replaced
+static void reductionReport() {
+    std::cout << std::left << std::setw(40) << "Benchmark" << std::right << std::setw(8) << "N" << std::setw(14) << "median ms" << std::endl;
+
+    RandomSystem large_system(200000);
+    std::vector<std::shared_ptr<Particle>> large_bodies = large_system.generateInitialConditions();
+    double reduction_KE = measure(21, [&]() { reductionKineticEnergy(large_bodies); }).median;
+    double deterministic_KE = measure(21, [&]() { totalKineticEnergy(large_bodies); }).median;
+    printRow("kinetic energy, omp reduction", large_bodies.size(), reduction_KE);
+    printRow("kinetic energy, deterministic", large_bodies.size(), deterministic_KE, overhead(deterministic_KE, reduction_KE));
+
+    RandomSystem pair_system(4000);
+    std::vector<std::shared_ptr<Particle>> pair_bodies = pair_system.generateInitialConditions();
+    double reduction_PE = measure(11, [&]() { reductionPotentialEnergy(pair_bodies); }).median;
+    double deterministic_PE = measure(11, [&]() { totalPotentialEnergy(pair_bodies); }).median;
+    printRow("potential energy, omp reduction", pair_bodies.size(), reduction_PE);
+    printRow("potential energy, deterministic", pair_bodies.size(), deterministic_PE, overhead(deterministic_PE, reduction_PE));
+
+    // Reproducibility over thread counts (more threads than cores is fine, only the split matters)
+    const int max_threads = std::max(8, omp_get_num_procs());
+    std::cout << "\nSame bits on 1 to " << max_threads << " threads:\n"
+              << "  kinetic energy:   omp reduction " << (sameOnAnyThreadCount(reductionKineticEnergy, large_bodies, max_threads) ? "yes" : "no")
+              << ", deterministic " << (sameOnAnyThreadCount(totalKineticEnergy, large_bodies, max_threads) ? "yes" : "no") << "\n"
+              << "  potential energy: omp reduction " << (sameOnAnyThreadCount(reductionPotentialEnergy, pair_bodies, max_threads) ? "yes" : "no")
+              << ", deterministic " << (sameOnAnyThreadCount(totalPotentialEnergy, pair_bodies, max_threads) ? "yes" : "no") << std::endl;
+}
+
+
+
+///////////////////////////////////////////////////////// Performance Gate /////////////////////////////////////////////////////////
+
+
+
+// A fixed piece of work timed by the performance gate
+struct Workload {
+    std::string name;
+    int repeats;
+    std::function<void()> work;
+};
+
+
+// The gated workloads. Each holds its own bodies, which keep evolving from one repeat to the next
+// (the cost of a direct sum does not depend on where the bodies are)
+static std::vector<Workload> gateWorkloads() {
+    auto solar_bodies = std::make_shared<std::vector<std::shared_ptr<Particle>>>(SolarSystem().generateInitialConditions());
+    auto bodies_1k = std::make_shared<std::vector<std::shared_ptr<Particle>>>(RandomSystem(1000).generateInitialConditions());
+    auto bodies_10k = std::make_shared<std::vector<std::shared_ptr<Particle>>>(RandomSystem(10000).generateInitialConditions());
+
+    // The same 10000 bodies in a state file, with blocks and tiles small enough that every step streams the file 4 times
+    const std::string out_of_core_path = "benchmark_out_of_core.bin";
+    saveInitialConditions(out_of_core_path, "benchmark", *bodies_10k);
+    std::shared_ptr<OutOfCoreSystem> out_of_core_10k(new OutOfCoreSystem(out_of_core_path, 1.0/1024, 0.01, 2500, 1000),
+                                                     [out_of_core_path](OutOfCoreSystem* system) {
+                                                         delete system;
+                                                         std::remove(out_of_core_path.c_str());
+                                                     });
+
+    return {
+        // 65536 steps of the 9 body solar system (the small system engine)
+        {"solar_system", 15, [=]() { evolutionOfSystem(*solar_bodies, 1.0/1024, 64.0); }},
+        // 8 steps of 1000 random bodies
+        {"random_1k", 15, [=]() { evolutionOfSystem(*bodies_1k, 1.0/1024, 8.0/1024, 0.01); }},
+        // 1 step of 10000 random bodies
+        {"random_10k", 5, [=]() { evolveOneStep(*bodies_10k, 1.0/1024, 0.01); }},
+        // The same step out of core, to compare with random_10k
+        {"out_of_core_10k", 5, [=]() { out_of_core_10k->step(); }},
+        // 100 sums over 10000 bodies, one alone being too short to time
+        {"kinetic_energy_10k", 15, [=]() {
+            for (int r = 0; r < 100; r++) {
+                totalKineticEnergy(*bodies_10k);
+            }
+        }},
+        {"potential_energy_10k", 5, [=]() { totalPotentialEnergy(*bodies_10k); }},
+    };
+}
+
+
+// A fixed scalar loop (dependent divides and square roots, like the force sums) timed alongside the workloads,
+// so a baseline recorded on one machine can be scaled to the speed of another
+static double calibrationLoop() {
+    double x = 1.0;
+    double sum = 0.0;
+    for (int i = 0; i < 4000000; i++) {
+        x = x * 1.0000001 + 1e-9;
+        sum += 1.0 / std::sqrt(x + sum * 1e-12);
+    }
+    return sum;
+}
+
+static Timing measureCalibration() {
+    volatile double sink = 0.0;
+    return measure(9, [&]() { sink = calibrationLoop(); });
+}
+
+
+
+// The baseline file: a kernels line, then one "name median deviation" line per workload (and the calibration loop), times in ms
+struct Baseline {
+    std::string kernels;
+    std::map<std::string, Timing> timings;
+};
+
+
+static Baseline readBaseline(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Could not open the baseline file " + path + ".");
+    }
+
+    Baseline baseline;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string name;
+        fields >> name;
+        if (name == "kernels") {
+            fields >> baseline.kernels;
+            continue;
+        }
+        Timing timing;
+        if (!(fields >> timing.median >> timing.deviation)) {
+            throw std::runtime_error("Bad line in the baseline file: " + line);
+        }
+        baseline.timings[name] = timing;
+    }
+    if (baseline.timings.count("calibration") == 0) {
+        throw std::runtime_error("The baseline file has no calibration line.");
+    }
+    return baseline;
+}
+
+
+// Time every workload and write them as the new baseline
+static int recordBaseline(const std::string& path) {
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "Could not write the baseline file " << path << "." << std::endl;
+        return 2;
+    }
+
+    Timing calibration = measureCalibration();
+    file << "# Performance gate baseline, written by benchmarks --record with " << omp_get_max_threads() << " thread(s)\n"
+         << "# name median_ms deviation_ms\n"
+         << "kernels " << isaLevelName(activeIsaLevel()) << "\n"
+         << "calibration " << calibration.median << " " << calibration.deviation << "\n";
+    std::cout << "calibration " << calibration.median << " ms" << std::endl;
+
+    for (const Workload& workload : gateWorkloads()) {
+        Timing timing = measure(workload.repeats, workload.work);
+        file << workload.name << " " << timing.median << " " << timing.deviation << "\n";
+        std::cout << workload.name << " " << timing.median << " ms" << std::endl;
+    }
+    return 0;
+}
+
+
+// Slowdowns beyond these fractions of the scaled baseline (plus three times the noise) warn or fail
+constexpr double warn_slowdown = 0.15;
+constexpr double fail_slowdown = 0.5;
+
+// Time the workloads (or just the one named only) against the baseline. Returns 1 if any failed
+static int checkBaseline(const std::string& path, const std::string& only) {
+    Baseline baseline = readBaseline(path);
+
+    // Scale the baseline to this machine's speed, and only warn if the kernels differ from the recorded ones
+    Timing calibration = measureCalibration();
+    const double scale = calibration.median / baseline.timings["calibration"].median;
+    const bool comparable = baseline.kernels == isaLevelName(activeIsaLevel());
+    std::cout << "Machine speed relative to the baseline: " << std::fixed << std::setprecision(2) << 1.0 / scale << "x\n";
+    if (!comparable) {
+        std::cout << "WARNING: baseline recorded with " << baseline.kernels << " kernels, running " << isaLevelName(activeIsaLevel())
+                  << ", so slowdowns only warn\n";
+    }
+
+    bool failed = false;
+    bool found = false;
+    for (const Workload& workload : gateWorkloads()) {
+        if (!only.empty() && workload.name != only) {
+            continue;
+        }
+        found = true;
+        auto recorded = baseline.timings.find(workload.name);
+        if (recorded == baseline.timings.end()) {
+            std::cout << "WARNING: " << workload.name << " has no baseline\n";
+            continue;
+        }
+
+        Timing timing = measure(workload.repeats, workload.work);
+        const double expected = scale * recorded->second.median;
+        const double noise = 3.0 * std::max(scale * recorded->second.deviation, timing.deviation);
+
+        std::string status = "ok";
+        if (timing.median > expected * (1.0 + fail_slowdown) + noise) {
+            status = comparable ? "FAIL" : "WARNING";
+            failed = failed || comparable;
+        }
+        else if (timing.median > expected * (1.0 + warn_slowdown) + noise) {
+            status = "WARNING";
+        }
+        std::cout << std::left << std::setw(24) << workload.name << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(12) << timing.median << " ms  (expected " << expected << " +- " << noise << " ms, "
+                  << std::setprecision(2) << timing.median / expected << "x)  " << status << std::endl;
+    }
+
+    if (!found) {
+        std::cerr << "No workload named " << only << "." << std::endl;
+        return 2;
+    }
+    return failed ? 1 : 0;
+}
+
+
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    std::cout << "Threads: " << omp_get_max_threads() << ", kernels: " << isaReport() << "\n" << std::endl;
+
+    try {
+        if (args.empty()) {
+            reductionReport();
+
+            std::cout << "\nPerformance gate workloads:\n";
+            for (const Workload& workload : gateWorkloads()) {
+                std::cout << std::left << std::setw(24) << workload.name << std::right << std::fixed << std::setprecision(3)
+                          << std::setw(12) << measure(workload.repeats, workload.work).median << " ms" << std::endl;
+            }
+            return 0;
+        }
+        else if (args[0] == "--record" && args.size() == 2) {
+            return recordBaseline(args[1]);
+        }
+        else if (args[0] == "--check" && (args.size() == 2 || args.size() == 3)) {
+            return checkBaseline(args[1], args.size() == 3 ? args[2] : "");
+        }
+    }
+    catch (const std::exception& error) {
+        std::cerr << "ERROR: " << error.what() << std::endl;
+        return 2;
+    }
+
+    std::cerr << "Usage: benchmarks                                 Time everything\n"
+              << "       benchmarks --record <baseline file>         Write the performance gate baseline\n"
+              << "       benchmarks --check <baseline file> [name]   Compare the gate workloads (or one of them) with the baseline" << std::endl;
+    return 2;
+}
@@ -0,0 +1,35 @@
+#ifndef adaptiveTimestep_hpp
+#define adaptiveTimestep_hpp
+
+#include "solarSystem.hpp"
+
+
+// Accuracy targets for the adaptive timestep controller
+struct AdaptiveTolerances {
+    double eta = 0.01;              // Step criterion: dt <= eta * min(|v|/|a|), velocities taken relative to the centre of mass
+    double energy_tolerance = 1e-6; // Largest relative energy change accepted in a single step
+    double min_dt = 1e-9;           // Steps are never shrunk below this (accepted even if the energy check fails)
+    double max_dt = 1.0;
+};
+
+// Statistics of an adaptive run
+struct AdaptiveStepStats {
+    int accepted_steps = 0;
+    int rejected_steps = 0;
+    double smallest_dt = 0.0;
+    double largest_dt = 0.0;
+    double relative_energy_error = 0.0; // |E_final - E_initial| / |E_initial|
+};
+
+// Largest timestep allowed by the per-particle velocity/acceleration criterion, using the accelerations stored on the particles
+double timestepCriterion(const std::vector<std::shared_ptr<Particle>>& particle_list, double eta);
+
+// Evolution with a global timestep chosen every step from the particle criterion and the relative energy change of the step
+// A step whose energy change exceeds the tolerance is undone and retried with half the timestep
+// The energy change is tracked from the step's own force pass (exact kinetic change, work of the forces averaged over
+// the step), so a step costs one direct sum; the energy is only summed directly at the start and the end
+AdaptiveStepStats evolutionOfSystemAdaptive(const std::vector<std::shared_ptr<Particle>>& particle_list, double initial_dt, double total_time,
+                                            const AdaptiveTolerances& tolerances, double epsilon = 0.0);
+
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef autotune_hpp
+#define autotune_hpp
+
+#include "particle.hpp"
+#include "isaDispatch.hpp"
+#include <string>
+#include <vector>
+
+
+// The two implementations of the default (Euler, direct summation) integrator
+enum class Solver {
+    Particles, // evolutionOfSystem on the list of particles (fixed size engine for small systems, work stealing force loop otherwise)
+    Arrays     // Simulation: structure of arrays, one parallel region per step
+};
+
+std::string solverName(Solver solver);
+
+
+// Everything the auto-tuner chooses
+struct TuningChoice {
+    Solver solver = Solver::Particles;
+    IsaLevel isa = IsaLevel::Baseline;
+    int num_threads = 1;
+    int grain = 0; // Work stealing task size of the force loop, 0 for the executor's default
+};
+
+struct TuningTrial {
+    TuningChoice choice;
+    double seconds_per_step;
+};
+
+struct TuningResult {
+    TuningChoice best;
+    double seconds_per_step; // Of the best choice, when it was measured (on the trial bodies, see autotune)
+    std::vector<TuningTrial> trials; // Empty when the choice came from the cache
+    bool from_cache;
+};
+
+
+// Systems are tuned by size class: the smallest power of 2 at least num_bodies
+int sizeBucket(int num_bodies);
+
+// Identifies this machine in the cache: the CPU model and the number of logical CPUs
+std::string machineKey();
+
+// $NBODY_AUTOTUNE_CACHE, else ~/.nbody_autotune, else .nbody_autotune in the working directory
+std::string defaultAutotuneCachePath();
+
+
+// Pick the fastest settings for evolving these bodies with this timestep and softening
+// The choice is read from the cache file if this machine has tuned this size class before. Otherwise short trials run on
+// copies of the bodies, tuning the thread count, then the solver, then the kernels, then the task size, each with the
+// best of the previous settings, and the choice is appended to the cache (an empty cache_path skips the cache)
+// Systems of more than 2048 bodies are timed on every k-th body, so the trials stay short however big the system is
+// Without allow_arrays only the Particles solver is tried (e.g. when a step observer is needed)
+// The chosen settings are applied before returning
+TuningResult autotune(const std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double epsilon, const std::string& cache_path,
+                      bool allow_arrays = true);
+
+// Set the kernels, OpenMP thread count and force loop task size of a choice
+void applyTuning(const TuningChoice& choice);
+
+// e.g. "arrays solver, avx2 kernels, 4 threads, default grain"
+std::string describeTuning(const TuningChoice& choice);
+
+
+#endif
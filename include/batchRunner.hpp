@@ -0,0 +1,66 @@
+#ifndef batchRunner_hpp
+#define batchRunner_hpp
+
+#include "forceKernels.hpp"
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+// One run of a batch, read from one line of a scenario file
+// A line is a list of key=value fields, e.g.
+//   name=belt generator=random n=2000 seed=7 dt=0.01 time=6.28 epsilon=0.01 integrator=adaptive tolerance=1e-6 trajectory=belt.traj
+// Blank lines and lines starting with # are skipped
+struct Scenario {
+    std::string name;               // name= (default: run<line number>)
+    std::string generator;          // generator= solar or random
+    int num_bodies = 0;             // n= (random only)
+    unsigned int seed = 42;         // seed= (random only)
+    double dt = 0.0;                // dt=
+    double sim_time = 0.0;          // time=
+    double epsilon = 0.0;           // epsilon=
+    std::string integrator = "euler"; // integrator= euler, collisions, multistep or adaptive
+    double collision_radius = 0.0;  // radius= (collisions)
+    int substeps = 0;               // substeps= (multistep)
+    double energy_tolerance = 0.0;  // tolerance= (adaptive)
+    ForcePrecision precision = ForcePrecision::Double; // precision= double or mixed (euler)
+    ForceLaw force_law = ForceLaw::Plummer; // force= plummer, spline, newtonian or post-newtonian (euler)
+    std::string trajectory_path;    // trajectory= compressed trajectory file (euler)
+    std::string ephemeris_path;     // ephemeris= ephemeris file (euler)
+};
+
+// Throws std::invalid_argument naming the line of the first bad field
+std::vector<Scenario> parseScenarios(const std::string& text);
+std::vector<Scenario> readScenarios(const std::string& path);
+
+// Relative cost of a run: bodies squared times steps (roughly the number of pairwise forces)
+double estimatedCost(const Scenario& scenario);
+
+
+struct ScenarioResult {
+    Scenario scenario;
+    int num_threads = 0;
+    long num_steps = 0;
+    int final_bodies = 0;
+    double initial_energy = 0.0;
+    double final_energy = 0.0;
+    double runtime_ms = 0.0;
+    std::string error; // Empty if the run succeeded
+};
+
+// Run one scenario on the calling thread with num_threads OpenMP threads. Errors are caught into the result
+ScenarioResult runScenario(const Scenario& scenario, int num_threads);
+
+// Run every scenario, several at once, sharing num_cores cores between the running jobs
+// The costliest jobs start first, each taking cores in proportion to its share of the cost still to start
+// (at least one, small systems exactly one), and a job waits for a core to come free. The jobs run on a pool of at most num_cores threads
+// on_finish (optional) is called as each job finishes, one call at a time. Results are in the order of the scenarios
+std::vector<ScenarioResult> runBatch(const std::vector<Scenario>& scenarios, int num_cores,
+                                     const std::function<void(const ScenarioResult&)>& on_finish = {});
+
+// One row per run: name, generator, bodies, seed, integrator, threads, steps, final bodies, energies, relative energy error, runtime, status
+void writeResultsTable(std::ostream& out, const std::vector<ScenarioResult>& results);
+
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef closeEncounters_hpp
+#define closeEncounters_hpp
+
+#include "solarSystem.hpp"
+#include <utility>
+#include <vector>
+
+
+// Find every pair of particles closer than search_radius (returned as index pairs with first < second)
+// Uses a uniform spatial hash grid with cells of size search_radius, so only the 27 neighbouring cells are searched: O(N) expected
+std::vector<std::pair<int, int>> findClosePairs(const std::vector<std::shared_ptr<Particle>>& particle_list, double search_radius);
+
+// Merge each group of touching particles into a single body, conserving mass and momentum
+// The merged body replaces the lowest indexed particle of the group and the rest are removed from the list
+// Returns the number of particles removed
+int mergeCollisions(std::vector<std::shared_ptr<Particle>>& particle_list, const std::vector<std::pair<int, int>>& close_pairs);
+
+// Evolution of a system where bodies closer than collision_radius merge at the end of each timestep
+// Returns the total number of particles removed by merging
+int evolutionOfSystemWithCollisions(std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double total_time, double collision_radius, double epsilon = 0.0);
+
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef compactSystem_hpp
+#define compactSystem_hpp
+
+#include "particle.hpp"
+#include "memoryReport.hpp"
+#include <Eigen/Core>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+
+// Side of the cells that hold the position origins, in AU
+constexpr double default_compact_cell_size = 4.0;
+
+
+// A system of bodies stored in as few bytes per body as possible, for systems too big for a list of particles
+// State is structure of arrays: a double mass, a float position offset from the double origin of the body's cell,
+// a double (or optionally float) velocity and the body's index in the original order. That is 36 bytes per body
+// with float velocities and 48 with double, against about 170 for a list of particles and its force buffers
+// The acceleration is not kept: each step leases it from the scratch pool for the length of the step
+// Bodies are grouped by cell (a cube of side cell_size) and sorted again whenever one strays a cell width from its cell's origin
+class CompactSystem {
+    public:
+        using BodyVisitor = std::function<void(int index, const Particle& body)>;
+        // Calls the visitor for every body in order, with the same bodies on every call (e.g. RandomSystem::forEachBody)
+        using BodySource = std::function<void(const BodyVisitor& visit)>;
+
+        // Built straight from a source without a list of particles; the source is read twice
+        CompactSystem(int num_bodies, const BodySource& source, double dt, double epsilon = 0.0, bool float_velocities = false,
+                      double cell_size = default_compact_cell_size);
+        CompactSystem(const std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double epsilon = 0.0, bool float_velocities = false,
+                      double cell_size = default_compact_cell_size);
+
+        // Take num_steps timesteps (same Euler step as evolutionOfSystem)
+        void step(int num_steps = 1);
+        // Step until the simulation time reaches the given time (same loop as evolutionOfSystem)
+        void advanceTo(double time);
+
+        double totalKineticEnergy() const;
+        double totalPotentialEnergy() const;
+        double totalEnergy() const;
+
+        // Copy the state back into a list of particles in the original order. The accelerations are those of the current positions (one extra force pass)
+        void writeBack(const std::vector<std::shared_ptr<Particle>>& particle_list) const;
+
+        int getNumParticles() const;
+        int getNumCells() const;
+        int getNumRebins() const; // Times the bodies were sorted into cells again
+        double getTime() const;
+        long getStepCount() const;
+        bool hasFloatVelocities() const;
+        // Bytes held by each array of the state
+        std::vector<MemoryUsage> getMemoryUsage() const;
+
+
+    private:
+        struct Cell {
+            double origin[3]; // Centre of the cell
+            int begin;        // Bodies [begin, end) are in this cell
+            int end;
+        };
+        struct Block {        // Up to kernel_block_rows bodies of one cell, the unit of work of the force pass
+            int cell;
+            int begin;
+            int end;
+        };
+
+        void allocate();
+        // Build the cells from the bodies' cell keys, in key order
+        void buildCells(const std::vector<std::pair<std::uint64_t, int>>& key_counts);
+        void rebin();
+        std::uint64_t cellKey(double x, double y, double z) const;
+        double absolutePosition(int cell, int body, int axis) const;
+
+        template <typename Real>
+        void accelerations(Real* ax, Real* ay, Real* az) const;
+        template <typename Real>
+        void stepWith(Eigen::Matrix<Real, Eigen::Dynamic, 3>& velocity_store);
+
+        int num_particles;
+        double dt;
+        double epsilon;
+        double cell_size;
+        bool float_velocities;
+        double sim_time;
+        long step_count;
+        int num_rebins;
+
+        Eigen::VectorXd mass;
+        Eigen::MatrixX3f offset;          // Position minus the cell origin
+        Eigen::MatrixX3d velocity;        // Empty with float velocities
+        Eigen::MatrixX3f velocity_float;  // Empty with double velocities
+        Eigen::Matrix<std::uint32_t, Eigen::Dynamic, 1> body_index; // Index of each body in the original order
+        std::vector<Cell> cells;
+        std::vector<Block> blocks;
+};
+
+
+#endif
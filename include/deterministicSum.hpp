@@ -0,0 +1,38 @@
+#ifndef deterministicSum_hpp
+#define deterministicSum_hpp
+
+#include "particleArena.hpp"
+#include <algorithm>
+
+
+// Sums that give the same bits on any number of threads
+// The terms are cut into fixed blocks whatever the thread count, each block is added up in order by one thread,
+// and the block sums are combined in a fixed pairwise tree. An OpenMP reduction(+) instead adds one partial sum per thread,
+// so its rounding changes with OMP_NUM_THREADS
+
+// Block size for sums of cheap terms
+constexpr int reduction_block_size = 256;
+
+// Sum of count values in a fixed pairwise tree (rounding error grows as log(count) rather than count)
+double pairwiseSum(const double* values, int count);
+
+// Sum of block_sum(begin, end) over the blocks [0, block_size), [block_size, 2 * block_size), ... of [0, count),
+// the blocks shared over the OpenMP threads. block_sum must add its own terms in a fixed order
+template <typename BlockSum>
+double deterministicReduce(int count, int block_size, BlockSum&& block_sum) {
+    if (count <= 0) {
+        return 0.0;
+    }
+    const int num_blocks = (count + block_size - 1) / block_size;
+    ScratchPool::Lease<double> partial = scratchPool().acquire<double>(num_blocks);
+
+    #pragma omp parallel for schedule(static)
+    for (int block = 0; block < num_blocks; block++) {
+        const int begin = block * block_size;
+        partial[block] = block_sum(begin, std::min(begin + block_size, count));
+    }
+    return pairwiseSum(partial.data(), num_blocks);
+}
+
+
+#endif
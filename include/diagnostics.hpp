@@ -0,0 +1,107 @@
+#ifndef diagnostics_hpp
+#define diagnostics_hpp
+
+#include "solarSystem.hpp"
+#include <Eigen/Geometry>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Conserved quantities of the system at one sampled step
+struct Diagnostics {
+    long step;
+    double time;
+    double kinetic;
+    double potential;
+    double total;
+    Eigen::Vector3d momentum;
+    Eigen::Vector3d angular_momentum; // About the origin
+    Eigen::Vector3d centre_of_mass;
+};
+
+// What sample does when every snapshot buffer is still waiting for a worker
+enum class DiagnosticsOverflow {
+    Block, // Wait for a buffer to come free: every sample is kept, the integration slows down to the speed of the workers
+    Skip   // Drop the sample: the integration never waits, the time series gets gaps
+};
+
+
+// Computes diagnostics on worker threads while the integration keeps stepping
+// sample only copies masses, positions and velocities into a free snapshot buffer and queues it; the workers compute
+// the diagnostics of queued snapshots (the potential energy being O(N^2)) and hand the buffer back. There are
+// num_buffers buffers, so at most that many samples are ever in flight, and a slow worker pushes back on the integration
+// (Block) or loses samples (Skip) instead of queueing copies without bound
+// Results are written to the log in step order whatever order the workers finish in, as CSV:
+//   step,time,kinetic,potential,total,relative_energy_error,px,py,pz,lx,ly,lz,comx,comy,comz
+// with the energy error relative to the first sample. The energies are the same sums as totalKineticEnergy and totalPotentialEnergy
+class DiagnosticsPipeline {
+    public:
+        // An empty log_path keeps the series in memory only
+        DiagnosticsPipeline(const std::string& log_path, int num_bodies, int num_buffers = 2,
+                            DiagnosticsOverflow overflow = DiagnosticsOverflow::Block, int num_workers = 1);
+        ~DiagnosticsPipeline(); // Calls finish
+
+        DiagnosticsPipeline(const DiagnosticsPipeline&) = delete;
+        DiagnosticsPipeline& operator=(const DiagnosticsPipeline&) = delete;
+
+        // Copy the state into a snapshot buffer and queue it for the workers
+        void sample(long step, double sim_time, const std::vector<std::shared_ptr<Particle>>& particle_list);
+
+        // Observer for evolutionOfSystem that samples every steps_per_sample steps
+        StepObserver observer(int steps_per_sample = 1);
+
+        // Wait for every queued sample to be written, then stop the workers. Later samples are ignored
+        void finish();
+
+        // Results so far, in step order (complete after finish)
+        std::vector<Diagnostics> getSeries() const;
+        long getNumSamples() const; // Samples queued
+        long getNumSkipped() const; // Samples dropped because no buffer was free (Skip only)
+        double getStallSeconds() const; // Time sample spent waiting for a free buffer (Block only)
+
+
+    private:
+        struct Snapshot {
+            long sequence;
+            long step;
+            double time;
+            std::vector<double> mass, x, y, z, vx, vy, vz;
+        };
+
+        void run();
+        Diagnostics compute(const Snapshot& snapshot) const;
+        void publish(long sequence, const Diagnostics& result); // Write out every result that is next in sequence
+
+        int num_bodies;
+        DiagnosticsOverflow overflow;
+        std::ofstream log;
+
+        std::vector<Snapshot> buffers;
+        mutable std::mutex queue_mutex;
+        std::condition_variable buffer_freed;
+        std::condition_variable snapshot_queued;
+        std::vector<Snapshot*> free_buffers;
+        std::deque<Snapshot*> queued;
+        bool stopping;
+        long num_samples;
+        long num_skipped;
+        double stall_seconds;
+
+        mutable std::mutex result_mutex;
+        std::map<long, Diagnostics> waiting; // Finished out of order, waiting for earlier samples
+        long next_sequence;                  // Sequence of the next result to be written
+        double initial_energy;
+        std::vector<Diagnostics> series;
+
+        std::vector<std::thread> workers;
+};
+
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef distributed_hpp
+#define distributed_hpp
+
+// Only available when built with -DNBODY_ENABLE_MPI=ON
+#ifdef NBODY_WITH_MPI
+
+#include "particle.hpp"
+#include <Eigen/Core>
+#include <cstdint>
+#include <mpi.h>
+#include <utility>
+#include <vector>
+
+
+// Morton (Z-order) key of a position inside a bounding box, 21 bits per axis
+std::uint64_t mortonKey(const Eigen::Vector3d& position, const Eigen::Vector3d& box_min, const Eigen::Vector3d& box_max);
+
+
+// A system of bodies spread over the ranks of an MPI communicator
+// The bodies are sorted along a Morton space filling curve and cut into equal contiguous pieces, one per rank,
+// so each rank holds a compact region of space. Forces are direct sums: the source blocks travel round the ranks in a ring
+// (systolic exchange), each block being sent on while the forces from it are computed
+// The step is the same Euler step as evolutionOfSystem
+class DistributedSystem {
+    public:
+        // Collective. The bodies are taken from root_particles on rank 0 (the other ranks pass an empty list)
+        DistributedSystem(MPI_Comm comm, const std::vector<std::shared_ptr<Particle>>& root_particles, double epsilon = 0.0);
+
+        // Collective
+        void step(double dt);
+        void evolve(double dt, double total_time); // Same loop as evolutionOfSystem
+
+        // Collective, every rank gets the energy of the whole system
+        double totalKineticEnergy() const;
+        double totalPotentialEnergy();
+        double totalEnergy();
+
+        // Collective. On rank 0, every body in its original order; empty on the other ranks
+        std::vector<std::shared_ptr<Particle>> gather() const;
+
+        int getRank() const;
+        int getNumRanks() const;
+        int getNumLocal() const;
+        long getNumGlobal() const;
+        const std::vector<long>& getLocalIds() const; // Original index of each local body
+        std::pair<std::uint64_t, std::uint64_t> getLocalKeyRange() const; // Smallest and largest Morton key held here
+        const Eigen::MatrixX3d& getLocalPositions() const;
+
+
+    private:
+        // Pass the source blocks round the ring, calling interact(block, sources_are_local) for each
+        template <typename Interact>
+        void ringPass(Interact&& interact);
+
+        MPI_Comm comm;
+        int rank;
+        int num_ranks;
+        long num_global;
+        double epsilon;
+
+        std::vector<long> ids;
+        std::vector<std::uint64_t> keys;
+        Eigen::VectorXd mass;
+        Eigen::MatrixX3d position;
+        Eigen::MatrixX3d velocity;
+        Eigen::MatrixX3d acceleration;
+
+        // Source blocks for the ring: count, then x, y, z and mass each padded to max_local
+        int max_local;
+        std::vector<double> current_block;
+        std::vector<double> next_block;
+};
+
+
+#endif
+#endif
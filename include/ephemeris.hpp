@@ -0,0 +1,82 @@
+#ifndef ephemeris_hpp
+#define ephemeris_hpp
+
+#include "solarSystem.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Dense output of a run: the states recorded at times t_0 < t_1 < ... < t_n are joined by cubic Hermite segments,
+// one per body and axis, matching the recorded position and velocity at both ends of every segment
+// On segment k with h = t_{k+1} - t_k and s = (t - t_k) / h in [0, 1]:
+//   position(s) = a + b s + c s^2 + d s^3
+//
+// File layout: EphemerisFileHeader | times (num_segments + 1 doubles) | coefficients
+//   coefficients = for each segment, for each body, for each axis: a, b, c, d
+
+constexpr char ephemeris_magic[8] = {'N', 'B', 'E', 'P', 'H', '0', '0', '1'};
+
+struct EphemerisFileHeader {
+    char magic[8];
+    std::uint64_t num_bodies;
+    std::uint64_t num_segments;
+};
+
+
+class Ephemeris {
+    public:
+        Ephemeris(int num_bodies, std::vector<double> times, std::vector<double> coefficients);
+        explicit Ephemeris(const std::string& path); // Load a file written by save
+
+        // State of a body at any time between getStartTime and getEndTime, found by binary search over the segments
+        Eigen::Vector3d position(int body, double time) const;
+        Eigen::Vector3d velocity(int body, double time) const;
+
+        void save(const std::string& path) const;
+
+        int getNumBodies() const;
+        std::size_t getNumSegments() const;
+        double getStartTime() const;
+        double getEndTime() const;
+
+
+    private:
+        // Segment containing the time, and the fraction s of the way through it
+        std::size_t findSegment(double time, double& s) const;
+        const double* segmentCoefficients(std::size_t segment, int body) const;
+
+        int num_bodies;
+        std::vector<double> times;
+        std::vector<double> coefficients;
+};
+
+
+
+// Builds an ephemeris from states recorded during a run
+// Record the initial state before the run, then pass observer() to evolutionOfSystem
+class EphemerisRecorder {
+    public:
+        explicit EphemerisRecorder(int num_bodies);
+
+        // Add a sample, closing the segment from the previous one. Times must increase
+        void record(double time, const std::vector<std::shared_ptr<Particle>>& particle_list);
+
+        // Observer for evolutionOfSystem that records every steps_per_sample steps
+        StepObserver observer(int steps_per_sample = 1);
+
+        std::size_t getNumSegments() const;
+
+        // Needs at least two samples
+        Ephemeris build() const;
+
+
+    private:
+        int num_bodies;
+        std::vector<double> times;
+        std::vector<double> coefficients;
+        std::vector<double> previous_state; // Position and velocity of each body at the last sample
+};
+
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef forceKernels_hpp
+#define forceKernels_hpp
+
+#include "particle.hpp"
+#include "forceLaw.hpp"
+#include <string>
+#include <vector>
+
+
+// Arithmetic used for the pairwise interactions of the direct force calculation
+enum class ForcePrecision {
+    Double, // Everything in double precision (same as sumAccelerations)
+    Mixed   // Float pairwise arithmetic on positions relative to a local origin, double accumulation
+};
+
+// Convert "double"/"mixed" to a ForcePrecision (throws for anything else)
+ForcePrecision parseForcePrecision(const std::string& name);
+
+// Accelerations of every particle due to all the others, written into acc_out (resized to the number of particles)
+// Laws other than Plummer run on the structure of arrays kernels and need double precision (throws otherwise)
+void computeAccelerations(const std::vector<std::shared_ptr<Particle>>& particle_list, std::vector<Eigen::Vector3d>& acc_out,
+                          double epsilon = 0.0, ForcePrecision precision = ForcePrecision::Double, ForceLaw law = ForceLaw::Plummer);
+
+// Direct summation in double precision with Plummer softening on structure of arrays data
+// Writes the acceleration of every particle due to all the others into ax, ay, az without allocating
+void directAccelerations(int num_particles, const double* x, const double* y, const double* z, const double* mass, double epsilon,
+                         double* ax, double* ay, double* az);
+// Same, called from inside an existing OpenMP parallel region: the rows are shared out over its threads with a static schedule
+// (the same split as the parallel loops over particles elsewhere, so each thread works on the rows it first touched)
+void directAccelerationsWorkshare(int num_particles, const double* x, const double* y, const double* z, const double* mass, double epsilon,
+                                  double* ax, double* ay, double* az);
+
+
+#endif
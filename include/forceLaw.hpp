@@ -0,0 +1,28 @@
+#ifndef forceLaw_hpp
+#define forceLaw_hpp
+
+#include <string>
+
+
+// Law of the pairwise gravitational force. Each law has its own copy of the double precision force kernel
+// (a template instance in isaKernels.cpp), picked once per force pass, so the inner loop never branches on the law
+enum class ForceLaw {
+    Plummer,       // m d / (r^2 + epsilon^2)^(3/2), the default
+    Spline,        // Monaghan cubic spline softening: smooth inside spline_kernel_radius * epsilon, exactly Newtonian outside
+    Newtonian,     // m d / r^3, epsilon is ignored
+    PostNewtonian  // Newtonian plus the first post-Newtonian (1PN) correction, e.g. for the perihelion shift of Mercury
+};
+constexpr int num_force_laws = 4;
+
+// Convert "plummer"/"spline"/"newtonian"/"post-newtonian" to a ForceLaw (throws for anything else)
+ForceLaw parseForceLaw(const std::string& name);
+std::string forceLawName(ForceLaw law);
+
+// Kernel radius of the spline softening in units of epsilon, so that it matches Plummer softening of epsilon far away
+constexpr double spline_kernel_radius = 2.8;
+
+// Speed of light in simulation units (AU per year / 2 pi, with G = 1 and one solar mass = 1)
+constexpr double speed_of_light = 10065.3201;
+
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef frameServer_hpp
+#define frameServer_hpp
+
+#include "solarSystem.hpp"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Wire protocol of the frame server, all values in host byte order (the socket is local)
+//
+// A client connects and sends one SubscriptionRequest followed by num_bodies uint32 body indices (none means every body)
+// The server then sends one message per frame: a FrameMessageHeader followed by, for every subscribed body in the order asked for,
+// the requested fields in the order position (3 doubles), velocity (3 doubles), acceleration (3 doubles), mass (1 double)
+// An invalid request closes the connection
+
+constexpr std::uint32_t frame_server_magic = 0x4E42534Bu; // "NBSK"
+
+enum FrameField : std::uint32_t {
+    field_position = 1,
+    field_velocity = 2,
+    field_acceleration = 4,
+    field_mass = 8
+};
+
+struct SubscriptionRequest {
+    std::uint32_t magic;
+    std::uint32_t decimation; // Send every decimation-th frame, at least 1
+    std::uint32_t field_mask; // FrameField bits, at least one
+    std::uint32_t num_bodies;
+};
+
+struct FrameMessageHeader {
+    std::uint32_t magic;
+    std::uint32_t field_mask;
+    std::uint32_t num_bodies;
+    std::uint32_t padding;
+    std::int64_t step;
+    double time;
+};
+
+// Number of doubles sent per body for a field mask
+int doublesPerBody(std::uint32_t field_mask);
+
+
+
+// Serves frames over a Unix domain socket from its own thread, using epoll
+// The integration thread only copies each frame into a queue; encoding, filtering and sending happen on the server thread
+// If the server thread falls behind, the oldest queued frames are dropped; a client that reads too slowly loses frames instead of
+// slowing anything else down
+class FrameServer {
+    public:
+        FrameServer(const std::string& socket_path, int num_bodies, std::size_t max_queued_frames = 64);
+        ~FrameServer(); // Sends what is already queued, then closes every connection and removes the socket file
+
+        FrameServer(const FrameServer&) = delete;
+        FrameServer& operator=(const FrameServer&) = delete;
+
+        // Queue a copy of the bodies for the server thread. Never waits for clients
+        void publish(long step, double sim_time, const std::vector<std::shared_ptr<Particle>>& particle_list);
+
+        // Observer for evolutionOfSystem that publishes every steps_per_frame steps
+        StepObserver observer(int steps_per_frame = 1);
+
+        int getNumSubscribers() const;
+        std::uint64_t getFramesPublished() const;
+        std::uint64_t getFramesDropped() const;
+
+
+    private:
+        struct QueuedFrame {
+            std::int64_t step;
+            double time;
+            std::vector<double> state; // Per body: position, velocity, acceleration, mass
+        };
+
+        struct Client {
+            int fd;
+            std::vector<char> request; // Bytes of the subscription request received so far
+            bool subscribed = false;
+            std::uint32_t decimation = 1;
+            std::uint32_t field_mask = 0;
+            std::vector<std::uint32_t> bodies;
+            std::uint64_t frames_seen = 0;
+            std::vector<char> outgoing; // Encoded frames waiting to be sent
+            std::size_t sent = 0; // Bytes of outgoing already sent
+            bool want_write = false;
+        };
+
+        void run();
+        void acceptClients();
+        bool readRequest(Client& client); // false if the client has to be closed
+        void encodeFrame(Client& client, const QueuedFrame& frame);
+        bool flush(Client& client); // false if the client has to be closed
+        void watchWrites(Client& client, bool enable);
+        void closeClient(std::size_t index);
+        void drainQueue();
+
+        std::string socket_path;
+        int num_bodies;
+        std::size_t max_queued_frames;
+
+        int listen_fd;
+        int epoll_fd;
+        int wake_fd; // eventfd the integration thread signals when it queues a frame
+
+        std::mutex queue_mutex;
+        std::deque<QueuedFrame> queue;
+        std::vector<QueuedFrame> spare_frames; // Recycled so publishing does not allocate once warmed up
+        std::vector<QueuedFrame> draining; // Owned by the server thread
+
+        std::vector<Client> clients; // Owned by the server thread
+        std::atomic<int> num_subscribers;
+        std::atomic<std::uint64_t> frames_published;
+        std::atomic<std::uint64_t> frames_dropped;
+        std::atomic<bool> stopping;
+        std::thread server_thread;
+};
+
+
+#endif
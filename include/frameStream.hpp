@@ -0,0 +1,96 @@
+#ifndef frameStream_hpp
+#define frameStream_hpp
+
+#include "simulation.hpp"
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <utility>
+
+
+// Owned copy of the state at one frame, for consumers that keep frames
+struct Frame {
+    long step;
+    double time;
+    Eigen::MatrixX3d positions;
+    Eigen::MatrixX3d velocities;
+};
+
+// Read-only view of the simulation at one frame
+// Nothing is copied: the view refers to the live simulation and is only valid until the stream is pulled again
+struct FrameView {
+    long step = 0;
+    double time = 0.0;
+    const Simulation* simulation = nullptr;
+
+    const Eigen::MatrixX3d& positions() const { return simulation->getPositions(); }
+    const Eigen::MatrixX3d& velocities() const { return simulation->getVelocities(); }
+    const Eigen::VectorXd& masses() const { return simulation->getMasses(); }
+
+    // Copy the state only when the consumer asks for it
+    Frame copy() const { return Frame{step, time, positions(), velocities()}; }
+};
+
+
+
+// Lazy stream of frames from a coroutine
+// The simulation only steps when the consumer pulls the next frame, so stopping early skips the rest of the run
+class FrameStream {
+    public:
+        struct promise_type {
+            FrameView current;
+            std::exception_ptr exception;
+
+            FrameStream get_return_object() { return FrameStream(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            std::suspend_always yield_value(const FrameView& frame) noexcept { current = frame; return {}; }
+            void return_void() {}
+            void unhandled_exception() { exception = std::current_exception(); }
+        };
+
+        // Input iterator so a stream can be used in a range based for loop
+        class iterator {
+            public:
+                using iterator_category = std::input_iterator_tag;
+                using value_type = FrameView;
+                using difference_type = std::ptrdiff_t;
+
+                explicit iterator(FrameStream* in_stream) : stream{in_stream} {}
+                const FrameView& operator*() const { return stream->current(); }
+                const FrameView* operator->() const { return &stream->current(); }
+                iterator& operator++() { if (!stream->next()) { stream = nullptr; } return *this; }
+                void operator++(int) { ++*this; }
+                bool operator==(std::default_sentinel_t) const { return stream == nullptr; }
+
+            private:
+                FrameStream* stream;
+        };
+
+        explicit FrameStream(std::coroutine_handle<promise_type> in_handle) : handle{in_handle} {}
+        FrameStream(FrameStream&& other) noexcept : handle{std::exchange(other.handle, nullptr)} {}
+        FrameStream(const FrameStream&) = delete;
+        FrameStream& operator=(const FrameStream&) = delete;
+        FrameStream& operator=(FrameStream&&) = delete;
+        ~FrameStream() { if (handle) { handle.destroy(); } }
+
+        // Compute the next frame. Returns false when the stream has finished
+        bool next();
+        const FrameView& current() const { return handle.promise().current; }
+
+        iterator begin() { return next() ? iterator(this) : iterator(nullptr); }
+        std::default_sentinel_t end() { return {}; }
+
+    private:
+        std::coroutine_handle<promise_type> handle;
+};
+
+
+// Frame of the current state, then a frame every steps_per_frame steps until the simulation time reaches end_time
+FrameStream streamFrames(Simulation& simulation, int steps_per_frame, double end_time);
+
+// A frame at each requested time (in increasing order). Each frame is taken at the first step that reaches the time
+FrameStream streamFramesAtTimes(Simulation& simulation, std::vector<double> times);
+
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef initialConditionCache_hpp
+#define initialConditionCache_hpp
+
+#include "particle.hpp"
+#include "particleArena.hpp"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// A generated system saved on disk, named by a hash of the parameters that generated it (content addressed),
+// so a sweep that reuses the same configuration generates it once and afterwards only maps the file
+// Each body is stored as 10 doubles: mass, position, velocity, acceleration
+
+constexpr int initial_condition_doubles_per_body = 10;
+
+// Offset in bytes of the first body of a file read or mapped into memory, setting num_bodies, or 0 if it is not a complete file in this format
+std::size_t initialConditionDataOffset(const void* file, std::size_t file_bytes, std::size_t& num_bodies);
+// The parameters a file was saved with (only for a file initialConditionDataOffset accepts)
+std::string initialConditionParameters(const void* file);
+
+// 64-bit FNV-1a hash of the parameters as 16 hex digits
+std::string initialConditionKey(const std::string& parameters);
+// directory/ic-<key>.bin
+std::string initialConditionPath(const std::string& directory, const std::string& parameters);
+
+
+// A read-only memory mapping of a cached system
+class MappedInitialConditions {
+    public:
+        // nullptr if there is no file, or it is not a complete cache file for exactly these parameters
+        static std::shared_ptr<const MappedInitialConditions> open(const std::string& path, const std::string& parameters);
+        ~MappedInitialConditions();
+
+        MappedInitialConditions(const MappedInitialConditions&) = delete;
+        MappedInitialConditions& operator=(const MappedInitialConditions&) = delete;
+
+        // Construct the bodies in a new arena, in parallel straight from the mapping
+        std::vector<std::shared_ptr<Particle>> instantiate(std::shared_ptr<ParticleArena>& arena) const;
+        // Overwrite the bodies of an earlier instantiate with the cached ones, without allocating
+        void reset(const std::vector<std::shared_ptr<Particle>>& particle_list) const;
+
+        std::size_t getNumBodies() const;
+        std::size_t getFileBytes() const;
+
+
+    private:
+        MappedInitialConditions(void* mapping, std::size_t file_bytes, const double* bodies, std::size_t num_bodies);
+
+        void* mapping;
+        std::size_t file_bytes;
+        const double* bodies;
+        std::size_t num_bodies;
+};
+
+
+// Write the bodies as the cache file for these parameters, creating the directory if needed
+// The file is written under a temporary name and renamed into place, so concurrent runs never see half a file
+void saveInitialConditions(const std::string& path, const std::string& parameters, const std::vector<std::shared_ptr<Particle>>& particle_list);
+
+// Calls visit(i, body) for every body in order, e.g. RandomSystem::forEachBody
+using InitialConditionSource = std::function<void(const std::function<void(int index, const Particle& body)>& visit)>;
+// The same, but written a block of bodies at a time as the source produces them, so the system never has to fit in memory
+// Throws if the source does not produce exactly num_bodies bodies
+void saveInitialConditions(const std::string& path, const std::string& parameters, long num_bodies, const InitialConditionSource& source);
+
+
+#endif
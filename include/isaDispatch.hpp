@@ -0,0 +1,68 @@
+#ifndef isaDispatch_hpp
+#define isaDispatch_hpp
+
+#include "forceLaw.hpp"
+#include <string>
+
+
+// Instruction set levels the hot kernels are compiled for, in increasing order
+enum class IsaLevel {
+    Baseline, // Plain x86-64 (SSE2), or whatever the target is off x86
+    SSE42,
+    AVX2,     // With FMA
+    AVX512    // F, DQ, BW and VL
+};
+
+// Convert "baseline"/"sse4.2"/"avx2"/"avx512" to an IsaLevel (throws for anything else)
+IsaLevel parseIsaLevel(const std::string& name);
+std::string isaLevelName(IsaLevel level);
+
+// Best level both this CPU (and its operating system) and this build support
+IsaLevel detectIsaLevel();
+
+
+// The structure of arrays kernels, one copy per instruction set level
+// Each works on the rows [begin, end) so callers split the rows over threads as they like
+struct IsaKernels {
+    // Direct summation in double precision: acceleration of each row due to every one of the num_particles sources
+    // One instance per force law, accelerationRows[static_cast<int>(law)]. Only the post-Newtonian law reads vx, vy, vz (others take nullptr)
+    void (*accelerationRows[num_force_laws])(int begin, int end, int num_particles, const double* x, const double* y, const double* z,
+                                             const double* vx, const double* vy, const double* vz, const double* mass, double epsilon,
+                                             double* ax, double* ay, double* az);
+    // Float pairwise arithmetic on separations taken in double from the row, sources summed in float in tiles, tiles in double
+    void (*mixedAccelerationRows)(int begin, int end, int num_particles, const double* x, const double* y, const double* z, const float* mass,
+                                  float epsilon_squared, double* ax, double* ay, double* az);
+    // Plummer softened acceleration of the rows [begin, end) of one cell due to the sources [source_begin, source_end) of one cell,
+    // added to ax, ay, az (indexed from begin). Positions are float offsets from the cell origins, shift is the source origin minus the row origin
+    void (*compactAccelerationRows)(int begin, int end, int source_begin, int source_end, const float* x, const float* y, const float* z,
+                                    const double* mass, double shift_x, double shift_y, double shift_z, double epsilon,
+                                    double* ax, double* ay, double* az);
+    // Plummer softened acceleration of the rows [begin, end) of a target block due to one tile of num_sources sources in separate arrays,
+    // added to ax, ay, az (indexed like the rows). Source j is row i itself when j == i + diagonal (out of range when the two do not overlap)
+    void (*tileAccelerationRows)(int begin, int end, const double* row_x, const double* row_y, const double* row_z, int num_sources,
+                                 const double* x, const double* y, const double* z, const double* mass, long diagonal, double epsilon,
+                                 double* ax, double* ay, double* az);
+    // Euler step: position += dt * velocity, then velocity += dt * acceleration
+    void (*eulerUpdateRows)(int begin, int end, double dt, double* x, double* y, double* z, double* vx, double* vy, double* vz,
+                            const double* ax, const double* ay, const double* az);
+    // Sum of m_i * m_j / r_ij over the rows i and every other body j
+    double (*potentialRows)(int begin, int end, int num_particles, const double* x, const double* y, const double* z, const double* mass);
+    // The same sum over the rows of a target block and one tile of sources, the pairs j == i + diagonal left out
+    double (*tilePotentialRows)(int begin, int end, const double* row_x, const double* row_y, const double* row_z, const double* row_mass,
+                                int num_sources, const double* x, const double* y, const double* z, const double* mass, long diagonal);
+};
+
+// Rows per block when the kernels are shared out with an OpenMP loop
+constexpr int kernel_block_rows = 64;
+
+// The kernels of the active level, detectIsaLevel() unless changed with setIsaLevel
+const IsaKernels& isaKernels();
+IsaLevel activeIsaLevel();
+// Use a lower level (for comparisons, or to match other nodes). Throws if the CPU or the build does not support it
+// Not thread safe: call before any simulation runs
+void setIsaLevel(IsaLevel level);
+// e.g. "avx512 (best available avx512)", for the run summary
+std::string isaReport();
+
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef memoryReport_hpp
+#define memoryReport_hpp
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+// Memory held by one part of a run, for the memory report in the run summary
+struct MemoryUsage {
+    std::string subsystem;
+    std::size_t bytes;
+};
+
+// e.g. "1.5 GiB"
+std::string formatBytes(double bytes);
+
+// One line per subsystem with its size and bytes per body, then the total and the peak resident size of the process
+std::string formatMemoryReport(const std::vector<MemoryUsage>& usage, long num_bodies);
+
+// Largest resident set size the process has reached so far (0 where the system does not tell)
+std::size_t peakResidentBytes();
+
+
+#endif
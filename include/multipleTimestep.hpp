@@ -0,0 +1,22 @@
+#ifndef multipleTimestep_hpp
+#define multipleTimestep_hpp
+
+#include "solarSystem.hpp"
+
+
+// Force splitting for star dominated systems. The first particle in the list is the central star (as built by celestialBody)
+// Fast term: every interaction involving the star, O(N)
+// Slow term: the mutual body-body perturbations, O(N^2)
+
+// Accelerations from the fast (star-body) term only
+void starAccelerations(const std::vector<std::shared_ptr<Particle>>& particle_list, std::vector<Eigen::Vector3d>& acc_out, double epsilon = 0.0);
+
+// Accelerations from the slow (body-body, star excluded) term only
+void perturbationAccelerations(const std::vector<std::shared_ptr<Particle>>& particle_list, std::vector<Eigen::Vector3d>& acc_out, double epsilon = 0.0);
+
+// RESPA style multiple time-stepping: the perturbations kick the bodies once per timestep dt
+// while the star-body term is integrated with `substeps` leapfrog steps of dt/substeps in between
+void evolutionOfSystemMultiStep(const std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double total_time, int substeps, double epsilon = 0.0);
+
+
+#endif
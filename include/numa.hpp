@@ -0,0 +1,49 @@
+#ifndef numa_hpp
+#define numa_hpp
+
+#include <string>
+#include <vector>
+
+
+// NUMA nodes of the machine and the CPUs that belong to each, read once from /sys/devices/system/node
+// Machines without that information are treated as a single node holding every CPU the process may run on
+struct NumaTopology {
+    std::vector<std::vector<int>> node_cpus;
+    std::vector<int> cpu_node; // Node of each CPU number, -1 for CPUs the process cannot use (counted as node 0)
+
+    int getNumNodes() const { return node_cpus.size(); }
+    int nodeOfCpu(int cpu) const { return (cpu >= 0 && cpu < static_cast<int>(cpu_node.size()) && cpu_node[cpu] >= 0) ? cpu_node[cpu] : 0; }
+};
+
+const NumaTopology& numaTopology();
+
+
+// How OpenMP threads are placed on CPUs
+//   None:    threads may run on any CPU the process was started with
+//   Compact: thread t on the t-th CPU, filling one node before the next (threads that share data share a node)
+//   Spread:  threads dealt out across the nodes in turn (uses the memory bandwidth of every node)
+enum class ThreadAffinity {
+    None,
+    Compact,
+    Spread
+};
+
+// Parse "none", "compact" or "spread" (throws std::invalid_argument otherwise)
+ThreadAffinity parseThreadAffinity(const std::string& name);
+std::string threadAffinityName(ThreadAffinity affinity);
+
+// Pin every thread of the OpenMP pool according to the affinity. The pool keeps its threads, so the pinning holds for later parallel regions
+// Returns the CPU of each thread (-1 for every thread with None)
+std::vector<int> pinThreads(ThreadAffinity affinity);
+
+// NUMA node each OpenMP thread is currently running on
+std::vector<int> threadNodes();
+
+// NUMA node holding the page of an address, -1 if the page is not placed yet or the kernel cannot tell
+int numaNodeOfAddress(const void* address);
+
+// One line summary for the run output, e.g. "2 NUMA nodes, 64 threads, affinity spread"
+std::string affinityReport();
+
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef outOfCore_hpp
+#define outOfCore_hpp
+
+#include "initialConditionCache.hpp"
+#include "memoryReport.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Bodies per source tile streamed through the force and energy passes (1.25 MiB of the file)
+constexpr int default_source_tile_bodies = 16384;
+// Bodies per target block held in memory during a force pass (56 bytes each, so 56 MiB)
+constexpr int default_target_block_bodies = 1 << 20;
+
+
+// Direct summation for systems bigger than memory, on a state file in the initial condition cache format (see initialConditionCache.hpp)
+// mapped read-write and evolved in place, so the file holds the latest state at every step
+// A force pass copies one target block of positions into memory and streams every source tile of the file past it,
+// asking the kernel to read the next tile ahead (madvise WILLNEED) while the current one is computed. The accelerations of the block
+// are written into the file before the next block, then a second sequential pass takes the Euler step in place
+// The file is read ceil(N / target_block_bodies) times per force pass, so the target block should be as big as memory allows
+// Only the pages being worked on need to stay resident: the page cache writes back and drops the rest as memory runs short
+// Plummer softening only, with the same Euler step as evolutionOfSystem
+class OutOfCoreSystem {
+    public:
+        // Open a state file, e.g. a copy of an initial condition file (throws if it is not a complete file in that format)
+        OutOfCoreSystem(const std::string& path, double dt, double epsilon = 0.0, int target_block_bodies = default_target_block_bodies,
+                        int source_tile_bodies = default_source_tile_bodies);
+        ~OutOfCoreSystem(); // Writes the state back to the file and unmaps it
+
+        OutOfCoreSystem(const OutOfCoreSystem&) = delete;
+        OutOfCoreSystem& operator=(const OutOfCoreSystem&) = delete;
+
+        // Take num_steps timesteps
+        void step(int num_steps = 1);
+        // Step until the simulation time reaches the given time (same loop as evolutionOfSystem)
+        void advanceTo(double time);
+
+        double totalKineticEnergy() const;
+        double totalPotentialEnergy() const;
+        double totalEnergy() const;
+
+        // Wait until the file holds the current state
+        void sync() const;
+
+        long getNumParticles() const;
+        double getTime() const;
+        long getStepCount() const;
+        std::string getParameters() const; // What the file was saved with
+        std::size_t getFileBytes() const;
+        std::uint64_t getBytesStreamed() const; // Bytes of source tiles read by the force and energy passes so far
+        // Bytes of the target block and source tile buffers (the file itself is not counted)
+        std::vector<MemoryUsage> getMemoryUsage() const;
+
+
+    private:
+        double* body(long index) const; // The 10 doubles of a body in the mapping
+        // Copy the positions (and masses) of the bodies [begin, begin + count) into structure of arrays buffers
+        void gather(long begin, int count, double* x, double* y, double* z, double* mass) const;
+        // Call pass(source_begin, count) for every source tile in order, with the tile gathered into the tile buffers
+        template <typename TilePass>
+        void forEachSourceTile(TilePass&& pass) const;
+        void computeAccelerations();
+
+        std::string path;
+        double dt;
+        double epsilon;
+        int target_block_bodies;
+        int source_tile_bodies;
+        double sim_time;
+        long step_count;
+
+        void* mapping;
+        std::size_t file_bytes;
+        double* bodies;
+        long num_particles;
+        mutable std::uint64_t bytes_streamed;
+
+        // Target block: positions, masses (energy pass) and accelerations
+        mutable std::vector<double> target_x, target_y, target_z, target_mass, target_ax, target_ay, target_az;
+        // The source tile being computed
+        mutable std::vector<double> tile_x, tile_y, tile_z, tile_mass;
+};
+
+
+#endif
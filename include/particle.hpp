@@ -8,14 +8,18 @@ class Particle {
     public:
         Particle(double in_mass, Eigen::Vector3d& in_pos, Eigen::Vector3d& in_vel, Eigen::Vector3d& in_acc); 
 
-        Eigen::Vector3d getPosition() const;
-        Eigen::Vector3d getVelocity() const;
-        Eigen::Vector3d getAcceleration() const;
+        const Eigen::Vector3d& getPosition() const;
+        const Eigen::Vector3d& getVelocity() const;
+        const Eigen::Vector3d& getAcceleration() const;
         double getMass() const;
 
         void updateAcceleration(Eigen::Vector3d& acc);
         // Update position and velocity
         void update(double dt);
+        // Update velocity only, using the given acceleration (for split-force integrators)
+        void kick(double dt, const Eigen::Vector3d& acc);
+        // Update position only
+        void drift(double dt);
 
 
 
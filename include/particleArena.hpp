@@ -0,0 +1,126 @@
+#ifndef particleArena_hpp
+#define particleArena_hpp
+
+#include "particle.hpp"
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+
+// Contiguous storage for a fixed number of particles, allocated in one block
+// Particles are handed out as shared_ptrs that share ownership of the whole arena (aliasing constructor),
+// so there is no per-particle allocation or control block and the arena lives until the last particle is released
+class ParticleArena : public std::enable_shared_from_this<ParticleArena> {
+    public:
+        static std::shared_ptr<ParticleArena> create(std::size_t capacity);
+        ~ParticleArena();
+
+        ParticleArena(const ParticleArena&) = delete;
+        ParticleArena& operator=(const ParticleArena&) = delete;
+
+        // Construct the next particle in the arena (throws when the arena is full)
+        std::shared_ptr<Particle> emplace(const Particle& particle);
+        // Construct the next count particles at once, particle i being make(i), in parallel with the same static split as the first touch
+        // Returns their handles in order (throws if they do not fit)
+        template <typename Make>
+        std::vector<std::shared_ptr<Particle>> emplaceMany(std::size_t count, Make&& make) {
+            reserveSlots(count);
+            Particle* first = storage + size;
+            const long num_new = count;
+
+            #pragma omp parallel for schedule(static)
+            for (long i = 0; i < num_new; i++) {
+                new (first + i) Particle(make(i));
+            }
+            size += count;
+
+            std::vector<std::shared_ptr<Particle>> handles;
+            handles.reserve(count);
+            std::shared_ptr<ParticleArena> owner = shared_from_this();
+            for (std::size_t i = 0; i < count; i++) {
+                handles.emplace_back(owner, first + i);
+            }
+            return handles;
+        }
+
+        std::size_t getSize() const;
+        std::size_t getCapacity() const;
+        std::size_t getBytesReserved() const;
+
+
+    private:
+        explicit ParticleArena(std::size_t capacity);
+        void reserveSlots(std::size_t count) const; // Throws unless count more particles fit
+
+        Particle* storage;
+        std::size_t capacity;
+        std::size_t size;
+};
+
+
+
+
+// Pool of reusable scratch buffers for the force and energy passes
+// A buffer is leased for the length of a pass and returned to the pool afterwards, so repeated passes stop allocating once the buffers have grown
+class ScratchPool {
+    public:
+        // Buffer of count elements of an arithmetic type, returned to the pool when the lease is destroyed
+        template <typename T>
+        class Lease {
+            public:
+                Lease(ScratchPool& in_pool, std::size_t in_block, T* in_data, std::size_t in_count) :
+                    pool{&in_pool}, block{in_block}, ptr{in_data}, count{in_count} {}
+                ~Lease() { if (pool) { pool->release(block); } }
+
+                Lease(Lease&& other) noexcept : pool{other.pool}, block{other.block}, ptr{other.ptr}, count{other.count} { other.pool = nullptr; }
+                Lease(const Lease&) = delete;
+                Lease& operator=(const Lease&) = delete;
+                Lease& operator=(Lease&&) = delete;
+
+                T* data() { return ptr; }
+                const T* data() const { return ptr; }
+                T& operator[](std::size_t i) { return ptr[i]; }
+                const T& operator[](std::size_t i) const { return ptr[i]; }
+                std::size_t size() const { return count; }
+
+            private:
+                ScratchPool* pool;
+                std::size_t block;
+                T* ptr;
+                std::size_t count;
+        };
+
+        template <typename T>
+        Lease<T> acquire(std::size_t count) {
+            static_assert(std::is_arithmetic_v<T>, "Scratch buffers only hold arithmetic types");
+            std::size_t block = 0;
+            std::byte* storage = acquireBlock(count * sizeof(T), block);
+            return Lease<T>(*this, block, reinterpret_cast<T*>(storage), count);
+        }
+
+        std::size_t getBytesReserved() const;
+        std::size_t getNumBuffers() const;
+
+
+    private:
+        struct Block {
+            std::unique_ptr<std::byte[]> storage;
+            std::size_t bytes;
+            bool in_use;
+        };
+
+        std::byte* acquireBlock(std::size_t bytes, std::size_t& block);
+        void release(std::size_t block);
+
+        std::vector<Block> blocks;
+        mutable std::mutex mutex;
+};
+
+// The pool shared by the force and energy functions
+ScratchPool& scratchPool();
+
+
+#endif
@@ -2,6 +2,8 @@
 #define randomParticleSystem_hpp
 
 #include "solarSystem.hpp"
+#include "initialConditionCache.hpp"
+#include <string>
 
 
 // Initial condition generator for a random system
@@ -9,15 +11,34 @@ class RandomSystem : public InitialConditionGenerator  // Class as subclass for
 {
 
   public:
-  RandomSystem(int body_num);
+  RandomSystem(int body_num, unsigned int seed = 42); // The same seed always gives the same system
   
   std::vector<std::shared_ptr<Particle>> generateInitialConditions() override; 
-  std::vector<std::shared_ptr<Particle>> getCelestialBodyList() const;
+  const std::vector<std::shared_ptr<Particle>>& getCelestialBodyList() const;
+  std::size_t getArenaBytes() const; // Memory reserved for the particles of the last generated system
+
+  // Keep generated systems in this directory, keyed by the number of bodies and the seed
+  // The first generation maps the cached file if there is one (or generates and saves it), and every later generation
+  // resets the bodies from the mapping, so repeated startups skip the random draws and the trigonometry
+  void setCacheDirectory(const std::string& directory);
+  bool wasLoadedFromCache() const; // Whether the last generation came from a file written by an earlier run
+  std::string getCacheParameters() const; // What the cache key is computed from
+
+  // Draw the system one body at a time without keeping it, visit(i, body) for every body in order
+  // Every call draws the same bodies as generateInitialConditions
+  void forEachBody(const std::function<void(int index, const Particle& body)>& visit) const;
 
 
   private:
+  std::vector<std::shared_ptr<Particle>> generateBodies(); // Draw the system from the seed
+
   int num_bodies; // Including the star
+  unsigned int seed;
   std::vector<std::shared_ptr<Particle>> celestial_body_list;
+  std::shared_ptr<ParticleArena> arena; // All particles live contiguously in here
+  std::string cache_directory; // Empty: no cache
+  std::shared_ptr<const MappedInitialConditions> snapshot; // Mapped cache file, once there is one
+  bool loaded_from_cache = false;
 
 
 
@@ -0,0 +1,106 @@
+#ifndef sharedFrameRing_hpp
+#define sharedFrameRing_hpp
+
+#include "solarSystem.hpp"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Fixed layout of the POSIX shared memory ring buffer of frames
+//
+//   RingHeader | slot 0 | slot 1 | ... | slot num_slots-1
+//   slot = SlotHeader followed by num_bodies * 6 doubles (x, y, z, vx, vy, vz of every body)
+//
+// There is one producer and any number of consumers. Frame n goes into slot n % num_slots under a per-slot sequence lock:
+// the sequence is odd while the producer writes the slot and 2n+2 once frame n is complete
+// The producer never waits for consumers; a consumer that falls behind finds its frames overwritten and skips ahead
+
+constexpr std::uint64_t frame_ring_magic = 0x4E424F4459524E47ULL; // "NBODYRNG"
+constexpr std::uint32_t frame_ring_version = 1;
+
+struct RingHeader {
+    std::uint64_t magic;
+    std::uint32_t version;
+    std::uint32_t num_bodies;
+    std::uint32_t num_slots;
+    std::uint32_t padding;
+    std::uint64_t slot_bytes;
+    std::atomic<std::uint64_t> frames_published;
+};
+
+struct SlotHeader {
+    std::atomic<std::uint64_t> sequence;
+    std::uint64_t frame_number;
+    std::int64_t step;
+    double time;
+};
+
+// A frame copied out of the ring by a consumer
+struct RingFrame {
+    std::uint64_t frame_number = 0;
+    std::int64_t step = 0;
+    double time = 0.0;
+    std::vector<double> state; // num_bodies * 6 doubles, same layout as the slot
+};
+
+
+
+// Producer side: creates the shared memory object and publishes frames into it
+class FramePublisher {
+    public:
+        // name is a POSIX shared memory name such as "/nbody_frames"
+        FramePublisher(const std::string& name, int num_bodies, int num_slots = 64);
+        ~FramePublisher(); // Unmaps and removes the shared memory object
+
+        FramePublisher(const FramePublisher&) = delete;
+        FramePublisher& operator=(const FramePublisher&) = delete;
+
+        // Copy the bodies into the next slot. Never blocks and never allocates
+        void publish(long step, double sim_time, const std::vector<std::shared_ptr<Particle>>& particle_list);
+
+        // Observer for evolutionOfSystem that publishes every steps_per_frame steps
+        StepObserver observer(int steps_per_frame = 1);
+
+        std::uint64_t getFramesPublished() const;
+
+
+    private:
+        std::string name;
+        RingHeader* header;
+        std::size_t mapped_bytes;
+};
+
+
+
+// Consumer side: opens an existing ring read-only
+class FrameSubscriber {
+    public:
+        explicit FrameSubscriber(const std::string& name);
+        ~FrameSubscriber();
+
+        FrameSubscriber(const FrameSubscriber&) = delete;
+        FrameSubscriber& operator=(const FrameSubscriber&) = delete;
+
+        // Next frame after the last one read, skipping frames that were already overwritten
+        // Returns false if there is no new complete frame yet
+        bool readNext(RingFrame& frame);
+        // Newest complete frame, if it is newer than the last one read
+        bool readLatest(RingFrame& frame);
+
+        int getNumBodies() const;
+        std::uint64_t getFramesSkipped() const;
+
+
+    private:
+        bool readFrame(std::uint64_t frame_number, RingFrame& frame);
+
+        const RingHeader* header;
+        std::size_t mapped_bytes;
+        std::uint64_t next_frame;
+        std::uint64_t frames_skipped;
+};
+
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef simulation_hpp
+#define simulation_hpp
+
+#include "particle.hpp"
+#include <Eigen/Core>
+#include <vector>
+
+
+// A system of bodies that owns its state and every scratch buffer
+// Everything is allocated in the constructor, so step() and advanceTo() never touch the heap
+// State is stored as structure of arrays: column 0/1/2 of each matrix holds all the x/y/z values contiguously
+// Every array is first touched, and then worked on, by the threads that own the same static share of the particles,
+// so on a NUMA machine each thread's rows live on its own node (pin the threads with pinThreads before constructing)
+class Simulation {
+    public:
+        // With replicate_sources, the positions and masses that every thread reads in the force loop are copied to one
+        // replica per NUMA node each step, so the inner loop only reads local memory
+        Simulation(const std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double epsilon = 0.0, bool replicate_sources = false);
+
+        // Take num_steps timesteps (same Euler step as evolutionOfSystem)
+        void step(int num_steps = 1);
+        // Step until the simulation time reaches the given time (same loop as evolutionOfSystem)
+        void advanceTo(double time);
+
+        // Read-only views of the state, row i is particle i
+        const Eigen::MatrixX3d& getPositions() const;
+        const Eigen::MatrixX3d& getVelocities() const;
+        const Eigen::MatrixX3d& getAccelerations() const;
+        const Eigen::VectorXd& getMasses() const;
+
+        int getNumParticles() const;
+        double getTime() const;
+        long getStepCount() const;
+        double getTimestep() const;
+        int getNumReplicas() const; // 0 without replication
+
+        // Copy the state back into a list of particles (e.g. the list the simulation was built from)
+        void writeBack(const std::vector<std::shared_ptr<Particle>>& particle_list) const;
+
+
+    private:
+        double dt;
+        double epsilon;
+        double sim_time;
+        long step_count;
+
+        Eigen::VectorXd mass;
+        Eigen::MatrixX3d position;
+        Eigen::MatrixX3d velocity;
+        Eigen::MatrixX3d acceleration;
+
+        // Source replication, one replica (x, y, z, mass columns) per NUMA node
+        std::vector<Eigen::Matrix<double, Eigen::Dynamic, 4>> replicas;
+        std::vector<int> thread_node; // Node of each OpenMP thread
+        std::vector<int> thread_rank; // Index of each thread among the threads of its node
+        std::vector<int> node_num_threads;
+};
+
+
+#endif
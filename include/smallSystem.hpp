@@ -0,0 +1,110 @@
+#ifndef smallSystem_hpp
+#define smallSystem_hpp
+
+#include "solarSystem.hpp"
+#include <array>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+
+// Largest number of bodies that evolutionOfSystem hands to the fixed size engine
+constexpr std::size_t max_small_system_size = 16;
+
+
+// Engine for a fixed number of bodies N, with or without softening
+// All state lives in std::arrays and every pair interaction is unrolled at compile time, with no threading or pointer chasing
+// A step is the same Euler step as evolutionOfSystem: accelerations from the current positions, then Particle::update
+template <std::size_t N, bool Softened>
+class SmallSystemEngine {
+    public:
+        SmallSystemEngine(const std::vector<std::shared_ptr<Particle>>& particle_list, double epsilon) :
+            epsilon_squared{epsilon * epsilon}
+        {
+            for (std::size_t i = 0; i < N; i++) {
+                const Eigen::Vector3d pos = particle_list[i]->getPosition();
+                const Eigen::Vector3d vel = particle_list[i]->getVelocity();
+                const Eigen::Vector3d acc = particle_list[i]->getAcceleration();
+
+                mass[i] = particle_list[i]->getMass();
+                x[i] = pos[0]; y[i] = pos[1]; z[i] = pos[2];
+                vx[i] = vel[0]; vy[i] = vel[1]; vz[i] = vel[2];
+                ax[i] = acc[0]; ay[i] = acc[1]; az[i] = acc[2];
+            }
+        }
+
+        void step(double dt) {
+            ax.fill(0.0); ay.fill(0.0); az.fill(0.0);
+            allPairs(std::make_index_sequence<N * N>{});
+            allUpdates(dt, std::make_index_sequence<N>{});
+        }
+
+        // Copy the engine state back into the particles
+        void writeBack(const std::vector<std::shared_ptr<Particle>>& particle_list) const {
+            for (std::size_t i = 0; i < N; i++) {
+                Eigen::Vector3d pos(x[i], y[i], z[i]);
+                Eigen::Vector3d vel(vx[i], vy[i], vz[i]);
+                Eigen::Vector3d acc(ax[i], ay[i], az[i]);
+                *particle_list[i] = Particle(mass[i], pos, vel, acc);
+            }
+        }
+
+    private:
+        std::array<double, N> mass, x, y, z, vx, vy, vz, ax, ay, az;
+        double epsilon_squared;
+
+        // Pair (I, J) with I < J, applied to both bodies
+        template <std::size_t I, std::size_t J>
+        void pair() {
+            const double dx = x[J] - x[I];
+            const double dy = y[J] - y[I];
+            const double dz = z[J] - z[I];
+
+            double r_squared = dx * dx + dy * dy + dz * dz;
+            if constexpr (Softened) {
+                r_squared += epsilon_squared;
+            }
+            const double inv_r_cubed = 1.0 / (r_squared * std::sqrt(r_squared));
+
+            ax[I] += mass[J] * dx * inv_r_cubed;
+            ay[I] += mass[J] * dy * inv_r_cubed;
+            az[I] += mass[J] * dz * inv_r_cubed;
+            ax[J] -= mass[I] * dx * inv_r_cubed;
+            ay[J] -= mass[I] * dy * inv_r_cubed;
+            az[J] -= mass[I] * dz * inv_r_cubed;
+        }
+
+        // Index K of the N*N sequence is the pair (K / N, K % N), only the upper triangle does any work
+        template <std::size_t K>
+        void pairFromIndex() {
+            if constexpr (K / N < K % N) {
+                pair<K / N, K % N>();
+            }
+        }
+
+        template <std::size_t... K>
+        void allPairs(std::index_sequence<K...>) {
+            (pairFromIndex<K>(), ...);
+        }
+
+        template <std::size_t I>
+        void update(double dt) {
+            x[I] += dt * vx[I]; y[I] += dt * vy[I]; z[I] += dt * vz[I];
+            vx[I] += dt * ax[I]; vy[I] += dt * ay[I]; vz[I] += dt * az[I];
+        }
+
+        template <std::size_t... I>
+        void allUpdates(double dt, std::index_sequence<I...>) {
+            (update<I>(dt), ...);
+        }
+};
+
+
+// Evolve the system on the fixed size engine when it has at most max_small_system_size bodies
+// With an observer, the state is written back to the particles after every step so the observer sees it
+// Returns false (and does nothing) for larger systems
+bool evolveSmallSystem(const std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double total_time, double epsilon = 0.0,
+                       const StepObserver& observer = {});
+
+
+#endif
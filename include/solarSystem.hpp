@@ -2,14 +2,18 @@
 #define solarSystem_hpp
 
 #include "particle.hpp"
+#include "forceKernels.hpp"
+#include "particleArena.hpp"
 #include <chrono>
 #include <random>
 #include <iostream>
+#include <functional>
 
 
 // Initial condition generator abstract class
 class InitialConditionGenerator {
     public:
+    virtual ~InitialConditionGenerator() = default;
     virtual std::vector<std::shared_ptr<Particle>> generateInitialConditions() = 0;
 };
 
@@ -23,20 +27,32 @@ class SolarSystem : public InitialConditionGenerator  // Refactor class as subcl
 
   // Generate Particle list for solar system bodies
   std::vector<std::shared_ptr<Particle>> generateInitialConditions() override; 
-  std::vector<std::shared_ptr<Particle>> getCelestialBodyList() const; // Mainly for tests
+  const std::vector<std::shared_ptr<Particle>>& getCelestialBodyList() const; // Mainly for tests
+  std::size_t getArenaBytes() const; // Memory reserved for the particles of the last generated system
 
   void printMessages();
 
   private:
   std::vector<std::shared_ptr<Particle>> celestial_body_list;
+  std::shared_ptr<ParticleArena> arena; // All generated particles live contiguously in here
 
 };
 
 // Generate a celestial body as a separate function
 Particle celestialBody(double mass, double distance, double angle); // Mass relative to the sun and distance that between body and sun
 
+// Called after every timestep of evolutionOfSystem with the number of steps taken so far, the simulation time reached and the bodies
+using StepObserver = std::function<void(long step, double sim_time, const std::vector<std::shared_ptr<Particle>>& particle_list)>;
+
 // Evolution of any system of bodies as a separate function
-void evolutionOfSystem(const std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double total_time, double epsilon = 0.0);
+// precision selects the arithmetic of the force calculation (see forceKernels.hpp) and law the force law (see forceLaw.hpp)
+// Laws other than Plummer need double precision
+void evolutionOfSystem(const std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double total_time, double epsilon = 0.0,
+                       ForcePrecision precision = ForcePrecision::Double, const StepObserver& observer = {}, ForceLaw law = ForceLaw::Plummer);
+
+// Advance a system of bodies by a single timestep (one iteration of evolutionOfSystem)
+void evolveOneStep(const std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double epsilon = 0.0,
+                   ForcePrecision precision = ForcePrecision::Double, ForceLaw law = ForceLaw::Plummer);
 
 
 
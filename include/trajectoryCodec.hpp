@@ -0,0 +1,143 @@
+#ifndef trajectoryCodec_hpp
+#define trajectoryCodec_hpp
+
+#include "solarSystem.hpp"
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+
+// Compressed trajectory file
+//
+//   TrajectoryFileHeader | frame 0 | frame 1 | ... | index (one TrajectoryIndexEntry per frame) | TrajectoryFooter
+//   frame = TrajectoryFrameHeader followed by payload_bytes of packed values
+//
+// Every component of a frame is quantized to an unsigned integer of position_bits (or velocity_bits) bits across that frame's
+// bounding box, so the error is at most half a quantization step of the box
+// Keyframes (every keyframe_interval frames) store the integers themselves, other frames store the difference from the
+// previous frame. The integers are zigzag encoded and bit packed in blocks of trajectory_block_size values,
+// each block using just enough bits for its largest value
+// Values are ordered x of every body, then y, z, vx, vy, vz, which keeps each block smooth
+
+constexpr char trajectory_magic[8] = {'N', 'B', 'T', 'R', 'J', '0', '0', '1'};
+constexpr std::size_t trajectory_block_size = 1024;
+
+struct TrajectoryCodecSettings {
+    int position_bits = 20; // 1 to 31
+    int velocity_bits = 16; // 1 to 31
+    int keyframe_interval = 32; // Frames between keyframes, the most frames a random access read decodes
+};
+
+struct TrajectoryFileHeader {
+    char magic[8];
+    std::uint32_t num_bodies;
+    std::uint32_t position_bits;
+    std::uint32_t velocity_bits;
+    std::uint32_t keyframe_interval;
+};
+
+struct TrajectoryFrameHeader {
+    std::int64_t step;
+    double time;
+    double position_min[3];
+    double position_max[3];
+    double velocity_min[3];
+    double velocity_max[3];
+    std::uint32_t keyframe;
+    std::uint32_t payload_bytes;
+};
+
+struct TrajectoryIndexEntry {
+    std::uint64_t offset; // Of the frame header from the start of the file
+    std::int64_t step;
+    double time;
+};
+
+struct TrajectoryFooter {
+    std::uint64_t index_offset;
+    std::uint64_t num_frames;
+    char magic[8];
+};
+
+// A decoded frame, one row per body
+struct TrajectoryFrame {
+    long step;
+    double time;
+    Eigen::MatrixX3d positions;
+    Eigen::MatrixX3d velocities;
+};
+
+
+
+// Appends frames to a trajectory file. Quantization and packing of a frame run in parallel with OpenMP
+class TrajectoryWriter {
+    public:
+        TrajectoryWriter(const std::string& path, int num_bodies, const TrajectoryCodecSettings& settings = {});
+        ~TrajectoryWriter(); // Calls finish if it was not called
+
+        TrajectoryWriter(const TrajectoryWriter&) = delete;
+        TrajectoryWriter& operator=(const TrajectoryWriter&) = delete;
+
+        void writeFrame(long step, double sim_time, const std::vector<std::shared_ptr<Particle>>& particle_list);
+
+        // Observer for evolutionOfSystem that writes every steps_per_frame steps
+        StepObserver observer(int steps_per_frame = 1);
+
+        // Write the index and footer and close the file. No frames can be written after this
+        void finish();
+
+        std::size_t getNumFrames() const;
+        std::uint64_t getBytesWritten() const;
+
+
+    private:
+        std::ofstream file;
+        int num_bodies;
+        TrajectoryCodecSettings settings;
+        std::vector<TrajectoryIndexEntry> index;
+        std::uint64_t bytes_written;
+        bool finished;
+
+        // Reused between frames
+        std::vector<std::int64_t> previous_quantized;
+        std::vector<std::int64_t> quantized;
+        std::vector<std::uint64_t> encoded;
+        std::vector<std::vector<std::uint8_t>> packed_blocks;
+};
+
+
+
+// Reads frames back from a trajectory file in any order
+// Reading frames in increasing order only decodes each frame once; a jump decodes from the keyframe before it
+class TrajectoryReader {
+    public:
+        explicit TrajectoryReader(const std::string& path); // Throws if the file is not a finished trajectory file or does not match its header
+
+        std::size_t getNumFrames() const;
+        int getNumBodies() const;
+        const TrajectoryCodecSettings& getSettings() const;
+        long getFrameStep(std::size_t frame) const;
+        double getFrameTime(std::size_t frame) const;
+
+        TrajectoryFrame readFrame(std::size_t frame);
+
+
+    private:
+        void decodeInto(std::size_t frame, TrajectoryFrameHeader& header); // Updates quantized from the previous frame
+
+        std::ifstream file;
+        int num_bodies;
+        TrajectoryCodecSettings settings;
+        std::vector<TrajectoryIndexEntry> index;
+        std::uint64_t frames_end; // Offset of the index, where the last frame must end
+
+        std::vector<std::int64_t> quantized; // Integers of frame decoded_frame
+        std::size_t decoded_frame;
+        bool have_decoded;
+        std::vector<std::uint8_t> payload;
+        std::vector<std::uint64_t> encoded;
+};
+
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef workStealing_hpp
+#define workStealing_hpp
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+// Counters of one worker, accumulated over every parallelFor since the last resetStats
+struct WorkerStats {
+    long tasks_run = 0;
+    long tasks_stolen = 0; // Tasks taken from another worker's deque
+    long steal_attempts = 0; // Including the ones that found nothing
+    double idle_seconds = 0.0; // Time spent looking for work
+};
+
+
+// Runs loops split into tasks on the OpenMP threads, each thread (worker) owning a deque of tasks
+// The tasks start out dealt in contiguous blocks like a static schedule, so balanced loops keep their locality
+// A worker that runs out takes tasks from the far end of a random other worker's deque, so uneven loops
+// (clustered neighbour searches, a few expensive particles) still keep every thread busy
+class WorkStealingExecutor {
+    public:
+        WorkStealingExecutor() = default;
+
+        WorkStealingExecutor(const WorkStealingExecutor&) = delete;
+        WorkStealingExecutor& operator=(const WorkStealingExecutor&) = delete;
+
+        // Call body(begin, end, worker) for every task of at most grain indices of [0, count), worker being the thread running it
+        // grain <= 0 uses the default grain (see setDefaultGrain). The first exception thrown by body is rethrown once every worker has stopped
+        template <typename Body>
+        void parallelFor(int count, int grain, Body&& body) {
+            using BodyType = std::remove_reference_t<Body>;
+            run(count, grain, [](void* context, int begin, int end, int worker) {
+                (*static_cast<BodyType*>(context))(begin, end, worker);
+            }, const_cast<void*>(static_cast<const void*>(&body)));
+        }
+
+        // Task size used when a loop passes grain <= 0. 0 (the default) picks about 8 tasks per worker
+        void setDefaultGrain(int grain);
+        int getDefaultGrain() const;
+
+        int getNumWorkers() const;
+        WorkerStats getStats(int worker) const;
+        WorkerStats getTotalStats() const;
+        void resetStats();
+
+
+    private:
+        struct alignas(64) Worker {
+            std::mutex mutex;
+            std::vector<std::pair<int, int>> tasks; // Index ranges, the owner takes from the front and thieves from the back
+            std::size_t head = 0;
+            std::size_t tail = 0;
+            WorkerStats stats;
+        };
+
+        using TaskFunction = void (*)(void*, int, int, int);
+
+        void run(int count, int grain, TaskFunction function, void* context);
+        bool popOwn(Worker& worker, std::pair<int, int>& task);
+        bool steal(Worker& victim, std::pair<int, int>& task);
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        int default_grain = 0;
+        std::atomic<long> remaining_tasks{0};
+        std::atomic<bool> cancelled{false};
+        std::exception_ptr first_exception;
+        std::mutex exception_mutex;
+};
+
+// The executor used by the force evaluation and the close encounter search
+// One per calling thread, so simulations run side by side on different threads (batch jobs) do not share one
+WorkStealingExecutor& forceExecutor();
+
+
+#endif
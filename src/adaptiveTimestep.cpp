@@ -0,0 +1,153 @@
+#include "adaptiveTimestep.hpp"
+#include "deterministicSum.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+
+
+double timestepCriterion(const std::vector<std::shared_ptr<Particle>>& particle_list, double eta) {
+    const int num_particles = particle_list.size();
+
+    // Velocities relative to the centre of mass, so a star at rest does not force a zero timestep
+    double total_mass = 0.0;
+    Eigen::Vector3d total_momentum(0.0, 0.0, 0.0);
+    for (const auto& particle : particle_list) {
+        total_mass += particle->getMass();
+        total_momentum += particle->getMass() * particle->getVelocity();
+    }
+    const Eigen::Vector3d com_velocity = total_momentum / total_mass;
+
+    double dt_min = std::numeric_limits<double>::infinity();
+
+    #pragma omp parallel for reduction(min: dt_min)
+    for (int i = 0; i < num_particles; i++) {
+        double acc = particle_list[i]->getAcceleration().norm();
+        double vel = (particle_list[i]->getVelocity() - com_velocity).norm();
+
+        if (acc > 0.0 && vel > 0.0) { // Particles with no acceleration or relative motion set no limit
+            dt_min = std::min(dt_min, vel / acc);
+        }
+    }
+
+    return eta * dt_min;
+}
+
+
+
+// Accelerations at the current positions on the structure of arrays kernel, the force pass of evolveOneStep
+static void currentAccelerations(const std::vector<std::shared_ptr<Particle>>& particle_list, double epsilon, std::vector<Eigen::Vector3d>& acc_out) {
+    const int num_particles = particle_list.size();
+    ScratchPool::Lease<double> mass = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> x = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> y = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> z = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> ax = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> ay = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> az = scratchPool().acquire<double>(num_particles);
+
+    #pragma omp parallel for
+    for (int i = 0; i < num_particles; i++) {
+        mass[i] = particle_list[i]->getMass();
+        x[i] = particle_list[i]->getPosition()[0];
+        y[i] = particle_list[i]->getPosition()[1];
+        z[i] = particle_list[i]->getPosition()[2];
+    }
+    directAccelerations(num_particles, x.data(), y.data(), z.data(), mass.data(), epsilon, ax.data(), ay.data(), az.data());
+
+    acc_out.resize(num_particles);
+    for (int i = 0; i < num_particles; i++) {
+        acc_out[i] = Eigen::Vector3d(ax[i], ay[i], az[i]);
+    }
+}
+
+
+
+AdaptiveStepStats evolutionOfSystemAdaptive(const std::vector<std::shared_ptr<Particle>>& particle_list, double initial_dt, double total_time,
+                                            const AdaptiveTolerances& tolerances, double epsilon) {
+
+    // Check that timestep and total simulation time arguments are greater than 0
+    if ( (initial_dt <= 0.0) || (total_time <= 0.0) )
+    {
+        throw std::invalid_argument("The timestep and total time must be greater than 0.");
+    }
+    if ( (tolerances.eta <= 0.0) || (tolerances.energy_tolerance <= 0.0) || (tolerances.min_dt <= 0.0) || (tolerances.max_dt < tolerances.min_dt) ) {
+        throw std::invalid_argument("The adaptive tolerances must be greater than 0 and min_dt must not exceed max_dt.");
+    }
+
+    AdaptiveStepStats stats;
+    stats.smallest_dt = std::numeric_limits<double>::infinity();
+
+    const int num_particles = particle_list.size();
+    const double initial_energy = totalEnergy(particle_list);
+
+    // The accelerations at the current positions are kept on the particles; each step's force pass gives those of the next step
+    std::vector<Eigen::Vector3d> new_accelerations;
+    currentAccelerations(particle_list, epsilon, new_accelerations);
+    for (int i = 0; i < num_particles; i++) {
+        particle_list[i]->updateAcceleration(new_accelerations[i]);
+    }
+
+    std::vector<Particle> saved_state;
+    saved_state.reserve(num_particles);
+
+    double dt = std::clamp(initial_dt, tolerances.min_dt, tolerances.max_dt);
+    double sim_time = 0.0;
+
+    while (sim_time < total_time) {
+        double step_dt = std::min(dt, total_time - sim_time); // Land exactly on the total time
+
+        // Keep the state so a failed step can be undone (O(N), unlike the force pass)
+        saved_state.clear();
+        for (const auto& particle : particle_list) {
+            saved_state.push_back(*particle);
+        }
+
+        #pragma omp parallel for
+        for (int i = 0; i < num_particles; i++) {
+            particle_list[i]->update(step_dt);
+        }
+        currentAccelerations(particle_list, epsilon, new_accelerations); // The only O(N^2) pass of the step
+
+        // Energy change of the step, tracked incrementally instead of with a second direct sum: the kinetic change is exact,
+        // the potential change is minus the work of the forces along the step, with the force averaged over both ends
+        // (an O(dt^3) error, below the O(dt^2) energy error of the Euler step being measured)
+        double energy_change = deterministicReduce(num_particles, reduction_block_size, [&](int begin, int end) {
+            double block_sum = 0.0;
+            for (int i = begin; i < end; i++) {
+                const Particle& before = saved_state[i];
+                const Eigen::Vector3d displacement = step_dt * before.getVelocity();
+                double kinetic_change = 0.5 * (particle_list[i]->getVelocity().squaredNorm() - before.getVelocity().squaredNorm());
+                double work = 0.5 * (before.getAcceleration() + new_accelerations[i]).dot(displacement);
+                block_sum += before.getMass() * (kinetic_change - work);
+            }
+            return block_sum;
+        });
+        double relative_change = std::abs(energy_change) / std::abs(initial_energy);
+
+        if (relative_change > tolerances.energy_tolerance && step_dt > tolerances.min_dt) {
+            for (int i = 0; i < num_particles; i++) {
+                *particle_list[i] = saved_state[i];
+            }
+            dt = std::max(0.5 * step_dt, tolerances.min_dt);
+            stats.rejected_steps++;
+            continue;
+        }
+
+        for (int i = 0; i < num_particles; i++) {
+            particle_list[i]->updateAcceleration(new_accelerations[i]);
+        }
+        sim_time += step_dt;
+        stats.accepted_steps++;
+        stats.smallest_dt = std::min(stats.smallest_dt, step_dt);
+        stats.largest_dt = std::max(stats.largest_dt, step_dt);
+
+        // Grow the step when the energy change is comfortably within tolerance, but never beyond the particle criterion
+        double growth = (relative_change < 0.25 * tolerances.energy_tolerance) ? 2.0 : 1.0;
+        dt = std::min( { growth * dt, timestepCriterion(particle_list, tolerances.eta), tolerances.max_dt } );
+        dt = std::max(dt, tolerances.min_dt);
+    }
+
+    stats.relative_energy_error = std::abs(totalEnergy(particle_list) - initial_energy) / std::abs(initial_energy);
+    return stats;
+}
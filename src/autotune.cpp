@@ -0,0 +1,272 @@
+#include "autotune.hpp"
+#include "solarSystem.hpp"
+#include "simulation.hpp"
+#include "smallSystem.hpp"
+#include "workStealing.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <omp.h>
+#include <sstream>
+#include <stdexcept>
+
+
+
+std::string solverName(Solver solver) {
+    return solver == Solver::Arrays ? "arrays" : "particles";
+}
+
+
+static Solver parseSolver(const std::string& name) {
+    if (name == "particles") {
+        return Solver::Particles;
+    }
+    else if (name == "arrays") {
+        return Solver::Arrays;
+    }
+    throw std::invalid_argument("Solver must be 'particles' or 'arrays'.");
+}
+
+
+
+int sizeBucket(int num_bodies) {
+    int bucket = 1;
+    while (bucket < num_bodies) {
+        bucket *= 2;
+    }
+    return bucket;
+}
+
+
+
+std::string machineKey() {
+    std::string model = "unknown";
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.rfind("model name", 0) == 0 && line.find(':') != std::string::npos) {
+            model = line.substr(line.find(':') + 1);
+            model.erase(0, model.find_first_not_of(' '));
+            break;
+        }
+    }
+
+    // One word, so it can be the first field of a cache line
+    std::string key = model + " " + std::to_string(omp_get_num_procs()) + "cpus";
+    std::replace_if(key.begin(), key.end(), [](char c) { return std::isspace(static_cast<unsigned char>(c)); }, '_');
+    return key;
+}
+
+
+
+std::string defaultAutotuneCachePath() {
+    if (const char* path = std::getenv("NBODY_AUTOTUNE_CACHE")) {
+        return path;
+    }
+    if (const char* home = std::getenv("HOME")) {
+        return std::string(home) + "/.nbody_autotune";
+    }
+    return ".nbody_autotune";
+}
+
+
+
+void applyTuning(const TuningChoice& choice) {
+    setIsaLevel(choice.isa);
+    omp_set_num_threads(choice.num_threads);
+    forceExecutor().setDefaultGrain(choice.grain);
+}
+
+
+std::string describeTuning(const TuningChoice& choice) {
+    std::ostringstream description;
+    description << solverName(choice.solver) << " solver, " << isaLevelName(choice.isa) << " kernels, "
+                << choice.num_threads << (choice.num_threads == 1 ? " thread, " : " threads, ");
+    if (choice.grain > 0) {
+        description << "grain " << choice.grain;
+    }
+    else {
+        description << "default grain";
+    }
+    return description.str();
+}
+
+
+
+// Cache lines: machine size_bucket solver kernels threads grain seconds_per_step. The last line for a machine and bucket wins
+static bool readCachedChoice(const std::string& cache_path, const std::string& machine, int bucket, TuningChoice& choice, double& seconds_per_step) {
+    std::ifstream cache(cache_path);
+    std::string line;
+    bool found = false;
+
+    while (std::getline(cache, line)) {
+        std::istringstream fields(line);
+        std::string line_machine, solver, isa;
+        int line_bucket;
+        TuningChoice line_choice;
+        double line_seconds;
+        if (!(fields >> line_machine >> line_bucket >> solver >> isa >> line_choice.num_threads >> line_choice.grain >> line_seconds)
+            || line_machine != machine || line_bucket != bucket) {
+            continue;
+        }
+        try {
+            line_choice.solver = parseSolver(solver);
+            line_choice.isa = parseIsaLevel(isa);
+        }
+        catch (const std::invalid_argument&) {
+            continue;
+        }
+        choice = line_choice;
+        seconds_per_step = line_seconds;
+        found = true;
+    }
+    return found;
+}
+
+
+static void writeCachedChoice(const std::string& cache_path, const std::string& machine, int bucket, const TuningChoice& choice, double seconds_per_step) {
+    std::ofstream cache(cache_path, std::ios::app);
+    cache << machine << " " << bucket << " " << solverName(choice.solver) << " " << isaLevelName(choice.isa) << " "
+          << choice.num_threads << " " << choice.grain << " " << seconds_per_step << "\n";
+}
+
+
+
+// Number of steps the evolutionOfSystem loop takes for this total time
+static long loopSteps(double dt, double total_time) {
+    long steps = 0;
+    for (double sim_time = 0.0; sim_time < total_time; sim_time += dt) {
+        steps++;
+    }
+    return steps;
+}
+
+
+// Bodies the trials run on at most: an O(N^2) step of a big system would make every trial take seconds
+constexpr std::size_t max_trial_bodies = 2048;
+
+
+// Wall clock seconds per step of a choice, on copies of the bodies
+static double secondsPerStep(const TuningChoice& choice, const std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double epsilon) {
+    constexpr double trial_seconds = 0.02;
+    applyTuning(choice);
+
+    std::vector<std::shared_ptr<Particle>> copies;
+    for (const auto& particle : particle_list) {
+        copies.push_back(std::make_shared<Particle>(*particle));
+    }
+    std::unique_ptr<Simulation> simulation;
+    if (choice.solver == Solver::Arrays) {
+        simulation = std::make_unique<Simulation>(copies, dt, epsilon);
+    }
+
+    auto run = [&](int num_steps) {
+        auto start = std::chrono::steady_clock::now();
+        long steps = num_steps;
+        if (simulation) {
+            simulation->step(num_steps);
+        }
+        else {
+            steps = loopSteps(dt, num_steps * dt);
+            evolutionOfSystem(copies, dt, num_steps * dt, epsilon);
+        }
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double>(end - start).count() / steps;
+    };
+
+    // A warm up step gives the length of the trial, then the best of two trials
+    const double estimate = run(1);
+    const int num_steps = std::clamp(static_cast<int>(trial_seconds / std::max(estimate, 1e-9)), 1, 10000);
+    return std::min(run(num_steps), run(num_steps));
+}
+
+
+
+TuningResult autotune(const std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double epsilon, const std::string& cache_path,
+                      bool allow_arrays) {
+    if (particle_list.empty()) {
+        throw std::invalid_argument("There are no bodies to tune for.");
+    }
+    const std::string machine = machineKey();
+    const int bucket = sizeBucket(particle_list.size());
+
+    TuningResult result;
+    if (!cache_path.empty() && readCachedChoice(cache_path, machine, bucket, result.best, result.seconds_per_step)
+        && result.best.isa <= detectIsaLevel()) {
+        if (result.best.solver == Solver::Arrays && !allow_arrays) {
+            result.best.solver = Solver::Particles;
+        }
+        result.from_cache = true;
+        applyTuning(result.best);
+        return result;
+    }
+    result.from_cache = false;
+
+    // Bigger systems are timed on every k-th body, so a trial costs no more than a step of max_trial_bodies
+    std::vector<std::shared_ptr<Particle>> trial_list;
+    for (std::size_t i = 0; i < std::min(particle_list.size(), max_trial_bodies); i++) {
+        trial_list.push_back(particle_list[i * particle_list.size() / std::min(particle_list.size(), max_trial_bodies)]);
+    }
+
+    // Keep a candidate if it beats the best so far
+    TuningChoice best;
+    best.isa = detectIsaLevel();
+    best.num_threads = omp_get_num_procs();
+    double best_seconds = 0.0;
+    auto tryChoice = [&](const TuningChoice& choice) {
+        double seconds = secondsPerStep(choice, trial_list, dt, epsilon);
+        result.trials.push_back({choice, seconds});
+        if (result.trials.size() == 1 || seconds < best_seconds) {
+            best = choice;
+            best_seconds = seconds;
+        }
+    };
+
+    // Thread counts: 1, 2, 4, ... and every logical CPU (small systems are often fastest on one thread)
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < omp_get_num_procs(); threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(omp_get_num_procs());
+    const TuningChoice start = best;
+    for (int threads : thread_counts) {
+        TuningChoice choice = start;
+        choice.num_threads = threads;
+        tryChoice(choice);
+    }
+
+    if (allow_arrays) {
+        TuningChoice choice = best;
+        choice.solver = Solver::Arrays;
+        tryChoice(choice);
+    }
+
+    const TuningChoice best_solver = best;
+    for (int level = static_cast<int>(IsaLevel::Baseline); level < static_cast<int>(detectIsaLevel()); level++) {
+        TuningChoice choice = best_solver;
+        choice.isa = static_cast<IsaLevel>(level);
+        tryChoice(choice);
+    }
+
+    // Task sizes only matter for the work stealing force loop, which small systems do not use
+    if (best.solver == Solver::Particles && particle_list.size() > max_small_system_size && best.num_threads > 1) {
+        const TuningChoice best_kernels = best;
+        for (int grain : {1, 4, 16, 64, 256}) {
+            if (grain < static_cast<int>(trial_list.size())) {
+                TuningChoice choice = best_kernels;
+                choice.grain = grain;
+                tryChoice(choice);
+            }
+        }
+    }
+
+    result.best = best;
+    result.seconds_per_step = best_seconds;
+    if (!cache_path.empty()) {
+        writeCachedChoice(cache_path, machine, bucket, best, best_seconds);
+    }
+    applyTuning(result.best);
+    return result;
+}
@@ -0,0 +1,294 @@
+#include "batchRunner.hpp"
+#include "solarSystem.hpp"
+#include "randomParticleSystem.hpp"
+#include "closeEncounters.hpp"
+#include "multipleTimestep.hpp"
+#include "adaptiveTimestep.hpp"
+#include "trajectoryCodec.hpp"
+#include "ephemeris.hpp"
+#include "smallSystem.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <numeric>
+#include <omp.h>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+
+
+// Value of one key=value field, throwing with the line number if it does not parse
+template <typename T>
+static T fieldValue(const std::string& key, const std::string& value, int line_number) {
+    std::istringstream stream(value);
+    T result;
+    if (!(stream >> result) || !stream.eof()) {
+        throw std::invalid_argument("Line " + std::to_string(line_number) + ": bad value '" + value + "' for " + key + ".");
+    }
+    return result;
+}
+
+
+
+std::vector<Scenario> parseScenarios(const std::string& text) {
+    std::vector<Scenario> scenarios;
+    std::istringstream lines(text);
+    std::string line;
+    int line_number = 0;
+
+    while (std::getline(lines, line)) {
+        line_number++;
+        std::istringstream fields(line);
+        std::string field;
+        if (!(fields >> field) || field[0] == '#') {
+            continue;
+        }
+
+        Scenario scenario;
+        scenario.name = "run" + std::to_string(line_number);
+        do {
+            const std::size_t equals = field.find('=');
+            if (equals == std::string::npos) {
+                throw std::invalid_argument("Line " + std::to_string(line_number) + ": expected key=value, got '" + field + "'.");
+            }
+            const std::string key = field.substr(0, equals);
+            const std::string value = field.substr(equals + 1);
+
+            if (key == "name") scenario.name = value;
+            else if (key == "generator") scenario.generator = value;
+            else if (key == "n") scenario.num_bodies = fieldValue<int>(key, value, line_number);
+            else if (key == "seed") scenario.seed = fieldValue<unsigned int>(key, value, line_number);
+            else if (key == "dt") scenario.dt = fieldValue<double>(key, value, line_number);
+            else if (key == "time") scenario.sim_time = fieldValue<double>(key, value, line_number);
+            else if (key == "epsilon") scenario.epsilon = fieldValue<double>(key, value, line_number);
+            else if (key == "integrator") scenario.integrator = value;
+            else if (key == "radius") scenario.collision_radius = fieldValue<double>(key, value, line_number);
+            else if (key == "substeps") scenario.substeps = fieldValue<int>(key, value, line_number);
+            else if (key == "tolerance") scenario.energy_tolerance = fieldValue<double>(key, value, line_number);
+            else if (key == "precision") scenario.precision = parseForcePrecision(value);
+            else if (key == "force") scenario.force_law = parseForceLaw(value);
+            else if (key == "trajectory") scenario.trajectory_path = value;
+            else if (key == "ephemeris") scenario.ephemeris_path = value;
+            else {
+                throw std::invalid_argument("Line " + std::to_string(line_number) + ": unknown key '" + key + "'.");
+            }
+        } while (fields >> field);
+
+        // Catch mistakes before any run starts
+        const std::string where = "Line " + std::to_string(line_number) + ": ";
+        if (scenario.generator != "solar" && scenario.generator != "random") {
+            throw std::invalid_argument(where + "generator must be 'solar' or 'random'.");
+        }
+        if (scenario.generator == "random" && scenario.num_bodies <= 0) {
+            throw std::invalid_argument(where + "a random system needs n greater than 0.");
+        }
+        if (scenario.dt <= 0.0 || scenario.sim_time <= 0.0) {
+            throw std::invalid_argument(where + "dt and time must be greater than 0.");
+        }
+        if (scenario.integrator != "euler" && scenario.integrator != "collisions" && scenario.integrator != "multistep" && scenario.integrator != "adaptive") {
+            throw std::invalid_argument(where + "integrator must be 'euler', 'collisions', 'multistep' or 'adaptive'.");
+        }
+        if ((scenario.integrator == "collisions" && scenario.collision_radius <= 0.0) || (scenario.integrator == "multistep" && scenario.substeps <= 0)
+            || (scenario.integrator == "adaptive" && scenario.energy_tolerance <= 0.0)) {
+            throw std::invalid_argument(where + "the " + scenario.integrator + " integrator needs its radius, substeps or tolerance.");
+        }
+        if (scenario.integrator != "euler" && (scenario.precision != ForcePrecision::Double || scenario.force_law != ForceLaw::Plummer
+                                               || !scenario.trajectory_path.empty() || !scenario.ephemeris_path.empty())) {
+            throw std::invalid_argument(where + "mixed precision, force laws and output files are only available with the euler integrator.");
+        }
+        if (scenario.force_law != ForceLaw::Plummer && scenario.precision != ForcePrecision::Double) {
+            throw std::invalid_argument(where + "force laws other than plummer need double precision.");
+        }
+        scenarios.push_back(scenario);
+    }
+    return scenarios;
+}
+
+
+
+std::vector<Scenario> readScenarios(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Could not open the scenario file " + path + ".");
+    }
+    std::ostringstream text;
+    text << file.rdbuf();
+    return parseScenarios(text.str());
+}
+
+
+
+static int scenarioBodies(const Scenario& scenario) {
+    return scenario.generator == "solar" ? 9 : scenario.num_bodies;
+}
+
+
+double estimatedCost(const Scenario& scenario) {
+    const double num_bodies = scenarioBodies(scenario);
+    return num_bodies * num_bodies * std::ceil(scenario.sim_time / scenario.dt);
+}
+
+
+
+ScenarioResult runScenario(const Scenario& scenario, int num_threads) {
+    ScenarioResult result;
+    result.scenario = scenario;
+    result.num_threads = num_threads;
+    omp_set_num_threads(num_threads); // Only for this thread's parallel regions
+
+    auto start_time = std::chrono::steady_clock::now();
+    try {
+        std::unique_ptr<InitialConditionGenerator> generator;
+        if (scenario.generator == "solar") {
+            generator = std::make_unique<SolarSystem>();
+        }
+        else {
+            generator = std::make_unique<RandomSystem>(scenario.num_bodies, scenario.seed);
+        }
+        std::vector<std::shared_ptr<Particle>> body_list = generator->generateInitialConditions();
+        result.initial_energy = totalEnergy(body_list);
+        result.num_steps = std::ceil(scenario.sim_time / scenario.dt);
+
+        if (scenario.integrator == "collisions") {
+            evolutionOfSystemWithCollisions(body_list, scenario.dt, scenario.sim_time, scenario.collision_radius, scenario.epsilon);
+        }
+        else if (scenario.integrator == "multistep") {
+            evolutionOfSystemMultiStep(body_list, scenario.dt, scenario.sim_time, scenario.substeps, scenario.epsilon);
+        }
+        else if (scenario.integrator == "adaptive") {
+            AdaptiveTolerances tolerances;
+            tolerances.energy_tolerance = scenario.energy_tolerance;
+            tolerances.max_dt = scenario.sim_time;
+            AdaptiveStepStats stats = evolutionOfSystemAdaptive(body_list, scenario.dt, scenario.sim_time, tolerances, scenario.epsilon);
+            result.num_steps = stats.accepted_steps + stats.rejected_steps;
+        }
+        else {
+            std::unique_ptr<TrajectoryWriter> trajectory;
+            std::unique_ptr<EphemerisRecorder> ephemeris;
+            StepObserver observer;
+            if (!scenario.trajectory_path.empty()) {
+                trajectory = std::make_unique<TrajectoryWriter>(scenario.trajectory_path, body_list.size());
+            }
+            if (!scenario.ephemeris_path.empty()) {
+                ephemeris = std::make_unique<EphemerisRecorder>(body_list.size());
+                ephemeris->record(0.0, body_list);
+            }
+            if (trajectory || ephemeris) {
+                observer = [&](long step, double sim_time, const std::vector<std::shared_ptr<Particle>>& particle_list) {
+                    if (trajectory) {
+                        trajectory->writeFrame(step, sim_time, particle_list);
+                    }
+                    if (ephemeris) {
+                        ephemeris->record(sim_time, particle_list);
+                    }
+                };
+            }
+            evolutionOfSystem(body_list, scenario.dt, scenario.sim_time, scenario.epsilon, scenario.precision, observer, scenario.force_law);
+
+            if (trajectory) {
+                trajectory->finish();
+            }
+            if (ephemeris) {
+                ephemeris->build().save(scenario.ephemeris_path);
+            }
+        }
+
+        result.final_bodies = body_list.size();
+        result.final_energy = totalEnergy(body_list);
+    }
+    catch (const std::exception& error) {
+        result.error = error.what();
+    }
+    auto end_time = std::chrono::steady_clock::now();
+    result.runtime_ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+    return result;
+}
+
+
+
+std::vector<ScenarioResult> runBatch(const std::vector<Scenario>& scenarios, int num_cores,
+                                     const std::function<void(const ScenarioResult&)>& on_finish) {
+    num_cores = std::max(1, num_cores);
+    std::vector<ScenarioResult> results(scenarios.size());
+
+    // Costliest first, so the long runs are not left until the end
+    std::vector<double> costs(scenarios.size());
+    std::vector<int> order(scenarios.size());
+    for (int i = 0; i < scenarios.size(); i++) {
+        costs[i] = estimatedCost(scenarios[i]);
+    }
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return costs[a] > costs[b]; });
+    double cost_to_start = std::accumulate(costs.begin(), costs.end(), 0.0);
+
+    std::mutex mutex;
+    std::condition_variable core_freed;
+    int free_cores = num_cores;
+    std::size_t next = 0; // Position in order of the next job to start
+
+    // Every job takes at least one core, so num_cores workers are enough to keep them all busy. Each worker starts
+    // the next job in order as soon as a core is free, and takes another once it finishes
+    auto work = [&]() {
+        while (true) {
+            int index = 0;
+            int num_threads = 1;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                core_freed.wait(lock, [&]() { return next == order.size() || free_cores > 0; });
+                if (next == order.size()) {
+                    return;
+                }
+                index = order[next++];
+
+                // Small systems run on the fixed size engine, which does not use threads
+                if (scenarioBodies(scenarios[index]) > max_small_system_size && cost_to_start > 0.0) {
+                    num_threads = static_cast<int>(std::lround(num_cores * costs[index] / cost_to_start));
+                }
+                num_threads = std::clamp(num_threads, 1, free_cores);
+                free_cores -= num_threads;
+                cost_to_start -= costs[index];
+            }
+
+            ScenarioResult result = runScenario(scenarios[index], num_threads);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            results[index] = result;
+            if (on_finish) {
+                on_finish(result);
+            }
+            free_cores += num_threads;
+            core_freed.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < std::min<std::size_t>(num_cores, scenarios.size()); i++) {
+        workers.emplace_back(work);
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    return results;
+}
+
+
+
+void writeResultsTable(std::ostream& out, const std::vector<ScenarioResult>& results) {
+    out << "name,generator,bodies,seed,integrator,threads,steps,final_bodies,initial_energy,final_energy,relative_energy_error,runtime_ms,status\n";
+
+    for (const ScenarioResult& result : results) {
+        const Scenario& scenario = result.scenario;
+        const double relative_error = std::abs((result.final_energy - result.initial_energy) / result.initial_energy);
+
+        out << scenario.name << "," << scenario.generator << "," << scenarioBodies(scenario) << "," << scenario.seed << ","
+            << scenario.integrator << "," << result.num_threads << "," << result.num_steps << "," << result.final_bodies << ","
+            << std::setprecision(12) << result.initial_energy << "," << result.final_energy << "," << std::setprecision(6) << relative_error << ","
+            << std::fixed << std::setprecision(3) << result.runtime_ms << std::defaultfloat << ","
+            << (result.error.empty() ? "ok" : "\"error: " + result.error + "\"") << "\n";
+    }
+}
@@ -0,0 +1,216 @@
+#include "closeEncounters.hpp"
+#include "workStealing.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <omp.h>
+
+
+
+using CellCoordinates = Eigen::Matrix<std::int64_t, 3, 1>;
+
+// Cell coordinates are clamped to +-2^62, so stepping to a neighbouring cell never overflows
+constexpr double cell_coordinate_limit = 4611686018427387904.0;
+
+// Integer coordinates of the grid cell containing a position
+// Bodies beyond the last cell share it (their pairs are still checked by distance). fmin and fmax also send NaN there
+static CellCoordinates cellOf(const Eigen::Vector3d& position, double cell_size) {
+    CellCoordinates cell;
+    for (int axis = 0; axis < 3; axis++) {
+        cell[axis] = static_cast<std::int64_t>(std::fmax(std::fmin(std::floor(position[axis] / cell_size), cell_coordinate_limit), -cell_coordinate_limit));
+    }
+    return cell;
+}
+
+// Hash a cell into a bucket of the table (mask = table size - 1, table size is a power of 2)
+static std::size_t bucketOf(const CellCoordinates& cell, std::size_t mask) {
+    std::uint64_t hash = (static_cast<std::uint64_t>(cell[0]) * 73856093ULL)
+                       ^ (static_cast<std::uint64_t>(cell[1]) * 19349663ULL)
+                       ^ (static_cast<std::uint64_t>(cell[2]) * 83492791ULL);
+    return static_cast<std::size_t>(hash) & mask;
+}
+
+
+
+std::vector<std::pair<int, int>> findClosePairs(const std::vector<std::shared_ptr<Particle>>& particle_list, double search_radius) {
+
+    if (search_radius <= 0.0) {
+        throw std::invalid_argument("The close encounter search radius must be greater than 0.");
+    }
+
+    const int num_particles = particle_list.size();
+    std::vector<std::pair<int, int>> close_pairs;
+    if (num_particles < 2) {
+        return close_pairs;
+    }
+
+    // Table with at least twice as many buckets as particles keeps the expected bucket occupancy below 1
+    std::size_t table_size = 1;
+    while (table_size < 2 * static_cast<std::size_t>(num_particles)) {
+        table_size <<= 1;
+    }
+    const std::size_t mask = table_size - 1;
+
+    std::vector<Eigen::Vector3d> positions(num_particles);
+    std::vector<CellCoordinates> cells(num_particles);
+    std::vector<std::size_t> buckets(num_particles);
+
+    // Bin every particle into its cell
+    #pragma omp parallel for
+    for (int i = 0; i < num_particles; i++) {
+        positions[i] = particle_list[i]->getPosition();
+        cells[i] = cellOf(positions[i], search_radius);
+        buckets[i] = bucketOf(cells[i], mask);
+    }
+
+    // Counting sort of particle indices by bucket, O(N)
+    std::vector<int> bucket_start(table_size + 1, 0);
+    for (int i = 0; i < num_particles; i++) {
+        bucket_start[buckets[i] + 1]++;
+    }
+    std::partial_sum(bucket_start.begin(), bucket_start.end(), bucket_start.begin());
+
+    std::vector<int> sorted_particles(num_particles);
+    std::vector<int> fill_position(bucket_start.begin(), bucket_start.end() - 1);
+    for (int i = 0; i < num_particles; i++) {
+        sorted_particles[fill_position[buckets[i]]++] = i;
+    }
+
+
+    // Search the 27 cells around each particle, every thread collecting its own pairs
+    const double radius_squared = search_radius * search_radius;
+    std::vector<std::vector<std::pair<int, int>>> thread_pairs(omp_get_max_threads());
+
+    // Crowded cells make some particles far more expensive than others, so idle threads steal from busy ones
+    forceExecutor().parallelFor(num_particles, 64, [&](int begin, int end, int worker) {
+        std::vector<std::pair<int, int>>& local_pairs = thread_pairs[worker];
+
+        for (int i = begin; i < end; i++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dz = -1; dz <= 1; dz++) {
+                        const CellCoordinates neighbour_cell = cells[i] + CellCoordinates(dx, dy, dz);
+                        const std::size_t bucket = bucketOf(neighbour_cell, mask);
+
+                        for (int k = bucket_start[bucket]; k < bucket_start[bucket + 1]; k++) {
+                            const int j = sorted_particles[k];
+
+                            // Only count each pair once, and skip other cells that share this bucket
+                            if (j > i && cells[j] == neighbour_cell
+                                && (positions[j] - positions[i]).squaredNorm() < radius_squared) {
+                                local_pairs.emplace_back(i, j);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    for (const auto& local_pairs : thread_pairs) {
+        close_pairs.insert(close_pairs.end(), local_pairs.begin(), local_pairs.end());
+    }
+    std::sort(close_pairs.begin(), close_pairs.end()); // Same order regardless of the number of threads
+
+    return close_pairs;
+}
+
+
+
+
+int mergeCollisions(std::vector<std::shared_ptr<Particle>>& particle_list, const std::vector<std::pair<int, int>>& close_pairs) {
+    if (close_pairs.empty()) {
+        return 0;
+    }
+
+    const int num_particles = particle_list.size();
+
+    // Union-find over the pairs so chains of touching bodies become one group, rooted at the lowest index
+    std::vector<int> parent(num_particles);
+    std::iota(parent.begin(), parent.end(), 0);
+
+    auto findRoot = [&parent](int i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    };
+
+    for (const auto& [i, j] : close_pairs) {
+        int root_i = findRoot(i);
+        int root_j = findRoot(j);
+        if (root_i != root_j) {
+            parent[std::max(root_i, root_j)] = std::min(root_i, root_j);
+        }
+    }
+
+
+    // Mass weighted sums for each group
+    std::vector<double> group_mass(num_particles, 0.0);
+    std::vector<Eigen::Vector3d> group_position(num_particles, Eigen::Vector3d::Zero());
+    std::vector<Eigen::Vector3d> group_momentum(num_particles, Eigen::Vector3d::Zero());
+    std::vector<Eigen::Vector3d> group_force(num_particles, Eigen::Vector3d::Zero());
+    std::vector<bool> merged(num_particles, false);
+
+    for (int i = 0; i < num_particles; i++) {
+        int root = findRoot(i);
+        if (root != i) {
+            merged[root] = true;
+        }
+
+        double mass = particle_list[i]->getMass();
+        group_mass[root] += mass;
+        group_position[root] += mass * particle_list[i]->getPosition();
+        group_momentum[root] += mass * particle_list[i]->getVelocity();
+        group_force[root] += mass * particle_list[i]->getAcceleration();
+    }
+
+    // Replace each root with the merged body at the centre of mass
+    for (int i = 0; i < num_particles; i++) {
+        if (merged[i]) {
+            Eigen::Vector3d pos = group_position[i] / group_mass[i];
+            Eigen::Vector3d vel = group_momentum[i] / group_mass[i];
+            Eigen::Vector3d acc = group_force[i] / group_mass[i];
+
+            *particle_list[i] = Particle(group_mass[i], pos, vel, acc);
+        }
+    }
+
+    // Remove the absorbed bodies, keeping the order of the survivors
+    int num_kept = 0;
+    for (int i = 0; i < num_particles; i++) {
+        if (findRoot(i) == i) {
+            particle_list[num_kept++] = particle_list[i];
+        }
+    }
+    particle_list.resize(num_kept);
+
+    return num_particles - num_kept;
+}
+
+
+
+
+int evolutionOfSystemWithCollisions(std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double total_time, double collision_radius, double epsilon) {
+
+    // Check that timestep and total simulation time arguments are greater than 0
+    if ( (dt <= 0.0) || (total_time <= 0.0) )
+    {
+        throw std::invalid_argument("The timestep and total time must be greater than 0.");
+    }
+    if (collision_radius <= 0.0) {
+        throw std::invalid_argument("The collision radius must be greater than 0.");
+    }
+
+    int num_removed = 0;
+
+    // Loop for full simulation time, resolving collisions after each step
+    for (double sim_time = 0.0; sim_time < total_time; sim_time += dt) {
+        evolveOneStep(particle_list, dt, epsilon);
+        num_removed += mergeCollisions(particle_list, findClosePairs(particle_list, collision_radius));
+    }
+
+    return num_removed;
+}
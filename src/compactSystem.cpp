@@ -0,0 +1,410 @@
+#include "compactSystem.hpp"
+#include "isaDispatch.hpp"
+#include "particleArena.hpp"
+#include "workStealing.hpp"
+#include "deterministicSum.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <unordered_map>
+
+
+
+// Cell coordinates are packed into 21 bits each, so a cell key is one integer
+constexpr int cell_coordinate_bits = 21;
+constexpr std::int64_t cell_coordinate_limit = std::int64_t{1} << (cell_coordinate_bits - 1);
+
+
+std::uint64_t CompactSystem::cellKey(double x, double y, double z) const {
+    std::uint64_t key = 0;
+    for (double coordinate : {x, y, z}) {
+        // Bodies beyond the last cell share it (their offsets just lose precision)
+        std::int64_t cell = static_cast<std::int64_t>(std::floor(coordinate / cell_size));
+        cell = std::clamp(cell, -cell_coordinate_limit, cell_coordinate_limit - 1);
+        key = (key << cell_coordinate_bits) | static_cast<std::uint64_t>(cell + cell_coordinate_limit);
+    }
+    return key;
+}
+
+
+double CompactSystem::absolutePosition(int cell, int body, int axis) const {
+    return cells[cell].origin[axis] + static_cast<double>(offset(body, axis));
+}
+
+
+
+CompactSystem::CompactSystem(int num_bodies, const BodySource& source, double in_dt, double in_epsilon, bool in_float_velocities, double in_cell_size) :
+    num_particles{num_bodies}, dt{in_dt}, epsilon{in_epsilon}, cell_size{in_cell_size}, float_velocities{in_float_velocities},
+    sim_time{0.0}, step_count{0}, num_rebins{0}
+{
+    if (num_bodies <= 0) {
+        throw std::invalid_argument("Number of bodies must be greater than 0.");
+    }
+    if (dt <= 0.0 || cell_size <= 0.0) {
+        throw std::invalid_argument("The timestep and the cell size must be greater than 0.");
+    }
+    allocate();
+
+    // First pass: count the bodies in each cell
+    std::unordered_map<std::uint64_t, int> counts;
+    int num_seen = 0;
+    source([&](int, const Particle& body) {
+        const Eigen::Vector3d& position = body.getPosition();
+        counts[cellKey(position[0], position[1], position[2])]++;
+        num_seen++;
+    });
+    if (num_seen != num_bodies) {
+        throw std::invalid_argument("The body source gave " + std::to_string(num_seen) + " bodies instead of " + std::to_string(num_bodies) + ".");
+    }
+    buildCells(std::vector<std::pair<std::uint64_t, int>>(counts.begin(), counts.end()));
+
+    // Second pass: store each body in the next free slot of its cell
+    std::unordered_map<std::uint64_t, int> cell_of_key;
+    std::vector<int> next_slot(cells.size());
+    for (int c = 0; c < cells.size(); c++) {
+        const Cell& cell = cells[c];
+        cell_of_key[cellKey(cell.origin[0], cell.origin[1], cell.origin[2])] = c;
+        next_slot[c] = cell.begin;
+    }
+    source([&](int index, const Particle& body) {
+        const Eigen::Vector3d& position = body.getPosition();
+        const int c = cell_of_key.at(cellKey(position[0], position[1], position[2]));
+        const int slot = next_slot[c]++;
+
+        mass[slot] = body.getMass();
+        body_index[slot] = index;
+        for (int axis = 0; axis < 3; axis++) {
+            offset(slot, axis) = static_cast<float>(position[axis] - cells[c].origin[axis]);
+            if (float_velocities) {
+                velocity_float(slot, axis) = static_cast<float>(body.getVelocity()[axis]);
+            }
+            else {
+                velocity(slot, axis) = body.getVelocity()[axis];
+            }
+        }
+    });
+}
+
+
+
+CompactSystem::CompactSystem(const std::vector<std::shared_ptr<Particle>>& particle_list, double in_dt, double in_epsilon, bool in_float_velocities,
+                             double in_cell_size) :
+    CompactSystem(particle_list.size(), [&](const BodyVisitor& visit) {
+        for (int i = 0; i < particle_list.size(); i++) {
+            visit(i, *particle_list[i]);
+        }
+    }, in_dt, in_epsilon, in_float_velocities, in_cell_size) {}
+
+
+
+void CompactSystem::allocate() {
+    mass.resize(num_particles);
+    offset.resize(num_particles, 3);
+    velocity.resize(float_velocities ? 0 : num_particles, 3);
+    velocity_float.resize(float_velocities ? num_particles : 0, 3);
+    body_index.resize(num_particles);
+
+    // First touch with the same static split as the update loop, so on a NUMA machine each thread's bodies live on its node
+    // (bodies are then filled in cell order, which a thread's share mostly keeps to)
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_particles; i++) {
+        mass[i] = 0.0;
+        body_index[i] = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            offset(i, axis) = 0.0f;
+            if (float_velocities) {
+                velocity_float(i, axis) = 0.0f;
+            }
+            else {
+                velocity(i, axis) = 0.0;
+            }
+        }
+    }
+}
+
+
+
+void CompactSystem::buildCells(const std::vector<std::pair<std::uint64_t, int>>& key_counts) {
+    std::vector<std::pair<std::uint64_t, int>> sorted = key_counts;
+    std::sort(sorted.begin(), sorted.end()); // Key order, so the layout does not depend on the hash map
+
+    cells.clear();
+    blocks.clear();
+    int begin = 0;
+    for (const auto& [key, count] : sorted) {
+        Cell cell;
+        for (int axis = 0; axis < 3; axis++) {
+            const int shift = (2 - axis) * cell_coordinate_bits;
+            const std::int64_t coordinate = static_cast<std::int64_t>((key >> shift) & ((std::uint64_t{1} << cell_coordinate_bits) - 1)) - cell_coordinate_limit;
+            cell.origin[axis] = (coordinate + 0.5) * cell_size;
+        }
+        cell.begin = begin;
+        cell.end = begin + count;
+        begin = cell.end;
+
+        for (int block_begin = cell.begin; block_begin < cell.end; block_begin += kernel_block_rows) {
+            blocks.push_back(Block{static_cast<int>(cells.size()), block_begin, std::min(block_begin + kernel_block_rows, cell.end)});
+        }
+        cells.push_back(cell);
+    }
+}
+
+
+
+void CompactSystem::rebin() {
+    // New cell of every body, kept in a transient buffer
+    ScratchPool::Lease<std::uint64_t> keys = scratchPool().acquire<std::uint64_t>(num_particles);
+    #pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < cells.size(); c++) {
+        for (int i = cells[c].begin; i < cells[c].end; i++) {
+            keys[i] = cellKey(absolutePosition(c, i, 0), absolutePosition(c, i, 1), absolutePosition(c, i, 2));
+        }
+    }
+
+    std::unordered_map<std::uint64_t, int> counts;
+    for (int i = 0; i < num_particles; i++) {
+        counts[keys[i]]++;
+    }
+    const std::vector<Cell> old_cells = cells;
+    buildCells(std::vector<std::pair<std::uint64_t, int>>(counts.begin(), counts.end()));
+
+    // Destination slot of every body, keeping the order within each new cell, and its offset from the new origin
+    std::unordered_map<std::uint64_t, int> cell_of_key;
+    std::vector<int> next_slot(cells.size());
+    for (int c = 0; c < cells.size(); c++) {
+        cell_of_key[cellKey(cells[c].origin[0], cells[c].origin[1], cells[c].origin[2])] = c;
+        next_slot[c] = cells[c].begin;
+    }
+    ScratchPool::Lease<int> destination = scratchPool().acquire<int>(num_particles);
+    for (int c = 0; c < old_cells.size(); c++) {
+        for (int i = old_cells[c].begin; i < old_cells[c].end; i++) {
+            const int new_cell = cell_of_key.at(keys[i]);
+            destination[i] = next_slot[new_cell]++;
+            for (int axis = 0; axis < 3; axis++) {
+                const double position = old_cells[c].origin[axis] + static_cast<double>(offset(i, axis));
+                offset(i, axis) = static_cast<float>(position - cells[new_cell].origin[axis]);
+            }
+        }
+    }
+
+    // Move every body to its slot in place, following the cycles of the permutation
+    for (int i = 0; i < num_particles; i++) {
+        while (destination[i] != i) {
+            const int j = destination[i];
+            std::swap(mass[i], mass[j]);
+            std::swap(body_index[i], body_index[j]);
+            for (int axis = 0; axis < 3; axis++) {
+                std::swap(offset(i, axis), offset(j, axis));
+                if (float_velocities) {
+                    std::swap(velocity_float(i, axis), velocity_float(j, axis));
+                }
+                else {
+                    std::swap(velocity(i, axis), velocity(j, axis));
+                }
+            }
+            std::swap(destination[i], destination[j]);
+        }
+    }
+    num_rebins++;
+}
+
+
+
+template <typename Real>
+void CompactSystem::accelerations(Real* ax, Real* ay, Real* az) const {
+    const IsaKernels& kernels = isaKernels();
+    const float* x = offset.col(0).data();
+    const float* y = offset.col(1).data();
+    const float* z = offset.col(2).data();
+
+    // Each block of bodies against every cell, summed in double and stored at the precision of the velocities
+    forceExecutor().parallelFor(blocks.size(), 1, [&](int first, int last, int) {
+        double block_ax[kernel_block_rows], block_ay[kernel_block_rows], block_az[kernel_block_rows];
+
+        for (int b = first; b < last; b++) {
+            const Block& block = blocks[b];
+            const Cell& row_cell = cells[block.cell];
+            std::fill_n(block_ax, kernel_block_rows, 0.0);
+            std::fill_n(block_ay, kernel_block_rows, 0.0);
+            std::fill_n(block_az, kernel_block_rows, 0.0);
+
+            for (const Cell& source_cell : cells) {
+                kernels.compactAccelerationRows(block.begin, block.end, source_cell.begin, source_cell.end, x, y, z, mass.data(),
+                                                source_cell.origin[0] - row_cell.origin[0], source_cell.origin[1] - row_cell.origin[1],
+                                                source_cell.origin[2] - row_cell.origin[2], epsilon, block_ax, block_ay, block_az);
+            }
+            for (int i = block.begin; i < block.end; i++) {
+                ax[i] = static_cast<Real>(block_ax[i - block.begin]);
+                ay[i] = static_cast<Real>(block_ay[i - block.begin]);
+                az[i] = static_cast<Real>(block_az[i - block.begin]);
+            }
+        }
+    });
+}
+
+
+
+template <typename Real>
+void CompactSystem::stepWith(Eigen::Matrix<Real, Eigen::Dynamic, 3>& velocity_store) {
+    ScratchPool::Lease<Real> ax = scratchPool().acquire<Real>(num_particles);
+    ScratchPool::Lease<Real> ay = scratchPool().acquire<Real>(num_particles);
+    ScratchPool::Lease<Real> az = scratchPool().acquire<Real>(num_particles);
+    accelerations(ax.data(), ay.data(), az.data());
+    const Real* acceleration[3] = {ax.data(), ay.data(), az.data()};
+
+    // Euler step, noting how far the bodies have strayed from their cell origins
+    float largest_offset = 0.0f;
+    #pragma omp parallel for schedule(static) reduction(max: largest_offset)
+    for (int i = 0; i < num_particles; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            offset(i, axis) = static_cast<float>(static_cast<double>(offset(i, axis)) + dt * static_cast<double>(velocity_store(i, axis)));
+            velocity_store(i, axis) = static_cast<Real>(static_cast<double>(velocity_store(i, axis)) + dt * static_cast<double>(acceleration[axis][i]));
+            largest_offset = std::max(largest_offset, std::abs(offset(i, axis)));
+        }
+    }
+
+    // Offsets lose precision as they grow, so sort the bodies into cells again once one is a cell width from its origin
+    if (largest_offset > cell_size) {
+        rebin();
+    }
+}
+
+
+
+void CompactSystem::step(int num_steps) {
+    for (int n = 0; n < num_steps; n++) {
+        if (float_velocities) {
+            stepWith(velocity_float);
+        }
+        else {
+            stepWith(velocity);
+        }
+        sim_time += dt;
+        step_count++;
+    }
+}
+
+
+
+void CompactSystem::advanceTo(double time) {
+    while (sim_time < time) {
+        step();
+    }
+}
+
+
+
+double CompactSystem::totalKineticEnergy() const {
+    double sum = deterministicReduce(num_particles, reduction_block_size, [&](int begin, int end) {
+        double block_sum = 0.0;
+        for (int i = begin; i < end; i++) {
+            double speed_squared = 0.0;
+            for (int axis = 0; axis < 3; axis++) {
+                const double component = float_velocities ? static_cast<double>(velocity_float(i, axis)) : velocity(i, axis);
+                speed_squared += component * component;
+            }
+            block_sum += mass[i] * speed_squared;
+        }
+        return block_sum;
+    });
+    return sum * 0.5;
+}
+
+
+
+double CompactSystem::totalPotentialEnergy() const {
+    // Fixed blocks of rows, so the total is the same on any number of threads
+    double sum = deterministicReduce(blocks.size(), 1, [&](int first, int last) {
+        double block_sum = 0.0;
+        for (int b = first; b < last; b++) {
+            const Block& block = blocks[b];
+            for (int i = block.begin; i < block.end; i++) {
+                double row_sum = 0.0;
+                for (int c = 0; c < cells.size(); c++) {
+                    double shift[3];
+                    for (int axis = 0; axis < 3; axis++) {
+                        shift[axis] = cells[c].origin[axis] - cells[block.cell].origin[axis];
+                    }
+                    for (int j = cells[c].begin; j < cells[c].end; j++) {
+                        if (j == i) {
+                            continue;
+                        }
+                        double r_squared = 0.0;
+                        for (int axis = 0; axis < 3; axis++) {
+                            const double d = static_cast<double>(offset(j, axis)) - (static_cast<double>(offset(i, axis)) - shift[axis]);
+                            r_squared += d * d;
+                        }
+                        row_sum += mass[j] / std::sqrt(r_squared);
+                    }
+                }
+                block_sum += mass[i] * row_sum;
+            }
+        }
+        return block_sum;
+    });
+    return sum * -0.5;
+}
+
+
+
+double CompactSystem::totalEnergy() const {
+    return totalKineticEnergy() + totalPotentialEnergy();
+}
+
+
+
+void CompactSystem::writeBack(const std::vector<std::shared_ptr<Particle>>& particle_list) const {
+    if (particle_list.size() != num_particles) {
+        throw std::invalid_argument("The particle list must have the same number of particles as the compact system.");
+    }
+
+    ScratchPool::Lease<double> ax = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> ay = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> az = scratchPool().acquire<double>(num_particles);
+    accelerations(ax.data(), ay.data(), az.data());
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < cells.size(); c++) {
+        for (int i = cells[c].begin; i < cells[c].end; i++) {
+            Eigen::Vector3d pos(absolutePosition(c, i, 0), absolutePosition(c, i, 1), absolutePosition(c, i, 2));
+            Eigen::Vector3d vel = float_velocities ? Eigen::Vector3d(velocity_float.row(i).cast<double>().transpose())
+                                                   : Eigen::Vector3d(velocity.row(i).transpose());
+            Eigen::Vector3d acc(ax[i], ay[i], az[i]);
+            *particle_list[body_index[i]] = Particle(mass[i], pos, vel, acc);
+        }
+    }
+}
+
+
+
+int CompactSystem::getNumParticles() const {
+    return num_particles;
+}
+int CompactSystem::getNumCells() const {
+    return cells.size();
+}
+int CompactSystem::getNumRebins() const {
+    return num_rebins;
+}
+double CompactSystem::getTime() const {
+    return sim_time;
+}
+long CompactSystem::getStepCount() const {
+    return step_count;
+}
+bool CompactSystem::hasFloatVelocities() const {
+    return float_velocities;
+}
+
+
+
+std::vector<MemoryUsage> CompactSystem::getMemoryUsage() const {
+    const std::size_t n = num_particles;
+    return {
+        {"Masses", n * sizeof(double)},
+        {"Position offsets", n * 3 * sizeof(float)},
+        {float_velocities ? "Velocities (float)" : "Velocities", n * 3 * (float_velocities ? sizeof(float) : sizeof(double))},
+        {"Body indices", n * sizeof(std::uint32_t)},
+        {"Cells", cells.capacity() * sizeof(Cell) + blocks.capacity() * sizeof(Block)}
+    };
+}
@@ -0,0 +1,16 @@
+#include "deterministicSum.hpp"
+
+
+
+double pairwiseSum(const double* values, int count) {
+    // Short runs are added in order, longer ones split in half, so the tree only depends on count
+    if (count <= 8) {
+        double sum = 0.0;
+        for (int i = 0; i < count; i++) {
+            sum += values[i];
+        }
+        return sum;
+    }
+    const int half = count / 2;
+    return pairwiseSum(values, half) + pairwiseSum(values + half, count - half);
+}
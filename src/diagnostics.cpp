@@ -0,0 +1,237 @@
+#include "diagnostics.hpp"
+#include "deterministicSum.hpp"
+#include "isaDispatch.hpp"
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <omp.h>
+#include <stdexcept>
+
+
+
+DiagnosticsPipeline::DiagnosticsPipeline(const std::string& log_path, int in_num_bodies, int num_buffers, DiagnosticsOverflow in_overflow, int num_workers) :
+    num_bodies{in_num_bodies}, overflow{in_overflow}, buffers(num_buffers > 0 ? num_buffers : 0), stopping{false},
+    num_samples{0}, num_skipped{0}, stall_seconds{0.0}, next_sequence{0}, initial_energy{0.0}
+{
+    if (num_bodies <= 0 || num_buffers < 1 || num_workers < 1) {
+        throw std::invalid_argument("A diagnostics pipeline needs at least 1 body, 1 snapshot buffer and 1 worker.");
+    }
+    if (!log_path.empty()) {
+        log.open(log_path, std::ios::trunc);
+        if (!log) {
+            throw std::runtime_error("Could not open the diagnostics log " + log_path + ".");
+        }
+        log << "step,time,kinetic,potential,total,relative_energy_error,px,py,pz,lx,ly,lz,comx,comy,comz\n";
+    }
+
+    // All buffers are allocated up front, so sampling never allocates
+    for (Snapshot& buffer : buffers) {
+        for (std::vector<double>* field : {&buffer.mass, &buffer.x, &buffer.y, &buffer.z, &buffer.vx, &buffer.vy, &buffer.vz}) {
+            field->resize(num_bodies);
+        }
+        free_buffers.push_back(&buffer);
+    }
+
+    for (int i = 0; i < num_workers; i++) {
+        workers.emplace_back(&DiagnosticsPipeline::run, this);
+    }
+}
+
+
+DiagnosticsPipeline::~DiagnosticsPipeline() {
+    finish();
+}
+
+
+
+void DiagnosticsPipeline::sample(long step, double sim_time, const std::vector<std::shared_ptr<Particle>>& particle_list) {
+    if (static_cast<int>(particle_list.size()) != num_bodies) {
+        throw std::invalid_argument("This diagnostics pipeline samples systems of " + std::to_string(num_bodies) + " bodies.");
+    }
+
+    Snapshot* snapshot;
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if (stopping) {
+            return;
+        }
+        if (free_buffers.empty()) {
+            if (overflow == DiagnosticsOverflow::Skip) {
+                num_skipped++;
+                return;
+            }
+            auto wait_start = std::chrono::steady_clock::now();
+            buffer_freed.wait(lock, [this] { return !free_buffers.empty(); });
+            stall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - wait_start).count();
+        }
+        snapshot = free_buffers.back();
+        free_buffers.pop_back();
+        snapshot->sequence = num_samples++;
+    }
+
+    // The copy is the only part of a sample on the integration thread
+    snapshot->step = step;
+    snapshot->time = sim_time;
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_bodies; i++) {
+        const Particle& particle = *particle_list[i];
+        snapshot->mass[i] = particle.getMass();
+        snapshot->x[i] = particle.getPosition()[0];
+        snapshot->y[i] = particle.getPosition()[1];
+        snapshot->z[i] = particle.getPosition()[2];
+        snapshot->vx[i] = particle.getVelocity()[0];
+        snapshot->vy[i] = particle.getVelocity()[1];
+        snapshot->vz[i] = particle.getVelocity()[2];
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queued.push_back(snapshot);
+    }
+    snapshot_queued.notify_one();
+}
+
+
+StepObserver DiagnosticsPipeline::observer(int steps_per_sample) {
+    if (steps_per_sample < 1) {
+        throw std::invalid_argument("The number of steps per sample must be at least 1.");
+    }
+
+    return [this, steps_per_sample](long step, double sim_time, const std::vector<std::shared_ptr<Particle>>& particle_list) {
+        if (step % steps_per_sample == 0) {
+            sample(step, sim_time, particle_list);
+        }
+    };
+}
+
+
+void DiagnosticsPipeline::finish() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    snapshot_queued.notify_all();
+    for (std::thread& worker : workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    if (log.is_open()) {
+        log.close();
+    }
+}
+
+
+
+void DiagnosticsPipeline::run() {
+    omp_set_num_threads(1); // The integration keeps the cores; a worker only takes the time the integration leaves
+
+    while (true) {
+        Snapshot* snapshot;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            snapshot_queued.wait(lock, [this] { return stopping || !queued.empty(); });
+            if (queued.empty()) {
+                return; // Stopping, and everything queued is done
+            }
+            snapshot = queued.front();
+            queued.pop_front();
+        }
+
+        const Diagnostics result = compute(*snapshot);
+        const long sequence = snapshot->sequence;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            free_buffers.push_back(snapshot);
+        }
+        buffer_freed.notify_one();
+
+        publish(sequence, result);
+    }
+}
+
+
+Diagnostics DiagnosticsPipeline::compute(const Snapshot& snapshot) const {
+    Diagnostics result;
+    result.step = snapshot.step;
+    result.time = snapshot.time;
+
+    // Same blocks and kernels as totalKineticEnergy and totalPotentialEnergy, so the energies match them exactly
+    result.kinetic = 0.5 * deterministicReduce(num_bodies, reduction_block_size, [&](int begin, int end) {
+        double block_sum = 0.0;
+        for (int i = begin; i < end; i++) {
+            const Eigen::Vector3d velocity(snapshot.vx[i], snapshot.vy[i], snapshot.vz[i]);
+            block_sum += snapshot.mass[i] * velocity.squaredNorm();
+        }
+        return block_sum;
+    });
+    const IsaKernels& kernels = isaKernels();
+    result.potential = -0.5 * deterministicReduce(num_bodies, kernel_block_rows, [&](int begin, int end) {
+        return kernels.potentialRows(begin, end, num_bodies, snapshot.x.data(), snapshot.y.data(), snapshot.z.data(), snapshot.mass.data());
+    });
+    result.total = result.kinetic + result.potential;
+
+    double total_mass = 0.0;
+    Eigen::Vector3d mass_moment = Eigen::Vector3d::Zero();
+    result.momentum.setZero();
+    result.angular_momentum.setZero();
+    for (int i = 0; i < num_bodies; i++) {
+        const double mass = snapshot.mass[i];
+        const Eigen::Vector3d position(snapshot.x[i], snapshot.y[i], snapshot.z[i]);
+        const Eigen::Vector3d momentum = mass * Eigen::Vector3d(snapshot.vx[i], snapshot.vy[i], snapshot.vz[i]);
+        total_mass += mass;
+        mass_moment += mass * position;
+        result.momentum += momentum;
+        result.angular_momentum += position.cross(momentum);
+    }
+    result.centre_of_mass = total_mass > 0.0 ? Eigen::Vector3d(mass_moment / total_mass) : Eigen::Vector3d::Zero();
+    return result;
+}
+
+
+void DiagnosticsPipeline::publish(long sequence, const Diagnostics& result) {
+    std::lock_guard<std::mutex> lock(result_mutex);
+    waiting.emplace(sequence, result);
+
+    // Samples of different workers can finish out of order; only the next one in sequence is written
+    for (auto next = waiting.find(next_sequence); next != waiting.end(); next = waiting.find(next_sequence)) {
+        const Diagnostics& diagnostics = next->second;
+        if (next_sequence == 0) {
+            initial_energy = diagnostics.total;
+        }
+        if (log.is_open()) {
+            const double relative_error = initial_energy != 0.0 ? std::abs((diagnostics.total - initial_energy) / initial_energy) : 0.0;
+            log << diagnostics.step << "," << std::setprecision(17) << diagnostics.time << "," << diagnostics.kinetic << ","
+                << diagnostics.potential << "," << diagnostics.total << "," << std::setprecision(6) << relative_error << std::setprecision(17);
+            for (const Eigen::Vector3d* vector : {&diagnostics.momentum, &diagnostics.angular_momentum, &diagnostics.centre_of_mass}) {
+                log << "," << (*vector)[0] << "," << (*vector)[1] << "," << (*vector)[2];
+            }
+            log << "\n";
+        }
+        series.push_back(diagnostics);
+        waiting.erase(next);
+        next_sequence++;
+    }
+}
+
+
+
+std::vector<Diagnostics> DiagnosticsPipeline::getSeries() const {
+    std::lock_guard<std::mutex> lock(result_mutex);
+    return series;
+}
+
+long DiagnosticsPipeline::getNumSamples() const {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return num_samples;
+}
+
+long DiagnosticsPipeline::getNumSkipped() const {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return num_skipped;
+}
+
+double DiagnosticsPipeline::getStallSeconds() const {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return stall_seconds;
+}
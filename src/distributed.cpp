@@ -0,0 +1,334 @@
+#include "distributed.hpp"
+#include "deterministicSum.hpp"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+
+
+// Doubles per body when scattering and gathering: id, mass, position, velocity, acceleration
+constexpr int packed_doubles = 11;
+
+
+
+// Spread the low 21 bits of a value so there are two zero bits between each
+static std::uint64_t spreadBits(std::uint64_t value) {
+    value &= 0x1FFFFF;
+    value = (value | value << 32) & 0x1F00000000FFFFULL;
+    value = (value | value << 16) & 0x1F0000FF0000FFULL;
+    value = (value | value << 8) & 0x100F00F00F00F00FULL;
+    value = (value | value << 4) & 0x10C30C30C30C30C3ULL;
+    value = (value | value << 2) & 0x1249249249249249ULL;
+    return value;
+}
+
+std::uint64_t mortonKey(const Eigen::Vector3d& position, const Eigen::Vector3d& box_min, const Eigen::Vector3d& box_max) {
+    constexpr double max_cell = (1 << 21) - 1;
+    std::uint64_t cell[3];
+
+    for (int axis = 0; axis < 3; axis++) {
+        const double extent = box_max[axis] - box_min[axis];
+        const double fraction = (extent > 0.0) ? (position[axis] - box_min[axis]) / extent : 0.0;
+        cell[axis] = static_cast<std::uint64_t>(std::clamp(fraction, 0.0, 1.0) * max_cell);
+    }
+    return spreadBits(cell[0]) | spreadBits(cell[1]) << 1 | spreadBits(cell[2]) << 2;
+}
+
+
+
+
+DistributedSystem::DistributedSystem(MPI_Comm in_comm, const std::vector<std::shared_ptr<Particle>>& root_particles, double in_epsilon) :
+    comm{in_comm}, epsilon{in_epsilon}
+{
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &num_ranks);
+
+    num_global = (rank == 0) ? root_particles.size() : 0;
+    MPI_Bcast(&num_global, 1, MPI_LONG, 0, comm);
+    if (num_global < num_ranks) {
+        throw std::invalid_argument("A distributed system needs at least one body per rank.");
+    }
+
+    // Rank 0 sorts the bodies along the curve and deals out equal contiguous pieces
+    double box[6] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0}; // min xyz, max xyz
+    std::vector<double> packed;
+    std::vector<int> send_counts(num_ranks), displacements(num_ranks);
+
+    if (rank == 0) {
+        Eigen::Vector3d box_min = root_particles[0]->getPosition();
+        Eigen::Vector3d box_max = box_min;
+        for (const auto& body : root_particles) {
+            box_min = box_min.cwiseMin(body->getPosition());
+            box_max = box_max.cwiseMax(body->getPosition());
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            box[axis] = box_min[axis];
+            box[axis + 3] = box_max[axis];
+        }
+
+        std::vector<std::uint64_t> all_keys(num_global);
+        for (long i = 0; i < num_global; i++) {
+            all_keys[i] = mortonKey(root_particles[i]->getPosition(), box_min, box_max);
+        }
+        std::vector<long> order(num_global);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&all_keys](long a, long b) { return all_keys[a] < all_keys[b]; });
+
+        packed.reserve(num_global * packed_doubles);
+        for (long i : order) {
+            const Particle& body = *root_particles[i];
+            packed.push_back(static_cast<double>(i));
+            packed.push_back(body.getMass());
+            for (const Eigen::Vector3d* vector : {&body.getPosition(), &body.getVelocity(), &body.getAcceleration()}) {
+                packed.insert(packed.end(), vector->data(), vector->data() + 3);
+            }
+        }
+        for (int r = 0; r < num_ranks; r++) {
+            const long first = num_global * r / num_ranks;
+            const long last = num_global * (r + 1) / num_ranks;
+            send_counts[r] = (last - first) * packed_doubles;
+            displacements[r] = first * packed_doubles;
+        }
+    }
+    MPI_Bcast(box, 6, MPI_DOUBLE, 0, comm);
+
+    const int num_local = num_global * (rank + 1) / num_ranks - num_global * rank / num_ranks;
+    std::vector<double> local_packed(num_local * packed_doubles);
+    MPI_Scatterv(packed.data(), send_counts.data(), displacements.data(), MPI_DOUBLE,
+                 local_packed.data(), local_packed.size(), MPI_DOUBLE, 0, comm);
+
+    const Eigen::Vector3d box_min(box[0], box[1], box[2]);
+    const Eigen::Vector3d box_max(box[3], box[4], box[5]);
+    ids.resize(num_local);
+    keys.resize(num_local);
+    mass.resize(num_local);
+    position.resize(num_local, 3);
+    velocity.resize(num_local, 3);
+    acceleration.resize(num_local, 3);
+
+    for (int i = 0; i < num_local; i++) {
+        const double* body = local_packed.data() + i * packed_doubles;
+        ids[i] = static_cast<long>(body[0]);
+        mass[i] = body[1];
+        position.row(i) = Eigen::RowVector3d(body[2], body[3], body[4]);
+        velocity.row(i) = Eigen::RowVector3d(body[5], body[6], body[7]);
+        acceleration.row(i) = Eigen::RowVector3d(body[8], body[9], body[10]);
+        keys[i] = mortonKey(position.row(i).transpose(), box_min, box_max);
+    }
+
+    MPI_Allreduce(&num_local, &max_local, 1, MPI_INT, MPI_MAX, comm);
+    current_block.resize(1 + 4 * max_local);
+    next_block.resize(1 + 4 * max_local);
+}
+
+
+
+template <typename Interact>
+void DistributedSystem::ringPass(Interact&& interact) {
+    const int num_local = getNumLocal();
+
+    // This rank's own sources start the ring
+    current_block[0] = num_local;
+    for (int j = 0; j < num_local; j++) {
+        current_block[1 + j] = position(j, 0);
+        current_block[1 + max_local + j] = position(j, 1);
+        current_block[1 + 2 * max_local + j] = position(j, 2);
+        current_block[1 + 3 * max_local + j] = mass[j];
+    }
+
+    const int right = (rank + 1) % num_ranks;
+    const int left = (rank + num_ranks - 1) % num_ranks;
+
+    for (int round = 0; round < num_ranks; round++) {
+        MPI_Request requests[2];
+        const bool pass_on = round < num_ranks - 1;
+
+        // Start moving the block on before working on it, so the transfer overlaps the computation
+        if (pass_on) {
+            MPI_Irecv(next_block.data(), next_block.size(), MPI_DOUBLE, left, round, comm, &requests[0]);
+            MPI_Isend(current_block.data(), current_block.size(), MPI_DOUBLE, right, round, comm, &requests[1]);
+        }
+
+        interact(current_block.data(), round == 0);
+
+        if (pass_on) {
+            MPI_Waitall(2, requests, MPI_STATUSES_IGNORE);
+            std::swap(current_block, next_block);
+        }
+    }
+}
+
+
+
+void DistributedSystem::step(double dt) {
+    const int num_local = getNumLocal();
+    const double epsilon_squared = epsilon * epsilon;
+    acceleration.setZero();
+
+    ringPass([&](const double* block, bool local) {
+        const int num_sources = static_cast<int>(block[0]);
+        const double* x = block + 1;
+        const double* y = x + max_local;
+        const double* z = y + max_local;
+        const double* m = z + max_local;
+
+        #pragma omp parallel for
+        for (int i = 0; i < num_local; i++) {
+            const double xi = position(i, 0), yi = position(i, 1), zi = position(i, 2);
+            double acc_x = 0.0, acc_y = 0.0, acc_z = 0.0;
+
+            for (int j = 0; j < num_sources; j++) {
+                double dx = x[j] - xi;
+                double dy = y[j] - yi;
+                double dz = z[j] - zi;
+                double r_squared = dx * dx + dy * dy + dz * dz + epsilon_squared;
+
+                // Skip self interaction (only in the rank's own block) without a branch on the division
+                double self = (local && j == i) ? 1.0 : 0.0;
+                r_squared += self;
+                double factor = (1.0 - self) * m[j] / (r_squared * std::sqrt(r_squared));
+
+                acc_x += factor * dx;
+                acc_y += factor * dy;
+                acc_z += factor * dz;
+            }
+            acceleration(i, 0) += acc_x;
+            acceleration(i, 1) += acc_y;
+            acceleration(i, 2) += acc_z;
+        }
+    });
+
+    // Update position and velocity of each body
+    position += dt * velocity;
+    velocity += dt * acceleration;
+}
+
+
+
+void DistributedSystem::evolve(double dt, double total_time) {
+    if (dt <= 0.0 || total_time < 0.0) {
+        throw std::invalid_argument("The timestep must be greater than 0 and the total time must not be negative.");
+    }
+
+    for (double sim_time = 0.0; sim_time < total_time; sim_time += dt) {
+        step(dt);
+    }
+}
+
+
+
+double DistributedSystem::totalKineticEnergy() const {
+    double local_KE = 0.5 * (mass.array() * velocity.rowwise().squaredNorm().array()).sum();
+    double total_KE = 0.0;
+    MPI_Allreduce(&local_KE, &total_KE, 1, MPI_DOUBLE, MPI_SUM, comm);
+    return total_KE;
+}
+
+
+
+double DistributedSystem::totalPotentialEnergy() {
+    const int num_local = getNumLocal();
+    double local_PE = 0.0;
+
+    ringPass([&](const double* block, bool local) {
+        const int num_sources = static_cast<int>(block[0]);
+        const double* x = block + 1;
+        const double* y = x + max_local;
+        const double* z = y + max_local;
+        const double* m = z + max_local;
+
+        // Fixed blocks of rows, so the energy does not depend on the number of threads
+        local_PE += deterministicReduce(num_local, reduction_block_size, [&](int begin, int end) {
+            double rows_PE = 0.0;
+            for (int i = begin; i < end; i++) {
+                for (int j = 0; j < num_sources; j++) {
+                    if (!(local && i == j)) {
+                        double dx = x[j] - position(i, 0);
+                        double dy = y[j] - position(i, 1);
+                        double dz = z[j] - position(i, 2);
+                        rows_PE += (mass[i] * m[j]) / std::sqrt(dx * dx + dy * dy + dz * dz);
+                    }
+                }
+            }
+            return rows_PE;
+        });
+    });
+
+    double total_PE = 0.0;
+    MPI_Allreduce(&local_PE, &total_PE, 1, MPI_DOUBLE, MPI_SUM, comm);
+    return total_PE * -0.5; // Every pair was counted from both ends
+}
+
+
+
+double DistributedSystem::totalEnergy() {
+    return totalKineticEnergy() + totalPotentialEnergy();
+}
+
+
+
+std::vector<std::shared_ptr<Particle>> DistributedSystem::gather() const {
+    const int num_local = getNumLocal();
+    std::vector<double> local_packed;
+    local_packed.reserve(num_local * packed_doubles);
+    for (int i = 0; i < num_local; i++) {
+        local_packed.push_back(static_cast<double>(ids[i]));
+        local_packed.push_back(mass[i]);
+        for (const Eigen::MatrixX3d* matrix : {&position, &velocity, &acceleration}) {
+            for (int axis = 0; axis < 3; axis++) {
+                local_packed.push_back((*matrix)(i, axis));
+            }
+        }
+    }
+
+    std::vector<int> receive_counts(num_ranks), displacements(num_ranks);
+    for (int r = 0; r < num_ranks; r++) {
+        const long first = num_global * r / num_ranks;
+        const long last = num_global * (r + 1) / num_ranks;
+        receive_counts[r] = (last - first) * packed_doubles;
+        displacements[r] = first * packed_doubles;
+    }
+
+    std::vector<double> packed((rank == 0) ? num_global * packed_doubles : 0);
+    MPI_Gatherv(local_packed.data(), local_packed.size(), MPI_DOUBLE,
+                packed.data(), receive_counts.data(), displacements.data(), MPI_DOUBLE, 0, comm);
+
+    std::vector<std::shared_ptr<Particle>> particle_list;
+    if (rank == 0) {
+        particle_list.resize(num_global);
+        for (long k = 0; k < num_global; k++) {
+            const double* body = packed.data() + k * packed_doubles;
+            Eigen::Vector3d pos(body[2], body[3], body[4]);
+            Eigen::Vector3d vel(body[5], body[6], body[7]);
+            Eigen::Vector3d acc(body[8], body[9], body[10]);
+            particle_list[static_cast<long>(body[0])] = std::make_shared<Particle>(body[1], pos, vel, acc);
+        }
+    }
+    return particle_list;
+}
+
+
+
+int DistributedSystem::getRank() const {
+    return rank;
+}
+int DistributedSystem::getNumRanks() const {
+    return num_ranks;
+}
+int DistributedSystem::getNumLocal() const {
+    return ids.size();
+}
+long DistributedSystem::getNumGlobal() const {
+    return num_global;
+}
+const std::vector<long>& DistributedSystem::getLocalIds() const {
+    return ids;
+}
+std::pair<std::uint64_t, std::uint64_t> DistributedSystem::getLocalKeyRange() const {
+    auto [smallest, largest] = std::minmax_element(keys.begin(), keys.end());
+    return {*smallest, *largest};
+}
+const Eigen::MatrixX3d& DistributedSystem::getLocalPositions() const {
+    return position;
+}
@@ -0,0 +1,224 @@
+#include "ephemeris.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+
+
+Ephemeris::Ephemeris(int in_num_bodies, std::vector<double> in_times, std::vector<double> in_coefficients) :
+    num_bodies{in_num_bodies}, times{std::move(in_times)}, coefficients{std::move(in_coefficients)}
+{
+    if (num_bodies <= 0 || times.size() < 2) {
+        throw std::invalid_argument("An ephemeris needs at least 1 body and 1 segment.");
+    }
+    if (coefficients.size() != (times.size() - 1) * num_bodies * 12) {
+        throw std::invalid_argument("Ephemeris coefficients do not match the number of segments and bodies.");
+    }
+    if (!std::is_sorted(times.begin(), times.end()) || std::adjacent_find(times.begin(), times.end()) != times.end()) {
+        throw std::invalid_argument("Ephemeris times must increase.");
+    }
+}
+
+
+
+// Read a file written by save, checking the header against the size of the file before allocating anything
+static Ephemeris loadEphemeris(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    const std::streamoff file_bytes = file ? static_cast<std::streamoff>(file.tellg()) : 0;
+    file.seekg(0);
+    EphemerisFileHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || std::memcmp(header.magic, ephemeris_magic, sizeof(header.magic)) != 0) {
+        throw std::runtime_error(path + " is not an ephemeris file.");
+    }
+
+    // The file holds num_segments + 1 times and 12 coefficients per segment and body, and nothing else
+    const std::uint64_t file_doubles = (file_bytes - sizeof(header)) / sizeof(double);
+    const bool counts_fit = header.num_bodies > 0 && header.num_bodies <= static_cast<std::uint64_t>(std::numeric_limits<int>::max())
+                            && header.num_segments > 0 && header.num_segments < file_doubles
+                            && header.num_bodies <= file_doubles / (12 * header.num_segments);
+    if (!counts_fit || header.num_segments + 1 + header.num_segments * header.num_bodies * 12 != file_doubles
+        || (file_bytes - sizeof(header)) % sizeof(double) != 0) {
+        throw std::runtime_error("Ephemeris file " + path + " does not match its header.");
+    }
+
+    std::vector<double> times(header.num_segments + 1);
+    std::vector<double> coefficients(header.num_segments * header.num_bodies * 12);
+    file.read(reinterpret_cast<char*>(times.data()), times.size() * sizeof(double));
+    file.read(reinterpret_cast<char*>(coefficients.data()), coefficients.size() * sizeof(double));
+    if (!file) {
+        throw std::runtime_error("Ephemeris file " + path + " is truncated.");
+    }
+    return Ephemeris(header.num_bodies, std::move(times), std::move(coefficients));
+}
+
+
+Ephemeris::Ephemeris(const std::string& path) : Ephemeris(loadEphemeris(path)) {} // The in-memory constructor checks the times and counts
+
+
+
+std::size_t Ephemeris::findSegment(double time, double& s) const {
+    if (!(time >= times.front() && time <= times.back())) {
+        throw std::out_of_range("Time " + std::to_string(time) + " is outside the ephemeris.");
+    }
+
+    // Last knot not after the time; the end time belongs to the last segment
+    std::size_t segment = std::upper_bound(times.begin(), times.end(), time) - times.begin() - 1;
+    segment = std::min(segment, times.size() - 2);
+
+    s = (time - times[segment]) / (times[segment + 1] - times[segment]);
+    return segment;
+}
+
+const double* Ephemeris::segmentCoefficients(std::size_t segment, int body) const {
+    if (body < 0 || body >= num_bodies) {
+        throw std::out_of_range("Body " + std::to_string(body) + " is not in the ephemeris.");
+    }
+    return coefficients.data() + (segment * num_bodies + body) * 12;
+}
+
+
+
+Eigen::Vector3d Ephemeris::position(int body, double time) const {
+    double s;
+    const std::size_t segment = findSegment(time, s);
+    const double* c = segmentCoefficients(segment, body);
+
+    Eigen::Vector3d pos;
+    for (int axis = 0; axis < 3; axis++, c += 4) {
+        pos[axis] = c[0] + s * (c[1] + s * (c[2] + s * c[3]));
+    }
+    return pos;
+}
+
+
+
+Eigen::Vector3d Ephemeris::velocity(int body, double time) const {
+    double s;
+    const std::size_t segment = findSegment(time, s);
+    const double* c = segmentCoefficients(segment, body);
+    const double h = times[segment + 1] - times[segment];
+
+    Eigen::Vector3d vel;
+    for (int axis = 0; axis < 3; axis++, c += 4) {
+        vel[axis] = (c[1] + s * (2.0 * c[2] + s * 3.0 * c[3])) / h;
+    }
+    return vel;
+}
+
+
+
+void Ephemeris::save(const std::string& path) const {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+    EphemerisFileHeader header;
+    std::memcpy(header.magic, ephemeris_magic, sizeof(header.magic));
+    header.num_bodies = num_bodies;
+    header.num_segments = getNumSegments();
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(times.data()), times.size() * sizeof(double));
+    file.write(reinterpret_cast<const char*>(coefficients.data()), coefficients.size() * sizeof(double));
+    if (!file) {
+        throw std::runtime_error("Could not write ephemeris file " + path);
+    }
+}
+
+
+
+int Ephemeris::getNumBodies() const {
+    return num_bodies;
+}
+
+std::size_t Ephemeris::getNumSegments() const {
+    return times.size() - 1;
+}
+
+double Ephemeris::getStartTime() const {
+    return times.front();
+}
+
+double Ephemeris::getEndTime() const {
+    return times.back();
+}
+
+
+
+
+EphemerisRecorder::EphemerisRecorder(int in_num_bodies) : num_bodies{in_num_bodies} {
+    if (num_bodies <= 0) {
+        throw std::invalid_argument("An ephemeris needs at least 1 body.");
+    }
+    previous_state.resize(6 * num_bodies);
+}
+
+
+
+void EphemerisRecorder::record(double time, const std::vector<std::shared_ptr<Particle>>& particle_list) {
+    if (particle_list.size() != static_cast<std::size_t>(num_bodies)) {
+        throw std::invalid_argument("The number of bodies does not match the ephemeris.");
+    }
+    if (!times.empty() && !(time > times.back())) {
+        throw std::invalid_argument("Ephemeris samples must be recorded at increasing times.");
+    }
+
+    if (!times.empty()) {
+        const double h = time - times.back();
+
+        for (int i = 0; i < num_bodies; i++) {
+            const Eigen::Vector3d& pos = particle_list[i]->getPosition();
+            const Eigen::Vector3d& vel = particle_list[i]->getVelocity();
+
+            for (int axis = 0; axis < 3; axis++) {
+                const double p0 = previous_state[6 * i + axis];
+                const double v0 = previous_state[6 * i + 3 + axis] * h;
+                const double p1 = pos[axis];
+                const double v1 = vel[axis] * h;
+
+                // Cubic Hermite in s, with both velocities scaled to the segment length
+                coefficients.push_back(p0);
+                coefficients.push_back(v0);
+                coefficients.push_back(3.0 * (p1 - p0) - 2.0 * v0 - v1);
+                coefficients.push_back(2.0 * (p0 - p1) + v0 + v1);
+            }
+        }
+    }
+
+    for (int i = 0; i < num_bodies; i++) {
+        const Eigen::Vector3d& pos = particle_list[i]->getPosition();
+        const Eigen::Vector3d& vel = particle_list[i]->getVelocity();
+        for (int axis = 0; axis < 3; axis++) {
+            previous_state[6 * i + axis] = pos[axis];
+            previous_state[6 * i + 3 + axis] = vel[axis];
+        }
+    }
+    times.push_back(time);
+}
+
+
+
+StepObserver EphemerisRecorder::observer(int steps_per_sample) {
+    if (steps_per_sample < 1) {
+        throw std::invalid_argument("The number of steps per sample must be at least 1.");
+    }
+
+    return [this, steps_per_sample](long step, double sim_time, const std::vector<std::shared_ptr<Particle>>& particle_list) {
+        if (step % steps_per_sample == 0) {
+            record(sim_time, particle_list);
+        }
+    };
+}
+
+
+
+std::size_t EphemerisRecorder::getNumSegments() const {
+    return times.empty() ? 0 : times.size() - 1;
+}
+
+
+
+Ephemeris EphemerisRecorder::build() const {
+    return Ephemeris(num_bodies, times, coefficients);
+}
@@ -0,0 +1,191 @@
+#include "forceKernels.hpp"
+#include "isaDispatch.hpp"
+#include "particleArena.hpp"
+#include "workStealing.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+
+
+ForcePrecision parseForcePrecision(const std::string& name) {
+    if (name == "double") {
+        return ForcePrecision::Double;
+    }
+    else if (name == "mixed") {
+        return ForcePrecision::Mixed;
+    }
+    throw std::invalid_argument("Force precision must be 'double' or 'mixed'.");
+}
+
+
+
+ForceLaw parseForceLaw(const std::string& name) {
+    if (name == "plummer") {
+        return ForceLaw::Plummer;
+    }
+    else if (name == "spline") {
+        return ForceLaw::Spline;
+    }
+    else if (name == "newtonian") {
+        return ForceLaw::Newtonian;
+    }
+    else if (name == "post-newtonian") {
+        return ForceLaw::PostNewtonian;
+    }
+    throw std::invalid_argument("Force law must be 'plummer', 'spline', 'newtonian' or 'post-newtonian'.");
+}
+
+
+
+std::string forceLawName(ForceLaw law) {
+    switch (law) {
+        case ForceLaw::Spline: return "spline";
+        case ForceLaw::Newtonian: return "newtonian";
+        case ForceLaw::PostNewtonian: return "post-newtonian";
+        default: return "plummer";
+    }
+}
+
+
+
+// Direct summation in double precision, the same arithmetic as sumAccelerations
+static void doublePrecisionAccelerations(const std::vector<std::shared_ptr<Particle>>& particle_list, std::vector<Eigen::Vector3d>& acc_out, double epsilon) {
+    const int num_particles = particle_list.size();
+
+    forceExecutor().parallelFor(num_particles, 0, [&](int begin, int end, int) {
+        for (int i = begin; i < end; i++) {
+            Eigen::Vector3d acc_tot(0.0, 0.0, 0.0);
+
+            for (int j = 0; j < num_particles; j++) {
+                if (i != j) {
+                    acc_tot += calcAcceleration(*particle_list[i], *particle_list[j], epsilon);
+                }
+            }
+            acc_out[i] = acc_tot;
+        }
+    });
+}
+
+
+
+// Direct summation with float pairwise arithmetic
+// Positions stay in double and each separation is taken in double relative to the target particle (the local origin),
+// so only the separation is rounded to float. The costly r^2, square root and division then run at float width
+// Each tile of sources is summed in float and the tile sums are accumulated in double
+static void mixedPrecisionAccelerations(const std::vector<std::shared_ptr<Particle>>& particle_list, std::vector<Eigen::Vector3d>& acc_out, double epsilon) {
+    const int num_particles = particle_list.size();
+
+    // Structure of arrays so the inner loop reads contiguous data, in reused scratch buffers
+    ScratchPool::Lease<double> x = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> y = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> z = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<float> mass = scratchPool().acquire<float>(num_particles);
+
+    #pragma omp parallel for
+    for (int i = 0; i < num_particles; i++) {
+        const Eigen::Vector3d position = particle_list[i]->getPosition();
+        x[i] = position[0];
+        y[i] = position[1];
+        z[i] = position[2];
+        mass[i] = static_cast<float>(particle_list[i]->getMass());
+    }
+
+    ScratchPool::Lease<double> ax = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> ay = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> az = scratchPool().acquire<double>(num_particles);
+    const IsaKernels& kernels = isaKernels();
+    const float epsilon_squared = static_cast<float>(epsilon * epsilon);
+
+    #pragma omp parallel for schedule(static)
+    for (int begin = 0; begin < num_particles; begin += kernel_block_rows) {
+        const int end = std::min(begin + kernel_block_rows, num_particles);
+        kernels.mixedAccelerationRows(begin, end, num_particles, x.data(), y.data(), z.data(), mass.data(), epsilon_squared, ax.data(), ay.data(), az.data());
+
+        for (int i = begin; i < end; i++) {
+            acc_out[i] = Eigen::Vector3d(ax[i], ay[i], az[i]);
+        }
+    }
+}
+
+
+
+void directAccelerationsWorkshare(int num_particles, const double* x, const double* y, const double* z, const double* mass, double epsilon,
+                                  double* ax, double* ay, double* az) {
+    const IsaKernels& kernels = isaKernels();
+
+    #pragma omp for schedule(static)
+    for (int begin = 0; begin < num_particles; begin += kernel_block_rows) {
+        kernels.accelerationRows[static_cast<int>(ForceLaw::Plummer)](begin, std::min(begin + kernel_block_rows, num_particles), num_particles, x, y, z,
+                                                                      nullptr, nullptr, nullptr, mass, epsilon, ax, ay, az);
+    }
+}
+
+
+
+void directAccelerations(int num_particles, const double* x, const double* y, const double* z, const double* mass, double epsilon,
+                         double* ax, double* ay, double* az) {
+    #pragma omp parallel
+    directAccelerationsWorkshare(num_particles, x, y, z, mass, epsilon, ax, ay, az);
+}
+
+
+
+// Direct summation in double precision with any force law, on the structure of arrays kernel of that law
+static void forceLawAccelerations(const std::vector<std::shared_ptr<Particle>>& particle_list, std::vector<Eigen::Vector3d>& acc_out, double epsilon,
+                                  ForceLaw law) {
+    const int num_particles = particle_list.size();
+    const bool with_velocity = law == ForceLaw::PostNewtonian;
+
+    ScratchPool::Lease<double> mass = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> x = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> y = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> z = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> vx = scratchPool().acquire<double>(with_velocity ? num_particles : 0);
+    ScratchPool::Lease<double> vy = scratchPool().acquire<double>(with_velocity ? num_particles : 0);
+    ScratchPool::Lease<double> vz = scratchPool().acquire<double>(with_velocity ? num_particles : 0);
+    ScratchPool::Lease<double> ax = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> ay = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> az = scratchPool().acquire<double>(num_particles);
+
+    #pragma omp parallel for
+    for (int i = 0; i < num_particles; i++) {
+        mass[i] = particle_list[i]->getMass();
+        x[i] = particle_list[i]->getPosition()[0];
+        y[i] = particle_list[i]->getPosition()[1];
+        z[i] = particle_list[i]->getPosition()[2];
+        if (with_velocity) {
+            vx[i] = particle_list[i]->getVelocity()[0];
+            vy[i] = particle_list[i]->getVelocity()[1];
+            vz[i] = particle_list[i]->getVelocity()[2];
+        }
+    }
+
+    const auto kernel = isaKernels().accelerationRows[static_cast<int>(law)];
+    forceExecutor().parallelFor(num_particles, 0, [&](int begin, int end, int) {
+        kernel(begin, end, num_particles, x.data(), y.data(), z.data(), vx.data(), vy.data(), vz.data(), mass.data(), epsilon, ax.data(), ay.data(), az.data());
+        for (int i = begin; i < end; i++) {
+            acc_out[i] = Eigen::Vector3d(ax[i], ay[i], az[i]);
+        }
+    });
+}
+
+
+
+void computeAccelerations(const std::vector<std::shared_ptr<Particle>>& particle_list, std::vector<Eigen::Vector3d>& acc_out,
+                          double epsilon, ForcePrecision precision, ForceLaw law) {
+    acc_out.resize(particle_list.size());
+
+    if (law != ForceLaw::Plummer) {
+        if (precision != ForcePrecision::Double) {
+            throw std::invalid_argument("The " + forceLawName(law) + " force law needs double precision.");
+        }
+        forceLawAccelerations(particle_list, acc_out, epsilon, law);
+    }
+    else if (precision == ForcePrecision::Mixed) {
+        mixedPrecisionAccelerations(particle_list, acc_out, epsilon);
+    }
+    else {
+        doublePrecisionAccelerations(particle_list, acc_out, epsilon);
+    }
+}
@@ -0,0 +1,437 @@
+#include "frameServer.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+
+// A client further behind than this stops receiving frames until it catches up
+constexpr std::size_t max_client_backlog_bytes = 16 << 20;
+
+// Doubles stored per body in a queued frame: position, velocity, acceleration, mass
+constexpr int queued_doubles_per_body = 10;
+
+
+
+int doublesPerBody(std::uint32_t field_mask) {
+    return 3 * ((field_mask & field_position) != 0) + 3 * ((field_mask & field_velocity) != 0)
+         + 3 * ((field_mask & field_acceleration) != 0) + ((field_mask & field_mass) != 0);
+}
+
+static void appendBytes(std::vector<char>& buffer, const void* data, std::size_t bytes) {
+    const char* first = static_cast<const char*>(data);
+    buffer.insert(buffer.end(), first, first + bytes);
+}
+
+static std::runtime_error systemError(const std::string& what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+
+
+
+FrameServer::FrameServer(const std::string& in_socket_path, int in_num_bodies, std::size_t in_max_queued_frames) :
+    socket_path{in_socket_path}, num_bodies{in_num_bodies}, max_queued_frames{in_max_queued_frames},
+    listen_fd{-1}, epoll_fd{-1}, wake_fd{-1},
+    num_subscribers{0}, frames_published{0}, frames_dropped{0}, stopping{false}
+{
+    if (num_bodies <= 0 || max_queued_frames == 0) {
+        throw std::invalid_argument("A frame server needs at least 1 body and room for 1 queued frame.");
+    }
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.empty() || socket_path.size() >= sizeof(address.sun_path)) {
+        throw std::invalid_argument("Invalid frame server socket path: " + socket_path);
+    }
+    std::strcpy(address.sun_path, socket_path.c_str());
+
+    auto fail = [this](const std::string& what) {
+        std::runtime_error error = systemError(what);
+        for (int fd : {listen_fd, epoll_fd, wake_fd}) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+        return error;
+    };
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        throw fail("Could not create frame server socket");
+    }
+    unlink(socket_path.c_str()); // Left behind by a previous run
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listen_fd, 16) != 0) {
+        throw fail("Could not listen on " + socket_path);
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || wake_fd < 0) {
+        throw fail("Could not create frame server events");
+    }
+
+    for (int fd : {listen_fd, wake_fd}) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            throw fail("Could not watch frame server events");
+        }
+    }
+
+    server_thread = std::thread(&FrameServer::run, this);
+}
+
+
+
+FrameServer::~FrameServer() {
+    stopping = true;
+    const std::uint64_t one = 1;
+    [[maybe_unused]] ssize_t written = write(wake_fd, &one, sizeof(one));
+    server_thread.join();
+
+    close(wake_fd);
+    close(epoll_fd);
+    close(listen_fd);
+    unlink(socket_path.c_str());
+}
+
+
+
+void FrameServer::publish(long step, double sim_time, const std::vector<std::shared_ptr<Particle>>& particle_list) {
+    if (particle_list.size() != static_cast<std::size_t>(num_bodies)) {
+        throw std::invalid_argument("The number of bodies does not match the frame server.");
+    }
+
+    QueuedFrame frame;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (!spare_frames.empty()) {
+            frame = std::move(spare_frames.back());
+            spare_frames.pop_back();
+        }
+    }
+
+    // Copy outside the lock so the server thread is never held up by it
+    frame.step = step;
+    frame.time = sim_time;
+    frame.state.resize(queued_doubles_per_body * num_bodies);
+    double* state = frame.state.data();
+    for (const std::shared_ptr<Particle>& body : particle_list) {
+        const Eigen::Vector3d& pos = body->getPosition();
+        const Eigen::Vector3d& vel = body->getVelocity();
+        const Eigen::Vector3d& acc = body->getAcceleration();
+        state[0] = pos[0]; state[1] = pos[1]; state[2] = pos[2];
+        state[3] = vel[0]; state[4] = vel[1]; state[5] = vel[2];
+        state[6] = acc[0]; state[7] = acc[1]; state[8] = acc[2];
+        state[9] = body->getMass();
+        state += queued_doubles_per_body;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (queue.size() >= max_queued_frames) { // Server thread is behind, drop the oldest frame
+            spare_frames.push_back(std::move(queue.front()));
+            queue.pop_front();
+            frames_dropped++;
+        }
+        queue.push_back(std::move(frame));
+    }
+    frames_published++;
+
+    const std::uint64_t one = 1;
+    [[maybe_unused]] ssize_t written = write(wake_fd, &one, sizeof(one));
+}
+
+
+
+StepObserver FrameServer::observer(int steps_per_frame) {
+    if (steps_per_frame < 1) {
+        throw std::invalid_argument("The number of steps per frame must be at least 1.");
+    }
+
+    return [this, steps_per_frame](long step, double sim_time, const std::vector<std::shared_ptr<Particle>>& particle_list) {
+        if (step % steps_per_frame == 0) {
+            publish(step, sim_time, particle_list);
+        }
+    };
+}
+
+
+
+int FrameServer::getNumSubscribers() const {
+    return num_subscribers;
+}
+
+std::uint64_t FrameServer::getFramesPublished() const {
+    return frames_published;
+}
+
+std::uint64_t FrameServer::getFramesDropped() const {
+    return frames_dropped;
+}
+
+
+
+
+void FrameServer::run() {
+    epoll_event events[16];
+
+    while (!stopping) {
+        int num_events = epoll_wait(epoll_fd, events, 16, -1);
+        if (num_events < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        for (int e = 0; e < num_events; e++) {
+            const int fd = events[e].data.fd;
+
+            if (fd == listen_fd) {
+                acceptClients();
+            }
+            else if (fd == wake_fd) {
+                std::uint64_t count;
+                [[maybe_unused]] ssize_t bytes = read(wake_fd, &count, sizeof(count));
+                drainQueue();
+            }
+            else {
+                for (std::size_t i = 0; i < clients.size(); i++) {
+                    if (clients[i].fd != fd) {
+                        continue;
+                    }
+
+                    bool keep = !(events[e].events & EPOLLERR);
+                    if (keep && (events[e].events & (EPOLLIN | EPOLLHUP))) {
+                        keep = readRequest(clients[i]);
+                    }
+                    if (keep && (events[e].events & EPOLLOUT)) {
+                        keep = flush(clients[i]);
+                    }
+                    if (!keep) {
+                        closeClient(i);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    // Send what was queued before stopping, giving each client a moment to take it
+    drainQueue();
+    for (Client& client : clients) {
+        fcntl(client.fd, F_SETFL, fcntl(client.fd, F_GETFL) & ~O_NONBLOCK);
+        timeval timeout{1, 0};
+        setsockopt(client.fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        flush(client);
+    }
+    while (!clients.empty()) {
+        closeClient(clients.size() - 1);
+    }
+}
+
+
+
+void FrameServer::acceptClients() {
+    while (true) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return; // EAGAIN once every pending connection is accepted
+        }
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            continue;
+        }
+
+        Client client;
+        client.fd = fd;
+        clients.push_back(std::move(client));
+    }
+}
+
+
+
+bool FrameServer::readRequest(Client& client) {
+    char buffer[4096];
+    while (true) {
+        ssize_t bytes = recv(client.fd, buffer, sizeof(buffer), 0);
+        if (bytes > 0) {
+            if (!client.subscribed) { // Anything sent after the subscription is ignored
+                client.request.insert(client.request.end(), buffer, buffer + bytes);
+            }
+        }
+        else if (bytes == 0) { // Client closed the connection
+            return false;
+        }
+        else if (errno == EINTR) {
+            continue;
+        }
+        else {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+            break;
+        }
+    }
+
+    if (client.subscribed || client.request.size() < sizeof(SubscriptionRequest)) {
+        return true;
+    }
+
+    SubscriptionRequest request;
+    std::memcpy(&request, client.request.data(), sizeof(request));
+    if (request.magic != frame_server_magic || request.decimation < 1 || request.field_mask == 0 || request.field_mask > 15
+        || request.num_bodies > static_cast<std::uint32_t>(num_bodies)) {
+        return false;
+    }
+
+    const std::size_t request_bytes = sizeof(request) + request.num_bodies * sizeof(std::uint32_t);
+    if (client.request.size() < request_bytes) {
+        return true; // Rest of the body list still to come
+    }
+
+    client.bodies.resize(request.num_bodies);
+    std::memcpy(client.bodies.data(), client.request.data() + sizeof(request), request.num_bodies * sizeof(std::uint32_t));
+    for (std::uint32_t body : client.bodies) {
+        if (body >= static_cast<std::uint32_t>(num_bodies)) {
+            return false;
+        }
+    }
+    if (client.bodies.empty()) { // Every body
+        for (int i = 0; i < num_bodies; i++) {
+            client.bodies.push_back(i);
+        }
+    }
+
+    client.decimation = request.decimation;
+    client.field_mask = request.field_mask;
+    client.subscribed = true;
+    client.request.clear();
+    client.request.shrink_to_fit();
+    num_subscribers++;
+    return true;
+}
+
+
+
+void FrameServer::encodeFrame(Client& client, const QueuedFrame& frame) {
+    if (client.outgoing.size() - client.sent > max_client_backlog_bytes) {
+        return; // Client is not keeping up
+    }
+
+    FrameMessageHeader header{frame_server_magic, client.field_mask, static_cast<std::uint32_t>(client.bodies.size()), 0, frame.step, frame.time};
+    appendBytes(client.outgoing, &header, sizeof(header));
+
+    for (std::uint32_t body : client.bodies) {
+        const double* state = frame.state.data() + queued_doubles_per_body * body;
+        if (client.field_mask & field_position) {
+            appendBytes(client.outgoing, state, 3 * sizeof(double));
+        }
+        if (client.field_mask & field_velocity) {
+            appendBytes(client.outgoing, state + 3, 3 * sizeof(double));
+        }
+        if (client.field_mask & field_acceleration) {
+            appendBytes(client.outgoing, state + 6, 3 * sizeof(double));
+        }
+        if (client.field_mask & field_mass) {
+            appendBytes(client.outgoing, state + 9, sizeof(double));
+        }
+    }
+}
+
+
+
+bool FrameServer::flush(Client& client) {
+    while (client.sent < client.outgoing.size()) {
+        ssize_t bytes = send(client.fd, client.outgoing.data() + client.sent, client.outgoing.size() - client.sent, MSG_NOSIGNAL);
+        if (bytes > 0) {
+            client.sent += bytes;
+        }
+        else if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            watchWrites(client, true); // Carry on when the socket has room again
+            return true;
+        }
+        else {
+            return false;
+        }
+    }
+
+    client.outgoing.clear();
+    client.sent = 0;
+    watchWrites(client, false);
+    return true;
+}
+
+
+
+void FrameServer::watchWrites(Client& client, bool enable) {
+    if (client.want_write == enable) {
+        return;
+    }
+
+    epoll_event event{};
+    event.events = enable ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    event.data.fd = client.fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client.fd, &event);
+    client.want_write = enable;
+}
+
+
+
+void FrameServer::closeClient(std::size_t index) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, clients[index].fd, nullptr);
+    close(clients[index].fd);
+    if (clients[index].subscribed) {
+        num_subscribers--;
+    }
+    clients.erase(clients.begin() + index);
+}
+
+
+
+void FrameServer::drainQueue() {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        while (!queue.empty()) {
+            draining.push_back(std::move(queue.front()));
+            queue.pop_front();
+        }
+    }
+
+    // Batch every waiting frame into each client's buffer, then send once per client
+    for (const QueuedFrame& frame : draining) {
+        for (Client& client : clients) {
+            if (client.subscribed && client.frames_seen++ % client.decimation == 0) {
+                encodeFrame(client, frame);
+            }
+        }
+    }
+
+    for (std::size_t i = clients.size(); i-- > 0;) {
+        if (!flush(clients[i])) {
+            closeClient(i);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    for (QueuedFrame& frame : draining) {
+        spare_frames.push_back(std::move(frame));
+    }
+    draining.clear();
+}
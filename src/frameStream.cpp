@@ -0,0 +1,41 @@
+#include "frameStream.hpp"
+#include <stdexcept>
+
+
+
+bool FrameStream::next() {
+    if (!handle || handle.done()) {
+        return false;
+    }
+
+    handle.resume();
+
+    if (handle.promise().exception) {
+        std::rethrow_exception(handle.promise().exception);
+    }
+    return !handle.done();
+}
+
+
+
+FrameStream streamFrames(Simulation& simulation, int steps_per_frame, double end_time) {
+    if (steps_per_frame < 1) {
+        throw std::invalid_argument("The number of steps per frame must be at least 1.");
+    }
+
+    co_yield FrameView{simulation.getStepCount(), simulation.getTime(), &simulation};
+
+    while (simulation.getTime() < end_time) {
+        simulation.step(steps_per_frame);
+        co_yield FrameView{simulation.getStepCount(), simulation.getTime(), &simulation};
+    }
+}
+
+
+
+FrameStream streamFramesAtTimes(Simulation& simulation, std::vector<double> times) {
+    for (double time : times) {
+        simulation.advanceTo(time);
+        co_yield FrameView{simulation.getStepCount(), simulation.getTime(), &simulation};
+    }
+}
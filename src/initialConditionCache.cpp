@@ -0,0 +1,232 @@
+#include "initialConditionCache.hpp"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+
+// Layout of a cache file: header, the parameters padded to a multiple of 8 bytes, then 10 doubles per body
+struct InitialConditionHeader {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint64_t num_bodies;
+    std::uint64_t parameters_bytes;
+};
+
+constexpr std::uint32_t initial_condition_magic = 0x4E424943; // "NBIC"
+constexpr std::uint32_t initial_condition_version = 1;
+constexpr int doubles_per_body = initial_condition_doubles_per_body;
+
+
+static std::size_t paddedLength(std::size_t bytes) {
+    return (bytes + 7) / 8 * 8;
+}
+
+
+
+std::size_t initialConditionDataOffset(const void* file, std::size_t file_bytes, std::size_t& num_bodies) {
+    if (file_bytes < sizeof(InitialConditionHeader)) {
+        return 0;
+    }
+    InitialConditionHeader header;
+    std::memcpy(&header, file, sizeof(header));
+    if (header.magic != initial_condition_magic || header.version != initial_condition_version || header.parameters_bytes > file_bytes) {
+        return 0;
+    }
+    const std::size_t data_offset = sizeof(header) + paddedLength(header.parameters_bytes);
+    const std::size_t body_bytes = doubles_per_body * sizeof(double);
+    if (data_offset > file_bytes || (file_bytes - data_offset) / body_bytes != header.num_bodies || (file_bytes - data_offset) % body_bytes != 0) {
+        return 0;
+    }
+    num_bodies = header.num_bodies;
+    return data_offset;
+}
+
+
+std::string initialConditionParameters(const void* file) {
+    InitialConditionHeader header;
+    std::memcpy(&header, file, sizeof(header));
+    return std::string(static_cast<const char*>(file) + sizeof(header), header.parameters_bytes);
+}
+
+
+
+std::string initialConditionKey(const std::string& parameters) {
+    std::uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : parameters) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    std::ostringstream key;
+    key << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return key.str();
+}
+
+
+std::string initialConditionPath(const std::string& directory, const std::string& parameters) {
+    return directory + "/ic-" + initialConditionKey(parameters) + ".bin";
+}
+
+
+
+std::shared_ptr<const MappedInitialConditions> MappedInitialConditions::open(const std::string& path, const std::string& parameters) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(InitialConditionHeader)) {
+        ::close(fd);
+        return nullptr;
+    }
+    const std::size_t file_bytes = status.st_size;
+    void* mapping = mmap(nullptr, file_bytes, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0); // Fault the pages in at once, not one at a time
+    ::close(fd); // The mapping keeps the file open
+    if (mapping == MAP_FAILED) {
+        return nullptr;
+    }
+
+    // Only accept a complete file for exactly these parameters (two parameter sets could share a hash)
+    const char* bytes = static_cast<const char*>(mapping);
+    std::size_t num_bodies = 0;
+    const std::size_t data_offset = initialConditionDataOffset(bytes, file_bytes, num_bodies);
+    if (data_offset == 0 || initialConditionParameters(bytes) != parameters) {
+        munmap(mapping, file_bytes);
+        return nullptr;
+    }
+
+    const double* bodies = reinterpret_cast<const double*>(bytes + data_offset);
+    return std::shared_ptr<const MappedInitialConditions>(new MappedInitialConditions(mapping, file_bytes, bodies, num_bodies));
+}
+
+
+MappedInitialConditions::MappedInitialConditions(void* in_mapping, std::size_t in_file_bytes, const double* in_bodies, std::size_t in_num_bodies) :
+    mapping{in_mapping}, file_bytes{in_file_bytes}, bodies{in_bodies}, num_bodies{in_num_bodies} {}
+
+
+MappedInitialConditions::~MappedInitialConditions() {
+    munmap(mapping, file_bytes);
+}
+
+
+
+static Particle bodyAt(const double* body) {
+    Eigen::Vector3d position(body[1], body[2], body[3]);
+    Eigen::Vector3d velocity(body[4], body[5], body[6]);
+    Eigen::Vector3d acceleration(body[7], body[8], body[9]);
+    return Particle {body[0], position, velocity, acceleration};
+}
+
+
+std::vector<std::shared_ptr<Particle>> MappedInitialConditions::instantiate(std::shared_ptr<ParticleArena>& arena) const {
+    arena = ParticleArena::create(num_bodies);
+    return arena->emplaceMany(num_bodies, [&](long i) { return bodyAt(bodies + i * doubles_per_body); });
+}
+
+
+void MappedInitialConditions::reset(const std::vector<std::shared_ptr<Particle>>& particle_list) const {
+    if (particle_list.size() != num_bodies) {
+        throw std::invalid_argument("Can only reset a list of " + std::to_string(num_bodies) + " bodies from this cache file.");
+    }
+    const long count = num_bodies;
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < count; i++) {
+        *particle_list[i] = bodyAt(bodies + i * doubles_per_body);
+    }
+}
+
+
+std::size_t MappedInitialConditions::getNumBodies() const {
+    return num_bodies;
+}
+
+std::size_t MappedInitialConditions::getFileBytes() const {
+    return file_bytes;
+}
+
+
+
+static void packBody(const Particle& particle, double* body) {
+    body[0] = particle.getMass();
+    for (int axis = 0; axis < 3; axis++) {
+        body[1 + axis] = particle.getPosition()[axis];
+        body[4 + axis] = particle.getVelocity()[axis];
+        body[7 + axis] = particle.getAcceleration()[axis];
+    }
+}
+
+
+// Write the header and whatever write_bodies writes under a temporary name, then rename the file into place
+static void writeInitialConditionFile(const std::string& path, const std::string& parameters, long num_bodies,
+                                      const std::function<void(std::ofstream& file)>& write_bodies) {
+    const std::filesystem::path file_path(path);
+    if (file_path.has_parent_path()) {
+        std::filesystem::create_directories(file_path.parent_path());
+    }
+
+    InitialConditionHeader header{initial_condition_magic, initial_condition_version, static_cast<std::uint64_t>(num_bodies), parameters.size()};
+    std::string padded_parameters = parameters;
+    padded_parameters.resize(paddedLength(parameters.size()), '\0');
+
+    const std::string temporary_path = path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(padded_parameters.data(), padded_parameters.size());
+        write_bodies(file);
+        if (!file) {
+            std::remove(temporary_path.c_str());
+            throw std::runtime_error("Could not write the initial condition cache file " + path + ".");
+        }
+    }
+    if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+        std::remove(temporary_path.c_str());
+        throw std::runtime_error("Could not move the initial condition cache file into place at " + path + ".");
+    }
+}
+
+
+void saveInitialConditions(const std::string& path, const std::string& parameters, const std::vector<std::shared_ptr<Particle>>& particle_list) {
+    // Pack the bodies in parallel, then write everything in one go
+    const long num_bodies = particle_list.size();
+    std::vector<double> bodies(num_bodies * doubles_per_body);
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < num_bodies; i++) {
+        packBody(*particle_list[i], bodies.data() + i * doubles_per_body);
+    }
+
+    writeInitialConditionFile(path, parameters, num_bodies, [&](std::ofstream& file) {
+        file.write(reinterpret_cast<const char*>(bodies.data()), bodies.size() * sizeof(double));
+    });
+}
+
+
+void saveInitialConditions(const std::string& path, const std::string& parameters, long num_bodies, const InitialConditionSource& source) {
+    constexpr long bodies_per_write = 65536;
+    std::vector<double> bodies(bodies_per_write * doubles_per_body);
+
+    writeInitialConditionFile(path, parameters, num_bodies, [&](std::ofstream& file) {
+        long num_written = 0;
+        long num_packed = 0;
+        source([&](int, const Particle& particle) {
+            packBody(particle, bodies.data() + num_packed * doubles_per_body);
+            if (++num_packed == bodies_per_write) {
+                file.write(reinterpret_cast<const char*>(bodies.data()), num_packed * doubles_per_body * sizeof(double));
+                num_written += num_packed;
+                num_packed = 0;
+            }
+        });
+        file.write(reinterpret_cast<const char*>(bodies.data()), num_packed * doubles_per_body * sizeof(double));
+        if (num_written + num_packed != num_bodies) {
+            file.setstate(std::ios::failbit); // The source gave a different number of bodies than the header says
+        }
+    });
+}
@@ -0,0 +1,111 @@
+#include "isaDispatch.hpp"
+#include <stdexcept>
+
+
+// One copy of the kernels per level, from the isaKernels.cpp object libraries
+namespace isa_baseline { IsaKernels kernelTable(); }
+#ifdef NBODY_MULTI_ISA
+namespace isa_sse42 { IsaKernels kernelTable(); }
+namespace isa_avx2 { IsaKernels kernelTable(); }
+namespace isa_avx512 { IsaKernels kernelTable(); }
+#endif
+
+
+
+IsaLevel parseIsaLevel(const std::string& name) {
+    if (name == "baseline") {
+        return IsaLevel::Baseline;
+    }
+    else if (name == "sse4.2") {
+        return IsaLevel::SSE42;
+    }
+    else if (name == "avx2") {
+        return IsaLevel::AVX2;
+    }
+    else if (name == "avx512") {
+        return IsaLevel::AVX512;
+    }
+    throw std::invalid_argument("Instruction set must be 'baseline', 'sse4.2', 'avx2' or 'avx512'.");
+}
+
+
+
+std::string isaLevelName(IsaLevel level) {
+    switch (level) {
+        case IsaLevel::SSE42: return "sse4.2";
+        case IsaLevel::AVX2: return "avx2";
+        case IsaLevel::AVX512: return "avx512";
+        default: return "baseline";
+    }
+}
+
+
+
+IsaLevel detectIsaLevel() {
+#ifdef NBODY_MULTI_ISA
+    // The compiler's CPU check also asks the operating system whether it saves the AVX registers
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512bw")
+        && __builtin_cpu_supports("avx512vl")) {
+        return IsaLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return IsaLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+        return IsaLevel::SSE42;
+    }
+#endif
+    return IsaLevel::Baseline;
+}
+
+
+
+static IsaKernels kernelsFor(IsaLevel level) {
+#ifdef NBODY_MULTI_ISA
+    switch (level) {
+        case IsaLevel::SSE42: return isa_sse42::kernelTable();
+        case IsaLevel::AVX2: return isa_avx2::kernelTable();
+        case IsaLevel::AVX512: return isa_avx512::kernelTable();
+        default: break;
+    }
+#endif
+    return isa_baseline::kernelTable();
+}
+
+
+
+// The level and kernels in use, chosen on first use
+struct ActiveKernels {
+    IsaLevel level;
+    IsaKernels kernels;
+};
+
+static ActiveKernels& activeKernels() {
+    static ActiveKernels active{detectIsaLevel(), kernelsFor(detectIsaLevel())};
+    return active;
+}
+
+
+
+const IsaKernels& isaKernels() {
+    return activeKernels().kernels;
+}
+
+
+IsaLevel activeIsaLevel() {
+    return activeKernels().level;
+}
+
+
+void setIsaLevel(IsaLevel level) {
+    if (level > detectIsaLevel()) {
+        throw std::invalid_argument("The " + isaLevelName(level) + " kernels cannot run here, the best available is " + isaLevelName(detectIsaLevel()) + ".");
+    }
+    activeKernels() = ActiveKernels{level, kernelsFor(level)};
+}
+
+
+std::string isaReport() {
+    return isaLevelName(activeIsaLevel()) + " (best available " + isaLevelName(detectIsaLevel()) + ")";
+}
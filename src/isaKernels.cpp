@@ -0,0 +1,325 @@
+// The hot structure of arrays kernels. This file is compiled once per instruction set level (see src/CMakeLists.txt),
+// each copy with its own flags inside its own namespace, and isaDispatch.cpp picks a copy at startup
+// Keep it to plain loops over raw arrays: an inline function from a library header would be emitted by every copy
+// and the linker could keep the AVX-512 one for the whole program. sqrt and sqrtf are the C functions for the same reason
+#include "isaDispatch.hpp"
+#include "forceLaw.hpp"
+#include <math.h>
+
+#ifndef NBODY_ISA_NAMESPACE
+#define NBODY_ISA_NAMESPACE isa_baseline
+#endif
+
+
+namespace NBODY_ISA_NAMESPACE {
+
+
+// The force laws of the double precision kernel (see forceLaw.hpp), as policies for accelerationRows
+// interact adds the acceleration due to one source at separation d (source minus target) with relative velocity dv
+// (source minus target, zero unless the law uses velocities). self is 1 for the body itself, whose term must come out 0
+struct PlummerLaw {
+    static constexpr bool uses_velocity = false;
+    double epsilon_squared;
+
+    explicit PlummerLaw(double epsilon) : epsilon_squared{epsilon * epsilon} {}
+
+    void interact(double dx, double dy, double dz, double, double, double, double self, double mass,
+                  double& acc_x, double& acc_y, double& acc_z) const {
+        double r_squared = dx * dx + dy * dy + dz * dz + epsilon_squared + self;
+        double factor = (1.0 - self) * mass / (r_squared * sqrt(r_squared));
+        acc_x += factor * dx;
+        acc_y += factor * dy;
+        acc_z += factor * dz;
+    }
+};
+
+
+// Cubic spline softening (Monaghan and Lattanzio 1985) in the form of Springel's GADGET-2, with kernel radius h
+// Inside h the force falls smoothly to zero at zero separation (no singularity), outside it is exactly Newtonian
+// All three pieces are computed and one selected, so the loop has no branch
+struct SplineLaw {
+    static constexpr bool uses_velocity = false;
+    double h;
+    double inverse_h;
+    double inverse_h_cubed;
+
+    explicit SplineLaw(double epsilon) :
+        h{spline_kernel_radius * epsilon}, inverse_h{1.0 / h}, inverse_h_cubed{inverse_h * inverse_h * inverse_h} {}
+
+    void interact(double dx, double dy, double dz, double, double, double, double self, double mass,
+                  double& acc_x, double& acc_y, double& acc_z) const {
+        double r_squared = dx * dx + dy * dy + dz * dz + self;
+        double r = sqrt(r_squared);
+        double u = r * inverse_h;
+
+        double inner = inverse_h_cubed * (32.0 / 3.0 + u * u * (32.0 * u - 38.4));
+        double shell = inverse_h_cubed * (64.0 / 3.0 - 48.0 * u + 38.4 * u * u - 32.0 / 3.0 * u * u * u - 1.0 / (15.0 * u * u * u));
+        double outside = 1.0 / (r_squared * r);
+        double kernel = r >= h ? outside : (u < 0.5 ? inner : shell);
+
+        double factor = (1.0 - self) * mass * kernel;
+        acc_x += factor * dx;
+        acc_y += factor * dy;
+        acc_z += factor * dz;
+    }
+};
+
+
+struct NewtonianLaw {
+    static constexpr bool uses_velocity = false;
+
+    explicit NewtonianLaw(double) {}
+
+    void interact(double dx, double dy, double dz, double, double, double, double self, double mass,
+                  double& acc_x, double& acc_y, double& acc_z) const {
+        double r_squared = dx * dx + dy * dy + dz * dz + self;
+        double factor = (1.0 - self) * mass / (r_squared * sqrt(r_squared));
+        acc_x += factor * dx;
+        acc_y += factor * dy;
+        acc_z += factor * dz;
+    }
+};
+
+
+// Newtonian force plus the 1PN correction of a body orbiting a mass m (Anderson et al. 1975),
+//   m / (c^2 r^3) ((4 m / r - v^2) r + 4 (r.v) v)   with r, v the position and velocity relative to the source,
+// applied to every pair. Written with d = -r and dv = -v it is folded into the Newtonian factor
+struct PostNewtonianLaw {
+    static constexpr bool uses_velocity = true;
+    static constexpr double inverse_c_squared = 1.0 / (speed_of_light * speed_of_light);
+
+    explicit PostNewtonianLaw(double) {}
+
+    void interact(double dx, double dy, double dz, double dvx, double dvy, double dvz, double self, double mass,
+                  double& acc_x, double& acc_y, double& acc_z) const {
+        double r_squared = dx * dx + dy * dy + dz * dz + self;
+        double r = sqrt(r_squared);
+        double factor = (1.0 - self) * mass / (r_squared * r);
+
+        double v_squared = dvx * dvx + dvy * dvy + dvz * dvz;
+        double d_dot_v = dx * dvx + dy * dvy + dz * dvz;
+        double radial = factor * (1.0 - (4.0 * mass / r - v_squared) * inverse_c_squared);
+        double along_velocity = -4.0 * factor * d_dot_v * inverse_c_squared;
+
+        acc_x += radial * dx + along_velocity * dvx;
+        acc_y += radial * dy + along_velocity * dvy;
+        acc_z += radial * dz + along_velocity * dvz;
+    }
+};
+
+
+
+template <typename Law>
+static void accelerationRows(int begin, int end, int num_particles, const double* x, const double* y, const double* z,
+                             const double* vx, const double* vy, const double* vz, const double* mass, double epsilon,
+                             double* ax, double* ay, double* az) {
+    const Law law(epsilon);
+
+    for (int i = begin; i < end; i++) {
+        const double xi = x[i], yi = y[i], zi = z[i];
+        double vxi = 0.0, vyi = 0.0, vzi = 0.0;
+        if constexpr (Law::uses_velocity) {
+            vxi = vx[i];
+            vyi = vy[i];
+            vzi = vz[i];
+        }
+        double acc_x = 0.0, acc_y = 0.0, acc_z = 0.0;
+
+        #pragma omp simd reduction(+: acc_x, acc_y, acc_z)
+        for (int j = 0; j < num_particles; j++) {
+            double dx = x[j] - xi;
+            double dy = y[j] - yi;
+            double dz = z[j] - zi;
+            double dvx = 0.0, dvy = 0.0, dvz = 0.0;
+            if constexpr (Law::uses_velocity) {
+                dvx = vx[j] - vxi;
+                dvy = vy[j] - vyi;
+                dvz = vz[j] - vzi;
+            }
+
+            // Skip self interaction without a branch on the division
+            double self = (j == i) ? 1.0 : 0.0;
+            law.interact(dx, dy, dz, dvx, dvy, dvz, self, mass[j], acc_x, acc_y, acc_z);
+        }
+        ax[i] = acc_x;
+        ay[i] = acc_y;
+        az[i] = acc_z;
+    }
+}
+
+
+
+static void mixedAccelerationRows(int begin, int end, int num_particles, const double* x, const double* y, const double* z, const float* mass,
+                                  float epsilon_squared, double* ax, double* ay, double* az) {
+    constexpr int tile_size = 256;
+
+    for (int i = begin; i < end; i++) {
+        const double xi = x[i], yi = y[i], zi = z[i];
+        double acc_x = 0.0, acc_y = 0.0, acc_z = 0.0;
+
+        for (int tile_start = 0; tile_start < num_particles; tile_start += tile_size) {
+            const int tile_end = tile_start + tile_size < num_particles ? tile_start + tile_size : num_particles;
+            float tile_ax = 0.0f, tile_ay = 0.0f, tile_az = 0.0f;
+
+            #pragma omp simd reduction(+: tile_ax, tile_ay, tile_az)
+            for (int j = tile_start; j < tile_end; j++) {
+                float dx = static_cast<float>(x[j] - xi);
+                float dy = static_cast<float>(y[j] - yi);
+                float dz = static_cast<float>(z[j] - zi);
+                float r_squared = dx * dx + dy * dy + dz * dz + epsilon_squared;
+
+                float self = (j == i) ? 1.0f : 0.0f;
+                r_squared += self;
+                float factor = (1.0f - self) * mass[j] / (r_squared * sqrtf(r_squared));
+
+                tile_ax += factor * dx;
+                tile_ay += factor * dy;
+                tile_az += factor * dz;
+            }
+            acc_x += tile_ax;
+            acc_y += tile_ay;
+            acc_z += tile_az;
+        }
+        ax[i] = acc_x;
+        ay[i] = acc_y;
+        az[i] = acc_z;
+    }
+}
+
+
+
+// Positions are float offsets from the origin of each body's cell. shift is the source cell's origin minus the row cell's origin,
+// so each separation is taken in double as offset_j - (offset_i - shift) and only the offsets themselves are rounded
+static void compactAccelerationRows(int begin, int end, int source_begin, int source_end, const float* x, const float* y, const float* z,
+                                    const double* mass, double shift_x, double shift_y, double shift_z, double epsilon,
+                                    double* ax, double* ay, double* az) {
+    const double epsilon_squared = epsilon * epsilon;
+
+    for (int i = begin; i < end; i++) {
+        const double xi = static_cast<double>(x[i]) - shift_x;
+        const double yi = static_cast<double>(y[i]) - shift_y;
+        const double zi = static_cast<double>(z[i]) - shift_z;
+        double acc_x = 0.0, acc_y = 0.0, acc_z = 0.0;
+
+        #pragma omp simd reduction(+: acc_x, acc_y, acc_z)
+        for (int j = source_begin; j < source_end; j++) {
+            double dx = static_cast<double>(x[j]) - xi;
+            double dy = static_cast<double>(y[j]) - yi;
+            double dz = static_cast<double>(z[j]) - zi;
+            double r_squared = dx * dx + dy * dy + dz * dz + epsilon_squared;
+
+            double self = (j == i) ? 1.0 : 0.0;
+            r_squared += self;
+            double factor = (1.0 - self) * mass[j] / (r_squared * sqrt(r_squared));
+
+            acc_x += factor * dx;
+            acc_y += factor * dy;
+            acc_z += factor * dz;
+        }
+        ax[i - begin] += acc_x;
+        ay[i - begin] += acc_y;
+        az[i - begin] += acc_z;
+    }
+}
+
+
+
+// Plummer softened acceleration of the rows [begin, end) of a target block due to one tile of sources kept in separate arrays,
+// added to ax, ay, az (indexed like the rows). Source j is row i itself when j == i + diagonal
+static void tileAccelerationRows(int begin, int end, const double* row_x, const double* row_y, const double* row_z, int num_sources,
+                                 const double* x, const double* y, const double* z, const double* mass, long diagonal, double epsilon,
+                                 double* ax, double* ay, double* az) {
+    const PlummerLaw law(epsilon);
+
+    for (int i = begin; i < end; i++) {
+        const double xi = row_x[i], yi = row_y[i], zi = row_z[i];
+        const long self_index = i + diagonal;
+        double acc_x = 0.0, acc_y = 0.0, acc_z = 0.0;
+
+        #pragma omp simd reduction(+: acc_x, acc_y, acc_z)
+        for (int j = 0; j < num_sources; j++) {
+            double self = (j == self_index) ? 1.0 : 0.0;
+            law.interact(x[j] - xi, y[j] - yi, z[j] - zi, 0.0, 0.0, 0.0, self, mass[j], acc_x, acc_y, acc_z);
+        }
+        ax[i] += acc_x;
+        ay[i] += acc_y;
+        az[i] += acc_z;
+    }
+}
+
+
+
+static void eulerUpdateRows(int begin, int end, double dt, double* x, double* y, double* z, double* vx, double* vy, double* vz,
+                            const double* ax, const double* ay, const double* az) {
+    #pragma omp simd
+    for (int i = begin; i < end; i++) {
+        x[i] += dt * vx[i];
+        y[i] += dt * vy[i];
+        z[i] += dt * vz[i];
+        vx[i] += dt * ax[i];
+        vy[i] += dt * ay[i];
+        vz[i] += dt * az[i];
+    }
+}
+
+
+
+static double potentialRows(int begin, int end, int num_particles, const double* x, const double* y, const double* z, const double* mass) {
+    double sum = 0.0;
+
+    for (int i = begin; i < end; i++) {
+        const double xi = x[i], yi = y[i], zi = z[i];
+        double row_sum = 0.0;
+
+        #pragma omp simd reduction(+: row_sum)
+        for (int j = 0; j < num_particles; j++) {
+            double dx = x[j] - xi;
+            double dy = y[j] - yi;
+            double dz = z[j] - zi;
+
+            double self = (j == i) ? 1.0 : 0.0;
+            double r_squared = dx * dx + dy * dy + dz * dz + self;
+            row_sum += (1.0 - self) * mass[j] / sqrt(r_squared);
+        }
+        sum += mass[i] * row_sum;
+    }
+    return sum;
+}
+
+
+
+// Sum of m_i * m_j / r_ij over the rows i of a target block and one tile of sources kept in separate arrays, j == i + diagonal left out
+static double tilePotentialRows(int begin, int end, const double* row_x, const double* row_y, const double* row_z, const double* row_mass,
+                                int num_sources, const double* x, const double* y, const double* z, const double* mass, long diagonal) {
+    double sum = 0.0;
+
+    for (int i = begin; i < end; i++) {
+        const double xi = row_x[i], yi = row_y[i], zi = row_z[i];
+        const long self_index = i + diagonal;
+        double row_sum = 0.0;
+
+        #pragma omp simd reduction(+: row_sum)
+        for (int j = 0; j < num_sources; j++) {
+            double dx = x[j] - xi;
+            double dy = y[j] - yi;
+            double dz = z[j] - zi;
+
+            double self = (j == self_index) ? 1.0 : 0.0;
+            double r_squared = dx * dx + dy * dy + dz * dz + self;
+            row_sum += (1.0 - self) * mass[j] / sqrt(r_squared);
+        }
+        sum += row_mass[i] * row_sum;
+    }
+    return sum;
+}
+
+
+
+IsaKernels kernelTable() {
+    // In the order of ForceLaw
+    return {{&accelerationRows<PlummerLaw>, &accelerationRows<SplineLaw>, &accelerationRows<NewtonianLaw>, &accelerationRows<PostNewtonianLaw>},
+            &mixedAccelerationRows, &compactAccelerationRows, &tileAccelerationRows, &eulerUpdateRows, &potentialRows, &tilePotentialRows};
+}
+
+
+}
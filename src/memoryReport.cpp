@@ -0,0 +1,64 @@
+#include "memoryReport.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <sys/resource.h>
+
+
+
+std::string formatBytes(double bytes) {
+    const char* units[] = {"bytes", "KiB", "MiB", "GiB", "TiB"};
+    int unit = 0;
+    while (bytes >= 1024.0 && unit < 4) {
+        bytes /= 1024.0;
+        unit++;
+    }
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << bytes << " " << units[unit];
+    return text.str();
+}
+
+
+
+std::string formatMemoryReport(const std::vector<MemoryUsage>& usage, long num_bodies) {
+    std::ostringstream report;
+    std::size_t total = 0;
+    std::size_t name_width = 5;
+    for (const MemoryUsage& entry : usage) {
+        name_width = std::max(name_width, entry.subsystem.size());
+    }
+
+    auto line = [&](const std::string& name, std::size_t bytes) {
+        report << "  " << std::left << std::setw(name_width + 2) << name + ":" << std::right << std::setw(10) << formatBytes(bytes);
+        if (num_bodies > 0) {
+            report << "  (" << std::fixed << std::setprecision(1) << static_cast<double>(bytes) / num_bodies << std::defaultfloat << " bytes per body)";
+        }
+        report << "\n";
+    };
+
+    report << "Memory:\n";
+    for (const MemoryUsage& entry : usage) {
+        line(entry.subsystem, entry.bytes);
+        total += entry.bytes;
+    }
+    line("Total", total);
+    const std::size_t peak = peakResidentBytes();
+    if (peak > 0) {
+        line("Peak resident", peak);
+    }
+    return report.str();
+}
+
+
+
+std::size_t peakResidentBytes() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<std::size_t>(usage.ru_maxrss); // Bytes on macOS
+#else
+    return static_cast<std::size_t>(usage.ru_maxrss) * 1024; // Kilobytes on Linux
+#endif
+}
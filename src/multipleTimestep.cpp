@@ -0,0 +1,114 @@
+#include "multipleTimestep.hpp"
+
+
+
+void starAccelerations(const std::vector<std::shared_ptr<Particle>>& particle_list, std::vector<Eigen::Vector3d>& acc_out, double epsilon) {
+    const int num_particles = particle_list.size();
+    acc_out.resize(num_particles);
+    if (num_particles == 0) {
+        return;
+    }
+
+    const Particle& star = *particle_list[0];
+
+    // Each body only feels the star
+    #pragma omp parallel for
+    for (int i = 1; i < num_particles; i++) {
+        acc_out[i] = calcAcceleration(*particle_list[i], star, epsilon);
+    }
+
+    // The star feels every body
+    Eigen::Vector3d star_acc(0.0, 0.0, 0.0);
+    for (int i = 1; i < num_particles; i++) {
+        star_acc += calcAcceleration(star, *particle_list[i], epsilon);
+    }
+    acc_out[0] = star_acc;
+}
+
+
+
+void perturbationAccelerations(const std::vector<std::shared_ptr<Particle>>& particle_list, std::vector<Eigen::Vector3d>& acc_out, double epsilon) {
+    const int num_particles = particle_list.size();
+    acc_out.resize(num_particles);
+    if (num_particles == 0) {
+        return;
+    }
+
+    acc_out[0] = Eigen::Vector3d::Zero(); // Star is handled by the fast term
+
+    #pragma omp parallel for
+    for (int i = 1; i < num_particles; i++) {
+        Eigen::Vector3d acc_tot(0.0, 0.0, 0.0);
+
+        for (int j = 1; j < num_particles; j++) {
+            if (i != j) {
+                acc_tot += calcAcceleration(*particle_list[i], *particle_list[j], epsilon);
+            }
+        }
+        acc_out[i] = acc_tot;
+    }
+}
+
+
+
+void evolutionOfSystemMultiStep(const std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double total_time, int substeps, double epsilon) {
+
+    // Check that timestep and total simulation time arguments are greater than 0
+    if ( (dt <= 0.0) || (total_time <= 0.0) )
+    {
+        throw std::invalid_argument("The timestep and total time must be greater than 0.");
+    }
+    if (substeps < 1) {
+        throw std::invalid_argument("The number of substeps must be at least 1.");
+    }
+
+    const int num_particles = particle_list.size();
+    const double inner_dt = dt / substeps;
+
+    std::vector<Eigen::Vector3d> slow_acc;
+    std::vector<Eigen::Vector3d> fast_acc;
+
+    // Forces at the end of one step are reused at the start of the next, so the O(N^2) term is evaluated once per timestep
+    perturbationAccelerations(particle_list, slow_acc, epsilon);
+    starAccelerations(particle_list, fast_acc, epsilon);
+
+
+    // Loop for full simulation time
+    for (double sim_time = 0.0; sim_time < total_time; sim_time += dt) {
+
+        // Half kick from the slow perturbations
+        #pragma omp parallel for
+        for (int i = 0; i < num_particles; i++) {
+            particle_list[i]->kick(0.5 * dt, slow_acc[i]);
+        }
+
+        // Leapfrog (kick-drift-kick) the star-body term over the inner steps
+        for (int step = 0; step < substeps; step++) {
+
+            #pragma omp parallel for
+            for (int i = 0; i < num_particles; i++) {
+                particle_list[i]->kick(0.5 * inner_dt, fast_acc[i]);
+                particle_list[i]->drift(inner_dt);
+            }
+
+            starAccelerations(particle_list, fast_acc, epsilon);
+
+            #pragma omp parallel for
+            for (int i = 0; i < num_particles; i++) {
+                particle_list[i]->kick(0.5 * inner_dt, fast_acc[i]);
+            }
+        }
+
+        // Second half kick from the perturbations at the new positions
+        perturbationAccelerations(particle_list, slow_acc, epsilon);
+
+        #pragma omp parallel for
+        for (int i = 0; i < num_particles; i++) {
+            particle_list[i]->kick(0.5 * dt, slow_acc[i]);
+
+            // Store the total acceleration so the particle reflects the full force
+            Eigen::Vector3d acc_tot = fast_acc[i] + slow_acc[i];
+            particle_list[i]->updateAcceleration(acc_tot);
+        }
+    }
+}
@@ -0,0 +1,218 @@
+#include "numa.hpp"
+#include <cstdint>
+#include <fstream>
+#include <omp.h>
+#include <sched.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+
+// CPUs the process was allowed to run on before any pinning
+static const cpu_set_t& startupMask() {
+    static const cpu_set_t mask = [] {
+        cpu_set_t startup;
+        CPU_ZERO(&startup);
+        if (sched_getaffinity(0, sizeof(startup), &startup) != 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                CPU_SET(cpu, &startup);
+            }
+        }
+        return startup;
+    }();
+    return mask;
+}
+
+static ThreadAffinity current_affinity = ThreadAffinity::None;
+
+
+
+// Parse a kernel CPU list such as "0-3,8-11"
+static std::vector<int> parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ranges(list);
+    std::string range;
+
+    while (std::getline(ranges, range, ',')) {
+        if (range.empty() || range == "\n") {
+            continue;
+        }
+        const std::size_t dash = range.find('-');
+        const int first = std::stoi(range.substr(0, dash));
+        const int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+
+
+static NumaTopology readTopology() {
+    const cpu_set_t& allowed = startupMask();
+    NumaTopology topology;
+
+    for (int node = 0; ; node++) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!file) {
+            break;
+        }
+        std::string list;
+        std::getline(file, list);
+
+        std::vector<int> cpus;
+        for (int cpu : parseCpuList(list)) {
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+            }
+        }
+        if (!cpus.empty()) { // Nodes with only memory, or only CPUs we may not use, hold no threads
+            topology.node_cpus.push_back(cpus);
+        }
+    }
+
+    if (topology.node_cpus.empty()) {
+        topology.node_cpus.emplace_back();
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                topology.node_cpus[0].push_back(cpu);
+            }
+        }
+    }
+
+    for (int node = 0; node < topology.getNumNodes(); node++) {
+        for (int cpu : topology.node_cpus[node]) {
+            if (cpu >= static_cast<int>(topology.cpu_node.size())) {
+                topology.cpu_node.resize(cpu + 1, -1);
+            }
+            topology.cpu_node[cpu] = node;
+        }
+    }
+    return topology;
+}
+
+const NumaTopology& numaTopology() {
+    static const NumaTopology topology = readTopology();
+    return topology;
+}
+
+
+
+ThreadAffinity parseThreadAffinity(const std::string& name) {
+    if (name == "none") {
+        return ThreadAffinity::None;
+    }
+    if (name == "compact") {
+        return ThreadAffinity::Compact;
+    }
+    if (name == "spread") {
+        return ThreadAffinity::Spread;
+    }
+    throw std::invalid_argument("Unknown thread affinity '" + name + "', expected 'none', 'compact' or 'spread'.");
+}
+
+std::string threadAffinityName(ThreadAffinity affinity) {
+    switch (affinity) {
+        case ThreadAffinity::Compact: return "compact";
+        case ThreadAffinity::Spread: return "spread";
+        default: return "none";
+    }
+}
+
+
+
+std::vector<int> pinThreads(ThreadAffinity affinity) {
+    const NumaTopology& topology = numaTopology();
+
+    // Order in which threads take CPUs
+    std::vector<int> order;
+    if (affinity == ThreadAffinity::Compact) {
+        for (const std::vector<int>& cpus : topology.node_cpus) {
+            order.insert(order.end(), cpus.begin(), cpus.end());
+        }
+    }
+    else if (affinity == ThreadAffinity::Spread) {
+        for (std::size_t k = 0; ; k++) {
+            bool any = false;
+            for (const std::vector<int>& cpus : topology.node_cpus) {
+                if (k < cpus.size()) {
+                    order.push_back(cpus[k]);
+                    any = true;
+                }
+            }
+            if (!any) {
+                break;
+            }
+        }
+    }
+
+    std::vector<int> thread_cpus(omp_get_max_threads(), -1);
+
+    #pragma omp parallel
+    {
+        const int thread = omp_get_thread_num();
+        cpu_set_t mask = startupMask();
+
+        if (affinity != ThreadAffinity::None) {
+            const int cpu = order[thread % order.size()]; // More threads than CPUs wrap around
+            CPU_ZERO(&mask);
+            CPU_SET(cpu, &mask);
+            thread_cpus[thread] = cpu;
+        }
+        sched_setaffinity(0, sizeof(mask), &mask); // 0 is the calling thread
+    }
+
+    current_affinity = affinity;
+    return thread_cpus;
+}
+
+
+
+std::vector<int> threadNodes() {
+    const NumaTopology& topology = numaTopology();
+    std::vector<int> nodes(omp_get_max_threads(), 0);
+
+    #pragma omp parallel
+    {
+        nodes[omp_get_thread_num()] = topology.nodeOfCpu(sched_getcpu());
+    }
+    return nodes;
+}
+
+
+
+int numaNodeOfAddress(const void* address) {
+    const long page_size = sysconf(_SC_PAGESIZE);
+    void* page = reinterpret_cast<void*>(reinterpret_cast<std::uintptr_t>(address) & ~static_cast<std::uintptr_t>(page_size - 1));
+    int status = -1;
+
+    // move_pages with no target nodes only reports where each page is
+    if (syscall(SYS_move_pages, 0, 1, &page, nullptr, &status, 0) != 0) {
+        return -1;
+    }
+    return status >= 0 ? status : -1;
+}
+
+
+
+std::string affinityReport() {
+    const NumaTopology& topology = numaTopology();
+    std::vector<int> nodes = threadNodes();
+
+    std::vector<int> threads_per_node(topology.getNumNodes(), 0);
+    for (int node : nodes) {
+        threads_per_node[node]++;
+    }
+
+    std::ostringstream report;
+    report << topology.getNumNodes() << (topology.getNumNodes() == 1 ? " NUMA node, " : " NUMA nodes, ")
+           << nodes.size() << " threads, affinity " << threadAffinityName(current_affinity) << " (threads per node:";
+    for (int count : threads_per_node) {
+        report << " " << count;
+    }
+    report << ")";
+    return report.str();
+}
@@ -0,0 +1,257 @@
+#include "outOfCore.hpp"
+#include "isaDispatch.hpp"
+#include "deterministicSum.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+
+// Body layout of the state file: mass, position, velocity, acceleration
+constexpr int doubles_per_body = initial_condition_doubles_per_body;
+constexpr std::size_t bytes_per_body = doubles_per_body * sizeof(double);
+
+
+
+OutOfCoreSystem::OutOfCoreSystem(const std::string& in_path, double in_dt, double in_epsilon, int in_target_block_bodies, int in_source_tile_bodies) :
+    path{in_path}, dt{in_dt}, epsilon{in_epsilon}, target_block_bodies{in_target_block_bodies}, source_tile_bodies{in_source_tile_bodies},
+    sim_time{0.0}, step_count{0}, mapping{nullptr}, file_bytes{0}, bodies{nullptr}, num_particles{0}, bytes_streamed{0}
+{
+    if (dt <= 0.0 || target_block_bodies < 1 || source_tile_bodies < 1) {
+        throw std::invalid_argument("An out-of-core system needs a positive timestep and at least 1 body per target block and source tile.");
+    }
+
+    int fd = ::open(path.c_str(), O_RDWR);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open the out-of-core state file " + path + ": " + std::strerror(errno));
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size == 0) {
+        ::close(fd);
+        throw std::invalid_argument(path + " is not an initial condition file.");
+    }
+    file_bytes = status.st_size;
+    mapping = mmap(nullptr, file_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0); // Writes go straight back to the file
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Could not map the out-of-core state file " + path + ": " + std::strerror(errno));
+    }
+
+    std::size_t count = 0;
+    const std::size_t data_offset = initialConditionDataOffset(mapping, file_bytes, count);
+    if (data_offset == 0 || count == 0) {
+        munmap(mapping, file_bytes);
+        throw std::invalid_argument(path + " is not a complete initial condition file.");
+    }
+    bodies = reinterpret_cast<double*>(static_cast<char*>(mapping) + data_offset);
+    num_particles = count;
+    madvise(mapping, file_bytes, MADV_SEQUENTIAL); // Every pass reads the file front to back
+
+    const std::size_t target_rows = std::min<long>(num_particles, target_block_bodies);
+    const std::size_t tile_rows = std::min<long>(num_particles, source_tile_bodies);
+    for (std::vector<double>* buffer : {&target_x, &target_y, &target_z, &target_mass, &target_ax, &target_ay, &target_az}) {
+        buffer->resize(target_rows);
+    }
+    for (std::vector<double>* buffer : {&tile_x, &tile_y, &tile_z, &tile_mass}) {
+        buffer->resize(tile_rows);
+    }
+}
+
+
+OutOfCoreSystem::~OutOfCoreSystem() {
+    msync(mapping, file_bytes, MS_SYNC);
+    munmap(mapping, file_bytes);
+}
+
+
+
+double* OutOfCoreSystem::body(long index) const {
+    return bodies + index * doubles_per_body;
+}
+
+
+void OutOfCoreSystem::gather(long begin, int count, double* x, double* y, double* z, double* mass) const {
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < count; i++) {
+        const double* state = body(begin + i);
+        x[i] = state[1];
+        y[i] = state[2];
+        z[i] = state[3];
+        if (mass) {
+            mass[i] = state[0];
+        }
+    }
+}
+
+
+template <typename TilePass>
+void OutOfCoreSystem::forEachSourceTile(TilePass&& pass) const {
+    const long page_size = sysconf(_SC_PAGESIZE);
+
+    for (long source_begin = 0; source_begin < num_particles; source_begin += source_tile_bodies) {
+        const int count = std::min<long>(source_tile_bodies, num_particles - source_begin);
+
+        // Start reading the next tile in the background while this one is computed
+        const long next_begin = source_begin + count;
+        if (next_begin < num_particles) {
+            const long next_count = std::min<long>(source_tile_bodies, num_particles - next_begin);
+            const std::uintptr_t first = reinterpret_cast<std::uintptr_t>(body(next_begin));
+            const std::uintptr_t aligned = first / page_size * page_size;
+            madvise(reinterpret_cast<void*>(aligned), first - aligned + next_count * bytes_per_body, MADV_WILLNEED);
+        }
+
+        gather(source_begin, count, tile_x.data(), tile_y.data(), tile_z.data(), tile_mass.data());
+        bytes_streamed += count * bytes_per_body;
+        pass(source_begin, count);
+    }
+}
+
+
+
+void OutOfCoreSystem::computeAccelerations() {
+    const IsaKernels& kernels = isaKernels();
+
+    for (long target_begin = 0; target_begin < num_particles; target_begin += target_block_bodies) {
+        const int rows = std::min<long>(target_block_bodies, num_particles - target_begin);
+        gather(target_begin, rows, target_x.data(), target_y.data(), target_z.data(), nullptr);
+        std::fill_n(target_ax.begin(), rows, 0.0);
+        std::fill_n(target_ay.begin(), rows, 0.0);
+        std::fill_n(target_az.begin(), rows, 0.0);
+
+        // Every tile is added to the block's accelerations in file order, so the result does not depend on the thread count
+        forEachSourceTile([&](long source_begin, int count) {
+            const int num_blocks = (rows + kernel_block_rows - 1) / kernel_block_rows;
+            #pragma omp parallel for schedule(dynamic)
+            for (int block = 0; block < num_blocks; block++) {
+                const int begin = block * kernel_block_rows;
+                kernels.tileAccelerationRows(begin, std::min(begin + kernel_block_rows, rows), target_x.data(), target_y.data(), target_z.data(),
+                                             count, tile_x.data(), tile_y.data(), tile_z.data(), tile_mass.data(), target_begin - source_begin,
+                                             epsilon, target_ax.data(), target_ay.data(), target_az.data());
+            }
+        });
+
+        // Positions are still needed as sources by the blocks after this one, so only the accelerations are written back now
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < rows; i++) {
+            double* state = body(target_begin + i);
+            state[7] = target_ax[i];
+            state[8] = target_ay[i];
+            state[9] = target_az[i];
+        }
+    }
+}
+
+
+void OutOfCoreSystem::step(int num_steps) {
+    for (int n = 0; n < num_steps; n++) {
+        computeAccelerations();
+
+        // Euler step in place, one sequential pass over the file
+        #pragma omp parallel for schedule(static)
+        for (long i = 0; i < num_particles; i++) {
+            double* state = body(i);
+            for (int axis = 0; axis < 3; axis++) {
+                state[1 + axis] += dt * state[4 + axis];
+                state[4 + axis] += dt * state[7 + axis];
+            }
+        }
+        sim_time += dt;
+        step_count++;
+    }
+}
+
+
+void OutOfCoreSystem::advanceTo(double time) {
+    while (sim_time < time) {
+        step();
+    }
+}
+
+
+
+double OutOfCoreSystem::totalKineticEnergy() const {
+    // Fixed blocks in file order, so the total does not depend on the thread count
+    double sum = 0.0;
+    for (long tile_begin = 0; tile_begin < num_particles; tile_begin += source_tile_bodies) {
+        const int count = std::min<long>(source_tile_bodies, num_particles - tile_begin);
+        sum += deterministicReduce(count, reduction_block_size, [&](int begin, int end) {
+            double block_sum = 0.0;
+            for (int i = begin; i < end; i++) {
+                const double* state = body(tile_begin + i);
+                block_sum += state[0] * (state[4] * state[4] + state[5] * state[5] + state[6] * state[6]);
+            }
+            return block_sum;
+        });
+    }
+    return sum * 0.5;
+}
+
+
+double OutOfCoreSystem::totalPotentialEnergy() const {
+    const IsaKernels& kernels = isaKernels();
+    double sum = 0.0;
+
+    for (long target_begin = 0; target_begin < num_particles; target_begin += target_block_bodies) {
+        const int rows = std::min<long>(target_block_bodies, num_particles - target_begin);
+        gather(target_begin, rows, target_x.data(), target_y.data(), target_z.data(), target_mass.data());
+
+        forEachSourceTile([&](long source_begin, int count) {
+            sum += deterministicReduce(rows, kernel_block_rows, [&](int begin, int end) {
+                return kernels.tilePotentialRows(begin, end, target_x.data(), target_y.data(), target_z.data(), target_mass.data(),
+                                                 count, tile_x.data(), tile_y.data(), tile_z.data(), tile_mass.data(), target_begin - source_begin);
+            });
+        });
+    }
+    return sum * -0.5;
+}
+
+
+double OutOfCoreSystem::totalEnergy() const {
+    return totalKineticEnergy() + totalPotentialEnergy();
+}
+
+
+
+void OutOfCoreSystem::sync() const {
+    if (msync(mapping, file_bytes, MS_SYNC) != 0) {
+        throw std::runtime_error("Could not write the out-of-core state back to " + path + ": " + std::strerror(errno));
+    }
+}
+
+
+long OutOfCoreSystem::getNumParticles() const {
+    return num_particles;
+}
+
+double OutOfCoreSystem::getTime() const {
+    return sim_time;
+}
+
+long OutOfCoreSystem::getStepCount() const {
+    return step_count;
+}
+
+std::string OutOfCoreSystem::getParameters() const {
+    return initialConditionParameters(mapping);
+}
+
+std::size_t OutOfCoreSystem::getFileBytes() const {
+    return file_bytes;
+}
+
+std::uint64_t OutOfCoreSystem::getBytesStreamed() const {
+    return bytes_streamed;
+}
+
+
+std::vector<MemoryUsage> OutOfCoreSystem::getMemoryUsage() const {
+    return {
+        {"Target block", target_x.size() * 7 * sizeof(double)},
+        {"Source tile", tile_x.size() * 4 * sizeof(double)}
+    };
+}
@@ -9,13 +9,13 @@ Particle::Particle(double in_mass, Eigen::Vector3d& in_pos, Eigen::Vector3d& in_
 double Particle::getMass() const {
     return mass;
 }
-Eigen::Vector3d Particle::getPosition() const {
+const Eigen::Vector3d& Particle::getPosition() const {
     return position;
 }
-Eigen::Vector3d Particle::getVelocity() const {
+const Eigen::Vector3d& Particle::getVelocity() const {
     return velocity;
 }
-Eigen::Vector3d Particle::getAcceleration() const {
+const Eigen::Vector3d& Particle::getAcceleration() const {
     return acceleration;
 }
 
@@ -30,6 +30,14 @@ void Particle::update(double dt) {
     velocity += dt * acceleration;
 }
 
+void Particle::kick(double dt, const Eigen::Vector3d& acc) {
+    velocity += dt * acc;
+}
+
+void Particle::drift(double dt) {
+    position += dt * velocity;
+}
+
 
 
 
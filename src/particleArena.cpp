@@ -0,0 +1,128 @@
+#include "particleArena.hpp"
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+
+
+ParticleArena::ParticleArena(std::size_t in_capacity) :
+    storage{std::allocator<Particle>().allocate(in_capacity)}, capacity{in_capacity}, size{0}
+{
+    // First touch the storage with the same static split over threads as the parallel loops over particles,
+    // so on a NUMA machine each page is placed on the node of the threads that will work on those particles
+    std::byte* bytes = reinterpret_cast<std::byte*>(storage);
+    const long num_slots = capacity;
+
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < num_slots; i++) {
+        std::memset(bytes + i * sizeof(Particle), 0, sizeof(Particle));
+    }
+}
+
+std::shared_ptr<ParticleArena> ParticleArena::create(std::size_t capacity) {
+    return std::shared_ptr<ParticleArena>(new ParticleArena(capacity)); // Constructor is private so make_shared cannot be used
+}
+
+ParticleArena::~ParticleArena() {
+    for (std::size_t i = 0; i < size; i++) {
+        storage[i].~Particle();
+    }
+    std::allocator<Particle>().deallocate(storage, capacity);
+}
+
+
+
+std::shared_ptr<Particle> ParticleArena::emplace(const Particle& particle) {
+    if (size == capacity) {
+        throw std::length_error("The particle arena is full.");
+    }
+
+    Particle* slot = new (storage + size) Particle(particle);
+    size++;
+
+    // Shares ownership of the arena but points at the particle
+    return std::shared_ptr<Particle>(shared_from_this(), slot);
+}
+
+
+
+void ParticleArena::reserveSlots(std::size_t count) const {
+    if (count > capacity - size) {
+        throw std::length_error("The particle arena is full.");
+    }
+}
+
+
+
+std::size_t ParticleArena::getSize() const {
+    return size;
+}
+std::size_t ParticleArena::getCapacity() const {
+    return capacity;
+}
+std::size_t ParticleArena::getBytesReserved() const {
+    return capacity * sizeof(Particle);
+}
+
+
+
+
+std::byte* ScratchPool::acquireBlock(std::size_t bytes, std::size_t& block) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Smallest free block that is big enough
+    std::size_t best = blocks.size();
+    for (std::size_t i = 0; i < blocks.size(); i++) {
+        if (!blocks[i].in_use && blocks[i].bytes >= bytes && (best == blocks.size() || blocks[i].bytes < blocks[best].bytes)) {
+            best = i;
+        }
+    }
+
+    // Otherwise grow the largest free block, or add a new one
+    if (best == blocks.size()) {
+        for (std::size_t i = 0; i < blocks.size(); i++) {
+            if (!blocks[i].in_use && (best == blocks.size() || blocks[i].bytes > blocks[best].bytes)) {
+                best = i;
+            }
+        }
+        if (best == blocks.size()) {
+            blocks.push_back(Block{nullptr, 0, false});
+        }
+        blocks[best].storage.reset(new std::byte[bytes]); // Left uninitialised, the pass fills it
+        blocks[best].bytes = bytes;
+    }
+
+    blocks[best].in_use = true;
+    block = best;
+    return blocks[best].storage.get();
+}
+
+
+
+void ScratchPool::release(std::size_t block) {
+    std::lock_guard<std::mutex> lock(mutex);
+    blocks[block].in_use = false;
+}
+
+
+
+std::size_t ScratchPool::getBytesReserved() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::size_t total = 0;
+    for (const auto& block : blocks) {
+        total += block.bytes;
+    }
+    return total;
+}
+
+std::size_t ScratchPool::getNumBuffers() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return blocks.size();
+}
+
+
+
+ScratchPool& scratchPool() {
+    static ScratchPool pool;
+    return pool;
+}
@@ -1,8 +1,9 @@
 #include "randomParticleSystem.hpp"
+#include <stdexcept>
 
 
 
-RandomSystem::RandomSystem(int body_num): num_bodies(body_num) {
+RandomSystem::RandomSystem(int body_num, unsigned int seed): num_bodies(body_num), seed(seed) {
     if (body_num <= 0) {
         throw std::invalid_argument("Number of bodies must be greater than 0.");
     }
@@ -10,12 +11,58 @@ RandomSystem::RandomSystem(int body_num): num_bodies(body_num) {
 
 
 std::vector<std::shared_ptr<Particle>> RandomSystem::generateInitialConditions() {
+    if (cache_directory.empty()) {
+        return generateBodies();
+    }
+
+    // Later generations reset the bodies from the mapped file
+    // If nothing outside holds the last bodies, they are overwritten in place instead of building a new arena
+    if (snapshot) {
+        if (arena.use_count() == 1 + static_cast<long>(celestial_body_list.size()) && celestial_body_list.size() == snapshot->getNumBodies()) {
+            snapshot->reset(celestial_body_list);
+        }
+        else {
+            celestial_body_list = snapshot->instantiate(arena);
+        }
+        return celestial_body_list;
+    }
+
+    // First generation: map the file of an earlier run, or generate the system and write the file
+    const std::string parameters = getCacheParameters();
+    const std::string path = initialConditionPath(cache_directory, parameters);
+    snapshot = MappedInitialConditions::open(path, parameters);
+    loaded_from_cache = snapshot != nullptr;
+    if (loaded_from_cache) {
+        celestial_body_list = snapshot->instantiate(arena);
+        return celestial_body_list;
+    }
+
+    generateBodies();
+    saveInitialConditions(path, parameters, celestial_body_list);
+    snapshot = MappedInitialConditions::open(path, parameters);
+    if (!snapshot) {
+        throw std::runtime_error("Could not map the initial condition cache file " + path + ".");
+    }
+    return celestial_body_list;
+}
+
+
+std::vector<std::shared_ptr<Particle>> RandomSystem::generateBodies() {
     celestial_body_list.clear(); // Ensure list is empty
+    celestial_body_list.reserve(num_bodies);
+    arena = ParticleArena::create(num_bodies); // One allocation for every body instead of one each
+
+    forEachBody([&](int, const Particle& body) {
+        celestial_body_list.push_back(arena->emplace(body)); // Make celestial body instance as shared pointers into the arena
+    });
+    return celestial_body_list;
+}
+
 
-    auto star = std::make_shared<Particle>(celestialBody(1.0, 0.0, 0.0));
-    celestial_body_list.push_back(star);
+void RandomSystem::forEachBody(const std::function<void(int index, const Particle& body)>& visit) const {
+    visit(0, celestialBody(1.0, 0.0, 0.0)); // The star
 
-    std::default_random_engine generator(42); // Seed the random number generator. Can fix the seed to any value by changing the number.
+    std::default_random_engine generator(seed); // Seed the random number generator
     std::uniform_real_distribution<double> massDistribution(1.0 / 6000000, 1.0 / 1000);
     std::uniform_real_distribution<double> distanceDistribution(0.4, 30.0);
     std::uniform_real_distribution<double> angleDistribution(0.0, 2.0 * M_PI);
@@ -28,19 +75,39 @@ std::vector<std::shared_ptr<Particle>> RandomSystem::generateInitialConditions()
         double distance = distanceDistribution(generator);
         double angle = angleDistribution(generator);
 
-        auto body = std::make_shared<Particle>(celestialBody(mass, distance, angle)); // Make celestial body instance as shared pointers
-        celestial_body_list.push_back(body);
+        visit(i, celestialBody(mass, distance, angle));
     }
-
-    return celestial_body_list;
 }
 
 
-std::vector<std::shared_ptr<Particle>> RandomSystem::getCelestialBodyList() const{
+const std::vector<std::shared_ptr<Particle>>& RandomSystem::getCelestialBodyList() const{
     return celestial_body_list; 
 }
 
 
+std::size_t RandomSystem::getArenaBytes() const {
+    return arena ? arena->getBytesReserved() : 0;
+}
+
+
+void RandomSystem::setCacheDirectory(const std::string& directory) {
+    cache_directory = directory;
+    snapshot.reset();
+    loaded_from_cache = false;
+}
+
+
+bool RandomSystem::wasLoadedFromCache() const {
+    return loaded_from_cache;
+}
+
+
+std::string RandomSystem::getCacheParameters() const {
+    // The version changes whenever the generator changes what a seed produces
+    return "RandomSystem v1 n=" + std::to_string(num_bodies) + " seed=" + std::to_string(seed);
+}
+
+
 
 
 
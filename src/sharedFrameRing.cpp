@@ -0,0 +1,248 @@
+#include "sharedFrameRing.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+
+// Slot size rounded up to a cache line so neighbouring slots never share one
+static std::size_t slotBytes(int num_bodies) {
+    std::size_t bytes = sizeof(SlotHeader) + 6 * sizeof(double) * num_bodies;
+    return (bytes + 63) / 64 * 64;
+}
+
+static SlotHeader* slotAt(RingHeader* header, std::uint64_t frame_number) {
+    char* base = reinterpret_cast<char*>(header) + sizeof(RingHeader);
+    return reinterpret_cast<SlotHeader*>(base + (frame_number % header->num_slots) * header->slot_bytes);
+}
+
+static const SlotHeader* slotAt(const RingHeader* header, std::uint64_t frame_number) {
+    return slotAt(const_cast<RingHeader*>(header), frame_number);
+}
+
+static std::runtime_error systemError(const std::string& what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+
+
+
+FramePublisher::FramePublisher(const std::string& in_name, int num_bodies, int num_slots) : name{in_name}, header{nullptr}, mapped_bytes{0} {
+    if (num_bodies <= 0 || num_slots < 2) {
+        throw std::invalid_argument("A frame ring needs at least 1 body and 2 slots.");
+    }
+
+    const std::size_t slot_bytes = slotBytes(num_bodies);
+    mapped_bytes = sizeof(RingHeader) + slot_bytes * num_slots;
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw systemError("Could not create shared memory " + name);
+    }
+    if (ftruncate(fd, mapped_bytes) != 0) {
+        close(fd);
+        shm_unlink(name.c_str());
+        throw systemError("Could not size shared memory " + name);
+    }
+
+    void* memory = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw systemError("Could not map shared memory " + name);
+    }
+
+    header = static_cast<RingHeader*>(memory);
+    header->num_bodies = num_bodies;
+    header->num_slots = num_slots;
+    header->padding = 0;
+    header->slot_bytes = slot_bytes;
+    new (&header->frames_published) std::atomic<std::uint64_t>(0);
+
+    for (int slot = 0; slot < num_slots; slot++) {
+        new (&slotAt(header, slot)->sequence) std::atomic<std::uint64_t>(0);
+    }
+
+    // Consumers check the magic number last, so it only appears once the layout is valid
+    header->version = frame_ring_version;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = frame_ring_magic;
+}
+
+
+
+FramePublisher::~FramePublisher() {
+    munmap(header, mapped_bytes);
+    shm_unlink(name.c_str());
+}
+
+
+
+void FramePublisher::publish(long step, double sim_time, const std::vector<std::shared_ptr<Particle>>& particle_list) {
+    if (particle_list.size() != header->num_bodies) {
+        throw std::invalid_argument("The number of bodies does not match the frame ring.");
+    }
+
+    const std::uint64_t frame_number = header->frames_published.load(std::memory_order_relaxed);
+    SlotHeader* slot = slotAt(header, frame_number);
+
+    // Odd sequence: slot is being written
+    slot->sequence.store(2 * frame_number + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->frame_number = frame_number;
+    slot->step = step;
+    slot->time = sim_time;
+
+    double* state = reinterpret_cast<double*>(slot + 1);
+    for (std::size_t i = 0; i < particle_list.size(); i++) {
+        const Eigen::Vector3d& pos = particle_list[i]->getPosition();
+        const Eigen::Vector3d& vel = particle_list[i]->getVelocity();
+        state[6 * i + 0] = pos[0];
+        state[6 * i + 1] = pos[1];
+        state[6 * i + 2] = pos[2];
+        state[6 * i + 3] = vel[0];
+        state[6 * i + 4] = vel[1];
+        state[6 * i + 5] = vel[2];
+    }
+
+    // Even sequence: frame complete
+    slot->sequence.store(2 * frame_number + 2, std::memory_order_release);
+    header->frames_published.store(frame_number + 1, std::memory_order_release);
+}
+
+
+
+StepObserver FramePublisher::observer(int steps_per_frame) {
+    if (steps_per_frame < 1) {
+        throw std::invalid_argument("The number of steps per frame must be at least 1.");
+    }
+
+    return [this, steps_per_frame](long step, double sim_time, const std::vector<std::shared_ptr<Particle>>& particle_list) {
+        if (step % steps_per_frame == 0) {
+            publish(step, sim_time, particle_list);
+        }
+    };
+}
+
+
+
+std::uint64_t FramePublisher::getFramesPublished() const {
+    return header->frames_published.load(std::memory_order_relaxed);
+}
+
+
+
+
+FrameSubscriber::FrameSubscriber(const std::string& name) : header{nullptr}, mapped_bytes{0}, next_frame{0}, frames_skipped{0} {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        throw systemError("Could not open shared memory " + name);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(RingHeader))) {
+        close(fd);
+        throw std::runtime_error("Shared memory " + name + " is not a frame ring.");
+    }
+    mapped_bytes = info.st_size;
+
+    void* memory = mmap(nullptr, mapped_bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        throw systemError("Could not map shared memory " + name);
+    }
+    header = static_cast<const RingHeader*>(memory);
+
+    if (header->magic != frame_ring_magic || header->version != frame_ring_version
+        || mapped_bytes < sizeof(RingHeader) + header->slot_bytes * header->num_slots) {
+        munmap(const_cast<RingHeader*>(header), mapped_bytes);
+        throw std::runtime_error("Shared memory " + name + " is not a compatible frame ring.");
+    }
+}
+
+
+
+FrameSubscriber::~FrameSubscriber() {
+    munmap(const_cast<RingHeader*>(header), mapped_bytes);
+}
+
+
+
+bool FrameSubscriber::readFrame(std::uint64_t frame_number, RingFrame& frame) {
+    const SlotHeader* slot = slotAt(header, frame_number);
+
+    const std::uint64_t sequence_before = slot->sequence.load(std::memory_order_acquire);
+    if (sequence_before != 2 * frame_number + 2) { // Being written, or already holds a later frame
+        return false;
+    }
+
+    frame.frame_number = slot->frame_number;
+    frame.step = slot->step;
+    frame.time = slot->time;
+    frame.state.resize(6 * header->num_bodies);
+    std::memcpy(frame.state.data(), slot + 1, frame.state.size() * sizeof(double));
+
+    // The copy is only valid if the producer did not start rewriting the slot meanwhile
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot->sequence.load(std::memory_order_relaxed) == sequence_before;
+}
+
+
+
+bool FrameSubscriber::readNext(RingFrame& frame) {
+    while (true) {
+        const std::uint64_t published = header->frames_published.load(std::memory_order_acquire);
+        if (next_frame >= published) {
+            return false;
+        }
+
+        // The slot of the oldest frame may be the one the producer is writing next
+        const std::uint64_t oldest = (published >= header->num_slots) ? published - header->num_slots + 1 : 0;
+        if (next_frame < oldest) {
+            frames_skipped += oldest - next_frame;
+            next_frame = oldest;
+        }
+
+        if (readFrame(next_frame, frame)) {
+            next_frame++;
+            return true;
+        }
+        // Overwritten while reading, try again from the new oldest frame
+        frames_skipped++;
+        next_frame++;
+    }
+}
+
+
+
+bool FrameSubscriber::readLatest(RingFrame& frame) {
+    while (true) {
+        const std::uint64_t published = header->frames_published.load(std::memory_order_acquire);
+        if (published == 0 || published - 1 < next_frame) {
+            return false;
+        }
+
+        const std::uint64_t latest = published - 1;
+        if (readFrame(latest, frame)) {
+            frames_skipped += latest - next_frame;
+            next_frame = latest + 1;
+            return true;
+        }
+    }
+}
+
+
+
+int FrameSubscriber::getNumBodies() const {
+    return header->num_bodies;
+}
+
+std::uint64_t FrameSubscriber::getFramesSkipped() const {
+    return frames_skipped;
+}
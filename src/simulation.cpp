@@ -0,0 +1,165 @@
+#include "simulation.hpp"
+#include "forceKernels.hpp"
+#include "isaDispatch.hpp"
+#include "numa.hpp"
+#include <algorithm>
+#include <omp.h>
+#include <stdexcept>
+
+
+
+// Share [first, last) of n items for one of num_shares equal shares
+static void shareOf(int n, int share, int num_shares, int& first, int& last) {
+    first = static_cast<long>(n) * share / num_shares;
+    last = static_cast<long>(n) * (share + 1) / num_shares;
+}
+
+
+Simulation::Simulation(const std::vector<std::shared_ptr<Particle>>& particle_list, double in_dt, double in_epsilon, bool replicate_sources) :
+    dt{in_dt}, epsilon{in_epsilon}, sim_time{0.0}, step_count{0},
+    mass(particle_list.size()), position(particle_list.size(), 3), velocity(particle_list.size(), 3), acceleration(particle_list.size(), 3)
+{
+    if (dt <= 0.0) {
+        throw std::invalid_argument("The timestep must be greater than 0.");
+    }
+
+    const int num_particles = particle_list.size();
+
+    // Copying in is the first touch of the arrays, so use the same split as the force and update loops
+    // (this also starts the OpenMP thread pool now so the first step does not allocate it)
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_particles; i++) {
+        mass[i] = particle_list[i]->getMass();
+        position.row(i) = particle_list[i]->getPosition().transpose();
+        velocity.row(i) = particle_list[i]->getVelocity().transpose();
+        acceleration.row(i) = particle_list[i]->getAcceleration().transpose();
+    }
+
+    if (replicate_sources) {
+        thread_node = threadNodes();
+        node_num_threads.assign(numaTopology().getNumNodes(), 0);
+        for (int node : thread_node) {
+            thread_rank.push_back(node_num_threads[node]++);
+        }
+
+        replicas.resize(node_num_threads.size());
+        for (auto& replica : replicas) {
+            replica.resize(num_particles, 4);
+        }
+
+        // Each node's threads first touch their own replica
+        #pragma omp parallel
+        {
+            const int thread = omp_get_thread_num();
+            const int node = thread_node[thread];
+            int first, last;
+            shareOf(num_particles, thread_rank[thread], node_num_threads[node], first, last);
+            replicas[node].middleRows(first, last - first).setZero();
+        }
+    }
+}
+
+
+
+void Simulation::step(int num_steps) {
+    const int num_particles = getNumParticles();
+    const bool replicate = !replicas.empty() && omp_get_max_threads() == static_cast<int>(thread_node.size());
+
+    for (int n = 0; n < num_steps; n++) {
+        #pragma omp parallel
+        {
+            const double* x = position.col(0).data();
+            const double* y = position.col(1).data();
+            const double* z = position.col(2).data();
+            const double* m = mass.data();
+
+            if (replicate) {
+                // The threads of each node copy an equal share of the sources into the node's replica
+                const int thread = omp_get_thread_num();
+                const int node = thread_node[thread];
+                auto& replica = replicas[node];
+                int first, last;
+                shareOf(num_particles, thread_rank[thread], node_num_threads[node], first, last);
+
+                replica.block(first, 0, last - first, 3) = position.middleRows(first, last - first);
+                replica.col(3).segment(first, last - first) = mass.segment(first, last - first);
+                #pragma omp barrier
+
+                x = replica.col(0).data();
+                y = replica.col(1).data();
+                z = replica.col(2).data();
+                m = replica.col(3).data();
+            }
+
+            directAccelerationsWorkshare(num_particles, x, y, z, m, epsilon,
+                                         acceleration.col(0).data(), acceleration.col(1).data(), acceleration.col(2).data());
+
+            // Update position and velocity of each body, on the same rows as the force loop
+            const IsaKernels& kernels = isaKernels();
+            #pragma omp for schedule(static)
+            for (int begin = 0; begin < num_particles; begin += kernel_block_rows) {
+                kernels.eulerUpdateRows(begin, std::min(begin + kernel_block_rows, num_particles), dt,
+                                        position.col(0).data(), position.col(1).data(), position.col(2).data(),
+                                        velocity.col(0).data(), velocity.col(1).data(), velocity.col(2).data(),
+                                        acceleration.col(0).data(), acceleration.col(1).data(), acceleration.col(2).data());
+            }
+        }
+
+        sim_time += dt;
+        step_count++;
+    }
+}
+
+
+
+void Simulation::advanceTo(double time) {
+    while (sim_time < time) {
+        step();
+    }
+}
+
+
+
+const Eigen::MatrixX3d& Simulation::getPositions() const {
+    return position;
+}
+const Eigen::MatrixX3d& Simulation::getVelocities() const {
+    return velocity;
+}
+const Eigen::MatrixX3d& Simulation::getAccelerations() const {
+    return acceleration;
+}
+const Eigen::VectorXd& Simulation::getMasses() const {
+    return mass;
+}
+
+int Simulation::getNumParticles() const {
+    return mass.size();
+}
+double Simulation::getTime() const {
+    return sim_time;
+}
+long Simulation::getStepCount() const {
+    return step_count;
+}
+double Simulation::getTimestep() const {
+    return dt;
+}
+int Simulation::getNumReplicas() const {
+    return replicas.size();
+}
+
+
+
+void Simulation::writeBack(const std::vector<std::shared_ptr<Particle>>& particle_list) const {
+    if (particle_list.size() != getNumParticles()) {
+        throw std::invalid_argument("The particle list must have the same number of particles as the simulation.");
+    }
+
+    for (int i = 0; i < getNumParticles(); i++) {
+        Eigen::Vector3d pos = position.row(i).transpose();
+        Eigen::Vector3d vel = velocity.row(i).transpose();
+        Eigen::Vector3d acc = acceleration.row(i).transpose();
+        *particle_list[i] = Particle(mass[i], pos, vel, acc);
+    }
+}
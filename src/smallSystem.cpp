@@ -0,0 +1,53 @@
+#include "smallSystem.hpp"
+
+
+
+// Run the whole evolution on the engine for exactly N bodies
+template <std::size_t N, bool Softened>
+static void runSmallSystem(const std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double total_time, double epsilon,
+                           const StepObserver& observer) {
+    SmallSystemEngine<N, Softened> engine(particle_list, epsilon);
+
+    // Same loop as evolutionOfSystem so the number of steps is identical
+    long step = 0;
+    for (double sim_time = 0.0; sim_time < total_time; sim_time += dt) {
+        engine.step(dt);
+
+        if (observer) {
+            engine.writeBack(particle_list);
+            observer(++step, sim_time + dt, particle_list);
+        }
+    }
+    engine.writeBack(particle_list);
+}
+
+
+using SmallSystemRunner = void (*)(const std::vector<std::shared_ptr<Particle>>&, double, double, double, const StepObserver&);
+
+// Table of engines indexed by body count, built at compile time
+template <bool Softened, std::size_t... N>
+static constexpr std::array<SmallSystemRunner, sizeof...(N)> makeRunnerTable(std::index_sequence<N...>) {
+    return { &runSmallSystem<N + 1, Softened>... };
+}
+
+static constexpr auto softened_runners = makeRunnerTable<true>(std::make_index_sequence<max_small_system_size>{});
+static constexpr auto unsoftened_runners = makeRunnerTable<false>(std::make_index_sequence<max_small_system_size>{});
+
+
+
+bool evolveSmallSystem(const std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double total_time, double epsilon,
+                       const StepObserver& observer) {
+    const std::size_t num_particles = particle_list.size();
+
+    if (num_particles == 0 || num_particles > max_small_system_size) {
+        return false;
+    }
+
+    if (epsilon == 0.0) {
+        unsoftened_runners[num_particles - 1](particle_list, dt, total_time, epsilon, observer);
+    }
+    else {
+        softened_runners[num_particles - 1](particle_list, dt, total_time, epsilon, observer);
+    }
+    return true;
+}
@@ -1,4 +1,9 @@
 #include "solarSystem.hpp"
+#include "smallSystem.hpp"
+#include "workStealing.hpp"
+#include "isaDispatch.hpp"
+#include "deterministicSum.hpp"
+#include <algorithm>
 
 
 SolarSystem::SolarSystem() {} // Constructor for celestial body list as the solar system
@@ -22,6 +27,7 @@ std::vector<std::shared_ptr<Particle>> SolarSystem::generateInitialConditions()
         {1.0/19352.0, 30.1}      // Neptune
     };
     celestial_body_list.clear(); // Ensure list is empty
+    arena = ParticleArena::create(mass_dist.size());
 
     std::default_random_engine generator(42); // Seed the random number generator. Can fix the seed to any value by changing the number.
     std::uniform_real_distribution<double> angleDistribution(0.0, 2.0 * M_PI);
@@ -30,7 +36,7 @@ std::vector<std::shared_ptr<Particle>> SolarSystem::generateInitialConditions()
     for (const auto& [mass, distance] : mass_dist) {
         double angle = angleDistribution(generator); // Generate pseudo-random angle
 
-        auto body = std::make_shared<Particle>(celestialBody(mass, distance, angle)); // Make celestial body instance as shared pointers
+        auto body = arena->emplace(celestialBody(mass, distance, angle)); // Make celestial body instance as shared pointers into the arena
         celestial_body_list.push_back(body);
     }
 
@@ -39,11 +45,16 @@ std::vector<std::shared_ptr<Particle>> SolarSystem::generateInitialConditions()
 
 
 
-std::vector<std::shared_ptr<Particle>> SolarSystem::getCelestialBodyList() const {
+const std::vector<std::shared_ptr<Particle>>& SolarSystem::getCelestialBodyList() const {
     return celestial_body_list; 
 }
 
 
+std::size_t SolarSystem::getArenaBytes() const {
+    return arena ? arena->getBytesReserved() : 0;
+}
+
+
 
 
 void SolarSystem::printMessages() {
@@ -100,7 +111,8 @@ Particle celestialBody(double mass, double distance, double angle) {
 
 
 
-void evolutionOfSystem(const std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double total_time, double epsilon) {
+void evolutionOfSystem(const std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double total_time, double epsilon, ForcePrecision precision,
+                       const StepObserver& observer, ForceLaw law) {
 
     // Check that timestep and total simulation time arguments are greater than 0
     if ( (dt <= 0.0) || (total_time <= 0.0) )
@@ -108,24 +120,85 @@ void evolutionOfSystem(const std::vector<std::shared_ptr<Particle>>& particle_li
         throw std::invalid_argument("The timestep and total time must be greater than 0.");
     }
 
+    if (law != ForceLaw::Plummer && precision != ForcePrecision::Double) {
+        throw std::invalid_argument("The " + forceLawName(law) + " force law needs double precision.");
+    }
+
+    // Small systems run on a fixed size engine with unrolled pair loops and no threading overhead (Plummer softening only)
+    if (precision == ForcePrecision::Double && law == ForceLaw::Plummer && evolveSmallSystem(particle_list, dt, total_time, epsilon, observer)) {
+        return;
+    }
+
 
     // Loop for full simulation time
+    long step = 0;
     for (double sim_time = 0.0; sim_time < total_time; sim_time += dt) {
+        evolveOneStep(particle_list, dt, epsilon, precision, law);
 
-        #pragma omp parallel  // Create parallel region
-        {
-            // Update acceleration felt by each body
-            #pragma omp for
-            for (auto& particle : particle_list) {
-                sumAccelerations(particle_list, *particle, epsilon);
-            }
-            // Update position and velocity of each body
-            #pragma omp for nowait // Disable unnecessary implicit barrier in this second omp
-            for (auto& particle : particle_list) {
-                particle->update(dt);
-            }
+        if (observer) {
+            observer(++step, sim_time + dt, particle_list);
         }
+    }
+}
+
+
+
+void evolveOneStep(const std::vector<std::shared_ptr<Particle>>& particle_list, double dt, double epsilon, ForcePrecision precision, ForceLaw law) {
+
+    if (precision != ForcePrecision::Double) {
+        std::vector<Eigen::Vector3d> accelerations;
+        computeAccelerations(particle_list, accelerations, epsilon, precision, law);
 
+        // Update acceleration, position and velocity of each body
+        #pragma omp parallel for
+        for (int i = 0; i < particle_list.size(); i++) {
+            particle_list[i]->updateAcceleration(accelerations[i]);
+            particle_list[i]->update(dt);
+        }
+        return;
+    }
+
+    const int num_particles = particle_list.size();
+    const bool with_velocity = law == ForceLaw::PostNewtonian;
+
+    // Copy into reused structure of arrays buffers for the force kernel of this CPU's instruction set
+    ScratchPool::Lease<double> mass = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> x = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> y = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> z = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> vx = scratchPool().acquire<double>(with_velocity ? num_particles : 0);
+    ScratchPool::Lease<double> vy = scratchPool().acquire<double>(with_velocity ? num_particles : 0);
+    ScratchPool::Lease<double> vz = scratchPool().acquire<double>(with_velocity ? num_particles : 0);
+    ScratchPool::Lease<double> ax = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> ay = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> az = scratchPool().acquire<double>(num_particles);
+
+    #pragma omp parallel for
+    for (int i = 0; i < num_particles; i++) {
+        mass[i] = particle_list[i]->getMass();
+        x[i] = particle_list[i]->getPosition()[0];
+        y[i] = particle_list[i]->getPosition()[1];
+        z[i] = particle_list[i]->getPosition()[2];
+        if (with_velocity) {
+            vx[i] = particle_list[i]->getVelocity()[0];
+            vy[i] = particle_list[i]->getVelocity()[1];
+            vz[i] = particle_list[i]->getVelocity()[2];
+        }
+    }
+
+    // Update acceleration felt by each body, idle threads stealing blocks of bodies from busy ones
+    // The kernel of the force law is picked here, once per step
+    const auto kernel = isaKernels().accelerationRows[static_cast<int>(law)];
+    forceExecutor().parallelFor(num_particles, 0, [&](int begin, int end, int) {
+        kernel(begin, end, num_particles, x.data(), y.data(), z.data(), vx.data(), vy.data(), vz.data(), mass.data(), epsilon, ax.data(), ay.data(), az.data());
+    });
+
+    // Update acceleration, position and velocity of each body
+    #pragma omp parallel for
+    for (int i = 0; i < num_particles; i++) {
+        Eigen::Vector3d acceleration(ax[i], ay[i], az[i]);
+        particle_list[i]->updateAcceleration(acceleration);
+        particle_list[i]->update(dt);
     }
 }
 
@@ -133,18 +206,21 @@ void evolutionOfSystem(const std::vector<std::shared_ptr<Particle>>& particle_li
 
 
 
+
 ///////////////////////////////////////////////////////// Energy Functions /////////////////////////////////////////////////////////
 
 
 
 double totalKineticEnergy(const std::vector<std::shared_ptr<Particle>>& particle_list) {
-    double tot_KE_sum = 0.0;
-    
-    // Loop through all particles
-    #pragma omp parallel for reduction(+: tot_KE_sum)
-    for(int i = 0; i < particle_list.size(); i++) {
-        tot_KE_sum += particle_list[i]->getMass() * (particle_list[i]->getVelocity()).squaredNorm(); // KE equation
-    }
+
+    // Fixed blocks of particles, so the total is the same on any number of threads
+    double tot_KE_sum = deterministicReduce(particle_list.size(), reduction_block_size, [&](int begin, int end) {
+        double block_sum = 0.0;
+        for (int i = begin; i < end; i++) {
+            block_sum += particle_list[i]->getMass() * (particle_list[i]->getVelocity()).squaredNorm(); // KE equation
+        }
+        return block_sum;
+    });
     return tot_KE_sum * 0.5;
 }
 
@@ -152,23 +228,28 @@ double totalKineticEnergy(const std::vector<std::shared_ptr<Particle>>& particle
 
 
 double totalPotentialEnergy(const std::vector<std::shared_ptr<Particle>>& particle_list) {
-    double tot_PE_sum = 0.0;
-
-    // Loop for total PE
-    #pragma omp parallel for collapse(2) reduction(+: tot_PE_sum)
-    for (int i = 0; i < particle_list.size(); i++) {
-        // Loop for PE of 1 particle
-        for (int j = 0; j < particle_list.size(); j++) {
-
-            // If the particle in the list is not the particle who's PE is being calculated
-            if ( i != j ) 
-            {
-                tot_PE_sum += ( particle_list[i]->getMass() * particle_list[j]->getMass() ) 
-                / ( particle_list[j]->getPosition() - particle_list[i]->getPosition() ).norm(); // The PE between two particles
-            }
-        }
+    const int num_particles = particle_list.size();
+
+    // Copy masses and positions into reused contiguous buffers so the pair loop does not chase pointers
+    ScratchPool::Lease<double> mass = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> x = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> y = scratchPool().acquire<double>(num_particles);
+    ScratchPool::Lease<double> z = scratchPool().acquire<double>(num_particles);
+
+    #pragma omp parallel for
+    for (int i = 0; i < num_particles; i++) {
+        mass[i] = particle_list[i]->getMass();
+        x[i] = particle_list[i]->getPosition()[0];
+        y[i] = particle_list[i]->getPosition()[1];
+        z[i] = particle_list[i]->getPosition()[2];
     }
 
+    // Loop for total PE, in fixed blocks of rows on the kernel of this CPU's instruction set (the same total on any number of threads)
+    const IsaKernels& kernels = isaKernels();
+    double tot_PE_sum = deterministicReduce(num_particles, kernel_block_rows, [&](int begin, int end) {
+        return kernels.potentialRows(begin, end, num_particles, x.data(), y.data(), z.data(), mass.data());
+    });
+
     return tot_PE_sum * -0.5;
 }
 
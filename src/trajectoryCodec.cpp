@@ -0,0 +1,424 @@
+#include "trajectoryCodec.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+
+
+static std::uint64_t zigzagEncode(std::int64_t value) {
+    return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+}
+
+static std::int64_t zigzagDecode(std::uint64_t value) {
+    return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+}
+
+
+
+// Pack count values using the bits of the largest one. Block = 1 byte width, then the bits least significant first
+static void packBlock(const std::uint64_t* values, std::size_t count, std::vector<std::uint8_t>& out) {
+    std::uint64_t all_bits = 0;
+    for (std::size_t i = 0; i < count; i++) {
+        all_bits |= values[i];
+    }
+    const int width = (all_bits == 0) ? 0 : 64 - __builtin_clzll(all_bits);
+
+    out.clear();
+    out.push_back(width);
+
+    // Quantized integers have at most 31 bits, so a zigzagged difference fits in 33 and the buffer never overflows
+    std::uint64_t buffer = 0;
+    int filled = 0;
+    for (std::size_t i = 0; i < count && width > 0; i++) {
+        buffer |= values[i] << filled;
+        filled += width;
+        while (filled >= 8) {
+            out.push_back(buffer & 0xFF);
+            buffer >>= 8;
+            filled -= 8;
+        }
+    }
+    if (filled > 0) {
+        out.push_back(buffer & 0xFF);
+    }
+}
+
+static std::size_t packedBlockBytes(int width, std::size_t count) {
+    return 1 + (width * count + 7) / 8;
+}
+
+static void unpackBlock(const std::uint8_t* block, std::size_t count, std::uint64_t* values) {
+    const int width = block[0];
+    const std::uint8_t* bytes = block + 1;
+    const std::uint64_t mask = (width == 64) ? ~0ULL : ((1ULL << width) - 1);
+
+    std::uint64_t buffer = 0;
+    int filled = 0;
+    for (std::size_t i = 0; i < count; i++) {
+        while (filled < width) {
+            buffer |= static_cast<std::uint64_t>(*bytes++) << filled;
+            filled += 8;
+        }
+        values[i] = buffer & mask;
+        buffer = (width == 64) ? 0 : buffer >> width;
+        filled -= width;
+    }
+}
+
+
+
+// Bounding box of one 3 component quantity across the bodies, stored per frame
+static void boundingBox(const std::vector<std::shared_ptr<Particle>>& particle_list, bool velocity, double* min, double* max) {
+    for (int axis = 0; axis < 3; axis++) {
+        min[axis] = INFINITY;
+        max[axis] = -INFINITY;
+    }
+    for (const std::shared_ptr<Particle>& body : particle_list) {
+        const Eigen::Vector3d& value = velocity ? body->getVelocity() : body->getPosition();
+        for (int axis = 0; axis < 3; axis++) {
+            min[axis] = std::min(min[axis], value[axis]);
+            max[axis] = std::max(max[axis], value[axis]);
+        }
+    }
+}
+
+static double quantizationScale(double min, double max, int bits) {
+    const double levels = static_cast<double>((1LL << bits) - 1);
+    return (max > min) ? levels / (max - min) : 0.0;
+}
+
+
+
+
+TrajectoryWriter::TrajectoryWriter(const std::string& path, int in_num_bodies, const TrajectoryCodecSettings& in_settings) :
+    file(path, std::ios::binary | std::ios::trunc), num_bodies{in_num_bodies}, settings{in_settings}, bytes_written{0}, finished{false}
+{
+    if (num_bodies <= 0) {
+        throw std::invalid_argument("A trajectory needs at least 1 body.");
+    }
+    if (settings.position_bits < 1 || settings.position_bits > 31 || settings.velocity_bits < 1 || settings.velocity_bits > 31) {
+        throw std::invalid_argument("Trajectory quantization must use 1 to 31 bits.");
+    }
+    if (settings.keyframe_interval < 1) {
+        throw std::invalid_argument("The trajectory keyframe interval must be at least 1.");
+    }
+    if (!file) {
+        throw std::runtime_error("Could not open trajectory file " + path);
+    }
+
+    TrajectoryFileHeader header;
+    std::memcpy(header.magic, trajectory_magic, sizeof(header.magic));
+    header.num_bodies = num_bodies;
+    header.position_bits = settings.position_bits;
+    header.velocity_bits = settings.velocity_bits;
+    header.keyframe_interval = settings.keyframe_interval;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    bytes_written = sizeof(header);
+
+    previous_quantized.assign(6 * num_bodies, 0);
+    quantized.resize(6 * num_bodies);
+    encoded.resize(6 * num_bodies);
+    packed_blocks.resize((6 * num_bodies + trajectory_block_size - 1) / trajectory_block_size);
+}
+
+
+
+TrajectoryWriter::~TrajectoryWriter() {
+    if (!finished) {
+        try {
+            finish();
+        }
+        catch (const std::exception&) {} // Nothing to report to from a destructor
+    }
+}
+
+
+
+void TrajectoryWriter::writeFrame(long step, double sim_time, const std::vector<std::shared_ptr<Particle>>& particle_list) {
+    if (finished) {
+        throw std::logic_error("Cannot write frames after the trajectory is finished.");
+    }
+    if (particle_list.size() != static_cast<std::size_t>(num_bodies)) {
+        throw std::invalid_argument("The number of bodies does not match the trajectory.");
+    }
+
+    TrajectoryFrameHeader header;
+    header.step = step;
+    header.time = sim_time;
+    header.keyframe = (index.size() % settings.keyframe_interval == 0);
+    boundingBox(particle_list, false, header.position_min, header.position_max);
+    boundingBox(particle_list, true, header.velocity_min, header.velocity_max);
+
+    double offset[6], scale[6];
+    for (int axis = 0; axis < 3; axis++) {
+        offset[axis] = header.position_min[axis];
+        scale[axis] = quantizationScale(header.position_min[axis], header.position_max[axis], settings.position_bits);
+        offset[axis + 3] = header.velocity_min[axis];
+        scale[axis + 3] = quantizationScale(header.velocity_min[axis], header.velocity_max[axis], settings.velocity_bits);
+    }
+
+    const std::size_t num_values = 6 * num_bodies;
+    const std::size_t num_blocks = packed_blocks.size();
+    const bool keyframe = header.keyframe;
+
+    #pragma omp parallel
+    {
+        // Quantize and take the difference from the previous frame
+        #pragma omp for schedule(static)
+        for (int i = 0; i < num_bodies; i++) {
+            const Eigen::Vector3d& pos = particle_list[i]->getPosition();
+            const Eigen::Vector3d& vel = particle_list[i]->getVelocity();
+
+            for (int component = 0; component < 6; component++) {
+                const double value = (component < 3) ? pos[component] : vel[component - 3];
+                const std::size_t k = component * num_bodies + i;
+
+                quantized[k] = std::llround((value - offset[component]) * scale[component]);
+                encoded[k] = zigzagEncode(keyframe ? quantized[k] : quantized[k] - previous_quantized[k]);
+            }
+        }
+
+        #pragma omp for schedule(static)
+        for (std::size_t block = 0; block < num_blocks; block++) {
+            const std::size_t first = block * trajectory_block_size;
+            packBlock(encoded.data() + first, std::min(trajectory_block_size, num_values - first), packed_blocks[block]);
+        }
+    }
+
+    std::size_t payload_bytes = 0;
+    for (const std::vector<std::uint8_t>& block : packed_blocks) {
+        payload_bytes += block.size();
+    }
+    header.payload_bytes = payload_bytes;
+
+    index.push_back({bytes_written, step, sim_time});
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const std::vector<std::uint8_t>& block : packed_blocks) {
+        file.write(reinterpret_cast<const char*>(block.data()), block.size());
+    }
+    if (!file) {
+        throw std::runtime_error("Could not write trajectory frame.");
+    }
+    bytes_written += sizeof(header) + payload_bytes;
+
+    std::swap(previous_quantized, quantized);
+}
+
+
+
+StepObserver TrajectoryWriter::observer(int steps_per_frame) {
+    if (steps_per_frame < 1) {
+        throw std::invalid_argument("The number of steps per frame must be at least 1.");
+    }
+
+    return [this, steps_per_frame](long step, double sim_time, const std::vector<std::shared_ptr<Particle>>& particle_list) {
+        if (step % steps_per_frame == 0) {
+            writeFrame(step, sim_time, particle_list);
+        }
+    };
+}
+
+
+
+void TrajectoryWriter::finish() {
+    if (finished) {
+        return;
+    }
+    finished = true;
+
+    TrajectoryFooter footer;
+    footer.index_offset = bytes_written;
+    footer.num_frames = index.size();
+    std::memcpy(footer.magic, trajectory_magic, sizeof(footer.magic));
+
+    file.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(TrajectoryIndexEntry));
+    file.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+    bytes_written += index.size() * sizeof(TrajectoryIndexEntry) + sizeof(footer);
+    file.close();
+
+    if (!file) {
+        throw std::runtime_error("Could not finish trajectory file.");
+    }
+}
+
+
+
+std::size_t TrajectoryWriter::getNumFrames() const {
+    return index.size();
+}
+
+std::uint64_t TrajectoryWriter::getBytesWritten() const {
+    return bytes_written;
+}
+
+
+
+
+TrajectoryReader::TrajectoryReader(const std::string& path) : file(path, std::ios::binary), decoded_frame{0}, have_decoded{false} {
+    if (!file) {
+        throw std::runtime_error("Could not open trajectory file " + path);
+    }
+
+    TrajectoryFileHeader header;
+    TrajectoryFooter footer;
+    file.seekg(0, std::ios::end);
+    const std::uint64_t file_bytes = file.tellg();
+    file.seekg(0);
+    if (file_bytes < sizeof(header) + sizeof(footer)) {
+        throw std::runtime_error(path + " is not a finished trajectory file.");
+    }
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    file.seekg(-static_cast<std::streamoff>(sizeof(footer)), std::ios::end);
+    file.read(reinterpret_cast<char*>(&footer), sizeof(footer));
+
+    if (!file || std::memcmp(header.magic, trajectory_magic, sizeof(header.magic)) != 0
+        || std::memcmp(footer.magic, trajectory_magic, sizeof(footer.magic)) != 0) {
+        throw std::runtime_error(path + " is not a finished trajectory file.");
+    }
+
+    // Check the header and footer before sizing anything from them: a frame has a width byte per block of values, so the bodies
+    // must fit in the file, and the index must run from index_offset to the footer
+    const std::uint64_t num_values = 6 * static_cast<std::uint64_t>(header.num_bodies);
+    if (header.num_bodies == 0 || header.num_bodies > static_cast<std::uint32_t>(std::numeric_limits<int>::max())
+        || (num_values + trajectory_block_size - 1) / trajectory_block_size > file_bytes
+        || header.position_bits < 1 || header.position_bits > 31 || header.velocity_bits < 1 || header.velocity_bits > 31
+        || header.keyframe_interval < 1 || header.keyframe_interval > static_cast<std::uint32_t>(std::numeric_limits<int>::max())
+        || footer.num_frames > file_bytes / sizeof(TrajectoryIndexEntry) || footer.index_offset < sizeof(header)
+        || footer.index_offset > file_bytes || footer.index_offset + footer.num_frames * sizeof(TrajectoryIndexEntry) + sizeof(footer) != file_bytes) {
+        throw std::runtime_error(path + " does not match its header.");
+    }
+
+    num_bodies = header.num_bodies;
+    settings.position_bits = header.position_bits;
+    settings.velocity_bits = header.velocity_bits;
+    settings.keyframe_interval = header.keyframe_interval;
+
+    index.resize(footer.num_frames);
+    file.seekg(footer.index_offset);
+    file.read(reinterpret_cast<char*>(index.data()), index.size() * sizeof(TrajectoryIndexEntry));
+    if (!file) {
+        throw std::runtime_error("Could not read the index of " + path);
+    }
+    for (const TrajectoryIndexEntry& entry : index) {
+        if (entry.offset < sizeof(header) || entry.offset > footer.index_offset || footer.index_offset - entry.offset < sizeof(TrajectoryFrameHeader)) {
+            throw std::runtime_error("The index of " + path + " points outside its frames.");
+        }
+    }
+    frames_end = footer.index_offset;
+
+    quantized.resize(6 * num_bodies);
+    encoded.resize(6 * num_bodies);
+}
+
+
+
+std::size_t TrajectoryReader::getNumFrames() const {
+    return index.size();
+}
+
+int TrajectoryReader::getNumBodies() const {
+    return num_bodies;
+}
+
+const TrajectoryCodecSettings& TrajectoryReader::getSettings() const {
+    return settings;
+}
+
+long TrajectoryReader::getFrameStep(std::size_t frame) const {
+    return index.at(frame).step;
+}
+
+double TrajectoryReader::getFrameTime(std::size_t frame) const {
+    return index.at(frame).time;
+}
+
+
+
+void TrajectoryReader::decodeInto(std::size_t frame, TrajectoryFrameHeader& header) {
+    file.seekg(index[frame].offset);
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || header.payload_bytes > frames_end - index[frame].offset - sizeof(header)) {
+        throw std::runtime_error("Corrupt trajectory frame " + std::to_string(frame));
+    }
+    payload.resize(header.payload_bytes);
+    file.read(reinterpret_cast<char*>(payload.data()), payload.size());
+    if (!file) {
+        throw std::runtime_error("Could not read trajectory frame " + std::to_string(frame));
+    }
+
+    // Block sizes follow from their widths, so find every block first and unpack them in parallel
+    const std::size_t num_values = 6 * num_bodies;
+    const std::size_t num_blocks = (num_values + trajectory_block_size - 1) / trajectory_block_size;
+    std::vector<std::size_t> block_offsets(num_blocks);
+    std::size_t offset = 0;
+    for (std::size_t block = 0; block < num_blocks; block++) {
+        if (offset >= payload.size() || payload[offset] > 64) {
+            throw std::runtime_error("Corrupt trajectory frame " + std::to_string(frame));
+        }
+        block_offsets[block] = offset;
+        offset += packedBlockBytes(payload[offset], std::min(trajectory_block_size, num_values - block * trajectory_block_size));
+    }
+    if (offset != payload.size()) {
+        throw std::runtime_error("Corrupt trajectory frame " + std::to_string(frame));
+    }
+
+    const bool keyframe = header.keyframe;
+    #pragma omp parallel for schedule(static)
+    for (std::size_t block = 0; block < num_blocks; block++) {
+        const std::size_t first = block * trajectory_block_size;
+        const std::size_t count = std::min(trajectory_block_size, num_values - first);
+        unpackBlock(payload.data() + block_offsets[block], count, encoded.data() + first);
+
+        for (std::size_t k = first; k < first + count; k++) {
+            quantized[k] = keyframe ? zigzagDecode(encoded[k]) : quantized[k] + zigzagDecode(encoded[k]);
+        }
+    }
+
+    decoded_frame = frame;
+    have_decoded = true;
+}
+
+
+
+TrajectoryFrame TrajectoryReader::readFrame(std::size_t frame) {
+    if (frame >= index.size()) {
+        throw std::out_of_range("Trajectory frame " + std::to_string(frame) + " does not exist.");
+    }
+
+    // Carry on from the last decoded frame if it is between the keyframe and this frame, otherwise start at the keyframe
+    const std::size_t keyframe = frame - frame % settings.keyframe_interval;
+    std::size_t first = keyframe;
+    if (have_decoded && decoded_frame >= keyframe && decoded_frame <= frame) {
+        first = decoded_frame + 1;
+    }
+
+    TrajectoryFrameHeader header;
+    if (first > frame) { // Already decoded, only the header is needed
+        file.seekg(index[frame].offset);
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    }
+    for (std::size_t f = first; f <= frame; f++) {
+        decodeInto(f, header);
+    }
+
+    TrajectoryFrame result;
+    result.step = header.step;
+    result.time = header.time;
+    result.positions.resize(num_bodies, 3);
+    result.velocities.resize(num_bodies, 3);
+
+    for (int axis = 0; axis < 3; axis++) {
+        const double position_scale = quantizationScale(header.position_min[axis], header.position_max[axis], settings.position_bits);
+        const double velocity_scale = quantizationScale(header.velocity_min[axis], header.velocity_max[axis], settings.velocity_bits);
+        const double position_step = (position_scale > 0.0) ? 1.0 / position_scale : 0.0;
+        const double velocity_step = (velocity_scale > 0.0) ? 1.0 / velocity_scale : 0.0;
+
+        for (int i = 0; i < num_bodies; i++) {
+            result.positions(i, axis) = header.position_min[axis] + quantized[axis * num_bodies + i] * position_step;
+            result.velocities(i, axis) = header.velocity_min[axis] + quantized[(axis + 3) * num_bodies + i] * velocity_step;
+        }
+    }
+    return result;
+}
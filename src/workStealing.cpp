@@ -0,0 +1,162 @@
+#include "workStealing.hpp"
+#include <algorithm>
+#include <chrono>
+#include <omp.h>
+#include <random>
+#include <thread>
+
+
+
+bool WorkStealingExecutor::popOwn(Worker& worker, std::pair<int, int>& task) {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.head == worker.tail) {
+        return false;
+    }
+    task = worker.tasks[worker.head++];
+    return true;
+}
+
+bool WorkStealingExecutor::steal(Worker& victim, std::pair<int, int>& task) {
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (victim.head == victim.tail) {
+        return false;
+    }
+    task = victim.tasks[--victim.tail];
+    return true;
+}
+
+
+
+void WorkStealingExecutor::run(int count, int grain, TaskFunction function, void* context) {
+    if (count <= 0) {
+        return;
+    }
+
+    const int num_workers = omp_get_max_threads();
+    while (static_cast<int>(workers.size()) < num_workers) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    if (grain <= 0) {
+        grain = default_grain > 0 ? default_grain : std::max(1, count / (8 * num_workers));
+    }
+
+    // Deal the tasks out in contiguous blocks, as a static schedule would
+    const int num_tasks = (count + grain - 1) / grain;
+    for (int w = 0; w < num_workers; w++) {
+        Worker& worker = *workers[w];
+        worker.tasks.clear(); // Keeps its capacity, so repeated loops stop allocating
+        for (int t = static_cast<long>(num_tasks) * w / num_workers; t < static_cast<long>(num_tasks) * (w + 1) / num_workers; t++) {
+            worker.tasks.emplace_back(t * grain, std::min(count, (t + 1) * grain));
+        }
+        worker.head = 0;
+        worker.tail = worker.tasks.size();
+    }
+    remaining_tasks = num_tasks;
+    cancelled = false;
+    first_exception = nullptr;
+
+    #pragma omp parallel num_threads(num_workers)
+    {
+        const int w = omp_get_thread_num();
+        Worker& self = *workers[w];
+        std::minstd_rand random_victim(w + 1);
+        std::pair<int, int> task;
+
+        bool idle = false;
+        std::chrono::steady_clock::time_point idle_start;
+
+        while (remaining_tasks > 0 && !cancelled) {
+            bool found = popOwn(self, task);
+
+            if (!found && num_workers > 1) {
+                if (!idle) {
+                    idle = true;
+                    idle_start = std::chrono::steady_clock::now();
+                }
+                // Any worker but this one
+                int victim = std::uniform_int_distribution<int>(0, num_workers - 2)(random_victim);
+                victim += (victim >= w);
+
+                self.stats.steal_attempts++;
+                found = steal(*workers[victim], task);
+                if (found) {
+                    self.stats.tasks_stolen++;
+                }
+            }
+
+            if (found) {
+                if (idle) {
+                    idle = false;
+                    self.stats.idle_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - idle_start).count();
+                }
+
+                try {
+                    function(context, task.first, task.second, w);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(exception_mutex);
+                    if (!first_exception) {
+                        first_exception = std::current_exception();
+                    }
+                    cancelled = true;
+                }
+                self.stats.tasks_run++;
+                remaining_tasks--;
+            }
+            else {
+                std::this_thread::yield(); // Others are finishing their last tasks
+            }
+        }
+
+        if (idle) {
+            self.stats.idle_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - idle_start).count();
+        }
+    }
+
+    if (first_exception) {
+        std::rethrow_exception(first_exception);
+    }
+}
+
+
+
+void WorkStealingExecutor::setDefaultGrain(int grain) {
+    default_grain = std::max(0, grain);
+}
+
+int WorkStealingExecutor::getDefaultGrain() const {
+    return default_grain;
+}
+
+
+int WorkStealingExecutor::getNumWorkers() const {
+    return workers.size();
+}
+
+WorkerStats WorkStealingExecutor::getStats(int worker) const {
+    return workers.at(worker)->stats;
+}
+
+WorkerStats WorkStealingExecutor::getTotalStats() const {
+    WorkerStats total;
+    for (const auto& worker : workers) {
+        total.tasks_run += worker->stats.tasks_run;
+        total.tasks_stolen += worker->stats.tasks_stolen;
+        total.steal_attempts += worker->stats.steal_attempts;
+        total.idle_seconds += worker->stats.idle_seconds;
+    }
+    return total;
+}
+
+void WorkStealingExecutor::resetStats() {
+    for (auto& worker : workers) {
+        worker->stats = WorkerStats{};
+    }
+}
+
+
+
+WorkStealingExecutor& forceExecutor() {
+    thread_local WorkStealingExecutor executor;
+    return executor;
+}
@@ -0,0 +1,97 @@
+#include <catch2/catch_session.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include "distributed.hpp"
+#include "randomParticleSystem.hpp"
+#include "solarSystem.hpp"
+
+
+// Run with mpirun -np 4. Every rank runs every test case, rank 0 also runs the serial reference
+
+
+
+TEST_CASE("Bodies are split along the space filling curve, one compact piece per rank", "[distributed]") {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    std::vector<std::shared_ptr<Particle>> body_list;
+    if (rank == 0) {
+        body_list = RandomSystem(103).generateInitialConditions();
+    }
+    DistributedSystem system(MPI_COMM_WORLD, body_list, 0.01);
+
+    REQUIRE( system.getNumGlobal() == 103 );
+    REQUIRE( (system.getNumLocal() == 25 || system.getNumLocal() == 26) );
+
+    // Key ranges of the ranks follow each other along the curve
+    auto [smallest, largest] = system.getLocalKeyRange();
+    std::uint64_t neighbour_smallest = 0;
+    MPI_Sendrecv(&smallest, 1, MPI_UINT64_T, (rank + system.getNumRanks() - 1) % system.getNumRanks(), 0,
+                 &neighbour_smallest, 1, MPI_UINT64_T, (rank + 1) % system.getNumRanks(), 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    if (rank < system.getNumRanks() - 1) {
+        REQUIRE( largest <= neighbour_smallest );
+    }
+
+    // Every body is held by exactly one rank
+    long id_sum = 0;
+    for (long id : system.getLocalIds()) {
+        id_sum += id;
+    }
+    long total_id_sum = 0;
+    MPI_Allreduce(&id_sum, &total_id_sum, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+    REQUIRE( total_id_sum == 103 * 102 / 2 );
+
+    REQUIRE_THROWS( DistributedSystem(MPI_COMM_WORLD, std::vector<std::shared_ptr<Particle>>(rank == 0 ? 2 : 0, nullptr)) );
+}
+
+
+
+TEST_CASE("Distributed evolution and energies match the serial run", "[distributed]") {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    std::vector<std::shared_ptr<Particle>> body_list;
+    if (rank == 0) {
+        body_list = RandomSystem(200).generateInitialConditions();
+    }
+    DistributedSystem system(MPI_COMM_WORLD, body_list, 0.01);
+
+    // Global reductions agree with the serial energy functions
+    double kinetic = system.totalKineticEnergy();
+    double potential = system.totalPotentialEnergy();
+    if (rank == 0) {
+        REQUIRE_THAT( kinetic, Catch::Matchers::WithinRel(totalKineticEnergy(body_list), 1e-12) );
+        REQUIRE_THAT( potential, Catch::Matchers::WithinRel(totalPotentialEnergy(body_list), 1e-12) );
+    }
+
+    system.evolve(0.001, 0.05);
+    std::vector<std::shared_ptr<Particle>> gathered = system.gather();
+
+    if (rank == 0) {
+        evolutionOfSystem(body_list, 0.001, 0.05, 0.01);
+        REQUIRE( gathered.size() == 200 );
+
+        // Only the order of the force sums differs
+        for (int i = 0; i < 200; i++) {
+            REQUIRE( (gathered[i]->getPosition() - body_list[i]->getPosition()).norm() < 1e-10 );
+            REQUIRE( (gathered[i]->getVelocity() - body_list[i]->getVelocity()).norm() < 1e-8 );
+            REQUIRE( gathered[i]->getMass() == body_list[i]->getMass() );
+        }
+    }
+    else {
+        REQUIRE( gathered.empty() );
+    }
+}
+
+
+
+int main(int argc, char* argv[]) {
+    MPI_Init(&argc, &argv);
+    int result = Catch::Session().run(argc, argv);
+
+    // Fail the whole run if any rank failed
+    int worst_result = 0;
+    MPI_Allreduce(&result, &worst_result, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Finalize();
+    return worst_result;
+}
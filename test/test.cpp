@@ -1,8 +1,47 @@
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers_floating_point.hpp>
+#include <catch2/generators/catch_generators.hpp>
 #include "particle.hpp"
 #include "solarSystem.hpp"
 #include "randomParticleSystem.hpp"
+#include "closeEncounters.hpp"
+#include "multipleTimestep.hpp"
+#include "adaptiveTimestep.hpp"
+#include "forceKernels.hpp"
+#include "smallSystem.hpp"
+#include "simulation.hpp"
+#include "particleArena.hpp"
+#include "frameStream.hpp"
+#include "sharedFrameRing.hpp"
+#include "frameServer.hpp"
+#include "trajectoryCodec.hpp"
+#include "ephemeris.hpp"
+#include "numa.hpp"
+#include "workStealing.hpp"
+#include "isaDispatch.hpp"
+#include "deterministicSum.hpp"
+#include "autotune.hpp"
+#include "batchRunner.hpp"
+#include "initialConditionCache.hpp"
+#include "compactSystem.hpp"
+#include "memoryReport.hpp"
+#include "diagnostics.hpp"
+#include "outOfCore.hpp"
+#include <filesystem>
+#include <atomic>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <omp.h>
+#include <sched.h>
 using Catch::Matchers::WithinRel;
 
 TEST_CASE( "Particle sets mass correctly", "[particle]" ) {
@@ -504,4 +543,1649 @@ TEST_CASE("Check evolutionOfSystem() function input time-step and total-time thr
 TEST_CASE("Check RandomSystem class constructor throws error after negative number of bodies", "[RandomSystem]") {
     REQUIRE_NOTHROW(RandomSystem(10));
     REQUIRE_THROWS(RandomSystem(-5));
-}
\ No newline at end of file
+}
+
+
+
+TEST_CASE("Close pairs found by the spatial hash grid match a brute force search", "[closeEncounters]") {
+    RandomSystem random_system(500);
+    random_system.generateInitialConditions();
+    std::vector<std::shared_ptr<Particle>> bodies = random_system.getCelestialBodyList();
+
+    double radius = 0.5;
+    std::vector<std::pair<int, int>> pairs_exp;
+    for (int i = 0; i < bodies.size(); i++) {
+        for (int j = i + 1; j < bodies.size(); j++) {
+            if ( (bodies[i]->getPosition() - bodies[j]->getPosition()).norm() < radius ) {
+                pairs_exp.emplace_back(i, j);
+            }
+        }
+    }
+
+    REQUIRE( pairs_exp.size() > 0 );
+    REQUIRE( findClosePairs(bodies, radius) == pairs_exp );
+    REQUIRE_THROWS( findClosePairs(bodies, 0.0) );
+
+    // Cells far beyond the range of an int (an ejected body, a tiny radius) share the last cell, and only close pairs count
+    Eigen::Vector3d zero = Eigen::Vector3d::Zero();
+    std::vector<std::shared_ptr<Particle>> far_bodies;
+    for (Eigen::Vector3d position : {Eigen::Vector3d(1e12, 0.0, 0.0), Eigen::Vector3d(1e12 + 1e-4, 0.0, 0.0),
+                                     Eigen::Vector3d(1e300, -1e300, 0.0), Eigen::Vector3d(2e300, -1e300, 0.0)}) {
+        far_bodies.push_back(std::make_shared<Particle>(1.0, position, zero, zero));
+    }
+    REQUIRE( findClosePairs(far_bodies, 1e-3) == std::vector<std::pair<int, int>>{{0, 1}} );
+}
+
+
+
+TEST_CASE("Merging colliding particles conserves mass and momentum", "[closeEncounters]") {
+    Eigen::Vector3d pos_test1(0.0, 0.0, 0.0);
+    Eigen::Vector3d vel_test1(1.0, 0.0, 0.0);
+    Eigen::Vector3d pos_test2(0.01, 0.0, 0.0);
+    Eigen::Vector3d vel_test2(-1.0, 2.0, 0.0);
+    Eigen::Vector3d pos_test3(5.0, 0.0, 0.0);
+    Eigen::Vector3d vel_test3(0.0, 1.0, 0.0);
+    Eigen::Vector3d acc_test(0.0, 0.0, 0.0);
+
+    std::vector<std::shared_ptr<Particle>> bodies{
+        std::make_shared<Particle>(1.0, pos_test1, vel_test1, acc_test),
+        std::make_shared<Particle>(3.0, pos_test2, vel_test2, acc_test),
+        std::make_shared<Particle>(2.0, pos_test3, vel_test3, acc_test)
+    };
+    std::shared_ptr<Particle> first_body = bodies[0];
+
+    int num_removed = mergeCollisions(bodies, findClosePairs(bodies, 0.1));
+
+    Eigen::Vector3d pos_exp(0.0075, 0.0, 0.0); // Centre of mass of the first two
+    Eigen::Vector3d vel_exp(-0.5, 1.5, 0.0);   // Total momentum (-2, 6, 0) over mass 4
+
+    REQUIRE( num_removed == 1 );
+    REQUIRE( bodies.size() == 2 );
+    REQUIRE( bodies[0] == first_body ); // The merged body keeps the place of the lowest index
+    REQUIRE( bodies[0]->getMass() == 4.0 );
+    REQUIRE( bodies[0]->getPosition().isApprox(pos_exp) );
+    REQUIRE( bodies[0]->getVelocity().isApprox(vel_exp) );
+    REQUIRE( bodies[1]->getPosition() == pos_test3 );
+}
+
+
+
+TEST_CASE("Evolution with collisions merges bodies on a collision course", "[closeEncounters]") {
+    Eigen::Vector3d pos_test1(-1.0, 0.0, 0.0);
+    Eigen::Vector3d vel_test1(1.0, 0.0, 0.0);
+    Eigen::Vector3d pos_test2(1.0, 0.0, 0.0);
+    Eigen::Vector3d vel_test2(-1.0, 0.0, 0.0);
+    Eigen::Vector3d acc_test(0.0, 0.0, 0.0);
+
+    std::vector<std::shared_ptr<Particle>> bodies{
+        std::make_shared<Particle>(1e-3, pos_test1, vel_test1, acc_test),
+        std::make_shared<Particle>(1e-3, pos_test2, vel_test2, acc_test)
+    };
+
+    int num_removed = evolutionOfSystemWithCollisions(bodies, 0.01, 2.0, 0.05);
+
+    REQUIRE( num_removed == 1 );
+    REQUIRE( bodies.size() == 1 );
+    REQUIRE( bodies[0]->getVelocity().norm() < 1e-12 ); // Head-on collision of equal masses leaves the merged body at rest
+    REQUIRE_THROWS( evolutionOfSystemWithCollisions(bodies, 0.01, 2.0, -0.05) );
+}
+
+
+
+TEST_CASE("Star and perturbation accelerations add up to the full acceleration", "[multipleTimestep]") {
+    SolarSystem solar_system;
+    std::vector<std::shared_ptr<Particle>> bodies = solar_system.generateInitialConditions();
+
+    std::vector<Eigen::Vector3d> fast_acc;
+    std::vector<Eigen::Vector3d> slow_acc;
+    starAccelerations(bodies, fast_acc);
+    perturbationAccelerations(bodies, slow_acc);
+
+    for (int i = 0; i < bodies.size(); i++) {
+        sumAccelerations(bodies, *bodies[i]);
+        REQUIRE( (fast_acc[i] + slow_acc[i]).isApprox(bodies[i]->getAcceleration(), 1e-12) );
+    }
+}
+
+
+
+TEST_CASE("Multiple time-stepping keeps the solar system accurate with a large outer timestep", "[multipleTimestep]") {
+    SolarSystem solar_system;
+    std::vector<std::shared_ptr<Particle>> bodies = solar_system.generateInitialConditions();
+    double tot_before = totalEnergy(bodies);
+
+    SolarSystem reference_system;
+    std::vector<std::shared_ptr<Particle>> reference_bodies = reference_system.generateInitialConditions();
+
+    // Timesteps are powers of 2 so both runs take exactly the same total time
+    evolutionOfSystemMultiStep(bodies, 1.0/16, 6.0, 16); // Star force every 1/256, perturbations every 1/16
+    evolutionOfSystemMultiStep(reference_bodies, 1.0/256, 6.0, 1); // Every force every 1/256 (plain leapfrog)
+    double tot_after = totalEnergy(bodies);
+
+    REQUIRE_THAT( tot_after, WithinRel(tot_before, 1e-4) );
+    for (int i = 0; i < bodies.size(); i++) {
+        REQUIRE( (bodies[i]->getPosition() - reference_bodies[i]->getPosition()).norm() < 1e-5 );
+    }
+    REQUIRE( bodies[0]->getAcceleration() != Eigen::Vector3d(0.0, 0.0, 0.0) ); // Total acceleration is stored on the particles
+
+    REQUIRE_THROWS( evolutionOfSystemMultiStep(bodies, 0.05, 2 * M_PI, 0) );
+    REQUIRE_THROWS( evolutionOfSystemMultiStep(bodies, -0.05, 2 * M_PI, 10) );
+}
+
+
+
+TEST_CASE("Adaptive timestep rejects a too large initial timestep and meets the energy tolerance", "[adaptiveTimestep]") {
+    SolarSystem solar_system;
+    std::vector<std::shared_ptr<Particle>> bodies = solar_system.generateInitialConditions();
+
+    AdaptiveTolerances tolerances;
+    tolerances.energy_tolerance = 1e-7;
+
+    AdaptiveStepStats stats = evolutionOfSystemAdaptive(bodies, 0.5, 2 * M_PI, tolerances);
+
+    REQUIRE( stats.rejected_steps > 0 ); // 0.5 is far too large for Mercury
+    REQUIRE( stats.accepted_steps > 0 );
+    REQUIRE( stats.largest_dt < 0.5 );
+    REQUIRE( stats.smallest_dt >= tolerances.min_dt );
+    REQUIRE( stats.relative_energy_error <= stats.accepted_steps * tolerances.energy_tolerance ); // Each step stays within tolerance
+    REQUIRE_THAT( totalEnergy(bodies), WithinRel(-0.000112415, 0.01) );
+}
+
+
+
+TEST_CASE("Timestep criterion follows velocity over acceleration relative to the centre of mass", "[adaptiveTimestep]") {
+    Eigen::Vector3d pos_test1(0.0, 0.0, 0.0);
+    Eigen::Vector3d vel_test1(0.0, 0.0, 0.0);
+    Eigen::Vector3d acc_test1(0.0, 0.0, 0.0);
+    Eigen::Vector3d pos_test2(1.0, 0.0, 0.0);
+    Eigen::Vector3d vel_test2(0.0, 2.0, 0.0);
+    Eigen::Vector3d acc_test2(-4.0, 0.0, 0.0);
+
+    std::vector<std::shared_ptr<Particle>> bodies{
+        std::make_shared<Particle>(1.0, pos_test1, vel_test1, acc_test1),
+        std::make_shared<Particle>(1.0, pos_test2, vel_test2, acc_test2)
+    };
+
+    // Centre of mass moves at (0, 1, 0) so the second body has relative speed 1 and the first has no acceleration
+    REQUIRE_THAT( timestepCriterion(bodies, 0.1), WithinRel(0.1 * 1.0 / 4.0, 1e-12) );
+
+    AdaptiveTolerances bad_tolerances;
+    bad_tolerances.energy_tolerance = -1.0;
+    REQUIRE_THROWS( evolutionOfSystemAdaptive(bodies, 0.01, 1.0, bad_tolerances) );
+    REQUIRE_THROWS( evolutionOfSystemAdaptive(bodies, -0.01, 1.0, AdaptiveTolerances{}) );
+}
+
+
+
+TEST_CASE("Mixed precision accelerations stay close to the double precision path", "[forceKernels]") {
+    RandomSystem random_system(2000);
+    std::vector<std::shared_ptr<Particle>> bodies = random_system.generateInitialConditions();
+
+    std::vector<Eigen::Vector3d> acc_double;
+    std::vector<Eigen::Vector3d> acc_mixed;
+    computeAccelerations(bodies, acc_double, 0.01, ForcePrecision::Double);
+    computeAccelerations(bodies, acc_mixed, 0.01, ForcePrecision::Mixed);
+
+    double max_error = 0.0;
+    double rms_error = 0.0;
+    for (int i = 0; i < bodies.size(); i++) {
+        double error = (acc_mixed[i] - acc_double[i]).norm() / acc_double[i].norm();
+        max_error = std::max(max_error, error);
+        rms_error += error * error;
+    }
+    rms_error = std::sqrt(rms_error / bodies.size());
+
+    WARN( "Mixed precision relative force error: max " << max_error << ", rms " << rms_error );
+    // Single interactions are good to ~1e-7, the worst totals are larger where the pulls on a body nearly cancel
+    REQUIRE( max_error < 5e-5 );
+    REQUIRE( rms_error < 1e-6 );
+
+    // The double path is exactly the sumAccelerations arithmetic
+    sumAccelerations(bodies, *bodies[7], 0.01);
+    REQUIRE( acc_double[7] == bodies[7]->getAcceleration() );
+}
+
+
+
+TEST_CASE("Mixed precision evolution follows the double precision evolution", "[forceKernels]") {
+    SolarSystem solar_system;
+    std::vector<std::shared_ptr<Particle>> bodies = solar_system.generateInitialConditions();
+    SolarSystem reference_system;
+    std::vector<std::shared_ptr<Particle>> reference_bodies = reference_system.generateInitialConditions();
+
+    evolutionOfSystem(bodies, 0.001, 2 * M_PI, 0.0, ForcePrecision::Mixed);
+    evolutionOfSystem(reference_bodies, 0.001, 2 * M_PI, 0.0, ForcePrecision::Double);
+
+    for (int i = 0; i < bodies.size(); i++) {
+        REQUIRE( (bodies[i]->getPosition() - reference_bodies[i]->getPosition()).norm() < 1e-4 );
+    }
+    REQUIRE_THROWS( parseForcePrecision("single") );
+}
+
+
+
+TEST_CASE("Fixed size engine matches the generic evolution step for step", "[smallSystem]") {
+    double epsilon = GENERATE(0.0, 0.1);
+    int num_bodies = GENERATE(2, 9, 16);
+
+    RandomSystem random_system(num_bodies);
+    std::vector<std::shared_ptr<Particle>> bodies = random_system.generateInitialConditions();
+    RandomSystem reference_system(num_bodies);
+    std::vector<std::shared_ptr<Particle>> reference_bodies = reference_system.generateInitialConditions();
+
+    REQUIRE( evolveSmallSystem(bodies, 0.01, M_PI, epsilon) );
+    for (double sim_time = 0.0; sim_time < M_PI; sim_time += 0.01) {
+        evolveOneStep(reference_bodies, 0.01, epsilon);
+    }
+
+    for (int i = 0; i < num_bodies; i++) {
+        REQUIRE( bodies[i]->getPosition().isApprox(reference_bodies[i]->getPosition(), 1e-10) );
+        REQUIRE( bodies[i]->getVelocity().isApprox(reference_bodies[i]->getVelocity(), 1e-10) );
+        REQUIRE( bodies[i]->getAcceleration().isApprox(reference_bodies[i]->getAcceleration(), 1e-10) );
+    }
+}
+
+
+
+TEST_CASE("Fixed size engine is only used up to the maximum small system size", "[smallSystem]") {
+    RandomSystem random_system(max_small_system_size + 1);
+    std::vector<std::shared_ptr<Particle>> bodies = random_system.generateInitialConditions();
+    const Eigen::Vector3d pos_initial = bodies[1]->getPosition();
+
+    REQUIRE_FALSE( evolveSmallSystem(bodies, 0.01, 1.0) );
+    REQUIRE( bodies[1]->getPosition() == pos_initial ); // Untouched
+}
+
+
+
+// Counting allocator: every global operator new in the test binary goes through here
+static std::atomic<bool> count_allocations{false};
+static std::atomic<long> num_allocations{0};
+
+void* operator new(std::size_t size) {
+    if (count_allocations) {
+        num_allocations++;
+    }
+    if (void* ptr = std::malloc(size > 0 ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+
+
+TEST_CASE("Simulation follows evolutionOfSystem", "[Simulation]") {
+    RandomSystem random_system(40);
+    std::vector<std::shared_ptr<Particle>> bodies = random_system.generateInitialConditions();
+    Simulation simulation(bodies, 0.01, 0.05);
+
+    evolutionOfSystem(bodies, 0.01, 1.0, 0.05);
+    simulation.advanceTo(1.0);
+
+    REQUIRE( simulation.getStepCount() == 100 );
+    REQUIRE( simulation.getNumParticles() == 40 );
+    for (int i = 0; i < bodies.size(); i++) {
+        Eigen::Vector3d pos = simulation.getPositions().row(i).transpose();
+        Eigen::Vector3d vel = simulation.getVelocities().row(i).transpose();
+        REQUIRE( pos.isApprox(bodies[i]->getPosition(), 1e-10) );
+        REQUIRE( vel.isApprox(bodies[i]->getVelocity(), 1e-10) );
+    }
+
+    std::vector<std::shared_ptr<Particle>> copies;
+    for (const auto& body : bodies) {
+        copies.push_back(std::make_shared<Particle>(*body));
+    }
+    simulation.writeBack(copies);
+    REQUIRE( copies[5]->getPosition() == simulation.getPositions().row(5).transpose() );
+    REQUIRE_THROWS( Simulation(bodies, 0.0) );
+}
+
+
+
+TEST_CASE("Simulation does not allocate after construction", "[Simulation]") {
+    RandomSystem random_system(200);
+    Simulation simulation(random_system.generateInitialConditions(), 0.01);
+
+    // The counter does see heap allocations
+    num_allocations = 0;
+    count_allocations = true;
+    auto control = std::make_unique<double>(1.0);
+    count_allocations = false;
+    REQUIRE( num_allocations == 1 );
+
+    num_allocations = 0;
+    count_allocations = true;
+    simulation.step(5);
+    simulation.advanceTo(0.2);
+    const Eigen::MatrixX3d& positions = simulation.getPositions();
+    double checksum = positions.sum() + simulation.getVelocities().sum() + simulation.getMasses().sum();
+    count_allocations = false;
+
+    REQUIRE( std::isfinite(checksum) );
+    REQUIRE( simulation.getStepCount() == 20 );
+    REQUIRE( num_allocations == 0 );
+}
+
+
+
+TEST_CASE("Generated particles live contiguously in an arena that outlives the generator", "[particleArena]") {
+    std::vector<std::shared_ptr<Particle>> bodies;
+    {
+        RandomSystem random_system(100);
+        bodies = random_system.generateInitialConditions();
+        REQUIRE( random_system.getArenaBytes() == 100 * sizeof(Particle) );
+    }
+
+    // The generator is gone but the particles are still owned through the arena
+    REQUIRE( bodies.size() == 100 );
+    for (int i = 1; i < bodies.size(); i++) {
+        REQUIRE( bodies[i].get() == bodies[0].get() + i );
+    }
+    REQUIRE( bodies[0]->getMass() == 1.0 );
+
+    std::shared_ptr<ParticleArena> arena = ParticleArena::create(1);
+    arena->emplace(*bodies[1]);
+    REQUIRE( arena->getSize() == 1 );
+    REQUIRE_THROWS( arena->emplace(*bodies[2]) );
+}
+
+
+
+TEST_CASE("Scratch pool reuses released buffers", "[particleArena]") {
+    ScratchPool pool;
+    double* first_data = nullptr;
+    {
+        ScratchPool::Lease<double> buffer = pool.acquire<double>(1000);
+        first_data = buffer.data();
+        buffer[999] = 1.0;
+
+        ScratchPool::Lease<float> other = pool.acquire<float>(10); // A buffer in use is never handed out twice
+        REQUIRE( static_cast<void*>(other.data()) != static_cast<void*>(first_data) );
+    }
+    REQUIRE( pool.getNumBuffers() == 2 );
+
+    ScratchPool::Lease<double> again = pool.acquire<double>(500);
+    REQUIRE( again.data() == first_data );
+    REQUIRE( pool.getNumBuffers() == 2 );
+    REQUIRE( pool.getBytesReserved() == 1000 * sizeof(double) + 10 * sizeof(float) );
+}
+
+
+
+TEST_CASE("Frame stream yields a frame every K steps and only steps when pulled", "[frameStream]") {
+    RandomSystem random_system(20);
+    Simulation simulation(random_system.generateInitialConditions(), 0.01);
+
+    FrameStream stream = streamFrames(simulation, 10, 1.0);
+    REQUIRE( simulation.getStepCount() == 0 ); // Nothing computed before the first pull
+
+    std::vector<long> frame_steps;
+    for (const FrameView& frame : stream) {
+        frame_steps.push_back(frame.step);
+        REQUIRE( frame.step == simulation.getStepCount() ); // The view is the live state
+        REQUIRE( &frame.positions() == &simulation.getPositions() ); // No copy
+    }
+
+    std::vector<long> frame_steps_exp{0, 10, 20, 30, 40, 50, 60, 70, 80, 90, 100};
+    REQUIRE( frame_steps == frame_steps_exp );
+}
+
+
+
+TEST_CASE("Frame stream can stop early and copy frames on request", "[frameStream]") {
+    RandomSystem random_system(20);
+    Simulation simulation(random_system.generateInitialConditions(), 0.01);
+
+    Frame kept{};
+    for (const FrameView& frame : streamFrames(simulation, 5, 100.0)) {
+        if (frame.step == 15) {
+            kept = frame.copy();
+            break; // The remaining steps up to t = 100 are never computed
+        }
+    }
+    REQUIRE( simulation.getStepCount() == 15 );
+
+    simulation.step();
+    REQUIRE( kept.step == 15 );
+    REQUIRE( kept.positions != simulation.getPositions() ); // The copy does not follow the simulation
+
+    FrameStream bad_stream = streamFrames(simulation, 0, 1.0);
+    REQUIRE_THROWS( bad_stream.next() );
+}
+
+
+
+TEST_CASE("Frame stream yields frames at requested times", "[frameStream]") {
+    RandomSystem random_system(20);
+    Simulation simulation(random_system.generateInitialConditions(), 0.25);
+
+    std::vector<double> frame_times;
+    for (const FrameView& frame : streamFramesAtTimes(simulation, {0.5, 0.6, 2.0})) {
+        frame_times.push_back(frame.time);
+    }
+
+    std::vector<double> frame_times_exp{0.5, 0.75, 2.0}; // First step reaching each time
+    REQUIRE( frame_times == frame_times_exp );
+}
+
+
+TEST_CASE("Frames published to shared memory are read back by a subscriber", "[sharedFrameRing]") {
+    const std::string name = "/nbody_test_ring_" + std::to_string(getpid());
+    RandomSystem random_system(5);
+    std::vector<std::shared_ptr<Particle>> body_list = random_system.generateInitialConditions();
+
+    FramePublisher publisher(name, 5, 8);
+    FrameSubscriber subscriber(name);
+    REQUIRE( subscriber.getNumBodies() == 5 );
+
+    RingFrame frame;
+    REQUIRE_FALSE( subscriber.readNext(frame) ); // Nothing published yet
+
+    publisher.publish(3, 0.5, body_list);
+    REQUIRE( subscriber.readNext(frame) );
+    REQUIRE( frame.frame_number == 0 );
+    REQUIRE( frame.step == 3 );
+    REQUIRE( frame.time == 0.5 );
+    for (int i = 0; i < 5; i++) {
+        REQUIRE( frame.state[6 * i + 0] == body_list[i]->getPosition()[0] );
+        REQUIRE( frame.state[6 * i + 2] == body_list[i]->getPosition()[2] );
+        REQUIRE( frame.state[6 * i + 4] == body_list[i]->getVelocity()[1] );
+    }
+    REQUIRE_FALSE( subscriber.readNext(frame) ); // Already read
+
+    std::vector<std::shared_ptr<Particle>> wrong_list(body_list.begin(), body_list.begin() + 3);
+    REQUIRE_THROWS( publisher.publish(4, 0.6, wrong_list) );
+    REQUIRE_THROWS( FrameSubscriber("/nbody_test_ring_missing") );
+}
+
+
+
+TEST_CASE("A subscriber that falls behind skips overwritten frames", "[sharedFrameRing]") {
+    const std::string name = "/nbody_test_ring_" + std::to_string(getpid());
+    RandomSystem random_system(3);
+    std::vector<std::shared_ptr<Particle>> body_list = random_system.generateInitialConditions();
+
+    FramePublisher publisher(name, 3, 4);
+    FrameSubscriber reader(name);
+    FrameSubscriber latest_reader(name);
+
+    for (long step = 0; step < 10; step++) {
+        publisher.publish(step, step * 0.1, body_list);
+    }
+
+    // Frames 0 to 6 are gone (or about to be overwritten), 7 to 9 are still readable
+    RingFrame frame;
+    std::vector<long> steps_read;
+    while (reader.readNext(frame)) {
+        steps_read.push_back(frame.step);
+    }
+    std::vector<long> steps_exp{7, 8, 9};
+    REQUIRE( steps_read == steps_exp );
+    REQUIRE( reader.getFramesSkipped() == 7 );
+
+    REQUIRE( latest_reader.readLatest(frame) );
+    REQUIRE( frame.step == 9 );
+    REQUIRE( latest_reader.getFramesSkipped() == 9 );
+    REQUIRE_FALSE( latest_reader.readLatest(frame) );
+}
+
+
+
+TEST_CASE("evolutionOfSystem publishes frames through an observer", "[sharedFrameRing]") {
+    const std::string name = "/nbody_test_ring_" + std::to_string(getpid());
+    auto precision = GENERATE(ForcePrecision::Double, ForcePrecision::Mixed); // Small system engine and general path
+
+    RandomSystem random_system(8);
+    std::vector<std::shared_ptr<Particle>> body_list = random_system.generateInitialConditions();
+    std::vector<std::shared_ptr<Particle>> reference_list = RandomSystem(8).generateInitialConditions();
+
+    FramePublisher publisher(name, 8, 64);
+    FrameSubscriber subscriber(name);
+    evolutionOfSystem(body_list, 0.01, 0.2, 0.0, precision, publisher.observer(5));
+    evolutionOfSystem(reference_list, 0.01, 0.2, 0.0, precision);
+
+    RingFrame frame;
+    std::vector<long> steps_read;
+    while (subscriber.readNext(frame)) {
+        steps_read.push_back(frame.step);
+    }
+    std::vector<long> steps_exp{5, 10, 15, 20};
+    REQUIRE( steps_read == steps_exp );
+
+    // The last frame is the final state, and observing does not change the result
+    for (int i = 0; i < 8; i++) {
+        REQUIRE( frame.state[6 * i + 0] == body_list[i]->getPosition()[0] );
+        REQUIRE( frame.state[6 * i + 5] == body_list[i]->getVelocity()[2] );
+        REQUIRE( body_list[i]->getPosition() == reference_list[i]->getPosition() );
+    }
+}
+
+
+
+// Minimal frame server client: connect and subscribe, returns the socket
+static int subscribeToFrameServer(const std::string& socket_path, std::uint32_t decimation, std::uint32_t field_mask, const std::vector<std::uint32_t>& bodies) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, socket_path.c_str());
+    REQUIRE( connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 );
+
+    timeval timeout{5, 0}; // Fail instead of hanging if a frame never comes
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    SubscriptionRequest request{frame_server_magic, decimation, field_mask, static_cast<std::uint32_t>(bodies.size())};
+    send(fd, &request, sizeof(request), 0);
+    send(fd, bodies.data(), bodies.size() * sizeof(std::uint32_t), 0);
+    return fd;
+}
+
+// Read exactly the given number of bytes, false on end of stream or timeout
+static bool receiveAll(int fd, void* data, std::size_t bytes) {
+    char* out = static_cast<char*>(data);
+    while (bytes > 0) {
+        ssize_t received = recv(fd, out, bytes, 0);
+        if (received <= 0) {
+            return false;
+        }
+        out += received;
+        bytes -= received;
+    }
+    return true;
+}
+
+static bool receiveFrameMessage(int fd, FrameMessageHeader& header, std::vector<double>& values) {
+    if (!receiveAll(fd, &header, sizeof(header))) {
+        return false;
+    }
+    values.resize(header.num_bodies * doublesPerBody(header.field_mask));
+    return receiveAll(fd, values.data(), values.size() * sizeof(double));
+}
+
+static void waitForSubscribers(const FrameServer& server, int num_subscribers) {
+    for (int tries = 0; tries < 500 && server.getNumSubscribers() < num_subscribers; tries++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    REQUIRE( server.getNumSubscribers() == num_subscribers );
+}
+
+
+
+TEST_CASE("Frame server sends each client only the bodies, fields and frames it asked for", "[frameServer]") {
+    const std::string socket_path = "/tmp/nbody_test_server_" + std::to_string(getpid());
+    SolarSystem solar_system;
+    std::vector<std::shared_ptr<Particle>> body_list = solar_system.generateInitialConditions();
+    std::vector<std::shared_ptr<Particle>> reference_list = SolarSystem().generateInitialConditions();
+
+    FrameServer server(socket_path, body_list.size());
+    int planets_client = subscribeToFrameServer(socket_path, 2, field_position, {3, 5}); // Earth and Jupiter positions, every other frame
+    int full_client = subscribeToFrameServer(socket_path, 1, field_position | field_velocity | field_acceleration | field_mass, {});
+    waitForSubscribers(server, 2);
+
+    evolutionOfSystem(body_list, 0.015625, 0.15625, 0.0, ForcePrecision::Double, server.observer()); // Exactly 10 steps
+    evolutionOfSystem(reference_list, 0.015625, 0.15625);
+
+    FrameMessageHeader header;
+    std::vector<double> values;
+    std::vector<long> planet_steps;
+    for (int frame = 0; frame < 5; frame++) {
+        REQUIRE( receiveFrameMessage(planets_client, header, values) );
+        REQUIRE( header.num_bodies == 2 );
+        REQUIRE( values.size() == 6 );
+        planet_steps.push_back(header.step);
+    }
+    std::vector<long> planet_steps_exp{1, 3, 5, 7, 9};
+    REQUIRE( planet_steps == planet_steps_exp );
+
+    for (int frame = 0; frame < 10; frame++) {
+        REQUIRE( receiveFrameMessage(full_client, header, values) );
+        REQUIRE( header.step == frame + 1 );
+        REQUIRE( values.size() == 10 * body_list.size() );
+    }
+    // The last frame is the final state: position, velocity, acceleration, mass of each body
+    for (std::size_t i = 0; i < body_list.size(); i++) {
+        REQUIRE( values[10 * i + 0] == reference_list[i]->getPosition()[0] );
+        REQUIRE( values[10 * i + 4] == reference_list[i]->getVelocity()[1] );
+        REQUIRE( values[10 * i + 9] == reference_list[i]->getMass() );
+    }
+
+    close(planets_client);
+    close(full_client);
+}
+
+
+
+TEST_CASE("Frame server drops invalid subscriptions and closes cleanly", "[frameServer]") {
+    const std::string socket_path = "/tmp/nbody_test_server_" + std::to_string(getpid());
+    RandomSystem random_system(4);
+    std::vector<std::shared_ptr<Particle>> body_list = random_system.generateInitialConditions();
+
+    std::vector<double> values;
+    FrameMessageHeader header;
+    int bad_client = -1;
+    int good_client = -1;
+    {
+        FrameServer server(socket_path, 4);
+        bad_client = subscribeToFrameServer(socket_path, 1, field_position, {7}); // No body 7
+        REQUIRE_FALSE( receiveFrameMessage(bad_client, header, values) ); // Connection closed by the server
+
+        good_client = subscribeToFrameServer(socket_path, 1, field_mass, {});
+        waitForSubscribers(server, 1);
+        server.publish(42, 1.5, body_list);
+        REQUIRE_THROWS( server.publish(43, 1.6, std::vector<std::shared_ptr<Particle>>(2, body_list[0])) );
+    } // Queued frames are still delivered when the server stops
+
+    REQUIRE( receiveFrameMessage(good_client, header, values) );
+    REQUIRE( header.step == 42 );
+    REQUIRE( header.time == 1.5 );
+    REQUIRE( values.size() == 4 );
+    REQUIRE_FALSE( receiveFrameMessage(good_client, header, values) );
+    REQUIRE( access(socket_path.c_str(), F_OK) != 0 ); // Socket file removed
+
+    close(bad_client);
+    close(good_client);
+}
+
+
+
+TEST_CASE("Trajectory frames decode to within half a quantization step, in any order", "[trajectoryCodec]") {
+    const std::string path = "/tmp/nbody_test_trajectory_" + std::to_string(getpid()) + ".nbt";
+    RandomSystem random_system(1500); // More than one packing block per frame
+    std::vector<std::shared_ptr<Particle>> body_list = random_system.generateInitialConditions();
+
+    TrajectoryCodecSettings settings;
+    settings.position_bits = 20;
+    settings.velocity_bits = 14;
+    settings.keyframe_interval = 8;
+
+    std::vector<Eigen::MatrixX3d> positions, velocities;
+    std::uint64_t bytes_written = 0;
+    {
+        TrajectoryWriter writer(path, 1500, settings);
+        for (long step = 0; step < 20; step++) {
+            Eigen::MatrixX3d pos(1500, 3), vel(1500, 3);
+            for (int i = 0; i < 1500; i++) {
+                pos.row(i) = body_list[i]->getPosition().transpose();
+                vel.row(i) = body_list[i]->getVelocity().transpose();
+            }
+            positions.push_back(pos);
+            velocities.push_back(vel);
+
+            writer.writeFrame(step, step * 0.001, body_list);
+            evolveOneStep(body_list, 0.001, 0.01);
+        }
+        writer.finish();
+        bytes_written = writer.getBytesWritten();
+        REQUIRE_THROWS( writer.writeFrame(20, 0.02, body_list) );
+    }
+
+    const std::uint64_t raw_bytes = 20 * 1500 * 6 * sizeof(double);
+    REQUIRE( bytes_written < raw_bytes / 3 );
+    WARN( "Compression ratio: " << double(raw_bytes) / bytes_written );
+
+    TrajectoryReader reader(path);
+    REQUIRE( reader.getNumFrames() == 20 );
+    REQUIRE( reader.getNumBodies() == 1500 );
+    REQUIRE( reader.getSettings().keyframe_interval == 8 );
+    REQUIRE( reader.getFrameStep(13) == 13 );
+
+    std::vector<TrajectoryFrame> in_order;
+    for (std::size_t f = 0; f < 20; f++) {
+        in_order.push_back(reader.readFrame(f));
+        const TrajectoryFrame& frame = in_order.back();
+        REQUIRE( frame.step == static_cast<long>(f) );
+
+        // Half a step of the frame's bounding box on every axis
+        Eigen::RowVector3d position_error = (positions[f].colwise().maxCoeff() - positions[f].colwise().minCoeff()) / ((1 << 20) - 1) * 0.5;
+        Eigen::RowVector3d velocity_error = (velocities[f].colwise().maxCoeff() - velocities[f].colwise().minCoeff()) / ((1 << 14) - 1) * 0.5;
+        for (int axis = 0; axis < 3; axis++) {
+            REQUIRE( (frame.positions.col(axis) - positions[f].col(axis)).cwiseAbs().maxCoeff() <= position_error[axis] * 1.0001 );
+            REQUIRE( (frame.velocities.col(axis) - velocities[f].col(axis)).cwiseAbs().maxCoeff() <= velocity_error[axis] * 1.0001 );
+        }
+    }
+
+    for (std::size_t f : {19, 3, 11, 11, 0, 17}) { // Random access gives the same frames
+        TrajectoryFrame frame = reader.readFrame(f);
+        REQUIRE( frame.positions == in_order[f].positions );
+        REQUIRE( frame.velocities == in_order[f].velocities );
+    }
+    REQUIRE_THROWS( reader.readFrame(20) );
+
+    std::remove(path.c_str());
+}
+
+
+
+TEST_CASE("Trajectory writer follows evolutionOfSystem and rejects bad settings", "[trajectoryCodec]") {
+    const std::string path = "/tmp/nbody_test_trajectory_" + std::to_string(getpid()) + ".nbt";
+    SolarSystem solar_system;
+    std::vector<std::shared_ptr<Particle>> body_list = solar_system.generateInitialConditions();
+
+    TrajectoryCodecSettings bad_settings;
+    bad_settings.position_bits = 40;
+    REQUIRE_THROWS( TrajectoryWriter(path, body_list.size(), bad_settings) );
+
+    {
+        TrajectoryWriter writer(path, body_list.size());
+        evolutionOfSystem(body_list, 0.015625, 1.0, 0.0, ForcePrecision::Double, writer.observer(16)); // 64 steps, a frame every 16
+    } // Finished by the destructor
+
+    TrajectoryReader reader(path);
+    REQUIRE( reader.getNumFrames() == 4 );
+    TrajectoryFrame last = reader.readFrame(3);
+    REQUIRE( last.step == 64 );
+    REQUIRE( last.time == 1.0 );
+    for (std::size_t i = 0; i < body_list.size(); i++) {
+        REQUIRE_THAT( last.positions(i, 0), Catch::Matchers::WithinAbs(body_list[i]->getPosition()[0], 1e-4) );
+    }
+
+    // Damaged files are rejected before anything is allocated from their header or footer
+    std::string good;
+    {
+        std::ifstream file(path, std::ios::binary);
+        good.assign(std::istreambuf_iterator<char>(file), {});
+    }
+    auto damage = [&](std::size_t offset, const void* bytes, std::size_t size) {
+        std::string bad = good;
+        bad.replace(offset, size, static_cast<const char*>(bytes), size);
+        std::ofstream(path, std::ios::binary | std::ios::trunc) << bad;
+    };
+    const std::uint32_t zero = 0;
+    const std::uint32_t huge = 0xFFFFFFFF;
+    const std::uint32_t forty = 40;
+    const std::uint64_t huge_64 = std::uint64_t(1) << 60;
+    const std::uint8_t wide = 200;
+    const std::size_t index_offset = good.size() - sizeof(TrajectoryFooter) - 4 * sizeof(TrajectoryIndexEntry);
+    damage(offsetof(TrajectoryFileHeader, keyframe_interval), &zero, sizeof(zero));
+    REQUIRE_THROWS_AS( TrajectoryReader(path), std::runtime_error );
+    damage(offsetof(TrajectoryFileHeader, num_bodies), &huge, sizeof(huge));
+    REQUIRE_THROWS_AS( TrajectoryReader(path), std::runtime_error );
+    damage(offsetof(TrajectoryFileHeader, position_bits), &forty, sizeof(forty));
+    REQUIRE_THROWS_AS( TrajectoryReader(path), std::runtime_error );
+    damage(good.size() - sizeof(TrajectoryFooter) + offsetof(TrajectoryFooter, num_frames), &huge_64, sizeof(huge_64));
+    REQUIRE_THROWS_AS( TrajectoryReader(path), std::runtime_error );
+    damage(index_offset + offsetof(TrajectoryIndexEntry, offset), &huge_64, sizeof(huge_64));
+    REQUIRE_THROWS_AS( TrajectoryReader(path), std::runtime_error );
+    damage(sizeof(TrajectoryFileHeader) + sizeof(TrajectoryFrameHeader), &wide, sizeof(wide)); // Width of the first block of frame 0
+    REQUIRE_THROWS_AS( TrajectoryReader(path).readFrame(0), std::runtime_error );
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << good.substr(0, 100) << good.substr(200); // A frame cut short
+    REQUIRE_THROWS_AS( TrajectoryReader(path), std::runtime_error );
+
+    std::ofstream(path, std::ios::trunc) << "not a trajectory";
+    REQUIRE_THROWS( TrajectoryReader(path) );
+    std::remove(path.c_str());
+}
+
+
+
+TEST_CASE("Ephemeris matches recorded samples and interpolates between them", "[ephemeris]") {
+    SolarSystem solar_system;
+    std::vector<std::shared_ptr<Particle>> body_list = solar_system.generateInitialConditions();
+
+    EphemerisRecorder recorder(body_list.size());
+    recorder.record(0.0, body_list);
+    StepObserver record_every_8 = recorder.observer(8);
+
+    // Keep every step of Earth to compare against
+    std::vector<double> step_times;
+    std::vector<Eigen::Vector3d> earth_positions, earth_velocities;
+    auto observer = [&](long step, double sim_time, const std::vector<std::shared_ptr<Particle>>& particle_list) {
+        record_every_8(step, sim_time, particle_list);
+        step_times.push_back(sim_time);
+        earth_positions.push_back(particle_list[3]->getPosition());
+        earth_velocities.push_back(particle_list[3]->getVelocity());
+    };
+    evolutionOfSystem(body_list, 1.0 / 1024, 1.0, 0.0, ForcePrecision::Double, observer);
+
+    Ephemeris ephemeris = recorder.build();
+    REQUIRE( ephemeris.getNumSegments() == 128 );
+    REQUIRE( ephemeris.getStartTime() == 0.0 );
+    REQUIRE( ephemeris.getEndTime() == 1.0 );
+
+    double max_position_error = 0.0, max_velocity_error = 0.0;
+    for (std::size_t k = 0; k < step_times.size(); k++) {
+        double position_error = (ephemeris.position(3, step_times[k]) - earth_positions[k]).norm();
+        double velocity_error = (ephemeris.velocity(3, step_times[k]) - earth_velocities[k]).norm();
+        if ((k + 1) % 8 == 0) { // Sample times are matched exactly
+            REQUIRE( position_error < 1e-14 );
+            REQUIRE( velocity_error < 1e-14 );
+        }
+        max_position_error = std::max(max_position_error, position_error);
+        max_velocity_error = std::max(max_velocity_error, velocity_error);
+    }
+    WARN( "Earth interpolation error: position " << max_position_error << ", velocity " << max_velocity_error );
+    // The Euler steps themselves are not smooth: positions move with the velocity of the previous step, so the
+    // velocities differ from the slope of the path by about one step of acceleration (dt * 1 here)
+    REQUIRE( max_position_error < 1e-6 );
+    REQUIRE( max_velocity_error < 1.0 / 1024 );
+}
+
+
+
+TEST_CASE("Ephemeris files round trip and queries outside the run are rejected", "[ephemeris]") {
+    const std::string path = "/tmp/nbody_test_ephemeris_" + std::to_string(getpid()) + ".nbe";
+    RandomSystem random_system(6);
+    std::vector<std::shared_ptr<Particle>> body_list = random_system.generateInitialConditions();
+
+    EphemerisRecorder recorder(6);
+    recorder.record(0.0, body_list);
+    REQUIRE_THROWS( recorder.build() ); // No segment yet
+    evolutionOfSystem(body_list, 0.01, 0.5, 0.0, ForcePrecision::Double, recorder.observer(5));
+    REQUIRE_THROWS( recorder.record(0.2, body_list) ); // Going back in time
+
+    Ephemeris ephemeris = recorder.build();
+    ephemeris.save(path);
+    Ephemeris loaded(path);
+    REQUIRE( loaded.getNumBodies() == 6 );
+    REQUIRE( loaded.getNumSegments() == ephemeris.getNumSegments() );
+    for (double time : {0.0, 0.013, 0.25, 0.4999}) {
+        REQUIRE( loaded.position(4, time) == ephemeris.position(4, time) );
+        REQUIRE( loaded.velocity(2, time) == ephemeris.velocity(2, time) );
+    }
+    REQUIRE( loaded.position(0, loaded.getEndTime()) == body_list[0]->getPosition() );
+
+    REQUIRE_THROWS_AS( loaded.position(0, -0.1), std::out_of_range );
+    REQUIRE_THROWS_AS( loaded.position(0, loaded.getEndTime() + 0.1), std::out_of_range );
+    REQUIRE_THROWS_AS( loaded.position(6, 0.1), std::out_of_range );
+
+    // Damaged files are rejected before anything is allocated from their header
+    auto damage = [&](std::streamoff offset, const void* bytes, std::size_t size) {
+        ephemeris.save(path);
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(offset);
+        file.write(static_cast<const char*>(bytes), size);
+    };
+    const std::uint64_t huge = std::uint64_t(1) << 40;
+    const std::uint64_t zero = 0;
+    const double backwards = 1.0;
+    damage(offsetof(EphemerisFileHeader, num_bodies), &huge, sizeof(huge));
+    REQUIRE_THROWS_AS( Ephemeris(path), std::runtime_error );
+    damage(offsetof(EphemerisFileHeader, num_bodies), &zero, sizeof(zero));
+    REQUIRE_THROWS_AS( Ephemeris(path), std::runtime_error );
+    damage(sizeof(EphemerisFileHeader) + sizeof(double), &backwards, sizeof(backwards)); // Second time after the last
+    REQUIRE_THROWS_AS( Ephemeris(path), std::invalid_argument );
+    std::remove(path.c_str());
+}
+
+
+
+TEST_CASE("NUMA topology covers the usable CPUs and threads can be pinned", "[numa]") {
+    const NumaTopology& topology = numaTopology();
+    REQUIRE( topology.getNumNodes() >= 1 );
+    for (int node = 0; node < topology.getNumNodes(); node++) {
+        REQUIRE_FALSE( topology.node_cpus[node].empty() );
+        for (int cpu : topology.node_cpus[node]) {
+            REQUIRE( topology.nodeOfCpu(cpu) == node );
+        }
+    }
+
+    omp_set_num_threads(4);
+    auto affinity = GENERATE(ThreadAffinity::Compact, ThreadAffinity::Spread);
+    std::vector<int> cpus = pinThreads(affinity);
+    REQUIRE( cpus.size() == 4 );
+
+    std::vector<int> running_on(4, -1);
+    #pragma omp parallel
+    {
+        running_on[omp_get_thread_num()] = sched_getcpu();
+    }
+    REQUIRE( running_on == cpus );
+    REQUIRE( threadNodes().size() == 4 );
+    REQUIRE( affinityReport().find("affinity " + threadAffinityName(affinity)) != std::string::npos );
+
+    std::vector<int> unpinned = pinThreads(ThreadAffinity::None);
+    REQUIRE( unpinned == std::vector<int>(4, -1) );
+    REQUIRE( parseThreadAffinity("spread") == ThreadAffinity::Spread );
+    REQUIRE_THROWS( parseThreadAffinity("everywhere") );
+}
+
+
+
+TEST_CASE("Simulation with per-node source replicas matches the plain simulation", "[numa]") {
+    omp_set_num_threads(4);
+    pinThreads(ThreadAffinity::Compact);
+
+    RandomSystem random_system(300);
+    std::vector<std::shared_ptr<Particle>> body_list = random_system.generateInitialConditions();
+    Simulation plain(body_list, 0.001, 0.01);
+    Simulation replicated(body_list, 0.001, 0.01, true);
+    REQUIRE( plain.getNumReplicas() == 0 );
+    REQUIRE( replicated.getNumReplicas() == numaTopology().getNumNodes() );
+
+    plain.step(20);
+    replicated.step(20);
+    REQUIRE( replicated.getPositions() == plain.getPositions() );
+    REQUIRE( replicated.getVelocities() == plain.getVelocities() );
+
+    // The arena pages are placed when the arena is created, before any particle is written
+    int node = numaNodeOfAddress(body_list[0].get());
+    REQUIRE( node >= -1 );
+    REQUIRE( node < numaTopology().getNumNodes() );
+    pinThreads(ThreadAffinity::None);
+}
+
+
+
+TEST_CASE("Work stealing runs every index once and rebalances uneven loops", "[workStealing]") {
+    omp_set_num_threads(4);
+    WorkStealingExecutor executor;
+
+    // All the work is in the first block, which starts out on worker 0
+    std::vector<std::atomic<int>> times_run(400);
+    std::atomic<bool> bad_worker{false};
+    executor.parallelFor(400, 4, [&](int begin, int end, int worker) {
+        bad_worker = bad_worker || worker < 0 || worker >= 4;
+        for (int i = begin; i < end; i++) {
+            times_run[i]++;
+            if (i < 100) {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        }
+    });
+
+    REQUIRE_FALSE( bad_worker );
+    for (const auto& count : times_run) {
+        REQUIRE( count == 1 );
+    }
+    WorkerStats total = executor.getTotalStats();
+    REQUIRE( executor.getNumWorkers() == 4 );
+    REQUIRE( total.tasks_run == 100 );
+    REQUIRE( total.tasks_stolen > 0 );
+    REQUIRE( total.steal_attempts >= total.tasks_stolen );
+    REQUIRE( executor.getStats(0).tasks_run < 25 + total.tasks_stolen ); // Others took some of worker 0's tasks
+
+    executor.resetStats();
+    REQUIRE( executor.getTotalStats().tasks_run == 0 );
+}
+
+
+
+TEST_CASE("Work stealing rethrows task errors and gives the same forces", "[workStealing]") {
+    omp_set_num_threads(4);
+    WorkStealingExecutor executor;
+    REQUIRE_THROWS_AS( executor.parallelFor(1000, 10, [](int begin, int, int) {
+        if (begin == 500) {
+            throw std::runtime_error("task failed");
+        }
+    }), std::runtime_error );
+
+    // Force evaluation through the shared executor matches the serial sum
+    RandomSystem random_system(200);
+    std::vector<std::shared_ptr<Particle>> body_list = random_system.generateInitialConditions();
+    std::vector<Eigen::Vector3d> accelerations;
+    computeAccelerations(body_list, accelerations, 0.01);
+    for (int i = 0; i < 200; i++) {
+        Eigen::Vector3d expected(0.0, 0.0, 0.0);
+        for (int j = 0; j < 200; j++) {
+            if (i != j) {
+                expected += calcAcceleration(*body_list[i], *body_list[j], 0.01);
+            }
+        }
+        REQUIRE( accelerations[i] == expected );
+    }
+    REQUIRE( forceExecutor().getTotalStats().tasks_run > 0 );
+}
+
+
+
+
+TEST_CASE("Every instruction set level computes the same forces and energies", "[isaDispatch]") {
+    REQUIRE( parseIsaLevel(isaLevelName(IsaLevel::AVX2)) == IsaLevel::AVX2 );
+    REQUIRE_THROWS( parseIsaLevel("avx9000") );
+
+    // The best level is picked at startup
+    const IsaLevel best = detectIsaLevel();
+    REQUIRE( activeIsaLevel() == best );
+    WARN( "Kernels: " << isaReport() );
+
+    RandomSystem random_system(500);
+    std::vector<std::shared_ptr<Particle>> bodies = random_system.generateInitialConditions();
+    const int n = bodies.size();
+    std::vector<double> x(n), y(n), z(n), mass(n);
+    for (int i = 0; i < n; i++) {
+        x[i] = bodies[i]->getPosition()[0];
+        y[i] = bodies[i]->getPosition()[1];
+        z[i] = bodies[i]->getPosition()[2];
+        mass[i] = bodies[i]->getMass();
+    }
+
+    setIsaLevel(IsaLevel::Baseline);
+    std::vector<double> ax_ref(n), ay_ref(n), az_ref(n);
+    directAccelerations(n, x.data(), y.data(), z.data(), mass.data(), 0.01, ax_ref.data(), ay_ref.data(), az_ref.data());
+    double potential_ref = totalPotentialEnergy(bodies);
+
+    for (int level = static_cast<int>(IsaLevel::SSE42); level <= static_cast<int>(best); level++) {
+        setIsaLevel(static_cast<IsaLevel>(level));
+        std::vector<double> ax(n), ay(n), az(n);
+        directAccelerations(n, x.data(), y.data(), z.data(), mass.data(), 0.01, ax.data(), ay.data(), az.data());
+
+        // Only the order of the sums (the vector width) and fused multiply-adds differ
+        for (int i = 0; i < n; i++) {
+            Eigen::Vector3d reference(ax_ref[i], ay_ref[i], az_ref[i]);
+            REQUIRE( (Eigen::Vector3d(ax[i], ay[i], az[i]) - reference).norm() <= 1e-12 * reference.norm() );
+        }
+        REQUIRE_THAT( totalPotentialEnergy(bodies), Catch::Matchers::WithinRel(potential_ref, 1e-12) );
+    }
+
+    // Levels above the CPU's are refused
+    if (best != IsaLevel::AVX512) {
+        REQUIRE_THROWS_AS( setIsaLevel(IsaLevel::AVX512), std::invalid_argument );
+    }
+    setIsaLevel(best);
+    REQUIRE( activeIsaLevel() == best );
+}
+
+
+
+TEST_CASE("Evolution on the baseline kernels follows the evolution on the best kernels", "[isaDispatch]") {
+    const IsaLevel best = detectIsaLevel();
+    RandomSystem random_system(300);
+    std::vector<std::shared_ptr<Particle>> initial = random_system.generateInitialConditions();
+
+    // Copies of the same bodies for each run
+    auto copyBodies = [&]() {
+        std::vector<std::shared_ptr<Particle>> copy;
+        for (const auto& body : initial) {
+            copy.push_back(std::make_shared<Particle>(*body));
+        }
+        return copy;
+    };
+    std::vector<std::shared_ptr<Particle>> baseline_bodies = copyBodies();
+    std::vector<std::shared_ptr<Particle>> best_bodies = copyBodies();
+
+    setIsaLevel(IsaLevel::Baseline);
+    evolutionOfSystem(baseline_bodies, 1.0/1024, 1.0/64, 0.01);
+    Simulation baseline_simulation(copyBodies(), 1.0/1024, 0.01);
+    baseline_simulation.step(16);
+
+    setIsaLevel(best);
+    evolutionOfSystem(best_bodies, 1.0/1024, 1.0/64, 0.01);
+    Simulation best_simulation(copyBodies(), 1.0/1024, 0.01);
+    best_simulation.step(16);
+
+    for (int i = 0; i < initial.size(); i++) {
+        REQUIRE( (best_bodies[i]->getPosition() - baseline_bodies[i]->getPosition()).norm() < 1e-10 );
+        REQUIRE( (best_bodies[i]->getVelocity() - baseline_bodies[i]->getVelocity()).norm() < 1e-10 );
+    }
+    REQUIRE( (best_simulation.getPositions() - baseline_simulation.getPositions()).cwiseAbs().maxCoeff() < 1e-10 );
+    REQUIRE( (best_simulation.getVelocities() - baseline_simulation.getVelocities()).cwiseAbs().maxCoeff() < 1e-10 );
+
+    // The Euler step is the same in the structure of arrays and particle paths
+    REQUIRE( (best_simulation.getPositions().row(5).transpose() - best_bodies[5]->getPosition()).norm() < 1e-10 );
+}
+
+
+
+
+TEST_CASE("Pairwise sums have a fixed shape", "[deterministicSum]") {
+    REQUIRE( pairwiseSum(nullptr, 0) == 0.0 );
+
+    std::vector<double> values(1000);
+    for (int i = 0; i < values.size(); i++) {
+        values[i] = 1.0 / (i + 1);
+    }
+    double running_sum = 0.0;
+    for (double value : values) {
+        running_sum += value;
+    }
+    REQUIRE_THAT( pairwiseSum(values.data(), values.size()), Catch::Matchers::WithinRel(running_sum, 1e-14) );
+
+    // The blocks do not depend on the thread count, and the sum of block sums is the pairwise sum
+    double reduced = deterministicReduce(values.size(), 100, [&](int begin, int end) {
+        double sum = 0.0;
+        for (int i = begin; i < end; i++) {
+            sum += values[i];
+        }
+        return sum;
+    });
+    std::vector<double> block_sums(10, 0.0);
+    for (int i = 0; i < values.size(); i++) {
+        block_sums[i / 100] += values[i];
+    }
+    REQUIRE( reduced == pairwiseSum(block_sums.data(), block_sums.size()) );
+    REQUIRE( deterministicReduce(0, 100, [](int, int) { return 1.0; }) == 0.0 );
+}
+
+
+
+TEST_CASE("Energies are bitwise identical on any number of threads", "[deterministicSum]") {
+    RandomSystem random_system(3000);
+    std::vector<std::shared_ptr<Particle>> bodies = random_system.generateInitialConditions();
+    const int default_threads = omp_get_max_threads();
+
+    omp_set_num_threads(1);
+    const double serial_KE = totalKineticEnergy(bodies);
+    const double serial_PE = totalPotentialEnergy(bodies);
+
+    for (int threads : {2, 3, 5, 8}) {
+        omp_set_num_threads(threads);
+        REQUIRE( totalKineticEnergy(bodies) == serial_KE );
+        REQUIRE( totalPotentialEnergy(bodies) == serial_PE );
+    }
+    omp_set_num_threads(default_threads);
+}
+
+
+
+
+TEST_CASE("The auto-tuner times the candidates and caches its choice", "[autotune]") {
+    REQUIRE( sizeBucket(1) == 1 );
+    REQUIRE( sizeBucket(9) == 16 );
+    REQUIRE( sizeBucket(1024) == 1024 );
+    REQUIRE( machineKey().find(' ') == std::string::npos );
+
+    const int default_threads = omp_get_max_threads();
+    const std::string cache_path = "/tmp/nbody_test_autotune_" + std::to_string(getpid());
+    std::remove(cache_path.c_str());
+
+    RandomSystem random_system(200);
+    std::vector<std::shared_ptr<Particle>> bodies = random_system.generateInitialConditions();
+    const Eigen::Vector3d first_position = bodies[0]->getPosition();
+
+    TuningResult tuned = autotune(bodies, 1.0/1024, 0.01, cache_path);
+    REQUIRE_FALSE( tuned.from_cache );
+    REQUIRE( tuned.trials.size() >= 2 ); // At least one thread count and the arrays solver
+    REQUIRE( bodies[0]->getPosition() == first_position ); // Trials run on copies
+
+    // The choice is the fastest trial, and it is applied
+    for (const TuningTrial& trial : tuned.trials) {
+        REQUIRE( tuned.seconds_per_step <= trial.seconds_per_step );
+    }
+    REQUIRE( omp_get_max_threads() == tuned.best.num_threads );
+    REQUIRE( activeIsaLevel() == tuned.best.isa );
+    REQUIRE( forceExecutor().getDefaultGrain() == tuned.best.grain );
+
+    // A second system of the same size class reuses the choice
+    RandomSystem other_system(150);
+    TuningResult cached = autotune(other_system.generateInitialConditions(), 1.0/1024, 0.01, cache_path);
+    REQUIRE( cached.from_cache );
+    REQUIRE( cached.trials.empty() );
+    REQUIRE( describeTuning(cached.best) == describeTuning(tuned.best) );
+
+    // Without the arrays solver only the particle list solver is tried
+    TuningResult particles_only = autotune(bodies, 1.0/1024, 0.01, "", false);
+    for (const TuningTrial& trial : particles_only.trials) {
+        REQUIRE( trial.choice.solver == Solver::Particles );
+    }
+
+    std::remove(cache_path.c_str());
+    applyTuning(TuningChoice{Solver::Particles, detectIsaLevel(), default_threads, 0});
+}
+
+
+
+TEST_CASE("The auto-tuner ignores cache lines of other machines and size classes", "[autotune]") {
+    const int default_threads = omp_get_max_threads();
+    const std::string cache_path = "/tmp/nbody_test_autotune_lines_" + std::to_string(getpid());
+    {
+        std::ofstream cache(cache_path);
+        cache << "some_other_machine 16 arrays baseline 3 0 1e-06\n"
+              << machineKey() << " 32 arrays baseline 1 0 1e-06\n"
+              << "not a cache line\n"
+              << machineKey() << " 16 particles baseline 1 4 2e-06\n";
+    }
+
+    // Nine bodies are in the 16 class: only the last line matches
+    SolarSystem solar_system;
+    TuningResult cached = autotune(solar_system.generateInitialConditions(), 1.0/1024, 0.0, cache_path);
+    REQUIRE( cached.from_cache );
+    REQUIRE( cached.best.solver == Solver::Particles );
+    REQUIRE( cached.best.isa == IsaLevel::Baseline );
+    REQUIRE( cached.best.grain == 4 );
+    REQUIRE( cached.seconds_per_step == 2e-06 );
+    REQUIRE( activeIsaLevel() == IsaLevel::Baseline );
+
+    REQUIRE_THROWS( autotune({}, 1.0/1024, 0.0, cache_path) );
+
+    std::remove(cache_path.c_str());
+    applyTuning(TuningChoice{Solver::Particles, detectIsaLevel(), default_threads, 0});
+}
+
+
+
+
+TEST_CASE("Scenario files are parsed and checked before anything runs", "[batchRunner]") {
+    std::vector<Scenario> scenarios = parseScenarios(
+        "# A comment, then a blank line\n"
+        "\n"
+        "name=inner generator=solar dt=0.015625 time=1\n"
+        "generator=random n=300 seed=7 dt=0.01 time=0.05 epsilon=0.01 integrator=adaptive tolerance=1e-6\n");
+
+    REQUIRE( scenarios.size() == 2 );
+    REQUIRE( scenarios[0].name == "inner" );
+    REQUIRE( scenarios[0].integrator == "euler" );
+    REQUIRE( scenarios[1].name == "run4" ); // Named after its line
+    REQUIRE( scenarios[1].num_bodies == 300 );
+    REQUIRE( scenarios[1].seed == 7 );
+    REQUIRE( scenarios[1].energy_tolerance == 1e-6 );
+    REQUIRE( estimatedCost(scenarios[1]) == 300.0 * 300.0 * 5 );
+
+    REQUIRE_THROWS_AS( parseScenarios("generator=solar dt=0.01 time=1 colour=red\n"), std::invalid_argument );
+    REQUIRE_THROWS_AS( parseScenarios("generator=random n=ten dt=0.01 time=1\n"), std::invalid_argument );
+    REQUIRE_THROWS_AS( parseScenarios("generator=solar dt=0.01\n"), std::invalid_argument );
+    REQUIRE_THROWS_AS( parseScenarios("generator=solar dt=0.01 time=1 integrator=multistep\n"), std::invalid_argument );
+    REQUIRE_THROWS_AS( readScenarios("/nonexistent/scenarios.txt"), std::runtime_error );
+
+    // The seed picks the random system
+    RandomSystem seven(50, 7);
+    RandomSystem seven_again(50, 7);
+    RandomSystem eight(50, 8);
+    REQUIRE( seven.generateInitialConditions()[10]->getPosition() == seven_again.generateInitialConditions()[10]->getPosition() );
+    REQUIRE( seven.generateInitialConditions()[10]->getPosition() != eight.generateInitialConditions()[10]->getPosition() );
+}
+
+
+
+TEST_CASE("A batch runs its scenarios side by side with the results of separate runs", "[batchRunner]") {
+    std::vector<Scenario> scenarios = parseScenarios(
+        "name=solar generator=solar dt=0.015625 time=2\n"
+        "name=big generator=random n=400 seed=3 dt=0.0078125 time=0.0625 epsilon=0.01\n"
+        "name=merging generator=random n=100 seed=4 dt=0.0078125 time=0.0625 epsilon=0.01 integrator=collisions radius=0.5\n"
+        "name=broken generator=random n=100 dt=0.0078125 time=0.0625 trajectory=/nonexistent/out.traj\n");
+
+    std::vector<std::string> finished;
+    std::vector<ScenarioResult> results = runBatch(scenarios, 3, [&](const ScenarioResult& result) {
+        finished.push_back(result.scenario.name);
+    });
+
+    REQUIRE( results.size() == 4 );
+    REQUIRE( finished.size() == 4 );
+    REQUIRE( results[0].scenario.name == "solar" ); // In the order of the file
+    REQUIRE( results[0].num_threads == 1 ); // Small systems take one core
+    REQUIRE( results[0].num_steps == 128 );
+    REQUIRE( results[2].final_bodies < 100 );
+    REQUIRE_FALSE( results[3].error.empty() ); // A failing run does not stop the others
+    for (int i = 0; i < 3; i++) {
+        REQUIRE( results[i].error.empty() );
+        REQUIRE( results[i].num_threads >= 1 );
+        REQUIRE( results[i].num_threads <= 3 );
+
+        // The forces and energies do not depend on the thread count, so a separate serial run agrees exactly
+        ScenarioResult separate = runScenario(scenarios[i], 1);
+        REQUIRE( results[i].final_energy == separate.final_energy );
+        REQUIRE( results[i].final_bodies == separate.final_bodies );
+    }
+
+    std::ostringstream table;
+    writeResultsTable(table, results);
+    std::string text = table.str();
+    REQUIRE( std::count(text.begin(), text.end(), '\n') == 5 ); // Header and one row per run
+    REQUIRE( text.find("big,random,400,3,euler,") != std::string::npos );
+    REQUIRE( text.find("\"error: ") != std::string::npos );
+}
+
+
+
+static void requireSameBodies(const std::vector<std::shared_ptr<Particle>>& a, const std::vector<std::shared_ptr<Particle>>& b) {
+    REQUIRE( a.size() == b.size() );
+    for (int i = 0; i < a.size(); i++) {
+        REQUIRE( a[i]->getMass() == b[i]->getMass() );
+        REQUIRE( a[i]->getPosition() == b[i]->getPosition() );
+        REQUIRE( a[i]->getVelocity() == b[i]->getVelocity() );
+        REQUIRE( a[i]->getAcceleration() == b[i]->getAcceleration() );
+    }
+}
+
+
+TEST_CASE("Cached initial conditions are bitwise the generated ones", "[icCache]") {
+    const std::string directory = "/tmp/nbody_test_ic_" + std::to_string(getpid());
+    std::filesystem::remove_all(directory);
+
+    std::vector<std::shared_ptr<Particle>> generated = RandomSystem(300, 5).generateInitialConditions();
+
+    RandomSystem first_run(300, 5);
+    first_run.setCacheDirectory(directory);
+    requireSameBodies(first_run.generateInitialConditions(), generated);
+    REQUIRE_FALSE( first_run.wasLoadedFromCache() );
+    REQUIRE( std::filesystem::exists(initialConditionPath(directory, first_run.getCacheParameters())) );
+
+    // A later generation is a reset: the evolved bodies are replaced by fresh ones
+    std::vector<std::shared_ptr<Particle>> evolved = first_run.generateInitialConditions();
+    evolutionOfSystem(evolved, 1.0/1024, 1.0/64, 0.01);
+    requireSameBodies(first_run.generateInitialConditions(), generated);
+
+    RandomSystem second_run(300, 5);
+    second_run.setCacheDirectory(directory);
+    requireSameBodies(second_run.generateInitialConditions(), generated);
+    REQUIRE( second_run.wasLoadedFromCache() );
+
+    // Another seed or size is another file
+    RandomSystem other_seed(300, 6);
+    RandomSystem other_size(301, 5);
+    REQUIRE( initialConditionKey(other_seed.getCacheParameters()) != initialConditionKey(first_run.getCacheParameters()) );
+    REQUIRE( initialConditionKey(other_size.getCacheParameters()) != initialConditionKey(first_run.getCacheParameters()) );
+    other_seed.setCacheDirectory(directory);
+    other_seed.generateInitialConditions();
+    REQUIRE_FALSE( other_seed.wasLoadedFromCache() );
+
+    std::filesystem::remove_all(directory);
+}
+
+
+
+TEST_CASE("Damaged or mismatched cache files are regenerated", "[icCache]") {
+    const std::string directory = "/tmp/nbody_test_ic_damaged_" + std::to_string(getpid());
+    std::filesystem::remove_all(directory);
+
+    RandomSystem random_system(50, 9);
+    const std::string parameters = random_system.getCacheParameters();
+    const std::string path = initialConditionPath(directory, parameters);
+    std::vector<std::shared_ptr<Particle>> generated = random_system.generateInitialConditions();
+    saveInitialConditions(path, parameters, generated);
+
+    REQUIRE( MappedInitialConditions::open(path, parameters) != nullptr );
+    REQUIRE( MappedInitialConditions::open(path, parameters)->getNumBodies() == 50 );
+    REQUIRE( MappedInitialConditions::open(path, "RandomSystem v1 n=50 seed=8") == nullptr ); // Same file, other parameters
+    REQUIRE( MappedInitialConditions::open(directory + "/missing.bin", parameters) == nullptr );
+
+    // A truncated file is not used, and the next run writes a complete one
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 8);
+    REQUIRE( MappedInitialConditions::open(path, parameters) == nullptr );
+
+    RandomSystem cached_system(50, 9);
+    cached_system.setCacheDirectory(directory);
+    requireSameBodies(cached_system.generateInitialConditions(), generated);
+    REQUIRE_FALSE( cached_system.wasLoadedFromCache() );
+    REQUIRE( MappedInitialConditions::open(path, parameters) != nullptr );
+
+    std::filesystem::remove_all(directory);
+}
+
+
+
+TEST_CASE("Each force law gives its own pairwise force", "[forceLaw]") {
+    for (ForceLaw law : {ForceLaw::Plummer, ForceLaw::Spline, ForceLaw::Newtonian, ForceLaw::PostNewtonian}) {
+        REQUIRE( parseForceLaw(forceLawName(law)) == law );
+    }
+    REQUIRE_THROWS_AS( parseForceLaw("yukawa"), std::invalid_argument );
+
+    RandomSystem random_system(500);
+    std::vector<std::shared_ptr<Particle>> bodies = random_system.generateInitialConditions();
+    const double epsilon = 0.01;
+    std::vector<Eigen::Vector3d> plummer, plummer_law, newtonian, plummer_unsoftened, spline;
+    computeAccelerations(bodies, plummer, epsilon);
+    computeAccelerations(bodies, plummer_law, epsilon, ForcePrecision::Double, ForceLaw::Plummer);
+    computeAccelerations(bodies, newtonian, epsilon, ForcePrecision::Double, ForceLaw::Newtonian);
+    computeAccelerations(bodies, plummer_unsoftened, 0.0);
+    computeAccelerations(bodies, spline, epsilon, ForcePrecision::Double, ForceLaw::Spline);
+    for (int i = 0; i < bodies.size(); i++) {
+        REQUIRE( plummer_law[i] == plummer[i] ); // The default is untouched
+        REQUIRE( (newtonian[i] - plummer_unsoftened[i]).norm() <= 1e-12 * plummer_unsoftened[i].norm() ); // Epsilon is ignored
+        REQUIRE( spline[i].allFinite() );
+    }
+    REQUIRE_THROWS_AS( computeAccelerations(bodies, spline, epsilon, ForcePrecision::Mixed, ForceLaw::Spline), std::invalid_argument );
+
+    // Spline softening: exactly Newtonian beyond 2.8 epsilon, smooth inside and zero when the bodies touch
+    auto pairAcceleration = [&](double distance) {
+        Eigen::Vector3d origin(0.0, 0.0, 0.0), offset(distance, 0.0, 0.0), zero(0.0, 0.0, 0.0);
+        std::vector<std::shared_ptr<Particle>> pair {std::make_shared<Particle>(1.0, origin, zero, zero),
+                                                     std::make_shared<Particle>(1.0, offset, zero, zero)};
+        std::vector<Eigen::Vector3d> acc;
+        computeAccelerations(pair, acc, epsilon, ForcePrecision::Double, ForceLaw::Spline);
+        return acc[0][0];
+    };
+    const double h = spline_kernel_radius * epsilon;
+    REQUIRE_THAT( pairAcceleration(1.5 * h), Catch::Matchers::WithinRel(1.0 / (2.25 * h * h), 1e-14) );
+    REQUIRE_THAT( pairAcceleration(0.999999 * h), Catch::Matchers::WithinRel(1.0 / (h * h), 1e-5) ); // Continuous at h
+    REQUIRE_THAT( pairAcceleration(0.5000001 * h), Catch::Matchers::WithinRel(pairAcceleration(0.4999999 * h), 1e-5) ); // and between the pieces
+    REQUIRE( pairAcceleration(0.1 * h) < pairAcceleration(0.3 * h) );
+    REQUIRE( pairAcceleration(0.0) == 0.0 );
+}
+
+
+
+TEST_CASE("The post-Newtonian law adds the 1PN correction", "[forceLaw]") {
+    // The Sun and Mercury on an eccentric, inclined orbit
+    Eigen::Vector3d sun_position(0.01, -0.02, 0.0), sun_velocity(0.0, 0.001, 0.0), zero(0.0, 0.0, 0.0);
+    Eigen::Vector3d mercury_position(0.31, 0.05, 0.02), mercury_velocity(-0.3, 1.9, 0.15);
+    std::vector<std::shared_ptr<Particle>> pair {std::make_shared<Particle>(1.0, sun_position, sun_velocity, zero),
+                                                 std::make_shared<Particle>(1.0/6023600.0, mercury_position, mercury_velocity, zero)};
+    std::vector<Eigen::Vector3d> newtonian, post_newtonian;
+    computeAccelerations(pair, newtonian, 0.0, ForcePrecision::Double, ForceLaw::Newtonian);
+    computeAccelerations(pair, post_newtonian, 0.0, ForcePrecision::Double, ForceLaw::PostNewtonian);
+
+    // m / (c^2 r^3) ((4 m / r - v^2) r + 4 (r.v) v) for Mercury relative to the Sun
+    Eigen::Vector3d r = mercury_position - sun_position;
+    Eigen::Vector3d v = mercury_velocity - sun_velocity;
+    double distance = r.norm();
+    Eigen::Vector3d correction = 1.0 / (speed_of_light * speed_of_light * std::pow(distance, 3))
+                                 * ((4.0 / distance - v.squaredNorm()) * r + 4.0 * r.dot(v) * v);
+    REQUIRE( (post_newtonian[1] - newtonian[1] - correction).norm() <= 1e-9 * correction.norm() );
+    REQUIRE( correction.norm() / newtonian[1].norm() < 1e-6 ); // A small correction, of order v^2 / c^2
+    REQUIRE( correction.norm() / newtonian[1].norm() > 1e-9 );
+
+    // The solar system evolves off the fixed size engine and drifts slightly from the Newtonian one
+    SolarSystem solar_system, reference_system;
+    std::vector<std::shared_ptr<Particle>> bodies = solar_system.generateInitialConditions();
+    std::vector<std::shared_ptr<Particle>> reference_bodies = reference_system.generateInitialConditions();
+    evolutionOfSystem(bodies, 1.0/1024, 1.0, 0.0, ForcePrecision::Double, {}, ForceLaw::PostNewtonian);
+    evolutionOfSystem(reference_bodies, 1.0/1024, 1.0, 0.0, ForcePrecision::Double, {}, ForceLaw::Newtonian);
+    const double drift = (bodies[1]->getPosition() - reference_bodies[1]->getPosition()).norm();
+    REQUIRE( drift > 0.0 );
+    REQUIRE( drift < 1e-5 );
+}
+
+
+
+TEST_CASE("Compact storage follows the evolution of the list of particles", "[compactSystem]") {
+    RandomSystem random_system(1500, 11);
+    std::vector<std::shared_ptr<Particle>> bodies = random_system.generateInitialConditions();
+    const double initial_energy = totalEnergy(bodies);
+
+    CompactSystem compact(bodies, 1.0/1024, 0.01);
+    CompactSystem compact_float(1500, [&](const CompactSystem::BodyVisitor& visit) { random_system.forEachBody(visit); }, 1.0/1024, 0.01, true);
+    REQUIRE( compact.getNumParticles() == 1500 );
+    REQUIRE( compact_float.hasFloatVelocities() );
+    REQUIRE_THAT( compact.totalEnergy(), Catch::Matchers::WithinRel(initial_energy, 1e-6) );
+    REQUIRE_THAT( compact_float.totalEnergy(), Catch::Matchers::WithinRel(initial_energy, 1e-6) );
+
+    evolutionOfSystem(bodies, 1.0/1024, 1.0/16, 0.01);
+    compact.advanceTo(1.0/16);
+    compact_float.advanceTo(1.0/16);
+    REQUIRE( compact.getStepCount() == 64 );
+
+    // The float offsets and velocities cost a few parts in a million over 64 steps, and the order comes back on write back
+    for (CompactSystem* system : {&compact, &compact_float}) {
+        std::vector<std::shared_ptr<Particle>> written = RandomSystem(1500, 11).generateInitialConditions();
+        system->writeBack(written);
+        for (int i = 0; i < bodies.size(); i++) {
+            REQUIRE( written[i]->getMass() == bodies[i]->getMass() );
+            REQUIRE( (written[i]->getPosition() - bodies[i]->getPosition()).norm() < 1e-4 );
+            REQUIRE( (written[i]->getVelocity() - bodies[i]->getVelocity()).norm() < 1e-3 * std::max(1.0, bodies[i]->getVelocity().norm()) );
+        }
+        REQUIRE_THAT( system->totalEnergy(), Catch::Matchers::WithinRel(totalEnergy(bodies), 1e-5) );
+    }
+
+    // 8 + 12 + 24 + 4 bytes per body with double velocities, 12 less with float ones
+    auto stateBytes = [](const CompactSystem& system) {
+        std::size_t bytes = 0;
+        for (const MemoryUsage& entry : system.getMemoryUsage()) {
+            if (entry.subsystem != "Cells") {
+                bytes += entry.bytes;
+            }
+        }
+        return bytes;
+    };
+    REQUIRE( stateBytes(compact) == 1500 * 48 );
+    REQUIRE( stateBytes(compact_float) == 1500 * 36 );
+}
+
+
+
+TEST_CASE("Compact storage sorts bodies into new cells as they move", "[compactSystem]") {
+    RandomSystem random_system(400, 12);
+    std::vector<std::shared_ptr<Particle>> bodies = random_system.generateInitialConditions();
+
+    // Cells far smaller than the distance a body travels, so the bodies are sorted again many times
+    CompactSystem compact(bodies, 1.0/256, 0.01, false, 0.01);
+    const int initial_cells = compact.getNumCells();
+    REQUIRE( initial_cells > 100 );
+    evolutionOfSystem(bodies, 1.0/256, 0.25, 0.01);
+    compact.advanceTo(0.25);
+    REQUIRE( compact.getNumRebins() > 0 );
+
+    std::vector<std::shared_ptr<Particle>> written = RandomSystem(400, 12).generateInitialConditions();
+    compact.writeBack(written);
+    for (int i = 0; i < bodies.size(); i++) {
+        REQUIRE( written[i]->getMass() == bodies[i]->getMass() ); // Still in the original order after the moves
+        REQUIRE( (written[i]->getPosition() - bodies[i]->getPosition()).norm() < 1e-5 );
+    }
+    REQUIRE_THROWS_AS( compact.writeBack(std::vector<std::shared_ptr<Particle>>(bodies.begin(), bodies.end() - 1)), std::invalid_argument );
+    REQUIRE_THROWS_AS( CompactSystem(10, [&](const CompactSystem::BodyVisitor& visit) { random_system.forEachBody(visit); }, 0.01), std::invalid_argument );
+
+    std::string report = formatMemoryReport({{"Masses", 8000}, {"Cells", 1000}}, 1000);
+    REQUIRE( report.find("Masses:") != std::string::npos );
+    REQUIRE( report.find("(8.0 bytes per body)") != std::string::npos );
+    REQUIRE( report.find("Total:") != std::string::npos );
+    REQUIRE( report.find("(9.0 bytes per body)") != std::string::npos );
+}
+
+
+
+TEST_CASE("The diagnostics pipeline logs the conserved quantities in step order", "[diagnostics]") {
+    std::vector<std::shared_ptr<Particle>> bodies = RandomSystem(300, 21).generateInitialConditions();
+    const std::string log_path = "test_diagnostics.csv";
+    std::vector<Diagnostics> series;
+    {
+        DiagnosticsPipeline diagnostics(log_path, 300, 3, DiagnosticsOverflow::Block, 2); // Two workers may finish out of order
+        diagnostics.sample(0, 0.0, bodies);
+        evolutionOfSystem(bodies, 1.0/256, 1.0/8, 0.01, ForcePrecision::Double, diagnostics.observer(4));
+        diagnostics.finish();
+        REQUIRE( diagnostics.getNumSamples() == 9 );
+        REQUIRE( diagnostics.getNumSkipped() == 0 );
+        series = diagnostics.getSeries();
+    }
+
+    // The last sample is the final state, and its energies are the same sums as the energy functions
+    REQUIRE( series.size() == 9 );
+    REQUIRE( series.back().step == 32 );
+    REQUIRE( series.back().kinetic == totalKineticEnergy(bodies) );
+    REQUIRE( series.back().potential == totalPotentialEnergy(bodies) );
+    Eigen::Vector3d momentum = Eigen::Vector3d::Zero();
+    Eigen::Vector3d angular_momentum = Eigen::Vector3d::Zero();
+    Eigen::Vector3d mass_moment = Eigen::Vector3d::Zero();
+    double total_mass = 0.0;
+    for (const std::shared_ptr<Particle>& body : bodies) {
+        momentum += body->getMass() * body->getVelocity();
+        angular_momentum += body->getPosition().cross(body->getMass() * body->getVelocity());
+        mass_moment += body->getMass() * body->getPosition();
+        total_mass += body->getMass();
+    }
+    REQUIRE( (series.back().momentum - momentum).norm() < 1e-12 * std::max(1.0, momentum.norm()) );
+    REQUIRE( (series.back().angular_momentum - angular_momentum).norm() < 1e-12 * angular_momentum.norm() );
+    REQUIRE( (series.back().centre_of_mass - mass_moment / total_mass).norm() < 1e-12 );
+    REQUIRE( (series.back().angular_momentum - series.front().angular_momentum).norm() < 1e-4 * angular_momentum.norm() ); // Conserved up to the Euler step error
+
+    std::ifstream log(log_path);
+    std::string line;
+    std::getline(log, line);
+    REQUIRE( line.rfind("step,time,kinetic,potential,total,relative_energy_error", 0) == 0 );
+    long expected_step = 0;
+    while (std::getline(log, line)) {
+        REQUIRE( std::stol(line.substr(0, line.find(','))) == expected_step );
+        expected_step += 4;
+    }
+    REQUIRE( expected_step == 36 );
+    std::remove(log_path.c_str());
+}
+
+
+
+TEST_CASE("A full diagnostics pipeline blocks or skips samples", "[diagnostics]") {
+    std::vector<std::shared_ptr<Particle>> bodies = RandomSystem(3000, 22).generateInitialConditions();
+
+    // One buffer and samples far faster than the O(N^2) potential energy: the buffer is nearly always busy
+    DiagnosticsPipeline skipping("", 3000, 1, DiagnosticsOverflow::Skip);
+    DiagnosticsPipeline blocking("", 3000, 1, DiagnosticsOverflow::Block);
+    for (long step = 0; step < 20; step++) {
+        skipping.sample(step, step * 0.01, bodies);
+        blocking.sample(step, step * 0.01, bodies);
+    }
+    skipping.finish();
+    blocking.finish();
+
+    REQUIRE( skipping.getNumSkipped() > 0 );
+    REQUIRE( skipping.getNumSamples() + skipping.getNumSkipped() == 20 );
+    REQUIRE( skipping.getSeries().size() == skipping.getNumSamples() );
+    REQUIRE( blocking.getNumSkipped() == 0 );
+    REQUIRE( blocking.getSeries().size() == 20 );
+    REQUIRE( blocking.getStallSeconds() > 0.0 );
+    for (int i = 0; i < 20; i++) {
+        REQUIRE( blocking.getSeries()[i].step == i );
+    }
+
+    blocking.sample(20, 0.2, bodies); // Ignored after finish
+    REQUIRE( blocking.getNumSamples() == 20 );
+    REQUIRE_THROWS_AS( blocking.sample(21, 0.21, std::vector<std::shared_ptr<Particle>>(bodies.begin(), bodies.end() - 1)), std::invalid_argument );
+    REQUIRE_THROWS_AS( DiagnosticsPipeline("", 10, 0), std::invalid_argument );
+}
+
+
+
+TEST_CASE("Out-of-core runs follow the run in memory and leave the state in the file", "[outOfCore]") {
+    RandomSystem random_system(1000, 31);
+    std::vector<std::shared_ptr<Particle>> bodies = random_system.generateInitialConditions();
+    const std::string path = "test_out_of_core.bin";
+    saveInitialConditions(path, random_system.getCacheParameters(), 1000,
+                          [&](const std::function<void(int, const Particle&)>& visit) { random_system.forEachBody(visit); });
+
+    {
+        // Block and tile sizes that do not divide the system, so the diagonal falls across tile edges
+        OutOfCoreSystem system(path, 1.0/1024, 0.01, 300, 128);
+        REQUIRE( system.getNumParticles() == 1000 );
+        REQUIRE( system.getParameters() == random_system.getCacheParameters() );
+        REQUIRE_THAT( system.totalKineticEnergy(), Catch::Matchers::WithinRel(totalKineticEnergy(bodies), 1e-14) );
+        REQUIRE_THAT( system.totalPotentialEnergy(), Catch::Matchers::WithinRel(totalPotentialEnergy(bodies), 1e-12) );
+
+        const std::uint64_t streamed_before = system.getBytesStreamed();
+        system.advanceTo(1.0/64);
+        REQUIRE( system.getStepCount() == 16 );
+        REQUIRE( system.getBytesStreamed() - streamed_before == 16 * 4 * 1000 * 80 ); // Four target blocks each read the whole file
+        evolutionOfSystem(bodies, 1.0/1024, 1.0/64, 0.01);
+        REQUIRE_THAT( system.totalEnergy(), Catch::Matchers::WithinRel(totalEnergy(bodies), 1e-12) );
+    }
+
+    // The state was written back in place: the file now holds the bodies after 16 steps
+    std::shared_ptr<const MappedInitialConditions> state = MappedInitialConditions::open(path, random_system.getCacheParameters());
+    REQUIRE( state != nullptr );
+    std::vector<std::shared_ptr<Particle>> written = RandomSystem(1000, 31).generateInitialConditions();
+    state->reset(written);
+    for (int i = 0; i < 1000; i++) {
+        REQUIRE( (written[i]->getPosition() - bodies[i]->getPosition()).norm() < 1e-12 * std::max(1.0, bodies[i]->getPosition().norm()) );
+        REQUIRE( (written[i]->getVelocity() - bodies[i]->getVelocity()).norm() < 1e-10 * std::max(1.0, bodies[i]->getVelocity().norm()) );
+        REQUIRE( (written[i]->getAcceleration() - bodies[i]->getAcceleration()).norm() < 1e-10 * std::max(1.0, bodies[i]->getAcceleration().norm()) );
+    }
+    std::remove(path.c_str());
+}
+
+
+
+TEST_CASE("Initial condition files can be written a block at a time", "[outOfCore]") {
+    RandomSystem random_system(70000, 32); // More than one block of the streaming writer
+    std::vector<std::shared_ptr<Particle>> bodies = random_system.generateInitialConditions();
+    auto source = [&](const std::function<void(int, const Particle&)>& visit) { random_system.forEachBody(visit); };
+    saveInitialConditions("test_streamed.bin", "streamed", 70000, source);
+    saveInitialConditions("test_in_memory.bin", "streamed", bodies);
+
+    std::ifstream streamed("test_streamed.bin", std::ios::binary);
+    std::ifstream in_memory("test_in_memory.bin", std::ios::binary);
+    std::string streamed_bytes((std::istreambuf_iterator<char>(streamed)), std::istreambuf_iterator<char>());
+    std::string in_memory_bytes((std::istreambuf_iterator<char>(in_memory)), std::istreambuf_iterator<char>());
+    REQUIRE( streamed_bytes.size() == in_memory_bytes.size() );
+    REQUIRE( streamed_bytes == in_memory_bytes );
+
+    // A source with fewer bodies than promised leaves no file, and only complete files open
+    REQUIRE_THROWS_AS( saveInitialConditions("test_short.bin", "streamed", 70001, source), std::runtime_error );
+    REQUIRE_FALSE( std::filesystem::exists("test_short.bin") );
+    std::filesystem::resize_file("test_streamed.bin", streamed_bytes.size() - 8);
+    REQUIRE_THROWS_AS( OutOfCoreSystem("test_streamed.bin", 0.01), std::invalid_argument );
+    REQUIRE_THROWS_AS( OutOfCoreSystem("test_missing.bin", 0.01), std::runtime_error );
+    REQUIRE_THROWS_AS( OutOfCoreSystem("test_in_memory.bin", 0.01, 0.0, 0), std::invalid_argument );
+    std::remove("test_streamed.bin");
+    std::remove("test_in_memory.bin");
+}